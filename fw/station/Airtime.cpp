@@ -0,0 +1,59 @@
+/* 
+ * LoRa Birdhouse Mesh Network Project
+ * Wellesley Amateur Radio Society
+ * 
+ * Copyright (C) 2022 Bruce MacKinnon
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "Airtime.h"
+
+uint32_t loraBandwidthHz(uint8_t bwCode) {
+    static const uint32_t table[] = { 7800, 10400, 15600, 20800, 31250, 
+        41700, 62500, 125000, 250000, 500000 };
+    if (bwCode >= sizeof(table) / sizeof(table[0]))
+        return 0;
+    return table[bwCode];
+}
+
+uint32_t loraSymbolUs(unsigned int sf, uint32_t bwHz) {
+    if (bwHz == 0)
+        return 0;
+    return ((uint64_t)1000000 << sf) / bwHz;
+}
+
+uint32_t loraAirtimeUs(unsigned int sf, uint32_t bwHz, unsigned int cr, 
+    unsigned int payloadLen, unsigned int preambleLen, bool crcOn, 
+    bool implicitHeader, bool lowDataRateOptimize) {
+
+    if (bwHz == 0)
+        return 0;
+
+    // The preamble is followed by 4.25 symbols of sync word, so work 
+    // in quarter symbols.
+    const uint64_t preambleQuarterSymbols = (preambleLen * 4) + 17;
+
+    // Number of payload symbols
+    const int de = lowDataRateOptimize ? 1 : 0;
+    const int num = (8 * (int)payloadLen) - (4 * (int)sf) + 28 + 
+        (crcOn ? 16 : 0) - (implicitHeader ? 20 : 0);
+    const int den = 4 * ((int)sf - (2 * de));
+    int blocks = 0;
+    if (num > 0 && den > 0)
+        blocks = (num + den - 1) / den;
+    const uint64_t payloadSymbols = 8 + (blocks * (cr + 4));
+
+    const uint64_t quarterSymbols = preambleQuarterSymbols + (payloadSymbols * 4);
+    return ((quarterSymbols * 1000000) << sf) / (4 * (uint64_t)bwHz);
+}
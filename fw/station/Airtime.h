@@ -0,0 +1,46 @@
+/* 
+ * LoRa Birdhouse Mesh Network Project
+ * Wellesley Amateur Radio Society
+ * 
+ * Copyright (C) 2022 Bruce MacKinnon
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _Airtime_h
+#define _Airtime_h
+
+#include <stdint.h>
+
+/**
+ * @brief Converts the bandwidth code used in RegModemConfig1 (bits 7-4)
+ * to Hz.
+ */
+uint32_t loraBandwidthHz(uint8_t bwCode);
+
+/**
+ * @brief The duration of one LoRa symbol in microseconds.
+ */
+uint32_t loraSymbolUs(unsigned int sf, uint32_t bwHz);
+
+/**
+ * @brief Calculates the time on air of a LoRa frame in microseconds 
+ * (see Semtech AN1200.13).
+ * 
+ * @param cr Coding rate 1-4 (i.e. 4/5 to 4/8).
+ */
+uint32_t loraAirtimeUs(unsigned int sf, uint32_t bwHz, unsigned int cr, 
+    unsigned int payloadLen, unsigned int preambleLen, bool crcOn, 
+    bool implicitHeader, bool lowDataRateOptimize);
+
+#endif
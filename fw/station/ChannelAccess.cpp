@@ -0,0 +1,174 @@
+/* 
+ * LoRa Birdhouse Mesh Network Project
+ * Wellesley Amateur Radio Society
+ * 
+ * Copyright (C) 2022 Bruce MacKinnon
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "ChannelAccess.h"
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
+
+ChannelAccess::ChannelAccess(const Clock& clock) 
+:   _clock(clock),
+    _addr(0),
+    _networkClock(0),
+    _tdmaExchangeUs(0),
+    _tdmaGuardUs(0),
+    _busyCounter(0),
+    _deferCounter(0),
+    _ackMissedCounter(0),
+    _tdmaTxCounter(0) {
+    for (unsigned int i = 0; i < TRAFFIC_CLASS_COUNT; i++) 
+        _nextCadTime[i] = 0;
+    ChannelAccessConfig config;
+    config.setDefaults();
+    configure(config);
+    TdmaConfig tdmaConfig;
+    tdmaConfig.setDefaults();
+    configureTdma(tdmaConfig, 0);
+}
+
+void ChannelAccess::configure(const ChannelAccessConfig& config) {
+    _config = config;
+    if (!_config.isValid()) 
+        _config.setDefaults();
+    for (unsigned int i = 0; i < TRAFFIC_CLASS_COUNT; i++) 
+        _cw[i] = _config.cwMin[i];
+}
+
+void ChannelAccess::configureTdma(const TdmaConfig& config, nodeaddr_t addr) {
+    _tdmaConfig = config;
+    if (!_tdmaConfig.isValid()) 
+        _tdmaConfig.setDefaults();
+    _addr = addr;
+}
+
+void ChannelAccess::setTdmaTiming(uint32_t exchangeUs, uint32_t guardUs) {
+    _tdmaExchangeUs = exchangeUs;
+    _tdmaGuardUs = guardUs;
+}
+
+TrafficClass ChannelAccess::classify(const Header& header) {
+    if (header.isAck()) {
+        return TRAFFIC_ACK;
+    } else if (header.getType() >= TYPE_TEXT) {
+        return TRAFFIC_DATA;
+    } else {
+        return TRAFFIC_CONTROL;
+    }
+}
+
+bool ChannelAccess::isTdmaActive() const {
+    return _tdmaConfig.enabled && 
+        _networkClock != 0 && _networkClock->isSynced() &&
+        (uint32_t)_tdmaConfig.slotMs * 1000 >= _tdmaExchangeUs + 2 * _tdmaGuardUs;
+}
+
+bool ChannelAccess::isOwnSlot(unsigned int slot) const {
+    if (_tdmaConfig.slotMask != 0) 
+        return (_tdmaConfig.slotMask >> slot) & 1;
+    else 
+        return slot == _addr % _tdmaConfig.slotCount;
+}
+
+bool ChannelAccess::isCadAllowed(TrafficClass tc, uint32_t extraUs) const {
+    // Each class has its own backoff, so a data backoff never holds 
+    // back an ACK.  The comparison is done on the difference so that it
+    // survives the wrap of the clock.
+    if ((int32_t)(_clock.time() - _nextCadTime[tc]) < 0)
+        return false;
+    // ACKs go out in the slot of the station that is waiting for them
+    if (tc == TRAFFIC_ACK || !isTdmaActive()) 
+        return true;
+    const uint64_t slotUs = (uint64_t)_tdmaConfig.slotMs * 1000;
+    const uint64_t t = _networkClock->getNetworkUs() % (slotUs * _tdmaConfig.slotCount);
+    const uint32_t slotOffsetUs = t % slotUs;
+    if (_tdmaExchangeUs + extraUs + 2 * _tdmaGuardUs > slotUs)
+        extraUs = 0;
+    return isOwnSlot(t / slotUs) &&
+        slotOffsetUs >= _tdmaGuardUs && 
+        slotOffsetUs + _tdmaExchangeUs + extraUs + _tdmaGuardUs <= slotUs;
+}
+
+bool ChannelAccess::processChannelIdle(TrafficClass tc) {
+    // ACKs are always sent right away since the other station
+    // is waiting for them.
+    if (tc == TRAFFIC_ACK) {
+        return true;
+    }
+    // Nobody else is allowed to start in our slot
+    if (isTdmaActive()) {
+        _tdmaTxCounter++;
+        return true;
+    }
+    if (random(0, 100) < _config.persistencePct) {
+        return true;
+    }
+    // Defer for one slot and check again
+    _deferCounter++;
+    _nextCadTime[tc] = _clock.time() + _config.slotMs;
+    return false;
+}
+
+void ChannelAccess::processChannelBusy(TrafficClass tc) {
+    _busyCounter++;
+    // In our own slot the activity can only be an ACK or a late frame 
+    // from the previous slot, so just check again after one CSMA slot
+    if (tc != TRAFFIC_ACK && isTdmaActive()) {
+        _nextCadTime[tc] = _clock.time() + _config.slotMs;
+        return;
+    }
+    _backoff(tc);
+}
+
+void ChannelAccess::processTxSuccess(TrafficClass tc) {
+    _cw[tc] = _config.cwMin[tc];
+}
+
+void ChannelAccess::processAckMissed(TrafficClass tc) {
+    _ackMissedCounter++;
+    // A missed ACK isn't caused by contention in TDMA mode
+    if (isTdmaActive())
+        return;
+    _backoff(tc);
+}
+
+uint16_t ChannelAccess::getContentionWindow(TrafficClass tc) const {
+    return _cw[tc];
+}
+
+void ChannelAccess::resetCounters() {
+    _busyCounter = 0;
+    _deferCounter = 0;
+    _ackMissedCounter = 0;
+    _tdmaTxCounter = 0;
+}
+
+void ChannelAccess::_backoff(TrafficClass tc) {
+    // Double the contention window (up to the limit)
+    uint16_t cw = _cw[tc] * 2;
+    if (cw > _config.cwMax[tc])
+        cw = _config.cwMax[tc];
+    _cw[tc] = cw;
+    // Pick a random number of slots from the window
+    uint32_t slots = random(1, cw + 1);
+    uint32_t t = _clock.time() + (slots * _config.slotMs);
+    // Never shorten a backoff that is already in progress
+    if ((int32_t)(t - _nextCadTime[tc]) > 0)
+        _nextCadTime[tc] = t;
+}
@@ -0,0 +1,172 @@
+/* 
+ * LoRa Birdhouse Mesh Network Project
+ * Wellesley Amateur Radio Society
+ * 
+ * Copyright (C) 2022 Bruce MacKinnon
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _ChannelAccess_h
+#define _ChannelAccess_h
+
+#include "Clock.h"
+#include "packets.h"
+#include "ChannelAccessConfig.h"
+#include "NetworkClock.h"
+
+/**
+ * @brief The channel access policy (p-persistent CSMA/CA with 
+ * binary exponential backoff).  
+ * 
+ * The radio layer asks isCadAllowed() before checking the channel 
+ * and reports the outcome of each channel check.  A busy channel 
+ * doubles the contention window of the traffic class and a random 
+ * backoff (in slots) is chosen from the window.  When the channel is 
+ * idle the station transmits with probability p, otherwise it defers 
+ * for one slot.  Missed ACKs also double the window and a successful 
+ * delivery resets it.  Each traffic class backs off on its own, so an 
+ * ACK is never held up by a backoff that a data frame is in.
+ * 
+ * When TDMA is enabled and the network time is known the network time
+ * is divided into frames of TdmaConfig::slotCount slots and a station 
+ * only starts a transmission inside one of its own slots, far enough 
+ * from the slot edges that the frame and its ACK fit between the guard 
+ * times.  There is no contention between stations that own different 
+ * slots, so the backoff isn't used.  Stations without the network 
+ * time (or with slots that are too short for the current radio 
+ * profile) fall back to CSMA.
+ */
+class ChannelAccess {
+public:
+
+    ChannelAccess(const Clock& clock);
+
+    void configure(const ChannelAccessConfig& config);
+
+    /**
+     * @param addr The address of this station, used to pick the
+     *   slot when the configuration doesn't list any.
+     */
+    void configureTdma(const TdmaConfig& config, nodeaddr_t addr);
+
+    /**
+     * @brief Supplies the network time that the TDMA slots are 
+     * aligned to.  TDMA is not used until this is set.
+     */
+    void setNetworkClock(const NetworkClock* networkClock) { _networkClock = networkClock; }
+
+    /**
+     * @brief Called by the radio layer whenever the modem settings 
+     * change.
+     * 
+     * @param exchangeUs The longest time that one transmission can 
+     *   occupy the channel (the longest frame plus its ACK).
+     * @param guardUs The margin that is left at each end of the slot
+     *   to allow for synchronization error.
+     */
+    void setTdmaTiming(uint32_t exchangeUs, uint32_t guardUs);
+
+    /**
+     * @brief Decides which traffic class a packet belongs to.
+     */
+    static TrafficClass classify(const Header& header);
+
+    /**
+     * @return true if any backoff/deferral has expired (or in TDMA mode,
+     *   if we are inside one of our slots) and the channel can be 
+     *   checked.
+     * 
+     * @param extraUs In TDMA mode, the time that the transmission will
+     *   occupy the channel beyond a normal exchange (e.g. copies of a 
+     *   broadcast or a long preamble).  The rest of the slot has to 
+     *   have room for this too, unless it wouldn't fit in any slot, in 
+     *   which case it is started where a normal exchange could be.
+     */
+    bool isCadAllowed(TrafficClass tc, uint32_t extraUs = 0) const;
+
+    /**
+     * @return true if TDMA is enabled, the network time is known and
+     *   the slots are long enough for the current radio profile.
+     */
+    bool isTdmaActive() const;
+
+    /**
+     * @return true if the slot that is in progress belongs to this 
+     *   station.
+     */
+    bool isOwnSlot(unsigned int slot) const;
+
+    /**
+     * @brief Called when a channel check finds the channel idle.
+     * 
+     * @return true if the station should transmit now, false if 
+     *   it should defer for a slot.
+     */
+    bool processChannelIdle(TrafficClass tc);
+
+    /**
+     * @brief Called when a channel check finds activity.
+     */
+    void processChannelBusy(TrafficClass tc);
+
+    /**
+     * @brief Called when a transmission is acknowledged.
+     */
+    void processTxSuccess(TrafficClass tc);
+
+    /**
+     * @brief Called when an expected ACK doesn't arrive (i.e. a 
+     * possible collision).
+     */
+    void processAckMissed(TrafficClass tc);
+
+    /**
+     * @return The current contention window (in slots)
+     */
+    uint16_t getContentionWindow(TrafficClass tc) const;
+
+    const ChannelAccessConfig& getConfig() const { return _config; }
+    const TdmaConfig& getTdmaConfig() const { return _tdmaConfig; }
+    uint32_t getTdmaExchangeUs() const { return _tdmaExchangeUs; }
+    uint32_t getTdmaGuardUs() const { return _tdmaGuardUs; }
+
+    uint16_t getBusyCounter() const { return _busyCounter; }
+    uint16_t getDeferCounter() const { return _deferCounter; }
+    uint16_t getAckMissedCounter() const { return _ackMissedCounter; }
+    uint16_t getTdmaTxCounter() const { return _tdmaTxCounter; }
+
+    void resetCounters();
+
+private:
+
+    void _backoff(TrafficClass tc);
+
+    const Clock& _clock;
+    ChannelAccessConfig _config;
+    TdmaConfig _tdmaConfig;
+    nodeaddr_t _addr;
+    const NetworkClock* _networkClock;
+    uint32_t _tdmaExchangeUs;
+    uint32_t _tdmaGuardUs;
+    uint16_t _cw[TRAFFIC_CLASS_COUNT];
+    // The earliest time that the next channel check is allowed (for 
+    // each traffic class)
+    uint32_t _nextCadTime[TRAFFIC_CLASS_COUNT];
+    uint16_t _busyCounter;
+    uint16_t _deferCounter;
+    uint16_t _ackMissedCounter;
+    uint16_t _tdmaTxCounter;
+};
+
+#endif
@@ -0,0 +1,107 @@
+/* 
+ * LoRa Birdhouse Mesh Network Project
+ * Wellesley Amateur Radio Society
+ * 
+ * Copyright (C) 2022 Bruce MacKinnon
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _ChannelAccessConfig_h
+#define _ChannelAccessConfig_h
+
+#include <stdint.h>
+
+/**
+ * @brief Transmissions are put into classes that contend for the 
+ * channel with different contention windows.  ACKs are the most 
+ * urgent since the sender is waiting on them.
+ */
+enum TrafficClass {
+    TRAFFIC_ACK = 0,
+    TRAFFIC_CONTROL = 1,
+    TRAFFIC_DATA = 2
+};
+
+static const unsigned int TRAFFIC_CLASS_COUNT = 3;
+
+/**
+ * @brief The tunable parameters of the CSMA/CA channel access policy. 
+ * This is stored as part of the station configuration.
+ */
+struct ChannelAccessConfig {
+    // The probability (in percent) of transmitting when the channel is 
+    // found to be idle.  Otherwise we defer for one slot and check again.
+    uint8_t persistencePct;
+    // The length of one backoff slot
+    uint8_t slotMs;
+    // The contention window limits (in slots) for each traffic class
+    uint8_t cwMin[TRAFFIC_CLASS_COUNT];
+    uint8_t cwMax[TRAFFIC_CLASS_COUNT];
+
+    void setDefaults() {
+        persistencePct = 50;
+        slotMs = 10;
+        cwMin[TRAFFIC_ACK] = 1;
+        cwMax[TRAFFIC_ACK] = 8;
+        cwMin[TRAFFIC_CONTROL] = 4;
+        cwMax[TRAFFIC_CONTROL] = 64;
+        cwMin[TRAFFIC_DATA] = 8;
+        cwMax[TRAFFIC_DATA] = 128;
+    }
+
+    bool isValid() const {
+        if (persistencePct == 0 || persistencePct > 100 || slotMs == 0)
+            return false;
+        for (unsigned int i = 0; i < TRAFFIC_CLASS_COUNT; i++) 
+            if (cwMin[i] == 0 || cwMax[i] < cwMin[i])
+                return false;
+        return true;
+    }
+};
+
+static const unsigned int TDMA_MAX_SLOTS = 32;
+
+/**
+ * @brief The parameters of the TDMA mode.  The network time is divided 
+ * into repeating frames of slotCount slots and each station only starts
+ * transmissions (other than ACKs) in the slots that it owns.  This is 
+ * stored as part of the station configuration.
+ */
+struct TdmaConfig {
+    // Non-zero to use TDMA whenever the network time is known
+    uint8_t enabled;
+    // The number of slots in a frame
+    uint8_t slotCount;
+    // The length of one slot.  This needs to be long enough for the 
+    // longest frame, its ACK and the guard times.
+    uint16_t slotMs;
+    // The slots that this station owns (bit N for slot N).  Zero means 
+    // the station owns the slot given by its address modulo slotCount.
+    uint32_t slotMask;
+
+    void setDefaults() {
+        enabled = 0;
+        slotCount = 8;
+        slotMs = 1500;
+        slotMask = 0;
+    }
+
+    bool isValid() const {
+        return enabled <= 1 && 
+            slotCount > 0 && slotCount <= TDMA_MAX_SLOTS && 
+            slotMs > 0;
+    }
+};
+
+#endif
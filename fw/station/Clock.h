@@ -26,6 +26,12 @@ class Clock {
 public:
 
     virtual uint32_t time() const = 0;
+
+    /**
+     * @brief Time in microseconds.  Used for measuring short intervals,
+     * so wrapping is expected.
+     */
+    virtual uint32_t timeUs() const { return time() * 1000; }
 };
 
 #endif
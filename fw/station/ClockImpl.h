@@ -33,6 +33,10 @@ public:
     uint32_t time() const {
         return millis();
     };
+
+    uint32_t timeUs() const {
+        return micros();
+    };
 };
 
 #endif
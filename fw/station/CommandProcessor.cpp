@@ -23,7 +23,11 @@
 #include <stdint.h>
 #include "Utils.h"
 #include "RoutingTable.h"
+#include "NeighborTable.h"
 #include "MessageProcessor.h"
+#include "ChannelAccess.h"
+#include "NetworkClock.h"
+#include "SleepSchedule.h"
 #include "CommandProcessor.h"
 #include "Configuration.h"
 
@@ -35,12 +39,30 @@ static auto msg_bad_address = F("ERR: Bad address");
 static auto msg_bad_message = F("ERR: Bad message");
 static auto msg_tx_busy = F("ERR: TX busy");
 static auto msg_ok = F("INF: OK");
+static auto msg_unreachable = F("ERR: Destination unreachable (route error)");
 
 extern Stream& logger;
 extern Configuration& systemConfig;
 extern Instrumentation& systemInstrumentation;
 extern RoutingTable& systemRoutingTable;
+extern NeighborTable& systemNeighborTable;
 extern MessageProcessor& systemMessageProcessor;
+extern ChannelAccess& systemChannelAccess;
+extern NetworkClock& systemNetworkClock;
+extern SleepSchedule& systemSleepSchedule;
+
+/**
+ * @brief Explains why a message can't be sent to the destination.  
+ * Routes that were taken out of service by a route error are 
+ * distinguished from routes that were never configured.
+ */
+static void printNoRoute(nodeaddr_t finalDestAddr) {
+    if (systemRoutingTable.isRouteInvalidated(finalDestAddr)) {
+        logger.println(msg_unreachable);
+    } else {
+        logger.println(msg_no_route);
+    }
+}
 
 int sendPing(int argc, char** argv) { 
  
@@ -52,7 +74,7 @@ int sendPing(int argc, char** argv) {
     nodeaddr_t finalDestAddr = parseAddr(argv[1]);
     nodeaddr_t nextHop = systemRoutingTable.nextHop(finalDestAddr);
     if (nextHop == RoutingTable::NO_ROUTE) {
-        logger.println(msg_no_route);
+        printNoRoute(finalDestAddr);
         return -1;
     }
     
@@ -64,6 +86,7 @@ int sendPing(int argc, char** argv) {
     packet.header.setDestAddr(nextHop);
     packet.header.setOriginalSourceAddr(systemConfig.getAddr());
     packet.header.setFinalDestAddr(finalDestAddr);
+    packet.header.setTtl(systemRoutingTable.getInitialTtl(finalDestAddr));
     packet.header.setSourceCall(systemConfig.getCall());
     packet.header.setOriginalSourceCall(systemConfig.getCall());
     unsigned int packetLen = sizeof(Header);
@@ -86,7 +109,7 @@ int sendGetSed(int argc, char** argv) {
     nodeaddr_t finalDestAddr = parseAddr(argv[1]);
     nodeaddr_t nextHop = systemRoutingTable.nextHop(finalDestAddr);
     if (nextHop == RoutingTable::NO_ROUTE) {
-        logger.println( msg_no_route);
+        printNoRoute(finalDestAddr);
         return -1;
     }
     
@@ -97,6 +120,7 @@ int sendGetSed(int argc, char** argv) {
     packet.header.setDestAddr(nextHop);
     packet.header.setOriginalSourceAddr(systemConfig.getAddr());
     packet.header.setFinalDestAddr(finalDestAddr);
+    packet.header.setTtl(systemRoutingTable.getInitialTtl(finalDestAddr));
     packet.header.setSourceCall(systemConfig.getCall());
     packet.header.setOriginalSourceCall(systemConfig.getCall());
     unsigned int packetLen = sizeof(Header);
@@ -119,7 +143,7 @@ static int sendReset(int argc, char **argv, uint8_t resetType) {
     nodeaddr_t finalDestAddr = parseAddr(argv[1]);
     nodeaddr_t nextHop = systemRoutingTable.nextHop(finalDestAddr);
     if (nextHop == RoutingTable::NO_ROUTE) {
-        logger.println(msg_no_route);
+        printNoRoute(finalDestAddr);
         return -1;
     }
     
@@ -130,6 +154,7 @@ static int sendReset(int argc, char **argv, uint8_t resetType) {
     packet.header.setDestAddr(nextHop);
     packet.header.setOriginalSourceAddr(systemConfig.getAddr());
     packet.header.setFinalDestAddr(finalDestAddr);
+    packet.header.setTtl(systemRoutingTable.getInitialTtl(finalDestAddr));
     packet.header.setSourceCall(systemConfig.getCall());
     packet.header.setOriginalSourceCall(systemConfig.getCall());
     // Fill in payload secion of the packet
@@ -183,7 +208,7 @@ int sendText(int argc, char **argv) {
     // figure out the "next hop."
     nodeaddr_t nextHop = systemRoutingTable.nextHop(finalDest);
     if (nextHop == RoutingTable::NO_ROUTE) {
-        logger.println(msg_no_route);
+        printNoRoute(finalDest);
         return -1;
     }
 
@@ -201,6 +226,7 @@ int sendText(int argc, char **argv) {
     packet.header.setDestAddr(nextHop);
     packet.header.setOriginalSourceAddr(systemConfig.getAddr());
     packet.header.setFinalDestAddr(finalDest);
+    packet.header.setTtl(systemRoutingTable.getInitialTtl(finalDest));
     packet.header.setSourceCall(systemConfig.getCall());
     packet.header.setOriginalSourceCall(systemConfig.getCall());
     // Put the text into the payload secion of the packet
@@ -237,7 +263,7 @@ int sendSetRoute(int argc, char **argv) {
     // figure out the "next hop."
     nodeaddr_t nextHop = systemRoutingTable.nextHop(finalDest);
     if (nextHop == RoutingTable::NO_ROUTE) {
-        logger.println(msg_no_route);
+        printNoRoute(finalDest);
         return -1;
     }
 
@@ -249,6 +275,7 @@ int sendSetRoute(int argc, char **argv) {
     packet.header.setDestAddr(nextHop);
     packet.header.setOriginalSourceAddr(systemConfig.getAddr());
     packet.header.setFinalDestAddr(finalDest);
+    packet.header.setTtl(systemRoutingTable.getInitialTtl(finalDest));
     packet.header.setSourceCall(systemConfig.getCall());
     packet.header.setOriginalSourceCall(systemConfig.getCall());
     // Fill in the payload
@@ -289,7 +316,7 @@ int sendGetRoute(int argc, char **argv) {
     // figure out the "next hop."
     nodeaddr_t nextHop = systemRoutingTable.nextHop(finalDest);
     if (nextHop == RoutingTable::NO_ROUTE) {
-        logger.println(msg_no_route);
+        printNoRoute(finalDest);
         return -1;
     }
 
@@ -301,6 +328,7 @@ int sendGetRoute(int argc, char **argv) {
     packet.header.setDestAddr(nextHop);
     packet.header.setOriginalSourceAddr(systemConfig.getAddr());
     packet.header.setFinalDestAddr(finalDest);
+    packet.header.setTtl(systemRoutingTable.getInitialTtl(finalDest));
     packet.header.setSourceCall(systemConfig.getCall());
     packet.header.setOriginalSourceCall(systemConfig.getCall());
     // Fill in the payload
@@ -318,6 +346,46 @@ int sendGetRoute(int argc, char **argv) {
     return 0;
 }
 
+int sendGetLinks(int argc, char **argv) { 
+ 
+    if (argc != 2) {
+        logger.println(msg_arg_error);
+        return -1;
+    }
+
+    nodeaddr_t finalDest = parseAddr(argv[1]);
+    if (finalDest == 0) {
+        logger.println(msg_bad_address);
+        return -1;
+    }
+
+    nodeaddr_t nextHop = systemRoutingTable.nextHop(finalDest);
+    if (nextHop == RoutingTable::NO_ROUTE) {
+        printNoRoute(finalDest);
+        return -1;
+    }
+
+    // Build the request packet
+    Packet packet;
+    packet.header.setType(TYPE_GETLINKS_REQ);
+    packet.header.setId(systemMessageProcessor.getUniqueId());
+    packet.header.setSourceAddr(systemConfig.getAddr());
+    packet.header.setDestAddr(nextHop);
+    packet.header.setOriginalSourceAddr(systemConfig.getAddr());
+    packet.header.setFinalDestAddr(finalDest);
+    packet.header.setTtl(systemRoutingTable.getInitialTtl(finalDest));
+    packet.header.setSourceCall(systemConfig.getCall());
+    packet.header.setOriginalSourceCall(systemConfig.getCall());
+    unsigned int packetLen = sizeof(Header);
+    // Send it
+    bool good = systemMessageProcessor.transmitIfPossible(packet, packetLen);
+    if (!good) {
+        logger.println(msg_tx_busy);
+        return -1;
+    }
+    return 0;
+}
+
 // ===== LOCAL COMMANDS ==============================================
 
 int boot(int argc, char **argv) { 
@@ -332,6 +400,23 @@ int bootRadio(int argc, char **argv) {
     return 0;
 }
 
+static void printProfile(const RadioProfile& p) {
+    logger.print(F("{ \"name\": \""));
+    char name[RADIO_PROFILE_NAME_LEN + 1];
+    memcpy(name, p.name, RADIO_PROFILE_NAME_LEN);
+    name[RADIO_PROFILE_NAME_LEN] = 0;
+    logger.print(name);
+    logger.print(F("\", \"sf\": "));
+    logger.print(p.sf);
+    logger.print(F(", \"bw\": "));
+    logger.print(p.bw);
+    logger.print(F(", \"cr\": "));
+    logger.print(p.cr);
+    logger.print(F(", \"powerDbm\": "));
+    logger.print(p.powerDbm);
+    logger.print(F(" }"));
+}
+
 int info(int argc, char **argv) { 
     logger.print(F("INFO: { \"node\": "));
     logger.print(systemConfig.getAddr());
@@ -354,6 +439,8 @@ int info(int argc, char **argv) {
     logger.print(systemConfig.getLogLevel());
     logger.print(F(", \"commandMode\": "));
     logger.print(systemConfig.getCommandMode());
+    logger.print(F(", \"probeInterval\": "));
+    logger.print(systemConfig.getProbeInterval());
     logger.print(F(", \"routes\": ["));
 
     // Display the routing table
@@ -371,10 +458,231 @@ int info(int argc, char **argv) {
       }
     }
     logger.print("]");
+    logger.print(F(", \"backupRoutes\": ["));
+
+    // Display the backup routes: [target, backup0, backup1]
+    first = true;
+    for (unsigned int i = 0; i < 256; i++) {
+      if (systemRoutingTable.getBackupRoute(i, 0) != RoutingTable::NO_ROUTE) {
+        if (!first) 
+          logger.print(", ");
+        first = false;
+        logger.print("[");
+        logger.print(i);
+        for (unsigned int b = 0; b < RoutingTable::MAX_BACKUP_ROUTES; b++) {
+          logger.print(", ");
+          logger.print(systemRoutingTable.getBackupRoute(i, b));
+        }
+        logger.print("]");
+      }
+    }
+    logger.print("]");
+    logger.print(F(", \"suspectHops\": ["));
+    first = true;
+    for (unsigned int i = 0; i < 256; i++) {
+      if (systemRoutingTable.isSuspect(i)) {
+        if (!first) 
+          logger.print(", ");
+        first = false;
+        logger.print(i);
+      }
+    }
+    logger.print("]");
+    logger.print(F(", \"failoverCount\": "));
+    logger.print(systemMessageProcessor.getFailoverCounter());
+    logger.print(F(", \"ttlDropCount\": "));
+    logger.print(systemMessageProcessor.getTtlDropCounter());
+
+    // Display the channel access policy: cw is [min, max, current] 
+    // for each traffic class
+    const ChannelAccessConfig& csma = systemChannelAccess.getConfig();
+    logger.print(F(", \"csma\": { \"persistPct\": "));
+    logger.print(csma.persistencePct);
+    logger.print(F(", \"slotMs\": "));
+    logger.print(csma.slotMs);
+    logger.print(F(", \"cw\": ["));
+    for (unsigned int i = 0; i < TRAFFIC_CLASS_COUNT; i++) {
+        if (i > 0)
+            logger.print(", ");
+        logger.print("[");
+        logger.print(csma.cwMin[i]);
+        logger.print(", ");
+        logger.print(csma.cwMax[i]);
+        logger.print(", ");
+        logger.print(systemChannelAccess.getContentionWindow((TrafficClass)i));
+        logger.print("]");
+    }
+    logger.print(F("], \"busyCount\": "));
+    logger.print(systemChannelAccess.getBusyCounter());
+    logger.print(F(", \"deferCount\": "));
+    logger.print(systemChannelAccess.getDeferCounter());
+    logger.print(F(", \"ackMissedCount\": "));
+    logger.print(systemChannelAccess.getAckMissedCounter());
+    logger.print(F(" }"));
+
+    // Display the TDMA slot assignment and timing
+    const TdmaConfig& tdma = systemChannelAccess.getTdmaConfig();
+    logger.print(F(", \"tdma\": { \"enabled\": "));
+    logger.print(tdma.enabled);
+    logger.print(F(", \"active\": "));
+    logger.print(systemChannelAccess.isTdmaActive());
+    logger.print(F(", \"slotCount\": "));
+    logger.print(tdma.slotCount);
+    logger.print(F(", \"slotMs\": "));
+    logger.print(tdma.slotMs);
+    logger.print(F(", \"slots\": ["));
+    first = true;
+    for (unsigned int i = 0; i < tdma.slotCount; i++) {
+        if (systemChannelAccess.isOwnSlot(i)) {
+            if (!first) 
+                logger.print(", ");
+            first = false;
+            logger.print(i);
+        }
+    }
+    logger.print(F("], \"exchangeUs\": "));
+    logger.print(systemChannelAccess.getTdmaExchangeUs());
+    logger.print(F(", \"guardUs\": "));
+    logger.print(systemChannelAccess.getTdmaGuardUs());
+    logger.print(F(", \"txCount\": "));
+    logger.print(systemChannelAccess.getTdmaTxCounter());
+    logger.print(F(" }"));
+
+    // Display the sleep schedule.  holdMs is the extra time that 
+    // outbound traffic waited for the wake window.
+    const SleepConfig& sleepConfig = systemSleepSchedule.getConfig();
+    logger.print(F(", \"sleep\": { \"enabled\": "));
+    logger.print(sleepConfig.enabled);
+    logger.print(F(", \"active\": "));
+    logger.print(systemSleepSchedule.isActive());
+    logger.print(F(", \"periodMs\": "));
+    logger.print(sleepConfig.periodMs);
+    logger.print(F(", \"listenMs\": "));
+    logger.print(sleepConfig.listenMs);
+    logger.print(F(", \"extendMs\": "));
+    logger.print(sleepConfig.extendMs);
+    logger.print(F(", \"awakePct\": "));
+    logger.print((int)(systemSleepSchedule.getAwakePct() + 0.5));
+    logger.print(F(", \"sleepCount\": "));
+    logger.print(systemSleepSchedule.getSleepCount());
+    logger.print(F(", \"holdCount\": "));
+    logger.print(systemSleepSchedule.getHoldCount());
+    logger.print(F(", \"holdAvgMs\": "));
+    logger.print(systemSleepSchedule.getAvgHoldMs());
+    logger.print(F(", \"holdMaxMs\": "));
+    logger.print(systemSleepSchedule.getMaxHoldMs());
+    logger.print(F(" }"));
+
+    // Display the low power listening.  The radio duty cycle covers 
+    // both the sleep schedule and the channel sampling.
+    logger.print(F(", \"lpl\": { \"intervalMs\": "));
+    logger.print(systemInstrumentation.getLplInterval());
+    logger.print(F(", \"radioOnPermille\": "));
+    logger.print(systemInstrumentation.getRadioOnPermille());
+    logger.print(F(", \"sampleCount\": "));
+    logger.print(systemInstrumentation.getLplSampleCount());
+    logger.print(F(", \"wakeCount\": "));
+    logger.print(systemInstrumentation.getLplWakeCount());
+    logger.print(F(", \"falseWakeCount\": "));
+    logger.print(systemInstrumentation.getLplFalseWakeCount());
+    logger.print(F(", \"longPreambleTxCount\": "));
+    logger.print(systemInstrumentation.getLongPreambleTxCount());
+    logger.print(F(" }"));
+    logger.print(F(", \"radio\": { \"cadToTxUs\": "));
+    logger.print(systemInstrumentation.getCadToTxUs());
+    logger.print(F(", \"cadToTxMaxUs\": "));
+    logger.print(systemInstrumentation.getMaxCadToTxUs());
+    logger.print(F(", \"preloadHits\": "));
+    logger.print(systemInstrumentation.getTxPreloadHits());
+    logger.print(F(", \"preloadMisses\": "));
+    logger.print(systemInstrumentation.getTxPreloadMisses());
+    logger.print(F(", \"rxOverrunCount\": "));
+    logger.print(systemInstrumentation.getRxOverruns());
+    logger.print(F(", \"rxServiceUs\": "));
+    logger.print(systemInstrumentation.getRxServiceUs());
+    logger.print(F(", \"rxServiceMaxUs\": "));
+    logger.print(systemInstrumentation.getMaxRxServiceUs());
+    logger.print(F(", \"txServiceUs\": "));
+    logger.print(systemInstrumentation.getTxServiceUs());
+    logger.print(F(", \"txServiceMaxUs\": "));
+    logger.print(systemInstrumentation.getMaxTxServiceUs());
+    logger.print(F(", \"regWriteSkips\": "));
+    logger.print(systemInstrumentation.getRegWriteSkips());
+    logger.print(F(", \"ackAirtimeUs\": "));
+    logger.print(systemInstrumentation.getAckAirtimeUs());
+    logger.print(F(", \"explicitAckAirtimeUs\": "));
+    logger.print(systemInstrumentation.getExplicitAckAirtimeUs());
+    logger.print(F(", \"ackWindowTimeouts\": "));
+    logger.print(systemInstrumentation.getAckWindowTimeouts());
+    logger.print(F(", \"symbolUs\": "));
+    logger.print(systemInstrumentation.getSymbolUs());
+    logger.print(F(", \"listenSf\": "));
+    logger.print(systemInstrumentation.getListenSf());
+    logger.print(F(", \"nextListenSf\": "));
+    logger.print(systemInstrumentation.getNextListenSf());
+    logger.print(F(", \"lowSfTxCount\": "));
+    logger.print(systemInstrumentation.getLowSfTxCount());
+    logger.print(F(", \"lowSfSavedUs\": "));
+    logger.print(systemInstrumentation.getLowSfSavedUs());
+    logger.print(F(", \"lowPowerTxCount\": "));
+    logger.print(systemInstrumentation.getLowPowerTxCount());
+    logger.print(F(", \"rfEnergySavedUj\": "));
+    logger.print(systemInstrumentation.getRfEnergySavedUj());
+    logger.print(F(", \"profile\": "));
+    printProfile(systemConfig.getRadioProfiles().getActive());
+    logger.print(F(" }"));
     logger.println(F("}"));
     return 0;
 }
 
+/**
+ * Displays the link quality of all of the neighbors that we 
+ * are tracking.
+ */
+int links(int argc, char **argv) { 
+    logger.print(F("LINKS: ["));
+    bool first = true;
+    for (unsigned int i = 0; i < NeighborTable::SIZE; i++) {
+        const NeighborEntry& entry = systemNeighborTable.getSlot(i);
+        if (!entry.isValid()) 
+            continue;
+        if (!first) 
+            logger.print(", ");
+        first = false;
+        logger.print(F("{ \"addr\": "));
+        logger.print(entry.addr);
+        logger.print(F(", \"rssi\": "));
+        logger.print((int)entry.rssi);
+        logger.print(F(", \"snr\": "));
+        logger.print((int)entry.snr);
+        if (entry.fwdValid) {
+            logger.print(F(", \"fwdRssi\": "));
+            logger.print((int)entry.fwdRssi);
+            logger.print(F(", \"fwdSnr\": "));
+            logger.print((int)entry.fwdSnr);
+            logger.print(F(", \"fwdFreqErrorHz\": "));
+            logger.print(entry.fwdFreqErrorHz);
+        }
+        logger.print(F(", \"deliveryPct\": "));
+        logger.print((int)(entry.deliveryRatio * 100.0));
+        logger.print(F(", \"rxCount\": "));
+        logger.print(entry.rxCount);
+        logger.print(F(", \"txCount\": "));
+        logger.print(entry.txCount);
+        logger.print(F(", \"ackCount\": "));
+        logger.print(entry.ackCount);
+        logger.print(F(", \"etx\": "));
+        logger.print((int)(systemNeighborTable.getEtx(entry.addr) * 100.0));
+        logger.print(F(", \"etxMeasured\": "));
+        logger.print(systemNeighborTable.isEtxMeasured(entry.addr) ? "true" : "false");
+        logger.print(F(", \"ageSeconds\": "));
+        logger.print(systemNeighborTable.getSecondsSinceHeard(entry));
+        logger.print(" }");
+    }
+    logger.println(F("]"));
+    return 0;
+}
+
 // Used for testing the watch dog 
 int sleep(int argc, char **argv) { 
 
@@ -458,6 +766,269 @@ int setMode(int argc, char **argv) {
     return 0;  
 }
 
+/**
+ * Sets the interval (in seconds) between link probes.  Zero turns 
+ * off probing.
+ */
+int setProbe(int argc, char **argv) {
+    if (argc != 2) {
+        logger.println(msg_arg_error);
+        return -1;
+    }
+    systemConfig.setProbeInterval(atoi(argv[1]));
+    logger.println(msg_ok);
+    return 0;  
+}
+
+int setCsma(int argc, char **argv) {
+    if (argc != 3) {
+        logger.println(msg_arg_error);
+        return -1;
+    }
+    ChannelAccessConfig c = systemConfig.getChannelAccessConfig();
+    c.persistencePct = atoi(argv[1]);
+    c.slotMs = atoi(argv[2]);
+    if (!c.isValid()) {
+        logger.println(msg_arg_error);
+        return -1;
+    }
+    systemConfig.setChannelAccessConfig(c);
+    systemChannelAccess.configure(c);
+    logger.println(msg_ok);
+    return 0;  
+}
+
+int setCw(int argc, char **argv) {
+    if (argc != 4) {
+        logger.println(msg_arg_error);
+        return -1;
+    }
+    unsigned int tc = atoi(argv[1]);
+    if (tc >= TRAFFIC_CLASS_COUNT) {
+        logger.println(msg_arg_error);
+        return -1;
+    }
+    ChannelAccessConfig c = systemConfig.getChannelAccessConfig();
+    c.cwMin[tc] = atoi(argv[2]);
+    c.cwMax[tc] = atoi(argv[3]);
+    if (!c.isValid()) {
+        logger.println(msg_arg_error);
+        return -1;
+    }
+    systemConfig.setChannelAccessConfig(c);
+    systemChannelAccess.configure(c);
+    logger.println(msg_ok);
+    return 0;  
+}
+
+/**
+ * Configures the TDMA mode.  The slots owned by this station can be 
+ * listed, otherwise the slot is picked using the station address.
+ */
+int setTdma(int argc, char **argv) {
+    if (argc < 4) {
+        logger.println(msg_arg_error);
+        return -1;
+    }
+    TdmaConfig c;
+    c.enabled = atoi(argv[1]);
+    c.slotCount = atoi(argv[2]);
+    c.slotMs = atoi(argv[3]);
+    c.slotMask = 0;
+    for (int i = 4; i < argc; i++) {
+        int slot = atoi(argv[i]);
+        if (slot < 0 || slot >= c.slotCount) {
+            logger.println(msg_arg_error);
+            return -1;
+        }
+        c.slotMask |= (1UL << slot);
+    }
+    if (!c.isValid()) {
+        logger.println(msg_arg_error);
+        return -1;
+    }
+    systemConfig.setTdmaConfig(c);
+    systemChannelAccess.configureTdma(c, systemConfig.getAddr());
+    logger.println(msg_ok);
+    return 0;  
+}
+
+/**
+ * Configures the coordinated sleep schedule.  This should match on all 
+ * of the stations in an area.
+ */
+int setSleep(int argc, char **argv) {
+    if (argc != 5) {
+        logger.println(msg_arg_error);
+        return -1;
+    }
+    SleepConfig c;
+    c.enabled = atoi(argv[1]);
+    c.periodMs = atoi(argv[2]);
+    c.listenMs = atoi(argv[3]);
+    c.extendMs = atoi(argv[4]);
+    if (!c.isValid()) {
+        logger.println(msg_arg_error);
+        return -1;
+    }
+    systemConfig.setSleepConfig(c);
+    systemSleepSchedule.configure(c);
+    logger.println(msg_ok);
+    return 0;  
+}
+
+/**
+ * Sets the low power listening sampling interval.  Zero keeps the 
+ * receiver on all of the time.  The neighbors find out about the 
+ * change from our next link probe, so probing needs to be turned on.
+ */
+int setLpl(int argc, char **argv) {
+    if (argc != 2) {
+        logger.println(msg_arg_error);
+        return -1;
+    }
+    const long ms = atol(argv[1]);
+    if (ms < 0 || ms > 0xffff) {
+        logger.println(msg_arg_error);
+        return -1;
+    }
+    systemConfig.setLplInterval(ms);
+    systemInstrumentation.setLplInterval(ms);
+    logger.println(msg_ok);
+    return 0;  
+}
+
+/**
+ * Switches to one of the profiles in the table.  The radio picks up the
+ * change as soon as it isn't busy.
+ */
+int setProfile(int argc, char **argv) {
+    if (argc != 2) {
+        logger.println(msg_arg_error);
+        return -1;
+    }
+    RadioProfileTable t = systemConfig.getRadioProfiles();
+    int i = t.find(argv[1]);
+    if (i < 0) {
+        logger.println(msg_arg_error);
+        return -1;
+    }
+    t.active = i;
+    systemConfig.setRadioProfiles(t);
+    systemInstrumentation.setRadioProfile(t.getActive());
+    logger.println(msg_ok);
+    return 0;  
+}
+
+int defProfile(int argc, char **argv) {
+    if (argc != 7) {
+        logger.println(msg_arg_error);
+        return -1;
+    }
+    unsigned int slot = atoi(argv[1]);
+    if (slot >= RADIO_PROFILE_COUNT) {
+        logger.println(msg_arg_error);
+        return -1;
+    }
+    RadioProfileTable t = systemConfig.getRadioProfiles();
+    t.profiles[slot].set(argv[2], atoi(argv[3]), atoi(argv[4]), atoi(argv[5]),
+        atoi(argv[6]));
+    if (!t.isValid()) {
+        logger.println(msg_arg_error);
+        return -1;
+    }
+    systemConfig.setRadioProfiles(t);
+    // Changes to the profile in use take effect right away
+    if (slot == t.active) 
+        systemInstrumentation.setRadioProfile(t.getActive());
+    logger.println(msg_ok);
+    return 0;  
+}
+
+int profiles(int argc, char **argv) {
+    RadioProfileTable t = systemConfig.getRadioProfiles();
+    logger.print(F("PROFILES: { \"active\": "));
+    logger.print(t.active);
+    logger.print(F(", \"profiles\": ["));
+    for (unsigned int i = 0; i < RADIO_PROFILE_COUNT; i++) {
+        if (i > 0)
+            logger.print(", ");
+        printProfile(t.profiles[i]);
+    }
+    logger.println(F("] }"));
+    return 0;
+}
+
+/**
+ * Moves the whole network (including this station) to one of the 
+ * profiles in the table.  Each station that accepts the change sends 
+ * back a SETPROFILE_RESP.
+ */
+int sendSetProfile(int argc, char **argv) {
+    if (argc != 5) {
+        logger.println(msg_arg_error);
+        return -1;
+    }
+    RadioProfileTable t = systemConfig.getRadioProfiles();
+    int i = t.find(argv[1]);
+    if (i < 0) {
+        logger.println(msg_arg_error);
+        return -1;
+    }
+    bool good = systemMessageProcessor.sendProfileChange(t.profiles[i],
+        atoi(argv[2]), atoi(argv[3]), atol(argv[4]));
+    if (!good) {
+        logger.println(msg_tx_busy);
+        return -1;
+    }
+    logger.println(msg_ok);
+    return 0;  
+}
+
+/**
+ * Sets the network time (seconds since the epoch).  This station becomes
+ * the root that the rest of the network takes its time from.
+ */
+int setTime(int argc, char **argv) {
+    if (argc != 2) {
+        logger.println(msg_arg_error);
+        return -1;
+    }
+    const uint32_t seconds = strtoul(argv[1], 0, 10);
+    systemNetworkClock.setTime((uint64_t)seconds * 1000000ULL, 
+        systemConfig.getAddr());
+    logger.println(msg_ok);
+    return 0;
+}
+
+/**
+ * Displays the state of the network time synchronization.
+ */
+int showTime(int argc, char **argv) {
+    logger.print(F("TIME: { \"hasTime\": "));
+    logger.print(systemNetworkClock.hasTime() ? "true" : "false");
+    logger.print(F(", \"seconds\": "));
+    logger.print(systemNetworkClock.getNetworkSeconds());
+    logger.print(F(", \"micros\": "));
+    logger.print((uint32_t)(systemNetworkClock.getNetworkUs() % 1000000ULL));
+    logger.print(F(", \"synced\": "));
+    logger.print(systemNetworkClock.isSynced() ? "true" : "false");
+    logger.print(F(", \"level\": "));
+    logger.print(systemNetworkClock.getLevel());
+    logger.print(F(", \"root\": "));
+    logger.print(systemNetworkClock.getRoot());
+    logger.print(F(", \"parent\": "));
+    logger.print(systemNetworkClock.getParent());
+    logger.print(F(", \"skewPpb\": "));
+    logger.print(systemNetworkClock.getSkewPpb());
+    logger.print(F(", \"lastOffsetUs\": "));
+    logger.print(systemNetworkClock.getLastOffsetUs());
+    logger.print(F(", \"beaconCount\": "));
+    logger.print(systemNetworkClock.getBeaconCount());
+    logger.println(F(" }"));
+    return 0;
+}
+
 int print(int argc, char **argv) { 
 
     if (argc != 2) {
@@ -502,6 +1073,33 @@ int setRoute(int argc, char **argv) {
     return 0;
 }
 
+int setBackupRoute(int argc, char **argv) { 
+
+    if (argc < 3 || argc > 2 + (int)RoutingTable::MAX_BACKUP_ROUTES) {
+        logger.println(msg_arg_error);
+        return -1;
+    }
+
+    nodeaddr_t t = parseAddr(argv[1]);
+    if (t == 0) {
+        logger.println(msg_bad_address);
+        return -1;
+    }
+
+    // Any backups that aren't specified are cleared. A zero 
+    // address is allowed so that the backups can be cleared.
+    for (unsigned int b = 0; b < RoutingTable::MAX_BACKUP_ROUTES; b++) {
+        nodeaddr_t r = 0;
+        if ((int)(b + 2) < argc) {
+            r = parseAddr(argv[b + 2]);
+        }
+        systemRoutingTable.setBackupRoute(t, b, r);
+    }
+    
+    logger.println(msg_ok);
+    return 0;
+}
+
 int clearRoutes(int argc, char **argv) { 
     systemRoutingTable.clearRoutes();
     logger.println(msg_ok);
@@ -511,6 +1109,8 @@ int clearRoutes(int argc, char **argv) {
 int resetCounters(int argc, char **argv) { 
     systemInstrumentation.resetCounters();
     systemMessageProcessor.resetCounters();
+    systemChannelAccess.resetCounters();
+    systemSleepSchedule.resetCounters();
     logger.println(msg_ok);
     return 0;
 }
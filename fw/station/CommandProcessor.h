@@ -26,6 +26,7 @@ int sendReset(int argc, char **argv);
 int sendResetCounters(int argc, char **argv);
 int sendSetRoute(int argc, char **argv);
 int sendGetRoute(int argc, char **argv);
+int sendGetLinks(int argc, char **argv);
 int sendText(int argc, char **argv);
 
 int setAddr(int argc, char **argv);
@@ -33,11 +34,25 @@ int setCall(int argc, char **argv);
 int setPasscode(int argc, char **argv);
 int setBatteryLimit(int argc, char **argv);
 int setRoute(int argc, char **argv);
+int setBackupRoute(int argc, char **argv);
 int clearRoutes(int argc, char **argv);
 int setLog(int argc, char **argv);
 int setMode(int argc, char **argv);
+int setProbe(int argc, char **argv);
+int setCsma(int argc, char **argv);
+int setCw(int argc, char **argv);
+int setTdma(int argc, char **argv);
+int setSleep(int argc, char **argv);
+int setLpl(int argc, char **argv);
+int setProfile(int argc, char **argv);
+int defProfile(int argc, char **argv);
+int profiles(int argc, char **argv);
+int sendSetProfile(int argc, char **argv);
+int setTime(int argc, char **argv);
+int showTime(int argc, char **argv);
 
 int info(int argc, char **argv);
+int links(int argc, char **argv);
 int sleep(int argc, char **argv);
 int print(int argc, char **argv);
 int boot(int argc, char **argv);
@@ -21,6 +21,9 @@
 #define _Configuration_h
 
 #include "Utils.h"
+#include "ChannelAccessConfig.h"
+#include "SleepConfig.h"
+#include "RadioProfile.h"
 
 class Configuration {
 public:
@@ -49,6 +52,40 @@ public:
     virtual uint8_t getCommandMode() const { return 0; }
     virtual void setCommandMode(uint8_t l) { };
 
+    virtual uint16_t getProbeInterval() const { return 0; }
+    virtual void setProbeInterval(uint16_t /*s*/) { };
+
+    virtual uint16_t getLplInterval() const { return 0; }
+    virtual void setLplInterval(uint16_t /*ms*/) { };
+
+    virtual ChannelAccessConfig getChannelAccessConfig() const { 
+        ChannelAccessConfig c;
+        c.setDefaults();
+        return c;
+    }
+    virtual void setChannelAccessConfig(const ChannelAccessConfig& /*c*/) { };
+
+    virtual TdmaConfig getTdmaConfig() const { 
+        TdmaConfig c;
+        c.setDefaults();
+        return c;
+    }
+    virtual void setTdmaConfig(const TdmaConfig& /*c*/) { };
+
+    virtual SleepConfig getSleepConfig() const { 
+        SleepConfig c;
+        c.setDefaults();
+        return c;
+    }
+    virtual void setSleepConfig(const SleepConfig& /*c*/) { };
+
+    virtual RadioProfileTable getRadioProfiles() const {
+        RadioProfileTable t;
+        t.setDefaults();
+        return t;
+    }
+    virtual void setRadioProfiles(const RadioProfileTable& /*t*/) { };
+
     virtual void factoryReset() = 0;
 };
 
@@ -103,6 +103,76 @@ void ConfigurationImpl::setCommandMode(uint8_t l) {
     _save();  
 }
 
+uint16_t ConfigurationImpl::getProbeInterval() const {
+    return _configCache.probeIntervalSeconds;
+}
+
+void ConfigurationImpl::setProbeInterval(uint16_t s) {
+    _configCache.probeIntervalSeconds = s;
+    _save();  
+}
+
+uint16_t ConfigurationImpl::getLplInterval() const {
+    return _configCache.lplIntervalMs;
+}
+
+void ConfigurationImpl::setLplInterval(uint16_t ms) {
+    _configCache.lplIntervalMs = ms;
+    _save();  
+}
+
+ChannelAccessConfig ConfigurationImpl::getChannelAccessConfig() const {
+    ChannelAccessConfig c = _configCache.channelAccess;
+    // Fill in the defaults if nothing has been configured yet
+    if (!c.isValid()) 
+        c.setDefaults();
+    return c;
+}
+
+void ConfigurationImpl::setChannelAccessConfig(const ChannelAccessConfig& c) {
+    _configCache.channelAccess = c;
+    _save();  
+}
+
+TdmaConfig ConfigurationImpl::getTdmaConfig() const {
+    TdmaConfig c = _configCache.tdma;
+    // Fill in the defaults if nothing has been configured yet
+    if (!c.isValid()) 
+        c.setDefaults();
+    return c;
+}
+
+void ConfigurationImpl::setTdmaConfig(const TdmaConfig& c) {
+    _configCache.tdma = c;
+    _save();  
+}
+
+SleepConfig ConfigurationImpl::getSleepConfig() const {
+    SleepConfig c = _configCache.sleep;
+    // Fill in the defaults if nothing has been configured yet
+    if (!c.isValid()) 
+        c.setDefaults();
+    return c;
+}
+
+void ConfigurationImpl::setSleepConfig(const SleepConfig& c) {
+    _configCache.sleep = c;
+    _save();  
+}
+
+RadioProfileTable ConfigurationImpl::getRadioProfiles() const {
+    RadioProfileTable t = _configCache.radioProfiles;
+    // Fill in the defaults if nothing has been configured yet
+    if (!t.isValid()) 
+        t.setDefaults();
+    return t;
+}
+
+void ConfigurationImpl::setRadioProfiles(const RadioProfileTable& t) {
+    _configCache.radioProfiles = t;
+    _save();  
+}
+
 void ConfigurationImpl::_save() {
     const uint8_t* v = (const uint8_t*)&_configCache;
     _pref.putBytes("config", v, sizeof(StationConfig));
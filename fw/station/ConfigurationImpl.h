@@ -55,6 +55,24 @@ public:
     uint8_t getCommandMode() const;
     void setCommandMode(uint8_t l);
 
+    uint16_t getProbeInterval() const;
+    void setProbeInterval(uint16_t s);
+
+    uint16_t getLplInterval() const;
+    void setLplInterval(uint16_t ms);
+
+    ChannelAccessConfig getChannelAccessConfig() const;
+    void setChannelAccessConfig(const ChannelAccessConfig& c);
+
+    TdmaConfig getTdmaConfig() const;
+    void setTdmaConfig(const TdmaConfig& c);
+
+    SleepConfig getSleepConfig() const;
+    void setSleepConfig(const SleepConfig& c);
+
+    RadioProfileTable getRadioProfiles() const;
+    void setRadioProfiles(const RadioProfileTable& t);
+
     void factoryReset();
 
 private:
@@ -0,0 +1,98 @@
+/* 
+ * LoRa Birdhouse Mesh Network Project
+ * Wellesley Amateur Radio Society
+ * 
+ * Copyright (C) 2022 Bruce MacKinnon
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _EdgeTimeQueue_h
+#define _EdgeTimeQueue_h
+
+#include <stdint.h>
+
+// Must be a power of two
+#define EDGE_TIME_QUEUE_SIZE 8
+
+/**
+ * @brief A small lock-free queue of interrupt times.  The ISR pushes
+ * the (microsecond) time of each DIO0 edge and the main loop takes them
+ * out when it services the radio.  There is one writer (the ISR) and 
+ * one reader (the main loop), so each index is only ever written by 
+ * one side.  If the queue is full the newest time is dropped.
+ * 
+ * push() is called from the ISR, so it is kept inline and doesn't 
+ * call anything.
+ */
+class EdgeTimeQueue {
+public:
+
+    EdgeTimeQueue() : _head(0), _tail(0), _droppedCount(0) { }
+
+    __attribute__((always_inline)) inline void push(uint32_t us) {
+        const uint8_t head = _head;
+        if ((uint8_t)(head - _tail) >= EDGE_TIME_QUEUE_SIZE) {
+            _droppedCount++;
+            return;
+        }
+        _times[head & (EDGE_TIME_QUEUE_SIZE - 1)] = us;
+        // The time must be in place before the reader can see it
+        __sync_synchronize();
+        _head = head + 1;
+    }
+
+    /**
+     * @brief Takes the oldest time off of the queue.
+     * @return true if there was one.
+     */
+    bool pop(uint32_t* us) {
+        const uint8_t tail = _tail;
+        if (tail == _head) {
+            return false;
+        }
+        *us = _times[tail & (EDGE_TIME_QUEUE_SIZE - 1)];
+        __sync_synchronize();
+        _tail = tail + 1;
+        return true;
+    }
+
+    /**
+     * @brief Empties the queue.  The radio latches its IRQ flags, so 
+     * when several edges are serviced at once the newest one belongs to
+     * the event that is being handled (i.e. the frame that is still in 
+     * the FIFO).
+     * 
+     * @param defaultUs Returned if there were no edges (i.e. the IRQ was
+     *   found some other way).
+     */
+    uint32_t popLatest(uint32_t defaultUs) {
+        uint32_t us = defaultUs;
+        uint32_t t;
+        while (pop(&t)) {
+            us = t;
+        }
+        return us;
+    }
+
+    uint16_t getDroppedCount() const { return _droppedCount; }
+
+private:
+
+    volatile uint32_t _times[EDGE_TIME_QUEUE_SIZE];
+    volatile uint8_t _head;
+    volatile uint8_t _tail;
+    volatile uint16_t _droppedCount;
+};
+
+#endif
@@ -22,6 +22,8 @@
 
 #include <stdint.h>
 
+#include "RadioProfile.h"
+
 /**
  * @brief An interface for accessing device-level instrumentation data.
  * This is done through an abstract interface to make unit testing 
@@ -42,6 +44,101 @@ public:
     virtual void restart() = 0;
     virtual void restartRadio() = 0;
 
+    /**
+     * @brief Time (in microseconds) between the CAD reporting an idle 
+     * channel and the radio being put into transmit mode for the 
+     * most recent transmission.
+     */
+    virtual uint32_t getCadToTxUs() const { return 0; }
+    virtual uint32_t getMaxCadToTxUs() const { return 0; }
+    /**
+     * @brief Number of transmissions where the frame was already 
+     * in the radio FIFO (hits) or had to be loaded after the CAD (misses).
+     */
+    virtual uint16_t getTxPreloadHits() const { return 0; }
+    virtual uint16_t getTxPreloadMisses() const { return 0; }
+    /**
+     * @brief Number of received frames that were lost because they 
+     * arrived before the previous frame was read out of the radio.
+     */
+    virtual uint16_t getRxOverruns() const { return 0; }
+    /**
+     * @brief Time (in microseconds) taken to move the most recent 
+     * received frame out of the radio and to start the most recent 
+     * transmission.
+     */
+    virtual uint32_t getRxServiceUs() const { return 0; }
+    virtual uint32_t getMaxRxServiceUs() const { return 0; }
+    virtual uint32_t getTxServiceUs() const { return 0; }
+    virtual uint32_t getMaxTxServiceUs() const { return 0; }
+    /**
+     * @brief Number of radio register writes that were skipped because
+     * the register already had the value.
+     */
+    virtual uint32_t getRegWriteSkips() const { return 0; }
+    /**
+     * @brief Airtime of an ACK in implicit header mode (as sent) and in
+     * explicit header mode (for comparison).
+     */
+    virtual uint32_t getAckAirtimeUs() const { return 0; }
+    virtual uint32_t getExplicitAckAirtimeUs() const { return 0; }
+    virtual uint16_t getAckWindowTimeouts() const { return 0; }
+    /**
+     * @brief How long the radio waits for an ACK after a transmission
+     * (it can stay open for up to twice this while an ACK is coming 
+     * in), and whether a transmission is in progress.
+     */
+    virtual uint32_t getAckWindowMs() const { return 0; }
+    virtual bool isTransmitting() const { return false; }
+
+    /**
+     * @brief Changes the radio modem settings without a reset.
+     */
+    virtual void setRadioProfile(const RadioProfile& /*profile*/) { }
+    /**
+     * @brief The timing of the current modem settings, for anything 
+     * that needs to scale with the speed of the channel.
+     */
+    virtual uint32_t getSymbolUs() const { return 0; }
+    virtual uint32_t getAirtimeUs(uint8_t /*len*/) const { return 0; }
+    /**
+     * @brief The spreading factor that the receiver is listening on 
+     * (chosen by the adaptive data rate), the one it will move to at 
+     * the end of the next rendezvous window (0 if none), and the number
+     * of transmissions made below the profile spreading factor along 
+     * with the airtime that this saved.
+     */
+    virtual uint8_t getListenSf() const { return 0; }
+    virtual uint8_t getNextListenSf() const { return 0; }
+    virtual uint16_t getLowSfTxCount() const { return 0; }
+    virtual uint32_t getLowSfSavedUs() const { return 0; }
+    /**
+     * @brief The number of transmissions made below the profile power
+     * (chosen by the transmit power control) and the RF energy, in 
+     * microjoules, that this saved.
+     */
+    virtual uint16_t getLowPowerTxCount() const { return 0; }
+    virtual uint32_t getRfEnergySavedUj() const { return 0; }
+
+    /**
+     * @brief Low power listening.  The receiver sleeps and samples the 
+     * channel once every interval (0 means always listening).  
+     */
+    virtual void setLplInterval(uint16_t /*ms*/) { }
+    virtual uint16_t getLplInterval() const { return 0; }
+    /**
+     * @brief The percentage of the time (in tenths) that the radio has 
+     * been out of SLEEP mode, the number of channel samples taken, the 
+     * number that found activity, the number of those that weren't 
+     * followed by a frame, and the number of frames sent with a long 
+     * preamble to wake up a sampling neighbor.
+     */
+    virtual uint16_t getRadioOnPermille() const { return 1000; }
+    virtual uint32_t getLplSampleCount() const { return 0; }
+    virtual uint16_t getLplWakeCount() const { return 0; }
+    virtual uint16_t getLplFalseWakeCount() const { return 0; }
+    virtual uint16_t getLongPreambleTxCount() const { return 0; }
+
     /**
      * @brief Resets diagnostic counters
      */
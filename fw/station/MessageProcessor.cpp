@@ -17,6 +17,8 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
+#include <stddef.h>
+
 #include "MessageProcessor.h"
 #include "CircularBuffer.h"
 #include "packets.h"
@@ -38,41 +40,102 @@ MessageProcessor::MessageProcessor(
     CircularBuffer& rxBuffer, 
     CircularBuffer& txBuffer,
     RoutingTable& routingTable,  
+    NeighborTable& neighborTable,
     Instrumentation& instrumentation,
     Configuration& config,
     uint32_t txTimeoutMs, 
     uint32_t txRetryMs) 
-    : _clock(clock),
+    : _config(config),
+      _clock(clock),
       _rxBuffer(rxBuffer),
       _txBuffer(txBuffer),
       _routingTable(routingTable),
+      _neighborTable(neighborTable),
       _instrumentation(instrumentation),
-      _config(config),
-      _opm(clock, txBuffer, txTimeoutMs, txRetryMs),
+      _opm(clock, txBuffer, routingTable, neighborTable, txTimeoutMs, txRetryMs),
       _idCounter(1),
       _startTime(clock.time()),
+      _lastRxTime(clock.time()),
+      _probeSeq(0),
+      _nextProbeTime(0),
+      _networkClock(0),
+      _nextTimeSyncTime(0),
+      _sleepSchedule(0),
+      _profileChangeState(PROFILE_IDLE),
+      _profileChangeOrigin(0),
+      _profileChangeId(0),
+      _profileChangeTime(0),
+      _profileChangeUs(0),
+      _profileHeard(false),
+      _profileFallbackMs(0),
+      _profileFallbackCounter(0),
       _rxPacketCounter(0),
       _badRxPacketCounter(0),
       _badRouteCounter(0),
-      _lastRxTime(clock.time()) {
+      _ttlDropCounter(0),
+      _routeErrorCounter(0) {
+    _opm.setInstrumentation(&instrumentation);
 }
 
 void MessageProcessor::pump() {
     // We keep processing until the receive buffer
     // has been drained.
     while (true) {
-      int16_t rssi = 0;
+      RxMetadata rxMeta;
       Packet packet;
       unsigned int packetLen = sizeof(Packet);
-      bool available = _rxBuffer.popIfNotEmpty((void*)&rssi, 
+      bool available = _rxBuffer.popIfNotEmpty((void*)&rxMeta, 
         (void*)&packet, &packetLen);
       if (!available) {
         break;
       }
-      _process(rssi, packet, packetLen);
+      // Traffic keeps the station awake for a while
+      if (_sleepSchedule != 0) {
+        _sleepSchedule->processActivity();
+      }
+      _process(rxMeta, packet, packetLen);
+    }
+    _sendProbeIfNecessary();
+    if (_networkClock != 0) {
+        _networkClock->tick();
+    }
+    _sendTimeSyncIfNecessary();
+    _checkProfileChange();
+    // Outside of the wake window everything other than ACKs waits 
+    // in the outbound queue
+    if (_sleepSchedule != 0) {
+        if (!_sleepSchedule->isTxAllowed()) {
+            _opm.pause();
+        } else if (_opm.isPaused()) {
+            const uint32_t heldMs = _opm.resume();
+            if (heldMs > 0)
+                _sleepSchedule->processHold(heldMs);
+        }
+        // Stay awake until everything that was sent is acknowledged
+        if (!_opm.isPaused() && _opm.getPendingCount() > 0)
+            _sleepSchedule->processActivity();
     }
     // Move any resulting packets onto the TX queue
     _opm.pump();
+    // Tell the originators about anything that couldn't be delivered
+    Header giveUpHeader;
+    while (_opm.popGiveUp(giveUpHeader)) {
+        _sendRouteError(giveUpHeader, giveUpHeader.getDestAddr());
+    }
+    // Routes that were taken out of service are eventually retried
+    _routingTable.revalidateRoutes(_clock.time(), ROUTE_HOLD_DOWN_MS);
+}
+
+void MessageProcessor::setChannelAccess(ChannelAccess* channelAccess) {
+    _opm.setChannelAccess(channelAccess);
+}
+
+void MessageProcessor::setNetworkClock(NetworkClock* networkClock) {
+    _networkClock = networkClock;
+}
+
+void MessageProcessor::setSleepSchedule(SleepSchedule* sleepSchedule) {
+    _sleepSchedule = sleepSchedule;
 }
 
 unsigned int MessageProcessor::getUniqueId() {
@@ -86,8 +149,9 @@ bool MessageProcessor::transmitIfPossible(const Packet& packet,
     // sent to the local node (i.e. loopback).  In this case
     // we just put the message on the receive queue immediately.
     if (packet.header.getDestAddr() == _config.getAddr()) {
-        int16_t fakeRssi = 0;
-        return _rxBuffer.push((const void*)&fakeRssi, 
+        RxMetadata fakeRxMeta;
+        fakeRxMeta.rxTimeUs = _clock.timeUs();
+        return _rxBuffer.push((const void*)&fakeRxMeta, 
             (const void*)&packet, packetLen);
     }
     // If the message is targeted at another node then put 
@@ -97,7 +161,8 @@ bool MessageProcessor::transmitIfPossible(const Packet& packet,
     }
 }
 
-static void log_packet(Stream& l, const Packet& packet, int16_t rssi) {
+static void log_packet(Stream& l, const Packet& packet, 
+    const RxMetadata& rxMeta) {
     l.print(F("INF: Got type: "));
     l.print(packet.header.type);
     l.print(", id: ");
@@ -114,12 +179,25 @@ static void log_packet(Stream& l, const Packet& packet, int16_t rssi) {
     packet.header.getOriginalSourceCall().printTo(l);
     l.print(", finalDest: ");
     l.print(packet.header.finalDestAddr);
+    l.print(", ttl: ");
+    l.print(packet.header.ttl);
+    l.print(", hops: ");
+    l.print(packet.header.hopCount);
     l.print(", RSSI: ");
-    l.print(rssi);
+    l.print(rxMeta.rssi);
+    l.print(", SNR: ");
+    l.print(rxMeta.snr);
+    if (rxMeta.sf != 0) {
+        l.print(", SF: ");
+        l.print(rxMeta.sf);
+    }
+    if (rxMeta.overrun) {
+        l.print(", overrun");
+    }
     l.println();  
 }
 
-void MessageProcessor::_process(int16_t rssi, 
+void MessageProcessor::_process(const RxMetadata& rxMeta, 
     const Packet& packet, unsigned int packetLen) { 
 
     // Error checking on new packet
@@ -136,6 +214,24 @@ void MessageProcessor::_process(int16_t rssi,
         return;
     }
 
+    // Every good frame tells us something about the link to the 
+    // station that sent it, even if it isn't targeted at this node.
+    // Loopback traffic is ignored.
+    if (packet.header.getSourceAddr() != _config.getAddr()) {
+        _neighborTable.processRx(packet.header.getSourceAddr(), 
+            rxMeta.rssi, rxMeta.snr);
+        if (packet.header.getDestAddr() == _config.getAddr()) {
+            _neighborTable.processUnicastRx(packet.header.getSourceAddr(), 
+                rxMeta.snr);
+        }
+        // A hop that we can hear is no longer suspect
+        _routingTable.clearSuspect(packet.header.getSourceAddr());
+        // A profile change that is being tried out is confirmed by a 
+        // frame that was sent on the new profile
+        if (_profileChangeState == PROFILE_TRIAL && _isOnNewProfile(rxMeta))
+            _profileHeard = true;
+    }
+
     // Ignore messages that aren't targeted at this node.
     // This can happen when nodes are close to each other 
     // and they are able to hear traffic targed at other
@@ -152,12 +248,46 @@ void MessageProcessor::_process(int16_t rssi,
     _rxPacketCounter++;
     _lastRxTime = _clock.time();
 
+    // The number of hops that this message took to get here is 
+    // a good estimate of the length of the route back.
+    // Hearing from a station is also evidence that it is reachable.
+    if (packet.header.getOriginalSourceAddr() != _config.getAddr()) {
+        _routingTable.setRouteLength(packet.header.getOriginalSourceAddr(),
+            packet.header.getHopCount() + 1);
+        _routingTable.revalidateRoute(packet.header.getOriginalSourceAddr());
+    }
+
     if (_config.getLogLevel() > 0) {
-        log_packet(logger, packet, rssi);
+        log_packet(logger, packet, rxMeta);
     }
     
+    // Link probes are consumed here and are never forwarded
+    if (packet.header.getType() == TYPE_LINK_PROBE) {
+        _processProbe(packet, packetLen);
+        return;
+    }
+
+    // Time sync beacons are consumed here and are never forwarded
+    if (packet.header.getType() == TYPE_TIME_SYNC) {
+        _processTimeSync(rxMeta, packet, packetLen);
+        return;
+    }
+
+    // Profile changes are flooded through the whole network
+    if (packet.header.getType() == TYPE_SETPROFILE_REQ) {
+        _processProfileChange(packet, packetLen);
+        return;
+    }
+
     // If we got an ACK then process it directly 
     if (packet.header.isAck()) {
+        // The ACK says how well our frame was received
+        if (packetLen >= sizeof(Header) + sizeof(AckPayload)) {
+            AckPayload payload;
+            memcpy((void*)&payload, packet.payload, sizeof(AckPayload));
+            _neighborTable.processAckFeedback(packet.header.getSourceAddr(),
+                -(int16_t)payload.negRssi, payload.snr, payload.freqErrorHz);
+        }
         _opm.processAck(packet);
         return;
     }
@@ -171,7 +301,13 @@ void MessageProcessor::_process(int16_t rssi,
     if (packet.header.isAckRequired()) {
         Packet ack;
         ack.header.setupAckFor(packet.header, _config);
-        bool good = transmitIfPossible(ack, sizeof(Header));
+        AckPayload payload;
+        payload.snr = rxMeta.snr;
+        payload.negRssi = (rxMeta.rssi < -255) ? 255 : 
+            ((rxMeta.rssi > 0) ? 0 : -rxMeta.rssi);
+        payload.freqErrorHz = rxMeta.freqErrorHz;
+        memcpy(ack.payload, (const void*)&payload, sizeof(payload));
+        bool good = transmitIfPossible(ack, sizeof(Header) + sizeof(payload));
         if (!good) {
             logger.println("ERR: Full, no ACK");
         }
@@ -200,7 +336,21 @@ void MessageProcessor::_process(int16_t rssi,
     // This is a forward route (i.e. twoards the final destination)
     nodeaddr_t nextHop = _routingTable.nextHop(
       packet.header.getFinalDestAddr());
-    if (nextHop != RoutingTable::NO_ROUTE) {
+    // Enforce the hop limit.  This protects the network from 
+    // routing loops.
+    if (packet.header.getTtl() <= 1) {
+      _ttlDropCounter++;
+      if (_config.getLogLevel() > 0) {
+        logger.print("INF: TTL expired from ");
+        logger.println(packet.header.getOriginalSourceAddr());
+      }
+    }
+    else if (nextHop != RoutingTable::NO_ROUTE) {
+      // Route errors are inspected on the way back to the originator
+      // so that the stations along the way stop using the broken route.
+      if (packet.header.getType() == TYPE_ROUTE_ERROR) {
+        _processRouteError(packet, packetLen);
+      }
       // Make a clean packet so that we can adjust it
       Packet outPacket(packet);
       // Tweak the header and overlay. 
@@ -209,6 +359,8 @@ void MessageProcessor::_process(int16_t rssi,
       outPacket.header.setId(getUniqueId()); 
       outPacket.header.setDestAddr(nextHop);
       outPacket.header.setSourceAddr(_config.getAddr());
+      outPacket.header.setTtl(packet.header.getTtl() - 1);
+      outPacket.header.setHopCount(packet.header.getHopCount() + 1);
       // Arrange for sending.
       // NOTE: WE USE THE SAME LENGTH THAT WE GOT ON THE RX
       bool good = transmitIfPossible(outPacket, packetLen);
@@ -225,6 +377,7 @@ void MessageProcessor::_process(int16_t rssi,
     else {
       _badRouteCounter++;
       logger.println(msg_no_route);
+      _sendRouteError(packet.header, _config.getAddr());
     }
   }
 
@@ -254,6 +407,8 @@ void MessageProcessor::_process(int16_t rssi,
       Packet resp;
       resp.header.setupResponseFor(packet.header, _config, 
         TYPE_PING_RESP, getUniqueId(), firstHop);
+      resp.header.setTtl(_routingTable.getInitialTtl(
+        packet.header.getOriginalSourceAddr()));
       bool good = transmitIfPossible(resp, sizeof(Header));
       if (!good) {
         logger.println("ERR: Full, no resp");
@@ -266,6 +421,8 @@ void MessageProcessor::_process(int16_t rssi,
       Packet resp;
       resp.header.setupResponseFor(packet.header, _config, 
         TYPE_GETSED_RESP, getUniqueId(), firstHop);
+      resp.header.setTtl(_routingTable.getInitialTtl(
+        packet.header.getOriginalSourceAddr()));
 
       // Populate the payload
       SadRespPayload respPayload;
@@ -273,10 +430,11 @@ void MessageProcessor::_process(int16_t rssi,
       respPayload.batteryMv = _instrumentation.getBatteryVoltage();
       respPayload.panelMv = _instrumentation.getPanelVoltage();
       respPayload.uptimeSeconds = (_clock.time() - _startTime) / 1000;
-      respPayload.time = _clock.time();
+      respPayload.time = (_networkClock && _networkClock->hasTime()) ? 
+        _networkClock->getNetworkSeconds() : 0;
       respPayload.bootCount = _config.getBootCount();
       respPayload.sleepCount = _config.getSleepCount();
-      respPayload.lastHopRssi = rssi;
+      respPayload.lastHopRssi = rxMeta.rssi;
 
       respPayload.temp = _instrumentation.getTemperature();
       respPayload.humidity = _instrumentation.getHumidity();
@@ -287,6 +445,9 @@ void MessageProcessor::_process(int16_t rssi,
       respPayload.rxPacketCount = _rxPacketCounter;
       respPayload.badRxPacketCount = _badRxPacketCounter;
       respPayload.badRouteCount = _badRouteCounter;
+      respPayload.failoverCount = _opm.getFailoverCounter();
+      respPayload.ttlDropCount = _ttlDropCounter;
+      respPayload.routeErrorCount = _routeErrorCounter;
 
       memcpy(resp.payload, (const void*)&respPayload, sizeof(SadRespPayload));
 
@@ -341,6 +502,8 @@ void MessageProcessor::_process(int16_t rssi,
       logger.print(respPayload.panelMv);
       logger.print(", \"uptimeSeconds\": ");
       logger.print(respPayload.uptimeSeconds);
+      logger.print(", \"time\": ");
+      logger.print(respPayload.time);
       logger.print(", \"bootCount\": ");
       logger.print(respPayload.bootCount);
       logger.print(", \"sleepCount\": ");
@@ -353,6 +516,12 @@ void MessageProcessor::_process(int16_t rssi,
       logger.print(respPayload.badRouteCount);
       logger.print(", \"lastHopRssi\": ");
       logger.print(respPayload.lastHopRssi);
+      logger.print(", \"failoverCount\": ");
+      logger.print(respPayload.failoverCount);
+      logger.print(", \"ttlDropCount\": ");
+      logger.print(respPayload.ttlDropCount);
+      logger.print(", \"routeErrorCount\": ");
+      logger.print(respPayload.routeErrorCount);
       logger.println("}");
     }
 
@@ -443,6 +612,8 @@ void MessageProcessor::_process(int16_t rssi,
       Packet resp;
       resp.header.setupResponseFor(packet.header, _config, 
         TYPE_GETROUTE_RESP, getUniqueId(), firstHop);
+      resp.header.setTtl(_routingTable.getInitialTtl(
+        packet.header.getOriginalSourceAddr()));
 
       // Populate the response payload    
       GetRouteRespPayload respPayload;
@@ -461,6 +632,85 @@ void MessageProcessor::_process(int16_t rssi,
       }
     }
 
+    // Get links
+    else if (packet.header.getType() == TYPE_GETLINKS_REQ) {
+
+      Packet resp;
+      resp.header.setupResponseFor(packet.header, _config, 
+        TYPE_GETLINKS_RESP, getUniqueId(), firstHop);
+      resp.header.setTtl(_routingTable.getInitialTtl(
+        packet.header.getOriginalSourceAddr()));
+
+      // Report the neighbors in the order that they appear in the table
+      GetLinksRespPayload respPayload;
+      respPayload.count = 0;
+      respPayload.UNUSED0 = 0;
+      for (unsigned int i = 0; i < NeighborTable::SIZE && 
+        respPayload.count < MAX_LINK_REPORTS; i++) {
+        const NeighborEntry& entry = _neighborTable.getSlot(i);
+        if (!entry.isValid()) 
+          continue;
+        LinkReport& report = respPayload.links[respPayload.count++];
+        report.addr = entry.addr;
+        report.rssi = entry.rssi;
+        report.snr = entry.snr;
+        report.deliveryPct = entry.deliveryRatio * 100.0;
+        uint32_t age = _neighborTable.getSecondsSinceHeard(entry);
+        report.ageSeconds = (age > 0xffff) ? 0xffff : age;
+      }
+
+      // Only the populated part of the payload is sent
+      unsigned int payloadLen = 2 + (respPayload.count * sizeof(LinkReport));
+      memcpy(resp.payload, (const void*)&respPayload, payloadLen);
+
+      bool good = transmitIfPossible(resp, sizeof(Header) + payloadLen);
+      if (!good) {
+        logger.println("ERR: Full, no resp");
+      }
+    }
+
+    // Get links response (display)
+    else if (packet.header.getType() == TYPE_GETLINKS_RESP) {
+
+      if (packetLen < sizeof(Header) + 2) {
+        logger.println(msg_bad_message);
+        return;
+      }
+
+      // Anything past the largest possible report is ignored
+      GetLinksRespPayload payload;
+      unsigned int payloadLen = packetLen - sizeof(Header);
+      if (payloadLen > sizeof(payload))
+          payloadLen = sizeof(payload);
+      memcpy((void*)&payload, packet.payload, payloadLen);
+      if (payload.count > MAX_LINK_REPORTS ||
+          packetLen < sizeof(Header) + 2 + (payload.count * sizeof(LinkReport))) {
+        logger.println(msg_bad_message);
+        return;
+      }
+
+      logger.print(F("GETLINKS_RESP: { \"node\": "));
+      logger.print(packet.header.getOriginalSourceAddr());
+      logger.print(F(", \"links\": ["));
+      for (unsigned int i = 0; i < payload.count; i++) {
+        const LinkReport& report = payload.links[i];
+        if (i > 0)
+          logger.print(", ");
+        logger.print(F("{ \"addr\": "));
+        logger.print(report.addr);
+        logger.print(F(", \"rssi\": "));
+        logger.print(report.rssi);
+        logger.print(F(", \"snr\": "));
+        logger.print(report.snr);
+        logger.print(F(", \"deliveryPct\": "));
+        logger.print(report.deliveryPct);
+        logger.print(F(", \"ageSeconds\": "));
+        logger.print(report.ageSeconds);
+        logger.print(" }");
+      }
+      logger.println("] }");
+    }
+
     // Get route response (display)
     else if (packet.header.getType() == TYPE_GETROUTE_RESP) {
 
@@ -483,12 +733,505 @@ void MessageProcessor::_process(int16_t rssi,
       logger.print(payload.nextHopAddr);
       logger.println(" }");
     }
+
+    // Route error (display)
+    else if (packet.header.getType() == TYPE_ROUTE_ERROR) {
+      _processRouteError(packet, packetLen);
+    }
+
+    // Profile change confirmation (display)
+    else if (packet.header.getType() == TYPE_SETPROFILE_RESP) {
+
+      if (packetLen < sizeof(Header) + sizeof(SetProfileRespPayload)) {
+        logger.println(msg_bad_message);
+        return;
+      }
+
+      SetProfileRespPayload payload;
+      memcpy((void*)&payload, packet.payload, sizeof(SetProfileRespPayload));
+
+      logger.print(F("SETPROFILE_RESP: { \"node\": "));
+      logger.print(packet.header.getOriginalSourceAddr());
+      logger.print(F(", \"changeId\": "));
+      logger.print(payload.changeId);
+      logger.print(F(", \"delaySeconds\": "));
+      logger.print(payload.delaySeconds);
+      logger.println(" }");
+    }
     else {
       logger.println(F("ERR: Unknown message"));
     }
   }
 }
 
+void MessageProcessor::_sendRouteError(const Header& failedHeader, 
+    nodeaddr_t failedHopAddr) {
+
+    const nodeaddr_t unreachableAddr = failedHeader.getFinalDestAddr();
+    const nodeaddr_t originatorAddr = failedHeader.getOriginalSourceAddr();
+
+    // Errors are never generated for errors. This avoids 
+    // storms when things are broken in both directions.
+    if (failedHeader.getType() == TYPE_ROUTE_ERROR) {
+        return;
+    }
+
+    // Stop using the route ourselves
+    _routingTable.invalidateRoute(unreachableAddr, _clock.time());
+
+    // If we originated the message then there is nobody else to tell
+    if (originatorAddr == _config.getAddr()) {
+        logger.print(F("ERR: Route to "));
+        logger.print(unreachableAddr);
+        logger.print(F(" failed at "));
+        logger.println(failedHopAddr);
+        return;
+    }
+
+    const nodeaddr_t firstHop = _routingTable.nextHop(originatorAddr);
+    if (firstHop == RoutingTable::NO_ROUTE) {
+        logger.println(msg_no_route);
+        return;
+    }
+
+    Packet error;
+    error.header.setType(TYPE_ROUTE_ERROR);
+    error.header.setId(getUniqueId());
+    error.header.setSourceAddr(_config.getAddr());
+    error.header.setDestAddr(firstHop);
+    error.header.setOriginalSourceAddr(_config.getAddr());
+    error.header.setFinalDestAddr(originatorAddr);
+    error.header.setTtl(_routingTable.getInitialTtl(originatorAddr));
+    error.header.setSourceCall(_config.getCall());
+    error.header.setOriginalSourceCall(_config.getCall());
+    error.header.setFinalDestCall(failedHeader.getOriginalSourceCall());
+    
+    RouteErrorPayload payload;
+    payload.unreachableAddr = unreachableAddr;
+    payload.failedHopAddr = failedHopAddr;
+    memcpy(error.payload, (const void*)&payload, sizeof(payload));
+
+    bool good = transmitIfPossible(error, sizeof(Header) + sizeof(payload));
+    if (!good) {
+        logger.println("ERR: Full, no route error");
+    } else {
+        _routeErrorCounter++;
+    }
+}
+
+void MessageProcessor::_processRouteError(const Packet& packet, 
+    unsigned int packetLen) {
+
+    if (packetLen < sizeof(Header) + sizeof(RouteErrorPayload)) {
+        logger.println(msg_bad_message);
+        return;
+    }
+
+    RouteErrorPayload payload;
+    memcpy((void*)&payload, packet.payload, sizeof(RouteErrorPayload));
+
+    // The originator always stops using the route.  Stations along 
+    // the way only stop if their route goes through the station that 
+    // passed the error back to us (i.e. they are on the broken path).
+    if (packet.header.getFinalDestAddr() == _config.getAddr()) {
+        _routingTable.invalidateRoute(payload.unreachableAddr, _clock.time());
+        logger.print(F("ROUTE_ERROR: { "));
+        logger.print(F("\"origSourceAddr\": ")); 
+        logger.print(packet.header.getOriginalSourceAddr());
+        logger.print(F(", \"unreachableAddr\": "));
+        logger.print(payload.unreachableAddr);
+        logger.print(F(", \"failedHopAddr\": ")); 
+        logger.print(payload.failedHopAddr);
+        logger.println(" }");
+    } else {
+        const nodeaddr_t hop = _routingTable.nextHop(payload.unreachableAddr);
+        if (hop == packet.header.getSourceAddr() || 
+            hop == payload.failedHopAddr) {
+            _routingTable.invalidateRoute(payload.unreachableAddr, _clock.time());
+        }
+    }
+}
+
+void MessageProcessor::_sendProbeIfNecessary() {
+
+    const uint16_t intervalSeconds = _config.getProbeInterval();
+    if (intervalSeconds == 0 || 
+        (int32_t)(_clock.time() - _nextProbeTime) < 0) {
+        return;
+    }
+
+    // The next probe is jittered by +/- 25% so that neighbors that 
+    // start at the same time don't keep colliding.
+    const uint32_t intervalMs = (uint32_t)intervalSeconds * 1000;
+    _nextProbeTime = _clock.time() + intervalMs - (intervalMs / 4) + 
+        random(0, intervalMs / 2);
+
+    Packet probe;
+    probe.header.setType(TYPE_LINK_PROBE);
+    probe.header.setId(getUniqueId());
+    probe.header.setSourceAddr(_config.getAddr());
+    probe.header.setDestAddr(BROADCAST_ADDR);
+    probe.header.setOriginalSourceAddr(_config.getAddr());
+    probe.header.setFinalDestAddr(BROADCAST_ADDR);
+    probe.header.setSourceCall(_config.getCall());
+    probe.header.setOriginalSourceCall(_config.getCall());
+
+    // Tell the neighbors how many of their probes we are hearing
+    LinkProbePayload payload;
+    payload.seq = _probeSeq++;
+    payload.intervalSeconds = intervalSeconds;
+    payload.count = 0;
+    payload.listenSf = _instrumentation.getListenSf() | 
+        (_instrumentation.getNextListenSf() << 4);
+    payload.wakeIntervalMs = _instrumentation.getLplInterval();
+    for (unsigned int i = 0; i < NeighborTable::SIZE && 
+        payload.count < MAX_PROBE_ENTRIES; i++) {
+        const NeighborEntry& entry = _neighborTable.getSlot(i);
+        float ratio = entry.isValid() ? _neighborTable.getReverseRatio(entry) : -1;
+        if (ratio < 0)
+            continue;
+        ProbeEntry& probeEntry = payload.entries[payload.count++];
+        probeEntry.addr = entry.addr;
+        probeEntry.rxRatio = ratio * 255.0;
+        probeEntry.snr = _neighborTable.getReportSnr(entry);
+    }
+
+    // Only the populated part of the payload is sent
+    unsigned int payloadLen = offsetof(LinkProbePayload, entries) + 
+        (payload.count * sizeof(ProbeEntry));
+    memcpy(probe.payload, (const void*)&payload, payloadLen);
+
+    bool good = transmitIfPossible(probe, sizeof(Header) + payloadLen);
+    if (!good) {
+        logger.println("ERR: Full, no probe");
+    }
+}
+
+void MessageProcessor::_sendTimeSyncIfNecessary() {
+
+    if (_networkClock == 0) {
+        return;
+    }
+    if ((int32_t)(_clock.time() - _nextTimeSyncTime) < 0) {
+        return;
+    }
+
+    // Jittered by +/- 25% like the probes
+    _nextTimeSyncTime = _clock.time() + TIME_SYNC_INTERVAL_MS - 
+        (TIME_SYNC_INTERVAL_MS / 4) + random(0, TIME_SYNC_INTERVAL_MS / 2);
+
+    // Only stations that are in step with the root pass the time on
+    if (!_networkClock->isSynced()) {
+        return;
+    }
+
+    Packet beacon;
+    beacon.header.setType(TYPE_TIME_SYNC);
+    beacon.header.setId(getUniqueId());
+    beacon.header.setSourceAddr(_config.getAddr());
+    beacon.header.setDestAddr(BROADCAST_ADDR);
+    beacon.header.setOriginalSourceAddr(_config.getAddr());
+    beacon.header.setFinalDestAddr(BROADCAST_ADDR);
+    beacon.header.setSourceCall(_config.getCall());
+    beacon.header.setOriginalSourceCall(_config.getCall());
+
+    // The radio driver puts the exact time in when the beacon is sent.
+    // This is only a placeholder.
+    const uint64_t networkUs = _networkClock->getNetworkUs();
+    TimeSyncPayload payload;
+    payload.txSeconds = networkUs / 1000000ULL;
+    payload.txMicros = networkUs % 1000000ULL;
+    payload.rootAddr = _networkClock->getRoot();
+    payload.level = _networkClock->getLevel();
+    payload.unused = 0;
+    memcpy(beacon.payload, (const void*)&payload, sizeof(payload));
+
+    bool good = transmitIfPossible(beacon, sizeof(Header) + sizeof(payload));
+    if (!good) {
+        logger.println("ERR: Full, no time sync");
+    }
+}
+
+void MessageProcessor::_processTimeSync(const RxMetadata& rxMeta, 
+    const Packet& packet, unsigned int packetLen) {
+
+    if (packetLen < sizeof(Header) + sizeof(TimeSyncPayload)) {
+        _badRxPacketCounter++;
+        logger.println(msg_bad_message);
+        return;
+    }
+    if (_networkClock == 0) {
+        return;
+    }
+
+    TimeSyncPayload payload;
+    memcpy(&payload, packet.payload, sizeof(payload));
+    const uint64_t networkUs = (uint64_t)payload.txSeconds * 1000000ULL + 
+        payload.txMicros;
+    // The beacon was stamped at the start of the transmission and the
+    // receive time is the end
+    const uint32_t txStartUs = rxMeta.rxTimeUs - rxMeta.airtimeUs;
+    _networkClock->processBeacon(packet.header.getSourceAddr(), 
+        payload.rootAddr, payload.level, txStartUs, networkUs);
+}
+
+void MessageProcessor::_processProbe(const Packet& packet, unsigned int packetLen) {
+
+    if (packetLen < sizeof(Header) + offsetof(LinkProbePayload, entries)) {
+        _badRxPacketCounter++;
+        logger.println(msg_bad_message);
+        return;
+    }
+
+    // Anything past the largest possible probe is ignored
+    LinkProbePayload payload;
+    unsigned int payloadLen = packetLen - sizeof(Header);
+    if (payloadLen > sizeof(payload))
+        payloadLen = sizeof(payload);
+    memcpy((void*)&payload, packet.payload, payloadLen);
+    if (payload.count > MAX_PROBE_ENTRIES ||
+        packetLen < sizeof(Header) + offsetof(LinkProbePayload, entries) + 
+            (payload.count * sizeof(ProbeEntry))) {
+        _badRxPacketCounter++;
+        logger.println(msg_bad_message);
+        return;
+    }
+
+    const nodeaddr_t neighbor = packet.header.getSourceAddr();
+    _neighborTable.processProbe(neighbor, payload.seq, payload.intervalSeconds);
+    // A planned move happens at the end of the next rendezvous window,
+    // which can only be found with the network time
+    uint8_t nextSf = payload.listenSf >> 4;
+    uint32_t switchDelayMs = 0;
+    if (_networkClock && _networkClock->isSynced()) {
+        switchDelayMs = NeighborTable::getRendezvousEndMs(
+            _networkClock->getNetworkUs());
+    } else {
+        nextSf = 0;
+    }
+    _neighborTable.processListenSf(neighbor, payload.listenSf & 0x0f, 
+        nextSf, switchDelayMs);
+    _neighborTable.processWakeInterval(neighbor, payload.wakeIntervalMs);
+
+    // Look for the neighbor's report on our own probes
+    for (unsigned int i = 0; i < payload.count; i++) {
+        if (payload.entries[i].addr == _config.getAddr()) {
+            _neighborTable.processForwardRatio(neighbor, 
+                (float)payload.entries[i].rxRatio / 255.0);
+            // The ACKs give better reports (they are about frames that were
+            // sent at the current power) so the probe is only used without them
+            const NeighborEntry* entry = _neighborTable.get(neighbor);
+            if (entry != 0 && !entry->fwdValid) {
+                _neighborTable.processLinkReport(neighbor, payload.entries[i].snr);
+            }
+            return;
+        }
+    }
+
+    // If we are probing and the neighbor doesn't mention us then 
+    // it isn't hearing our probes.
+    if (_config.getProbeInterval() != 0) {
+        _neighborTable.processForwardRatio(neighbor, 0);
+    }
+}
+
+bool MessageProcessor::sendProfileChange(const RadioProfile& profile, 
+    uint16_t delaySeconds, uint16_t fallbackSeconds, uint32_t passcode) {
+
+    Packet packet;
+    packet.header.setType(TYPE_SETPROFILE_REQ);
+    packet.header.setId(getUniqueId());
+    packet.header.setSourceAddr(_config.getAddr());
+    packet.header.setDestAddr(BROADCAST_ADDR);
+    packet.header.setOriginalSourceAddr(_config.getAddr());
+    packet.header.setFinalDestAddr(BROADCAST_ADDR);
+    packet.header.setSourceCall(_config.getCall());
+    packet.header.setOriginalSourceCall(_config.getCall());
+
+    SetProfileReqPayload payload;
+    payload.passcode = passcode;
+    payload.changeId = packet.header.getId();
+    payload.delaySeconds = delaySeconds;
+    payload.fallbackSeconds = fallbackSeconds;
+    payload.UNUSED0 = 0;
+    payload.profile = profile;
+    payload.changeSeconds = 0;
+    if (_networkClock && _networkClock->isSynced()) {
+        payload.changeSeconds = _networkClock->getNetworkSeconds() + delaySeconds;
+    }
+    memcpy(packet.payload, (const void*)&payload, sizeof(payload));
+
+    if (!transmitIfPossible(packet, sizeof(Header) + sizeof(payload))) {
+        return false;
+    }
+
+    // This station changes along with everyone else
+    _scheduleProfileChange(_config.getAddr(), payload);
+    return true;
+}
+
+void MessageProcessor::_processProfileChange(const Packet& packet, 
+    unsigned int packetLen) {
+
+    if (packetLen < sizeof(Header) + sizeof(SetProfileReqPayload)) {
+        _badRxPacketCounter++;
+        logger.println(msg_bad_message);
+        return;
+    }
+
+    SetProfileReqPayload payload;
+    memcpy((void*)&payload, packet.payload, sizeof(SetProfileReqPayload));
+
+    // Each station acts on a change (and passes it on) only once
+    const nodeaddr_t origin = packet.header.getOriginalSourceAddr();
+    if (origin == _config.getAddr() ||
+        (origin == _profileChangeOrigin && payload.changeId == _profileChangeId)) {
+        return;
+    }
+
+    // Authorization check
+    if (!_config.checkPasscode(payload.passcode)) {
+        logger.println(msg_no_auth);
+        return;
+    }
+    if (!payload.profile.isValid()) {
+        _badRxPacketCounter++;
+        logger.println(msg_bad_message);
+        return;
+    }
+
+    _scheduleProfileChange(origin, payload);
+
+    // Pass it on to everyone else
+    if (packet.header.getTtl() > 1) {
+        Packet outPacket(packet);
+        outPacket.header.setId(getUniqueId()); 
+        outPacket.header.setSourceAddr(_config.getAddr());
+        outPacket.header.setSourceCall(_config.getCall());
+        outPacket.header.setTtl(packet.header.getTtl() - 1);
+        outPacket.header.setHopCount(packet.header.getHopCount() + 1);
+        memcpy(outPacket.payload, (const void*)&payload, sizeof(payload));
+        if (!transmitIfPossible(outPacket, sizeof(Header) + sizeof(payload))) {
+            logger.println("ERR: Full, no forward");
+        }
+    }
+
+    // Let the originator know that the change will happen here 
+    const nodeaddr_t firstHop = _routingTable.nextHop(origin);
+    if (firstHop == RoutingTable::NO_ROUTE) {
+        _badRouteCounter++;  
+        logger.print("ERR: No route to ");
+        logger.print(origin);
+        logger.println();
+        return;
+    }
+    Packet resp;
+    resp.header.setupResponseFor(packet.header, _config, 
+        TYPE_SETPROFILE_RESP, getUniqueId(), firstHop);
+    resp.header.setTtl(_routingTable.getInitialTtl(origin));
+    SetProfileRespPayload respPayload;
+    respPayload.changeId = payload.changeId;
+    respPayload.delaySeconds = (_profileChangeTime - _clock.time()) / 1000;
+    memcpy(resp.payload, (const void*)&respPayload, sizeof(respPayload));
+    if (!transmitIfPossible(resp, sizeof(Header) + sizeof(respPayload))) {
+        logger.println("ERR: Full, no resp");
+    }
+}
+
+void MessageProcessor::_scheduleProfileChange(nodeaddr_t origin, 
+    const SetProfileReqPayload& payload) {
+    _profileChangeOrigin = origin;
+    _profileChangeId = payload.changeId;
+    _newProfile = payload.profile;
+    // With the network time every station changes at the same moment, 
+    // however long the request took to get here.  The change is never 
+    // later than the delay after the request is heard.
+    uint32_t delayMs = (uint32_t)payload.delaySeconds * 1000;
+    if (payload.changeSeconds != 0 && _networkClock && _networkClock->isSynced()) {
+        const uint64_t changeUs = (uint64_t)payload.changeSeconds * 1000000ULL;
+        const uint64_t networkUs = _networkClock->getNetworkUs();
+        const uint64_t remainingMs = (changeUs > networkUs) ? 
+            (changeUs - networkUs) / 1000ULL : 0;
+        if (remainingMs < delayMs) 
+            delayMs = remainingMs;
+    }
+    _profileChangeTime = _clock.time() + delayMs;
+    _profileFallbackMs = (uint32_t)payload.fallbackSeconds * 1000;
+    _profileChangeState = PROFILE_SCHEDULED;
+    logger.print(F("INF: Profile change in "));
+    logger.print(delayMs / 1000);
+    logger.println();
+}
+
+/**
+ * The new profile isn't saved until something is heard on it, so a 
+ * station that ends up alone on the new profile (or that reboots) goes
+ * back to the old one.
+ */
+void MessageProcessor::_checkProfileChange() {
+
+    const uint32_t now = _clock.time();
+
+    if (_profileChangeState == PROFILE_SCHEDULED &&
+        (int32_t)(now - _profileChangeTime) >= 0) {
+        _oldProfile = _config.getRadioProfiles().getActive();
+        _instrumentation.setRadioProfile(_newProfile);
+        _profileChangeState = PROFILE_TRIAL;
+        _profileChangeUs = _clock.timeUs();
+        _profileHeard = false;
+        logger.println(F("INF: Profile changed"));
+        if (_profileFallbackMs == 0) {
+            _commitProfile(_newProfile);
+        }
+    }
+    else if (_profileChangeState == PROFILE_TRIAL) {
+        if (_profileHeard) {
+            _commitProfile(_newProfile);
+        } 
+        else if (now - _profileChangeTime > _profileFallbackMs) {
+            logger.println(F("WRN: Nothing heard, profile change undone"));
+            _instrumentation.setRadioProfile(_oldProfile);
+            _profileFallbackCounter++;
+            _profileChangeState = PROFILE_IDLE;
+        }
+    }
+}
+
+/**
+ * The frame is stamped when it arrives, which may be a while before it 
+ * is processed, so a frame that was already on the air when the profile
+ * changed doesn't count.  The spreading factor isn't compared because 
+ * the adaptive data rate may have the receiver on a different one.
+ */
+bool MessageProcessor::_isOnNewProfile(const RxMetadata& rxMeta) const {
+    // Frames that didn't come from the radio say nothing about the link
+    if (rxMeta.sf == 0)
+        return false;
+    if (rxMeta.bw != _newProfile.bw || rxMeta.cr != _newProfile.cr)
+        return false;
+    const uint32_t startUs = rxMeta.rxTimeUs - rxMeta.airtimeUs;
+    return (int32_t)(startUs - _profileChangeUs) >= 0;
+}
+
+/**
+ * Makes the profile the active one in the configuration.  A profile 
+ * in the table with the same name is replaced, otherwise the active 
+ * slot is replaced.
+ */
+void MessageProcessor::_commitProfile(const RadioProfile& profile) {
+    RadioProfileTable t = _config.getRadioProfiles();
+    int i = -1;
+    for (unsigned int j = 0; j < RADIO_PROFILE_COUNT; j++) {
+        if (t.profiles[j].isNamed(profile.name))
+            i = j;
+    }
+    if (i >= 0) 
+        t.active = i;
+    t.profiles[t.active] = profile;
+    _config.setRadioProfiles(t);
+    _profileChangeState = PROFILE_IDLE;
+}
+
 uint16_t MessageProcessor::getPendingCount() const {
     return _opm.getPendingCount();
 }
@@ -502,10 +1245,25 @@ uint16_t MessageProcessor::getBadRxPacketCounter() const {
     return _badRxPacketCounter;
 }
 
+uint16_t MessageProcessor::getTtlDropCounter() const {
+    return _ttlDropCounter;
+}
+
+uint16_t MessageProcessor::getRouteErrorCounter() const {
+    return _routeErrorCounter;
+}
+
+uint16_t MessageProcessor::getFailoverCounter() const {
+    return _opm.getFailoverCounter();
+}
+
 void MessageProcessor::resetCounters() {
     _rxPacketCounter = 0;
     _badRxPacketCounter = 0;
     _badRouteCounter = 0;
+    _ttlDropCounter = 0;
+    _routeErrorCounter = 0;
+    _opm.resetCounters();
 }
 
 uint32_t MessageProcessor::getSecondsSinceLastRx() const {
@@ -26,8 +26,14 @@
 #include "Clock.h"
 #include "Instrumentation.h"
 #include "RoutingTable.h"
+#include "NeighborTable.h"
+#include "RxMetadata.h"
+#include "NetworkClock.h"
+#include "SleepSchedule.h"
 
 #define REPORT_TTL_MS 30 * 1000
+// How long a route stays out of service after a route error
+#define ROUTE_HOLD_DOWN_MS (60 * 1000)
 
 struct PacketReport {
 
@@ -66,8 +72,8 @@ class MessageProcessor {
 public:
 
     MessageProcessor(Clock& clock, CircularBuffer& rxBuffer, CircularBuffer& txBuffer,
-        RoutingTable& routingTable, Instrumentation& instrumentation,
-        Configuration& config,
+        RoutingTable& routingTable, NeighborTable& neighborTable, 
+        Instrumentation& instrumentation, Configuration& config,
         uint32_t txTimeoutMs, uint32_t txRetryMs);
 
     /**
@@ -99,8 +105,33 @@ public:
      */
     uint16_t getPendingCount() const;
 
+    /**
+     * @brief Lets the channel access policy know about missed and 
+     * received ACKs.
+     */
+    void setChannelAccess(ChannelAccess* channelAccess);
+
+    /**
+     * @brief Turns on the network time synchronization.  The clock 
+     * takes its time from the time sync beacons that are heard, and 
+     * once it has the time this station sends its own beacons.  pump()
+     * calls the clock's tick().
+     */
+    void setNetworkClock(NetworkClock* networkClock);
+
+    /**
+     * @brief Turns on the coordinated sleep.  Outbound traffic (other 
+     * than ACKs) is held in the outbound queue until the schedule 
+     * allows it, and the schedule is told about traffic so that the 
+     * station stays awake while the network is busy.
+     */
+    void setSleepSchedule(SleepSchedule* sleepSchedule);
+
     uint16_t getBadRxPacketCounter() const;
     uint16_t getBadRouteCounter() const;
+    uint16_t getFailoverCounter() const;
+    uint16_t getTtlDropCounter() const;
+    uint16_t getRouteErrorCounter() const;
 
     /**
      * @brief Resets all diagnostic counters
@@ -109,24 +140,104 @@ public:
 
     uint32_t getSecondsSinceLastRx() const;
 
+    /**
+     * @brief Starts a radio profile change across the whole network.  
+     * The request is flooded to every station, each of which makes the
+     * change after the delay and confirms back to this station.  When 
+     * this station has the network time the request also carries the 
+     * network time of the change, so the stations that have it too 
+     * all change together.
+     * 
+     * @param passcode Must match the passcode of the other stations.
+     * @param fallbackSeconds If nothing is heard this long after the 
+     *   change then the station goes back to the previous profile.
+     * @return false if the request couldn't be queued.
+     */
+    bool sendProfileChange(const RadioProfile& profile, uint16_t delaySeconds,
+        uint16_t fallbackSeconds, uint32_t passcode);
+
+    /**
+     * @brief Number of profile changes that were undone because 
+     * nothing was heard on the new profile.
+     */
+    uint16_t getProfileFallbackCounter() const { return _profileFallbackCounter; }
+
 private:
 
-    void _process(int16_t rssi, const Packet& packet, unsigned int packetLen);
+    void _process(const RxMetadata& rxMeta, const Packet& packet, unsigned int packetLen);
+
+    /**
+     * @brief Sends a link probe if the probe interval has elapsed.
+     */
+    void _sendProbeIfNecessary();
+    void _processProbe(const Packet& packet, unsigned int packetLen);
+
+    /**
+     * @brief Sends a time sync beacon if this station has the network
+     * time and the beacon interval has elapsed.
+     */
+    void _sendTimeSyncIfNecessary();
+    void _processTimeSync(const RxMetadata& rxMeta, const Packet& packet, 
+        unsigned int packetLen);
+
+    /**
+     * @brief Sends a route error back to the originator of a message 
+     * that could not be delivered.
+     * 
+     * @param failedHeader The header of the message that failed.
+     * @param failedHopAddr The hop that stopped acknowledging, or this 
+     *   station if there was no route.
+     */
+    void _sendRouteError(const Header& failedHeader, nodeaddr_t failedHopAddr);
+    void _processRouteError(const Packet& packet, unsigned int packetLen);
+
+    void _processProfileChange(const Packet& packet, unsigned int packetLen);
+    void _scheduleProfileChange(nodeaddr_t origin, 
+        const SetProfileReqPayload& payload);
+    void _checkProfileChange();
+    bool _isOnNewProfile(const RxMetadata& rxMeta) const;
+    void _commitProfile(const RadioProfile& profile);
 
     Configuration& _config;
     const Clock& _clock;
     CircularBuffer& _rxBuffer;
     CircularBuffer& _txBuffer;
     RoutingTable& _routingTable;
+    NeighborTable& _neighborTable;
     Instrumentation& _instrumentation;    
     OutboundPacketManager _opm;
     unsigned int _idCounter;
     uint32_t _startTime;
     uint32_t _lastRxTime;
+    // Link probe management
+    uint16_t _probeSeq;
+    uint32_t _nextProbeTime;
+    // Network time synchronization (0 if not in use)
+    NetworkClock* _networkClock;
+    uint32_t _nextTimeSyncTime;
+    // Coordinated sleep (0 if not in use)
+    SleepSchedule* _sleepSchedule;
+    // Network-wide profile change.  A change is scheduled, then tried 
+    // out until something is heard on the new profile, then saved.
+    enum ProfileChangeState { PROFILE_IDLE, PROFILE_SCHEDULED, PROFILE_TRIAL };
+    ProfileChangeState _profileChangeState;
+    nodeaddr_t _profileChangeOrigin;
+    uint16_t _profileChangeId;
+    RadioProfile _newProfile;
+    RadioProfile _oldProfile;
+    uint32_t _profileChangeTime;
+    // The microsecond clock when the new profile was put into use, and
+    // whether a frame sent on it has been heard since
+    uint32_t _profileChangeUs;
+    bool _profileHeard;
+    uint32_t _profileFallbackMs;
+    uint16_t _profileFallbackCounter;
     // Diagnostic counters
     uint16_t _rxPacketCounter;
     uint16_t _badRxPacketCounter;
     uint16_t _badRouteCounter;
+    uint16_t _ttlDropCounter;
+    uint16_t _routeErrorCounter;
     
     // Used for tracking packets to supress duplicates.  The more slots we allocate
     // the better we will be at eliminating duplicates.
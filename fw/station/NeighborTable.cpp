@@ -0,0 +1,431 @@
+/* 
+ * LoRa Birdhouse Mesh Network Project
+ * Wellesley Amateur Radio Society
+ * 
+ * Copyright (C) 2022 Bruce MacKinnon
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "NeighborTable.h"
+
+// The smoothing factors used for the EWMA calculations.  Smaller
+// numbers give more weight to the history.
+#define SIGNAL_ALPHA 0.125
+#define DELIVERY_ALPHA 0.125
+
+// The number of probe sequence numbers that are considered when 
+// computing the probe delivery ratio
+#define PROBE_WINDOW 16
+
+const float NeighborTable::MAX_ETX = 99.0;
+const float NeighborTable::SF_TARGET_RATIO = 0.9;
+
+static unsigned int countBits(uint16_t bits) {
+    unsigned int r = 0;
+    for (; bits != 0; bits >>= 1)
+        r += (bits & 1);
+    return r;
+}
+
+NeighborTable::NeighborTable(const Clock& clock) 
+:   _clock(clock) {
+}
+
+void NeighborTable::processRx(nodeaddr_t addr, int16_t rssi, int16_t snr) {
+    NeighborEntry* entry = _findOrAllocate(addr);
+    if (entry == 0) 
+        return;
+    // The first time we hear a neighbor the averages are seeded 
+    // with the first sample.
+    if (entry->rxCount == 0) {
+        entry->rssi = rssi;
+        entry->snr = snr;
+    } else {
+        entry->rssi += SIGNAL_ALPHA * ((float)rssi - entry->rssi);
+        entry->snr += SIGNAL_ALPHA * ((float)snr - entry->snr);
+    }
+    entry->rxCount++;
+    entry->lastHeardTime = _clock.time();
+}
+
+void NeighborTable::processUnicastRx(nodeaddr_t addr, int16_t snr) {
+    NeighborEntry* entry = _findOrAllocate(addr);
+    if (entry == 0) 
+        return;
+    if (!entry->unicastSnrValid) {
+        entry->unicastSnr = snr;
+        entry->unicastSnrValid = true;
+    } else {
+        entry->unicastSnr += SIGNAL_ALPHA * ((float)snr - entry->unicastSnr);
+    }
+}
+
+/**
+ * The power is brought down a little at a time (the reports are 
+ * smoothed, so they lag) and brought back up right away when the 
+ * margin is gone.
+ */
+void NeighborTable::processLinkReport(nodeaddr_t addr, int16_t snr) {
+    NeighborEntry* entry = _findOrAllocate(addr);
+    if (entry == 0 || snr == NO_SNR) 
+        return;
+    // If we don't know the neighbor's spreading factor then the least
+    // sensitive one is assumed
+    const uint8_t listenSf = _getCurrentListenSf(*entry);
+    const uint8_t sf = (listenSf < MIN_SF) ? MIN_SF : listenSf;
+    const float targetDb = -7.5 - 2.5 * (sf - 7) + TPC_MARGIN_DB;
+    const float excessDb = (float)snr - targetDb;
+    if (excessDb >= TPC_STEP_DOWN_DB && 
+        entry->txPowerReductionDb + TPC_STEP_DOWN_DB <= TPC_MAX_REDUCTION_DB) {
+        entry->txPowerReductionDb += TPC_STEP_DOWN_DB;
+    } else if (excessDb < 0) {
+        const uint8_t up = (uint8_t)(0.999 - excessDb);
+        entry->txPowerReductionDb -= (up < entry->txPowerReductionDb) ? 
+            up : entry->txPowerReductionDb;
+    }
+}
+
+void NeighborTable::processAckFeedback(nodeaddr_t addr, int16_t rssi, 
+    int16_t snr, int16_t freqErrorHz) {
+    NeighborEntry* entry = _findOrAllocate(addr);
+    if (entry == 0) 
+        return;
+    if (!entry->fwdValid) {
+        entry->fwdRssi = rssi;
+        entry->fwdSnr = snr;
+        entry->fwdValid = true;
+    } else {
+        entry->fwdRssi += SIGNAL_ALPHA * ((float)rssi - entry->fwdRssi);
+        entry->fwdSnr += SIGNAL_ALPHA * ((float)snr - entry->fwdSnr);
+    }
+    entry->fwdFreqErrorHz = freqErrorHz;
+    // Each ACK reports on a frame that was sent at the current power
+    processLinkReport(addr, snr);
+}
+
+void NeighborTable::processAck(nodeaddr_t addr) {
+    NeighborEntry* entry = _findOrAllocate(addr);
+    if (entry == 0) 
+        return;
+    entry->txCount++;
+    entry->ackCount++;
+    entry->consecutiveFailures = 0;
+    entry->deliveryRatio += DELIVERY_ALPHA * (1.0 - entry->deliveryRatio);
+    // An ACK means that we heard the neighbor
+    entry->lastHeardTime = _clock.time();
+}
+
+void NeighborTable::processTxFailure(nodeaddr_t addr) {
+    NeighborEntry* entry = _findOrAllocate(addr);
+    if (entry == 0) 
+        return;
+    entry->txCount++;
+    entry->consecutiveFailures++;
+    entry->deliveryRatio += DELIVERY_ALPHA * (0.0 - entry->deliveryRatio);
+    // Losses bring the power back up
+    entry->txPowerReductionDb -= (TPC_STEP_UP_DB < entry->txPowerReductionDb) ? 
+        TPC_STEP_UP_DB : entry->txPowerReductionDb;
+}
+
+void NeighborTable::processProbe(nodeaddr_t addr, uint16_t seq, 
+    uint16_t intervalSeconds) {
+    NeighborEntry* entry = _findOrAllocate(addr);
+    if (entry == 0) 
+        return;
+    // The gap since the last probe tells us how many were missed.  A 
+    // large (or backwards) gap means the neighbor restarted, so
+    // we start over.
+    uint16_t gap = seq - entry->lastProbeSeq;
+    if (entry->probeWindow == 0 || gap >= PROBE_WINDOW) {
+        entry->probeBits = 1;
+        entry->probeWindow = 1;
+    } else if (gap > 0) {
+        entry->probeBits = (entry->probeBits << gap) | 1;
+        entry->probeWindow += gap;
+        if (entry->probeWindow > PROBE_WINDOW)
+            entry->probeWindow = PROBE_WINDOW;
+    }
+    entry->lastProbeSeq = seq;
+    entry->probeIntervalSeconds = intervalSeconds;
+    entry->lastProbeTime = _clock.time();
+}
+
+void NeighborTable::processForwardRatio(nodeaddr_t addr, float ratio) {
+    NeighborEntry* entry = _findOrAllocate(addr);
+    if (entry == 0) 
+        return;
+    entry->forwardRatio = ratio;
+    entry->forwardRatioValid = true;
+}
+
+void NeighborTable::processListenSf(nodeaddr_t addr, uint8_t sf, 
+    uint8_t nextSf, uint32_t switchDelayMs) {
+    NeighborEntry* entry = _findOrAllocate(addr);
+    if (entry == 0) 
+        return;
+    entry->listenSf = sf;
+    entry->nextListenSf = nextSf;
+    entry->listenSfSwitchTime = _clock.time() + switchDelayMs;
+}
+
+void NeighborTable::processWakeInterval(nodeaddr_t addr, uint16_t ms) {
+    NeighborEntry* entry = _findOrAllocate(addr);
+    if (entry == 0) 
+        return;
+    entry->wakeIntervalMs = ms;
+}
+
+/**
+ * The SNR of a frame doesn't depend on the spreading factor.  The 
+ * demodulation limit is -7.5dB at SF7 and drops by 2.5dB for each 
+ * step up (see the SX1276 datasheet, table 13).
+ */
+uint8_t NeighborTable::getRequiredSf(const NeighborEntry& entry, 
+    uint8_t baseSf, int8_t marginDb) const {
+    if (entry.rxCount == 0 || getReverseRatio(entry) < SF_TARGET_RATIO) 
+        return baseSf;
+    for (uint8_t sf = MIN_SF; sf < baseSf; sf++) {
+        const float limitDb = -7.5 - 2.5 * (sf - 7);
+        if (entry.snr >= limitDb + marginDb)
+            return sf;
+    }
+    return baseSf;
+}
+
+/**
+ * A neighbor that could be heard below currentSf only pulls the receiver
+ * down if it has the extra margin as well.  Otherwise it holds the 
+ * receiver where it is.
+ */
+uint8_t NeighborTable::getListenSf(uint8_t baseSf, uint8_t currentSf) const {
+    uint8_t result = 0;
+    for (unsigned int i = 0; i < SIZE; i++) {
+        if (!_table[i].isValid())
+            continue;
+        uint8_t sf = getRequiredSf(_table[i], baseSf);
+        if (sf < currentSf) {
+            sf = getRequiredSf(_table[i], baseSf, 
+                SF_MARGIN_DB + SF_HYSTERESIS_DB);
+            if (sf > currentSf)
+                sf = currentSf;
+        }
+        if (sf > result)
+            result = sf;
+    }
+    return (result == 0) ? baseSf : result;
+}
+
+bool NeighborTable::isRendezvous(uint64_t networkUs) {
+    return (networkUs / 1000ULL) % SF_RENDEZVOUS_INTERVAL_MS < 
+        SF_RENDEZVOUS_WINDOW_MS;
+}
+
+uint32_t NeighborTable::getRendezvousEndMs(uint64_t networkUs) {
+    const uint32_t offsetMs = (networkUs / 1000ULL) % SF_RENDEZVOUS_INTERVAL_MS;
+    if (offsetMs < SF_RENDEZVOUS_WINDOW_MS)
+        return SF_RENDEZVOUS_WINDOW_MS - offsetMs;
+    return SF_RENDEZVOUS_INTERVAL_MS - offsetMs + SF_RENDEZVOUS_WINDOW_MS;
+}
+
+uint8_t NeighborTable::getTxSf(nodeaddr_t addr, uint8_t baseSf) const {
+    const NeighborEntry* entry = get(addr);
+    if (entry == 0)
+        return baseSf;
+    const uint8_t listenSf = _getCurrentListenSf(*entry);
+    if (listenSf < MIN_SF || listenSf > baseSf)
+        return baseSf;
+    return listenSf;
+}
+
+uint16_t NeighborTable::getWakeIntervalMs(nodeaddr_t addr) const {
+    const NeighborEntry* entry = get(addr);
+    return (entry == 0) ? 0 : entry->wakeIntervalMs;
+}
+
+uint16_t NeighborTable::getMaxWakeIntervalMs() const {
+    uint16_t result = 0;
+    for (unsigned int i = 0; i < SIZE; i++) {
+        if (_table[i].isValid() && _table[i].wakeIntervalMs > result)
+            result = _table[i].wakeIntervalMs;
+    }
+    return result;
+}
+
+uint8_t NeighborTable::getTxPowerDbm(nodeaddr_t addr, uint8_t profileDbm) const {
+    const NeighborEntry* entry = get(addr);
+    if (entry == 0)
+        return profileDbm;
+    // 2dBm is the lowest setting of the PA_BOOST output
+    if (entry->txPowerReductionDb + 2 > profileDbm)
+        return 2;
+    return profileDbm - entry->txPowerReductionDb;
+}
+
+int8_t NeighborTable::getReportSnr(const NeighborEntry& entry) const {
+    if (!entry.unicastSnrValid)
+        return NO_SNR;
+    if (entry.unicastSnr > 127)
+        return 127;
+    if (entry.unicastSnr < -127)
+        return -127;
+    return (int8_t)entry.unicastSnr;
+}
+
+uint16_t NeighborTable::getBroadcastSfMask(uint8_t baseSf) const {
+    uint16_t mask = 1 << baseSf;
+    for (unsigned int i = 0; i < SIZE; i++) {
+        if (_table[i].isValid()) 
+            mask |= 1 << getTxSf(_table[i].addr, baseSf);
+    }
+    return mask;
+}
+
+float NeighborTable::getReverseRatio(const NeighborEntry& entry) const {
+
+    if (entry.probeWindow == 0) 
+        return -1;
+
+    uint16_t bits = entry.probeBits;
+    unsigned int window = entry.probeWindow;
+
+    // Account for the probes that should have arrived by now
+    if (entry.probeIntervalSeconds != 0) {
+        uint32_t missed = (_clock.time() - entry.lastProbeTime) / 
+            ((uint32_t)entry.probeIntervalSeconds * 1000);
+        if (missed >= PROBE_WINDOW) {
+            return 0;
+        }
+        bits <<= missed;
+        window += missed;
+        if (window > PROBE_WINDOW)
+            window = PROBE_WINDOW;
+    }
+
+    return (float)countBits(bits) / (float)window;
+}
+
+float NeighborTable::getEtx(nodeaddr_t addr) const {
+
+    const NeighborEntry* entry = get(addr);
+    if (entry == 0)
+        return MAX_ETX;
+
+    float d = 0;
+    if (isEtxMeasured(addr)) {
+        d = entry->forwardRatio * getReverseRatio(*entry);
+    } 
+    // An ACK needs a good link in both directions, so the ACK-based
+    // delivery ratio is a reasonable fallback.
+    else if (entry->txCount > 0) {
+        d = entry->deliveryRatio;
+    }
+
+    if (d <= 1.0 / MAX_ETX)
+        return MAX_ETX;
+    return 1.0 / d;
+}
+
+bool NeighborTable::isEtxMeasured(nodeaddr_t addr) const {
+    const NeighborEntry* entry = get(addr);
+    return entry != 0 && entry->forwardRatioValid && entry->probeWindow > 0;
+}
+
+const NeighborEntry* NeighborTable::get(nodeaddr_t addr) const {
+    for (unsigned int i = 0; i < SIZE; i++) 
+        if (_table[i].addr == addr) 
+            return &(_table[i]);
+    return 0;
+}
+
+const NeighborEntry& NeighborTable::getSlot(unsigned int i) const {
+    return _table[i];
+}
+
+uint32_t NeighborTable::getSecondsSinceHeard(const NeighborEntry& entry) const {
+    return (_clock.time() - entry.lastHeardTime) / 1000;
+}
+
+void NeighborTable::clear() {
+    for (unsigned int i = 0; i < SIZE; i++) 
+        _table[i].addr = 0;
+}
+
+NeighborEntry* NeighborTable::_find(nodeaddr_t addr) {
+    for (unsigned int i = 0; i < SIZE; i++) 
+        if (_table[i].addr == addr) 
+            return &(_table[i]);
+    return 0;
+}
+
+NeighborEntry* NeighborTable::_findOrAllocate(nodeaddr_t addr) {
+
+    // Nothing is tracked for the special addresses
+    if (addr == 0 || addr == 0xffff) 
+        return 0;
+
+    NeighborEntry* entry = _find(addr);
+    if (entry != 0)
+        return entry;
+
+    // Look for an empty slot, or the slot that has been quiet the longest
+    unsigned int victim = 0;
+    for (unsigned int i = 0; i < SIZE; i++) {
+        if (!_table[i].isValid()) {
+            victim = i;
+            break;
+        }
+        if ((_clock.time() - _table[i].lastHeardTime) > 
+            (_clock.time() - _table[victim].lastHeardTime)) {
+            victim = i;
+        }
+    }
+
+    entry = &(_table[victim]);
+    entry->addr = addr;
+    entry->rssi = 0;
+    entry->snr = 0;
+    // We start off optimistic about new neighbors
+    entry->deliveryRatio = 1.0;
+    entry->lastHeardTime = _clock.time();
+    entry->rxCount = 0;
+    entry->txCount = 0;
+    entry->ackCount = 0;
+    entry->consecutiveFailures = 0;
+    entry->lastProbeSeq = 0;
+    entry->probeBits = 0;
+    entry->probeWindow = 0;
+    entry->probeIntervalSeconds = 0;
+    entry->lastProbeTime = 0;
+    entry->forwardRatio = 0;
+    entry->forwardRatioValid = false;
+    entry->listenSf = 0;
+    entry->nextListenSf = 0;
+    entry->listenSfSwitchTime = 0;
+    entry->wakeIntervalMs = 0;
+    entry->unicastSnr = 0;
+    entry->unicastSnrValid = false;
+    entry->txPowerReductionDb = 0;
+    entry->fwdValid = false;
+    entry->fwdRssi = 0;
+    entry->fwdSnr = 0;
+    entry->fwdFreqErrorHz = 0;
+    return entry;
+}
+
+uint8_t NeighborTable::_getCurrentListenSf(const NeighborEntry& entry) const {
+    if (entry.nextListenSf != 0 && 
+        (int32_t)(_clock.time() - entry.listenSfSwitchTime) >= 0)
+        return entry.nextListenSf;
+    return entry.listenSf;
+}
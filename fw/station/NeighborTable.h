@@ -0,0 +1,352 @@
+/* 
+ * LoRa Birdhouse Mesh Network Project
+ * Wellesley Amateur Radio Society
+ * 
+ * Copyright (C) 2022 Bruce MacKinnon
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _NeighborTable_h
+#define _NeighborTable_h
+
+#include "Utils.h"
+#include "Clock.h"
+
+// When the adaptive data rate is being used every station goes back to 
+// the profile spreading factor for part of every interval so that 
+// stations that haven't been heard yet (and don't know what we are 
+// listening on) can be found.  The window is keyed to the network time
+// so that all of the stations are in it together, and changes to the 
+// listening spreading factor take effect at the end of a window.  The 
+// window should be longer than the probe interval so that every change
+// is announced in a probe that all of the neighbors can hear.
+#define SF_RENDEZVOUS_INTERVAL_MS (15UL * 60UL * 1000UL)
+#define SF_RENDEZVOUS_WINDOW_MS (2UL * 60UL * 1000UL)
+
+/**
+ * @brief Link quality information for one neighbor (i.e. a station
+ * that we can hear directly).
+ */
+struct NeighborEntry {
+
+    NeighborEntry() : addr(0) { }
+
+    bool isValid() const { return addr != 0; }
+
+    nodeaddr_t addr;
+    // Smoothed (EWMA) receive quality of frames heard from the neighbor
+    float rssi;
+    float snr;
+    // Smoothed fraction of our transmissions to this neighbor that 
+    // were acknowledged (0.0 to 1.0)
+    float deliveryRatio;
+    // When we last heard anything from the neighbor
+    uint32_t lastHeardTime;
+    // Raw counters
+    uint16_t rxCount;
+    uint16_t txCount;
+    uint16_t ackCount;
+    // The number of transmissions since the last ACK from this neighbor
+    uint16_t consecutiveFailures;
+
+    // ----- Probe-based link estimation -----
+    // Sequence number of the last probe heard from the neighbor
+    uint16_t lastProbeSeq;
+    // Bitmap of the probes heard from the neighbor. Bit 0 is the 
+    // most recent sequence number.
+    uint16_t probeBits;
+    // The number of sequence numbers covered by the bitmap (max 16)
+    uint8_t probeWindow;
+    // The neighbor's advertised probe interval
+    uint16_t probeIntervalSeconds;
+    // When we last heard a probe from the neighbor
+    uint32_t lastProbeTime;
+    // The fraction of our probes that the neighbor says it heard 
+    // (i.e. the forward delivery ratio).  
+    float forwardRatio;
+    bool forwardRatioValid;
+
+    // ----- Adaptive data rate -----
+    // The spreading factor that the neighbor says (in its probes) that
+    // it is listening on, or zero if not known
+    uint8_t listenSf;
+    // The spreading factor that the neighbor has announced it will move
+    // to (zero if none), and when that happens
+    uint8_t nextListenSf;
+    uint32_t listenSfSwitchTime;
+
+    // ----- Low power listening -----
+    // How often the neighbor says (in its probes) that it samples the 
+    // channel, or zero if it is always listening
+    uint16_t wakeIntervalMs;
+
+    // ----- Transmit power control -----
+    // Smoothed SNR of the frames that the neighbor addressed to us.  
+    // These are sent at the neighbor's per-link power, so this is 
+    // what we report back to the neighbor.
+    float unicastSnr;
+    bool unicastSnrValid;
+    // How far (in dB) below the profile power we transmit to the neighbor
+    uint8_t txPowerReductionDb;
+
+    // ----- ACK feedback -----
+    // Smoothed receive quality of our frames at the neighbor (the 
+    // forward direction), as reported in its ACKs
+    bool fwdValid;
+    float fwdRssi;
+    float fwdSnr;
+    // Our frequency error as last measured by the neighbor
+    int16_t fwdFreqErrorHz;
+};
+
+/**
+ * @brief Keeps track of the quality of the link to each neighbor.  The 
+ * table is fed from every received frame and from the outcome
+ * (ACK or no ACK) of every transmission that needed an acknowledgement.
+ * 
+ * The table has a fixed number of slots.  When the table is full the 
+ * neighbor that was heard least recently is replaced.
+ */
+class NeighborTable {
+public:
+
+    static const unsigned int SIZE = 16;
+    // Used to indicate an unusable link
+    static const float MAX_ETX;
+    // The lowest spreading factor that the adaptive data rate will use
+    static const uint8_t MIN_SF = 7;
+    // The SNR (in dB) that a link needs above the demodulation limit 
+    // of a spreading factor before that spreading factor is used
+    static const int8_t SF_MARGIN_DB = 6;
+    // The extra SNR (in dB) that every neighbor needs before the 
+    // receiver moves down from the spreading factor it is on
+    static const int8_t SF_HYSTERESIS_DB = 3;
+    // Links that are delivering less than this fraction of the 
+    // probes stay at the profile spreading factor
+    static const float SF_TARGET_RATIO;
+    // The SNR (in dB) above the demodulation limit that transmit power
+    // control aims for at the neighbor.  This is kept below 
+    // SF_MARGIN_DB + 2.5 so that a power reduction never lets the 
+    // neighbor's adaptive data rate drop to a lower spreading factor.
+    static const int8_t TPC_MARGIN_DB = 8;
+    // The largest single power reduction, and the increase after
+    // a transmission that wasn't acknowledged
+    static const uint8_t TPC_STEP_DOWN_DB = 2;
+    static const uint8_t TPC_STEP_UP_DB = 3;
+    // The PA_BOOST output can't go below 2dBm
+    static const uint8_t TPC_MAX_REDUCTION_DB = 18;
+    // Used in link reports when nothing has been measured
+    static const int8_t NO_SNR = -128;
+
+    NeighborTable(const Clock& clock);
+
+    /**
+     * @brief Called whenever a frame is received from a neighbor.
+     * 
+     * @param addr The address of the station that transmitted the frame.
+     * @param rssi In dBm
+     * @param snr In dB
+     */
+    void processRx(nodeaddr_t addr, int16_t rssi, int16_t snr);
+
+    /**
+     * @brief Called (in addition to processRx()) when a frame that was
+     * addressed to us is received from a neighbor.
+     */
+    void processUnicastRx(nodeaddr_t addr, int16_t snr);
+
+    /**
+     * @brief Called when a neighbor reports the SNR at which it is 
+     * hearing our transmissions.  The transmit power used for the 
+     * neighbor is adjusted to keep TPC_MARGIN_DB above the demodulation
+     * limit of the spreading factor the neighbor is listening on.
+     */
+    void processLinkReport(nodeaddr_t addr, int16_t snr);
+
+    /**
+     * @brief Called when an ACK from the neighbor tells us how well it
+     * received the frame that it is acknowledging.  This is also used 
+     * as a link report for the transmit power control.
+     */
+    void processAckFeedback(nodeaddr_t addr, int16_t rssi, int16_t snr,
+        int16_t freqErrorHz);
+
+    /**
+     * @brief Called when a transmission to the neighbor is 
+     * acknowledged.
+     */
+    void processAck(nodeaddr_t addr);
+
+    /**
+     * @brief Called when a transmission to the neighbor is not
+     * acknowledged in time (i.e. a retry or a timeout).
+     */
+    void processTxFailure(nodeaddr_t addr);
+
+    /**
+     * @brief Called when a link probe is received from a neighbor.
+     * 
+     * @param seq The sequence number of the probe.
+     * @param intervalSeconds The interval at which the neighbor 
+     *   is sending probes.
+     */
+    void processProbe(nodeaddr_t addr, uint16_t seq, uint16_t intervalSeconds);
+
+    /**
+     * @brief Called when a neighbor tells us (in its probe) what fraction
+     * of our probes it has been hearing.
+     */
+    void processForwardRatio(nodeaddr_t addr, float ratio);
+
+    /**
+     * @brief Called when a neighbor tells us (in its probe) which 
+     * spreading factor it is listening on.
+     * @param nextSf The spreading factor that the neighbor has announced
+     *   it will move to (zero if none).
+     * @param switchDelayMs How long from now the move happens.
+     */
+    void processListenSf(nodeaddr_t addr, uint8_t sf, uint8_t nextSf = 0,
+        uint32_t switchDelayMs = 0);
+
+    /**
+     * @brief Called when a neighbor tells us (in its probe) how often 
+     * it samples the channel while its receiver is asleep (zero if it 
+     * is always listening).
+     */
+    void processWakeInterval(nodeaddr_t addr, uint16_t ms);
+
+    /**
+     * @returns The lowest spreading factor (not above baseSf) at which 
+     *   we would expect to hear the neighbor, based on the SNR of its 
+     *   frames.  baseSf is returned until the neighbor's probes are 
+     *   being heard reliably.
+     * @param marginDb The SNR needed above the demodulation limit.
+     */
+    uint8_t getRequiredSf(const NeighborEntry& entry, uint8_t baseSf,
+        int8_t marginDb = SF_MARGIN_DB) const;
+
+    /**
+     * @returns The spreading factor that this station should listen on
+     *   so that every neighbor can be heard.
+     * @param currentSf The spreading factor that the receiver is on.  
+     *   Moving below this takes an extra SF_HYSTERESIS_DB of margin.
+     */
+    uint8_t getListenSf(uint8_t baseSf, uint8_t currentSf = 0) const;
+
+    /**
+     * @returns True if the network time falls in an SF rendezvous 
+     *   window.
+     */
+    static bool isRendezvous(uint64_t networkUs);
+
+    /**
+     * @returns The time (in milliseconds) from the network time to the
+     *   end of the rendezvous window that is in progress, or of the 
+     *   next one.
+     */
+    static uint32_t getRendezvousEndMs(uint64_t networkUs);
+
+    /**
+     * @returns The spreading factor that should be used to reach the
+     *   neighbor (the one that the neighbor is listening on).
+     */
+    uint8_t getTxSf(nodeaddr_t addr, uint8_t baseSf) const;
+
+    /**
+     * @returns The spreading factors that a broadcast needs to be sent 
+     *   on to reach every neighbor (bit N is set for SF N).  baseSf is 
+     *   always included so that new stations can find us.
+     */
+    uint16_t getBroadcastSfMask(uint8_t baseSf) const;
+
+    /**
+     * @returns The transmit power that should be used to reach the 
+     *   neighbor.
+     */
+    uint8_t getTxPowerDbm(nodeaddr_t addr, uint8_t profileDbm) const;
+
+    /**
+     * @returns The sampling interval of the neighbor (zero if it is
+     *   always listening or isn't known).  A frame needs a preamble 
+     *   that spans this interval to wake the neighbor up.
+     */
+    uint16_t getWakeIntervalMs(nodeaddr_t addr) const;
+
+    /**
+     * @returns The longest sampling interval of all of the neighbors, 
+     *   which is what a broadcast needs to span.
+     */
+    uint16_t getMaxWakeIntervalMs() const;
+
+    /**
+     * @returns The SNR that we report back to the neighbor (NO_SNR if 
+     *   nothing has been measured).
+     */
+    int8_t getReportSnr(const NeighborEntry& entry) const;
+
+    /**
+     * @returns The fraction of the neighbor's probes that we have heard
+     *   recently (the reverse delivery ratio), or a negative number if 
+     *   no probes have been heard.  Probes that are overdue are 
+     *   counted as missed.
+     */
+    float getReverseRatio(const NeighborEntry& entry) const;
+
+    /**
+     * @returns The ETX (expected number of transmissions) for the link 
+     *   to the neighbor, computed as 1 / (df * dr).  When the probe 
+     *   data isn't available yet the ACK-based delivery ratio is used 
+     *   as an estimate. MAX_ETX is returned for unknown or 
+     *   dead links.
+     */
+    float getEtx(nodeaddr_t addr) const;
+
+    /**
+     * @returns true if the ETX of the link is based on probes
+     *   in both directions.
+     */
+    bool isEtxMeasured(nodeaddr_t addr) const;
+
+    /**
+     * @returns The entry for the neighbor, or 0 if the neighbor
+     *   isn't in the table.
+     */
+    const NeighborEntry* get(nodeaddr_t addr) const;
+
+    /**
+     * @brief Used for iterating across the table.  Check isValid() 
+     * on the result to see if the slot is being used.
+     */
+    const NeighborEntry& getSlot(unsigned int i) const;
+
+    /**
+     * @returns The number of seconds since we last heard from
+     *   the neighbor.
+     */
+    uint32_t getSecondsSinceHeard(const NeighborEntry& entry) const;
+
+    void clear();
+
+private:
+
+    NeighborEntry* _find(nodeaddr_t addr);
+    NeighborEntry* _findOrAllocate(nodeaddr_t addr);
+    // Includes any announced move that is due
+    uint8_t _getCurrentListenSf(const NeighborEntry& entry) const;
+
+    const Clock& _clock;
+    NeighborEntry _table[SIZE];
+};
+
+#endif
@@ -0,0 +1,147 @@
+/* 
+ * LoRa Birdhouse Mesh Network Project
+ * Wellesley Amateur Radio Society
+ * 
+ * Copyright (C) 2022 Bruce MacKinnon
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "NetworkClock.h"
+
+// The smoothing factor for the skew estimate.  Smaller numbers give 
+// more weight to the history.
+#define SKEW_ALPHA 0.25
+// The reference point is moved forward well before the local 
+// microsecond clock wraps (~71 minutes)
+#define REFERENCE_MAX_AGE_US (10UL * 60UL * 1000000UL)
+
+NetworkClock::NetworkClock(const Clock& localClock) 
+:   _localClock(localClock),
+    _localRefUs(localClock.timeUs()),
+    _networkRefUs(0),
+    _skewPpb(0),
+    _skewValid(false),
+    _parentLocalUs(0),
+    _parentNetworkUs(0),
+    _hasTime(false),
+    _level(TIME_SYNC_NO_LEVEL),
+    _parent(0),
+    _root(0),
+    _lastBeaconTime(0),
+    _lastOffsetUs(0),
+    _beaconCount(0) {
+}
+
+uint32_t NetworkClock::time() const {
+    return getNetworkUs() / 1000ULL;
+}
+
+uint32_t NetworkClock::timeUs() const {
+    return getNetworkUs();
+}
+
+uint64_t NetworkClock::getNetworkUs() const {
+    return toNetworkUs(_localClock.timeUs());
+}
+
+uint64_t NetworkClock::toNetworkUs(uint32_t localUs) const {
+    // The local time may be a little before the reference point
+    const int32_t elapsedUs = localUs - _localRefUs;
+    return _networkRefUs + (int64_t)elapsedUs + 
+        ((int64_t)elapsedUs * _skewPpb) / 1000000000LL;
+}
+
+void NetworkClock::setTime(uint64_t networkUs, nodeaddr_t self) {
+    _localRefUs = _localClock.timeUs();
+    _networkRefUs = networkUs;
+    _skewPpb = 0;
+    _skewValid = false;
+    _hasTime = true;
+    _level = 0;
+    _parent = 0;
+    _root = self;
+    _lastOffsetUs = 0;
+}
+
+bool NetworkClock::processBeacon(nodeaddr_t sender, nodeaddr_t root, 
+    uint8_t senderLevel, uint32_t localUs, uint64_t networkUs) {
+
+    // The root doesn't listen to anyone
+    if (isRoot() || senderLevel >= TIME_SYNC_MAX_LEVEL) {
+        return false;
+    }
+    // Stay with the parent unless a station that is closer to the 
+    // root is heard
+    const bool sameParent = isSynced() && sender == _parent;
+    if (isSynced() && !sameParent && senderLevel + 1 >= _level) {
+        return false;
+    }
+
+    const int64_t offsetUs = (int64_t)(networkUs - toNetworkUs(localUs));
+
+    if (sameParent && offsetUs > -TIME_SYNC_MAX_OFFSET_US && 
+        offsetUs < TIME_SYNC_MAX_OFFSET_US) {
+        _lastOffsetUs = offsetUs;
+        // The skew is estimated from the time that has passed on both 
+        // clocks since the previous beacon.
+        const int32_t localElapsedUs = localUs - _parentLocalUs;
+        if (localElapsedUs > TIME_SYNC_MIN_SKEW_INTERVAL_US) {
+            const int64_t networkElapsedUs = networkUs - _parentNetworkUs;
+            const int64_t sample = ((networkElapsedUs - localElapsedUs) * 
+                1000000000LL) / localElapsedUs;
+            if (sample > -TIME_SYNC_MAX_SKEW_PPB && 
+                sample < TIME_SYNC_MAX_SKEW_PPB) {
+                if (_skewValid) {
+                    _skewPpb += (sample - _skewPpb) * SKEW_ALPHA;
+                } else {
+                    _skewPpb = sample;
+                    _skewValid = true;
+                }
+            }
+        }
+    }
+    // A new parent (or a jump in the time) starts over.  The skew of the
+    // local crystal is kept since it doesn't depend on the parent.
+    else {
+        _lastOffsetUs = 0;
+    }
+
+    _localRefUs = localUs;
+    _networkRefUs = networkUs;
+    _parentLocalUs = localUs;
+    _parentNetworkUs = networkUs;
+    _hasTime = true;
+    _level = senderLevel + 1;
+    _parent = sender;
+    _root = root;
+    _lastBeaconTime = _localClock.time();
+    _beaconCount++;
+    return true;
+}
+
+void NetworkClock::tick() {
+    // Move the reference point forward.  This doesn't change the time.
+    const uint32_t nowUs = _localClock.timeUs();
+    if ((uint32_t)(nowUs - _localRefUs) > REFERENCE_MAX_AGE_US) {
+        _networkRefUs = toNetworkUs(nowUs);
+        _localRefUs = nowUs;
+    }
+    // Stop sending beacons if the parent has gone quiet, and take the 
+    // time from anyone.
+    if (isSynced() && !isRoot() && _localClock.time() - _lastBeaconTime > 
+        TIME_SYNC_LOSS_INTERVALS * TIME_SYNC_INTERVAL_MS) {
+        _level = TIME_SYNC_NO_LEVEL;
+        _parent = 0;
+    }
+}
@@ -0,0 +1,162 @@
+/* 
+ * LoRa Birdhouse Mesh Network Project
+ * Wellesley Amateur Radio Society
+ * 
+ * Copyright (C) 2022 Bruce MacKinnon
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _NetworkClock_h
+#define _NetworkClock_h
+
+#include <stdint.h>
+
+#include "Utils.h"
+#include "Clock.h"
+
+// How often a synchronized station sends a time sync beacon
+#define TIME_SYNC_INTERVAL_MS (60UL * 1000UL)
+// A station that doesn't hear from its parent for this many beacon
+// intervals will take its time from any other station
+#define TIME_SYNC_LOSS_INTERVALS 4
+// Stations can't be further than this from the root.  This stops 
+// a station from ever taking its time (indirectly) from itself.
+#define TIME_SYNC_MAX_LEVEL 15
+#define TIME_SYNC_NO_LEVEL 0xff
+// The skew of a crystal is never more than this.  Estimates beyond 
+// this are treated as bad samples.
+#define TIME_SYNC_MAX_SKEW_PPB 200000L
+// Corrections larger than this are treated as a jump in the network 
+// time (i.e. the root was set) rather than as drift.
+#define TIME_SYNC_MAX_OFFSET_US 100000L
+// How far apart two beacons need to be to estimate the skew
+#define TIME_SYNC_MIN_SKEW_INTERVAL_US 10000000L
+
+/**
+ * @brief The network time: microseconds since the epoch, shared by all
+ * of the stations.  
+ * 
+ * One station (the root) has its time set by hand.  Every station that
+ * has the time sends a time sync beacon every TIME_SYNC_INTERVAL_MS 
+ * giving the network time at the start of the transmission.  Each 
+ * station takes its time from the neighbor that is closest to the root
+ * (its parent), so the time spreads out over multiple hops.  
+ * 
+ * The network time is kept as a reference point (a local time and the 
+ * network time at that moment) plus the rate difference (skew) between
+ * the local clock and the network, which is estimated from consecutive
+ * beacons from the parent.  Between beacons the time runs at the 
+ * corrected rate.
+ * 
+ * As a Clock, time() and timeUs() give the (wrapping) low bits of the
+ * network time in milliseconds and microseconds.  tick() must be called
+ * at least every half hour.
+ */
+class NetworkClock : public Clock {
+public:
+
+    NetworkClock(const Clock& localClock);
+
+    uint32_t time() const;
+    uint32_t timeUs() const;
+
+    /**
+     * @return The current network time in microseconds since the epoch.
+     */
+    uint64_t getNetworkUs() const;
+
+    /**
+     * @return The network time at a recent moment on the local 
+     *   microsecond clock (i.e. a receive time stamp).
+     */
+    uint64_t toNetworkUs(uint32_t localUs) const;
+
+    uint32_t getNetworkSeconds() const { return getNetworkUs() / 1000000ULL; }
+
+    /**
+     * @brief Sets the network time, which makes this station the root.
+     * 
+     * @param self The address of this station.
+     */
+    void setTime(uint64_t networkUs, nodeaddr_t self);
+
+    /**
+     * @brief Gives the clock a time sync beacon.
+     * 
+     * @param sender The station that sent the beacon.
+     * @param root The station that the sender's time came from.
+     * @param senderLevel The sender's distance (in hops) from the root.
+     * @param localUs The time on the local microsecond clock that the 
+     *   transmission started.
+     * @param networkUs The network time that the transmission started.
+     * @return true if the beacon was used.
+     */
+    bool processBeacon(nodeaddr_t sender, nodeaddr_t root, 
+        uint8_t senderLevel, uint32_t localUs, uint64_t networkUs);
+
+    /**
+     * @brief Call periodically to keep the reference point fresh and to
+     * notice that the parent has gone quiet.
+     */
+    void tick();
+
+    /**
+     * @return true if the network time has ever been set, either by 
+     *   hand or from a beacon.
+     */
+    bool hasTime() const { return _hasTime; }
+    /**
+     * @return true if the time is being kept in step with the root.
+     */
+    bool isSynced() const { return _level != TIME_SYNC_NO_LEVEL; }
+    bool isRoot() const { return _level == 0; }
+    uint8_t getLevel() const { return _level; }
+    nodeaddr_t getParent() const { return _parent; }
+    nodeaddr_t getRoot() const { return _root; }
+    /**
+     * @return The rate of the network time relative to the local clock,
+     *   less one, in parts per billion.
+     */
+    int32_t getSkewPpb() const { return _skewPpb; }
+    /**
+     * @return The correction made at the last beacon from the parent
+     *   (i.e. how far off the time had drifted since the previous one).
+     */
+    int32_t getLastOffsetUs() const { return _lastOffsetUs; }
+    uint16_t getBeaconCount() const { return _beaconCount; }
+
+private:
+
+    const Clock& _localClock;
+
+    // The reference point
+    uint32_t _localRefUs;
+    uint64_t _networkRefUs;
+    int32_t _skewPpb;
+    bool _skewValid;
+    // The last beacon from the parent, for estimating the skew
+    uint32_t _parentLocalUs;
+    uint64_t _parentNetworkUs;
+    bool _hasTime;
+
+    uint8_t _level;
+    nodeaddr_t _parent;
+    nodeaddr_t _root;
+    // The local time of the last beacon used, in milliseconds
+    uint32_t _lastBeaconTime;
+    int32_t _lastOffsetUs;
+    uint16_t _beaconCount;
+};
+
+#endif
@@ -25,10 +25,10 @@
 
 extern Stream& logger;
 
-#define RETRY_INTERVAL_SECONDS 2
-
 OutboundPacket::OutboundPacket()
-: _isAllocated(false) {
+: _isAllocated(false),
+  _lastTransmitTime(0),
+  _awaitingAck(false) {
 }
 
 bool OutboundPacket::isAllocated() const {
@@ -41,23 +41,55 @@ void OutboundPacket::scheduleTransmit(const Packet& packet, unsigned int packetL
     ::memcpy((void*)&_packet, (const void*)&packet, packetLen);
     _packetLen = packetLen;
     _giveUpTime = giveUpTime;
+    _lastTransmitTime = 0;
 }
 
-void OutboundPacket::transmitIfReady(const Clock& clock, CircularBuffer& txBuffer) {
+bool OutboundPacket::checkTimeouts(const Clock& clock, NeighborTable& neighbors,
+    Header* giveUpHeader, uint32_t retryMs) {
     if (!_isAllocated) 
-        return;
+        return false;
     // Check for timeouts.  If we hit a timeout then reset the packet
     if (clock.time()  > _giveUpTime) {
         logger.print("WRN: TX timeout ");
         logger.print(_packet.header.id);
         logger.println();
+        // The last attempt was never acknowledged
+        if (_awaitingAck) {
+            neighbors.processTxFailure(_packet.header.destAddr);
+        }
+        if (giveUpHeader != 0) {
+            *giveUpHeader = _packet.header;
+        }
         _reset();
-        return;
+        return true;
     } 
+    // If the ACK hasn't arrived within the retry interval then the 
+    // attempt has failed and the packet becomes ready for a 
+    // re-transmit.
+    if (_awaitingAck &&
+        (clock.time() - _lastTransmitTime) >= retryMs) {
+        neighbors.processTxFailure(_packet.header.destAddr);
+        _awaitingAck = false;
+    }
+    return false;
+}
+
+void OutboundPacket::restartRetryTimer(const Clock& clock) {
+    if (_awaitingAck)
+        _lastTransmitTime = clock.time();
+}
+
+void OutboundPacket::deferTimeouts(uint32_t ms) {
+    if (!_isAllocated)
+        return;
+    _giveUpTime += ms;
+    _lastTransmitTime += ms;
+}
+
+void OutboundPacket::transmitIfReady(const Clock& clock, CircularBuffer& txBuffer) {
     // Check to see if this packet is still pending
-    if ((clock.time() - _lastTransmitTime) < RETRY_INTERVAL_SECONDS * 1000) {
+    if (!_isAllocated || _awaitingAck) 
         return;
-    }
     // If we make it here than we are ready to transmit
     bool good = txBuffer.push(0, &_packet, _packetLen);
     if (good) {
@@ -65,6 +97,7 @@ void OutboundPacket::transmitIfReady(const Clock& clock, CircularBuffer& txBuffe
             // If an acknowledgement is required then record the 
             // necessary information to manage the retries.
             _lastTransmitTime = clock.time();
+            _awaitingAck = true;
         } else {
             // If no acknowledgement is required then we are done.
             _reset();
@@ -74,21 +107,49 @@ void OutboundPacket::transmitIfReady(const Clock& clock, CircularBuffer& txBuffe
     }
 }
 
-void OutboundPacket::processAckIfRelevant(const Packet& ackPacket) {
+void OutboundPacket::processAckIfRelevant(const Packet& ackPacket, 
+    NeighborTable& neighbors) {
     // Check it see if this is an ACK that we were waiting for 
     if (_isAllocated &&
         ackPacket.header.sourceAddr == _packet.header.destAddr &&
         ackPacket.header.id == _packet.header.id) {
+        neighbors.processAck(_packet.header.destAddr);
         _reset();
     }
 }
 
+void OutboundPacket::readdress(nodeaddr_t nextHop) {
+    _packet.header.destAddr = nextHop;
+    _awaitingAck = false;
+}
+
 bool OutboundPacket::isAck() const {
     return _packet.header.type == TYPE_ACK;
 }
 
+bool OutboundPacket::isAckRequired() const {
+    return _packet.header.isAckRequired();
+}
+
+bool OutboundPacket::isAwaitingAck() const {
+    return _awaitingAck;
+}
+
+uint8_t OutboundPacket::getType() const {
+    return _packet.header.type;
+}
+
+nodeaddr_t OutboundPacket::getDestAddr() const {
+    return _packet.header.destAddr;
+}
+
+nodeaddr_t OutboundPacket::getFinalDestAddr() const {
+    return _packet.header.finalDestAddr;
+}
+
 void OutboundPacket::_reset() {
     _isAllocated = false;
     _lastTransmitTime = 0;
+    _awaitingAck = false;
     _packetLen = 0;
 }
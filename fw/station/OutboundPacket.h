@@ -23,6 +23,7 @@
 #include "Clock.h"
 #include "CircularBuffer.h"
 #include "packets.h"
+#include "NeighborTable.h"
 
 /**
  * @brief Used for tracking a packet that needs to the transmitted.  
@@ -37,10 +38,42 @@ public:
 
     bool isAllocated() const;
     bool isAck() const;
+    bool isAckRequired() const;
+    bool isAwaitingAck() const;
+    /**
+     * @return true if the packet is waiting to be (re-)transmitted.
+     */
+    bool isReady() const { return _isAllocated && !_awaitingAck; }
+
+    uint8_t getType() const;
+    unsigned int getPacketLen() const { return _packetLen; }
+    nodeaddr_t getDestAddr() const;
+    nodeaddr_t getFinalDestAddr() const;
     
     void scheduleTransmit(const Packet& packet, unsigned int packetLen,
         uint32_t giveUpTime);
 
+    /**
+     * @brief Looks for an overdue ACK (the packet becomes ready 
+     * for re-transmit) or a total timeout (the packet is dropped).
+     * 
+     * @param clock 
+     * @param neighbors Informed when a transmission goes un-acknowledged.
+     * @param giveUpHeader Filled in with the header of the packet 
+     *   if it is dropped.
+     * @param retryMs How long to wait for the ACK.
+     * @return true if the packet was dropped.
+     */
+    bool checkTimeouts(const Clock& clock, NeighborTable& neighbors,
+        Header* giveUpHeader, uint32_t retryMs);
+
+    /**
+     * @brief Starts the wait for the ACK over again.  Called while the
+     * frame may not have gone on the air yet, so that the wait runs 
+     * from the end of the transmission.
+     */
+    void restartRetryTimer(const Clock& clock);
+
     /**
      * @brief Causes a transmit or re-transmit it the time is right.
      * 
@@ -54,8 +87,25 @@ public:
      *   is not relevant.
      * 
      * @param ackPacket The packet that was received. 
+     * @param neighbors Informed when the transmission is acknowledged.
+     */
+    void processAckIfRelevant(const Packet& ackPacket, NeighborTable& neighbors);
+
+    /**
+     * @brief Changes the next hop of a pending packet.  The packet will 
+     * be transmitted to the new next hop right away.  The give-up time
+     * is not changed, so a failover never makes the originator wait 
+     * longer than it would have without one.
+     * 
+     * @param nextHop The new next hop.
+     */
+    void readdress(nodeaddr_t nextHop);
+
+    /**
+     * @brief Pushes the retry and give-up timeouts back, used when the
+     * station has been holding its traffic.
      */
-    void processAckIfRelevant(const Packet& ackPacket);
+    void deferTimeouts(uint32_t ms);
 
 private:
 
@@ -67,8 +117,12 @@ private:
     bool _isAllocated;
     // When we give up
     uint32_t _giveUpTime;
-    // The last time a transmission was attempted
+    // The last time a transmission was attempted (or was still in 
+    // progress)
     uint32_t _lastTransmitTime;
+    // Indicates that the packet has been sent and we are 
+    // waiting for the ACK
+    bool _awaitingAck;
 };
 
 #endif
@@ -19,12 +19,29 @@
  */
 #include "OutboundPacketManager.h"
 
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
+
+extern Stream& logger;
+
 OutboundPacketManager::OutboundPacketManager(const Clock& clock, CircularBuffer& txBuffer,
+    RoutingTable& routingTable, NeighborTable& neighbors, 
     uint32_t txTimeoutMs, uint32_t txRetryMs) 
     : _clock(clock), 
       _txBuffer(txBuffer),
+      _routingTable(routingTable),
+      _neighbors(neighbors),
+      _channelAccess(0),
+      _instrumentation(0),
       _txTimeoutMs(txTimeoutMs),
-      _txRetryMs(txRetryMs) {
+      _txRetryMs(txRetryMs),
+      _failoverCounter(0),
+      _paused(false),
+      _pauseTime(0),
+      _holding(false),
+      _holdStartTime(0),
+      _giveUpCount(0) {
 }
 
 unsigned int OutboundPacketManager::getPendingCount() const {
@@ -35,7 +52,13 @@ bool OutboundPacketManager::scheduleTransmitIfPossible(const Packet& packet, uns
     // Look for an unallocated packet a grab it - first come, first served.
     for (unsigned int i = 0; i < _packetCount; i++) {
         if (!_packets[i].isAllocated()) {
-            _packets[i].scheduleTransmit(packet, packetLen, _clock.time() + _txTimeoutMs);
+            _packets[i].scheduleTransmit(packet, packetLen, 
+                _clock.time() + _getGiveUpMs(packetLen));
+            // The wait for the end of the pause starts now
+            if (_paused && !_holding && !packet.header.isAck()) {
+                _holding = true;
+                _holdStartTime = _clock.time();
+            }
             return true;
         }
     }
@@ -44,6 +67,42 @@ bool OutboundPacketManager::scheduleTransmitIfPossible(const Packet& packet, uns
 }
 
 void OutboundPacketManager::pump() {
+    // While paused the timeouts are frozen and only ACKs go out
+    if (_paused) {
+        for (unsigned int i = 0; i < _packetCount; i++) {
+            if (_packets[i].isAck())
+                _packets[i].transmitIfReady(_clock, _txBuffer);
+            else if (_packets[i].isReady() && !_holding) {
+                _holding = true;
+                _holdStartTime = _clock.time();
+            }
+        }
+        return;
+    }
+    // The wait for an ACK runs from the end of the transmission, so it
+    // doesn't start while anything is still queued or on the air
+    const bool txBusy = !_txBuffer.isEmpty() || 
+        (_instrumentation != 0 && _instrumentation->isTransmitting());
+    // Deal with overdue ACKs before deciding what to send
+    for (unsigned int i = 0; i < _packetCount; i++) {
+        if (txBusy)
+            _packets[i].restartRetryTimer(_clock);
+        const bool wasAwaitingAck = _packets[i].isAwaitingAck();
+        const uint8_t type = _packets[i].getType();
+        Header header;
+        if (_packets[i].checkTimeouts(_clock, _neighbors, &header, 
+            _getRetryMs(_packets[i].getPacketLen())) &&
+            header.isAckRequired() &&
+            _giveUpCount < _giveUpSize) {
+            _giveUps[_giveUpCount++] = header;
+        }
+        // A missed ACK might be the result of a collision
+        if (_channelAccess != 0 && wasAwaitingAck && 
+            !_packets[i].isAwaitingAck()) {
+            _channelAccess->processAckMissed(_classify(type));
+        }
+    }
+    _failoverIfNecessary();
     // Make sure the ACKs have priority in the output queue
     for (unsigned int i = 0; i < _packetCount; i++) {
         if (_packets[i].isAck())
@@ -54,9 +113,109 @@ void OutboundPacketManager::pump() {
         _packets[i].transmitIfReady(_clock, _txBuffer);
 }
 
+void OutboundPacketManager::pause() {
+    if (_paused) 
+        return;
+    _paused = true;
+    _pauseTime = _clock.time();
+    _holding = false;
+}
+
+uint32_t OutboundPacketManager::resume() {
+    if (!_paused)
+        return 0;
+    _paused = false;
+    const uint32_t now = _clock.time();
+    for (unsigned int i = 0; i < _packetCount; i++)
+        _packets[i].deferTimeouts(now - _pauseTime);
+    return _holding ? now - _holdStartTime : 0;
+}
+
 void OutboundPacketManager::processAck(const Packet& ackPacket) {
-    for (unsigned int i = 0; i < _packetCount; i++) 
-        _packets[i].processAckIfRelevant(ackPacket);
+    for (unsigned int i = 0; i < _packetCount; i++) {
+        const bool wasAllocated = _packets[i].isAllocated();
+        const uint8_t type = _packets[i].getType();
+        _packets[i].processAckIfRelevant(ackPacket, _neighbors);
+        if (_channelAccess != 0 && wasAllocated && !_packets[i].isAllocated()) {
+            _channelAccess->processTxSuccess(_classify(type));
+        }
+    }
+}
+
+void OutboundPacketManager::setChannelAccess(ChannelAccess* channelAccess) {
+    _channelAccess = channelAccess;
+}
+
+void OutboundPacketManager::setInstrumentation(const Instrumentation* instrumentation) {
+    _instrumentation = instrumentation;
+}
+
+uint32_t OutboundPacketManager::_getRetryMs(unsigned int packetLen) const {
+    if (_instrumentation == 0)
+        return _txRetryMs;
+    // A late ACK can keep the ACK window open for twice its length
+    const uint32_t ms = (_instrumentation->getAirtimeUs(packetLen) + 999) / 1000 + 
+        2 * _instrumentation->getAckWindowMs();
+    return (ms > _txRetryMs) ? ms : _txRetryMs;
+}
+
+uint32_t OutboundPacketManager::_getGiveUpMs(unsigned int packetLen) const {
+    if (_txRetryMs == 0)
+        return _txTimeoutMs;
+    return (_txTimeoutMs / _txRetryMs) * _getRetryMs(packetLen);
+}
+
+TrafficClass OutboundPacketManager::_classify(uint8_t type) {
+    Header header;
+    header.setType(type);
+    return ChannelAccess::classify(header);
+}
+
+void OutboundPacketManager::_failoverIfNecessary() {
+    for (unsigned int i = 0; i < _packetCount; i++) {
+        
+        if (!_packets[i].isAllocated() || !_packets[i].isAckRequired())
+            continue;
+        
+        const nodeaddr_t oldHop = _packets[i].getDestAddr();
+        const NeighborEntry* entry = _neighbors.get(oldHop);
+        if (entry == 0 || entry->consecutiveFailures < FAILOVER_FAILURE_COUNT) 
+            continue;
+        
+        // Tell the routing table to stop using this next hop and 
+        // see what it recommends instead.
+        _routingTable.markSuspect(oldHop);
+        const nodeaddr_t newHop = _routingTable.nextHop(_packets[i].getFinalDestAddr());
+        if (newHop == RoutingTable::NO_ROUTE || newHop == oldHop) 
+            continue;
+
+        _packets[i].readdress(newHop);
+        _failoverCounter++;
+
+        logger.print("INF: Failover ");
+        logger.print(oldHop);
+        logger.print("->");
+        logger.print(newHop);
+        logger.println();
+    }
+}
+
+uint16_t OutboundPacketManager::getFailoverCounter() const {
+    return _failoverCounter;
+}
+
+bool OutboundPacketManager::popGiveUp(Header& header) {
+    if (_giveUpCount == 0) 
+        return false;
+    header = _giveUps[0];
+    for (unsigned int i = 1; i < _giveUpCount; i++) 
+        _giveUps[i - 1] = _giveUps[i];
+    _giveUpCount--;
+    return true;
+}
+
+void OutboundPacketManager::resetCounters() {
+    _failoverCounter = 0;
 }
 
 unsigned int OutboundPacketManager::getFreeCount() const {
@@ -24,13 +24,45 @@
 #include "CircularBuffer.h"
 #include "packets.h"
 #include "OutboundPacket.h"
+#include "NeighborTable.h"
+#include "RoutingTable.h"
+#include "ChannelAccess.h"
+#include "Instrumentation.h"
+
+// The number of un-acknowledged transmissions in a row before a 
+// next hop is considered suspect.
+#define FAILOVER_FAILURE_COUNT 2
 
 class OutboundPacketManager {
 public:
 
+    /**
+     * @param txTimeoutMs How long to keep trying before giving up on a 
+     *   packet.
+     * @param txRetryMs How long to wait for an ACK before sending again.
+     *   Both are stretched on radio profiles where an exchange takes 
+     *   longer (see setInstrumentation()).
+     */
     OutboundPacketManager(const Clock& clock, CircularBuffer& txBuffer,
+        RoutingTable& routingTable, NeighborTable& neighbors, 
         uint32_t txTimeoutMs, uint32_t txRetryMs);
 
+    /**
+     * @brief Lets the channel access policy know about missed and 
+     * received ACKs. 
+     * 
+     * @param channelAccess Can be 0 to disable.
+     */
+    void setChannelAccess(ChannelAccess* channelAccess);
+
+    /**
+     * @brief Lets the retry interval follow the airtime of the current 
+     * radio profile, and tells when the radio is still sending.
+     * 
+     * @param instrumentation Can be 0 to disable.
+     */
+    void setInstrumentation(const Instrumentation* instrumentation);
+
     bool scheduleTransmitIfPossible(const Packet& packet, 
         unsigned int packetLen);
 
@@ -38,6 +70,23 @@ public:
 
     void pump();
 
+    /**
+     * @brief Holds back all outbound traffic other than ACKs (i.e. 
+     * while the neighbors are asleep).  The retry and give-up timeouts
+     * stop running while the traffic is being held.
+     */
+    void pause();
+
+    /**
+     * @brief Lets the traffic go again after pause().
+     * 
+     * @return How long the oldest held packet waited (zero if nothing
+     *   was held).
+     */
+    uint32_t resume();
+
+    bool isPaused() const { return _paused; }
+
     /**
      * @brief Gets the number of free packets that remain.
      */
@@ -49,14 +98,68 @@ public:
      */
     unsigned int getPendingCount() const;
 
+    /**
+     * @brief Gets the number of times that pending packets were 
+     * moved to a backup next hop.
+     */
+    uint16_t getFailoverCounter() const;
+
+    void resetCounters();
+
+    /**
+     * @brief Retrieves the header of a packet that was dropped after
+     * the give-up timeout, so that the failure can be reported.  Only
+     * packets that required an ACK are reported.
+     * 
+     * @return true if a header was returned.
+     */
+    bool popGiveUp(Header& header);
+
 private:
 
+    /**
+     * @brief Looks for pending packets whose next hop has stopped 
+     * acknowledging.  The next hop is marked as suspect in the 
+     * routing table and the packets are moved to the backup 
+     * next hop (if there is one).
+     */
+    void _failoverIfNecessary();
+
+    static TrafficClass _classify(uint8_t type);
+
+    /**
+     * @brief The time to wait for the ACK after a frame of this length
+     * has been sent: the frame itself and the longest ACK window.  
+     * Never shorter than the configured retry interval.
+     */
+    uint32_t _getRetryMs(unsigned int packetLen) const;
+
+    /**
+     * @brief The give-up timeout, which allows the same number of 
+     * attempts as the configured timeouts do.
+     */
+    uint32_t _getGiveUpMs(unsigned int packetLen) const;
+
     static const unsigned int _packetCount = 8;
     const Clock& _clock;
     CircularBuffer& _txBuffer;
+    RoutingTable& _routingTable;
+    NeighborTable& _neighbors;
+    ChannelAccess* _channelAccess;
+    const Instrumentation* _instrumentation;
     OutboundPacket _packets[_packetCount];
     uint32_t _txTimeoutMs;
     uint32_t _txRetryMs;
+    uint16_t _failoverCounter;
+    bool _paused;
+    uint32_t _pauseTime;
+    // Set when a packet had to wait because of the pause
+    bool _holding;
+    uint32_t _holdStartTime;
+    // Headers of packets that were given up on
+    static const unsigned int _giveUpSize = 4;
+    Header _giveUps[_giveUpSize];
+    unsigned int _giveUpCount;
 };
 
 #endif
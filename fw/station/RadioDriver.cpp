@@ -0,0 +1,1273 @@
+/* 
+ * LoRa Birdhouse Mesh Network Project
+ * Wellesley Amateur Radio Society
+ * 
+ * Copyright (C) 2022 Bruce MacKinnon
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+
+#include "RadioDriver.h"
+#include "RxMetadata.h"
+#include "Airtime.h"
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
+
+extern Stream& logger;
+
+// This reference will be very important to you:
+// https://www.hoperf.com/data/upload/portal/20190730/RFM95W-V2.0.pdf
+// 
+// The LoRa register map starts on page 103.
+
+static uint8_t fifoRegionBase(uint8_t region) {
+    return region * FIFO_REGION_SIZE;
+}
+
+static uint8_t fifoRegionOf(uint8_t addr) {
+    return addr / FIFO_REGION_SIZE;
+}
+
+// Output power in tenths of a mW for 2dBm through 20dBm
+/**
+ * The time after which a CAD cycle should be finished, for the symbol 
+ * time that the CAD is using.
+ */
+static uint32_t cadPollUs(uint32_t symbolUs) {
+    const uint32_t us = CAD_POLL_SYMBOLS * symbolUs;
+    return (us < CAD_POLL_MS * 1000UL) ? CAD_POLL_MS * 1000UL : us;
+}
+
+static const uint16_t powerTenthsMw[] = { 16, 20, 25, 32, 40, 50, 63, 79, 
+    100, 126, 158, 200, 251, 316, 398, 501, 631, 794, 1000 };
+
+static uint16_t tenthsMw(uint8_t dbm) {
+    if (dbm < 2) 
+        dbm = 2;
+    else if (dbm > 20)
+        dbm = 20;
+    return powerTenthsMw[dbm - 2];
+}
+
+RadioDriver::RadioDriver(RegisterBus& bus, const Clock& clock, 
+    CircularBuffer& txBuffer, CircularBuffer& rxBuffer,
+    ChannelAccess& channelAccess)
+:   _bus(bus),
+    _clock(clock),
+    _txBuffer(txBuffer),
+    _rxBuffer(rxBuffer),
+    _channelAccess(channelAccess),
+    _state(IDLE),
+    _startTxTime(0),
+    _startCadTime(0),
+    _edgeUs(0),
+    _txDoneUs(0),
+    _cadTrafficClass(TRAFFIC_DATA),
+    _txPreloaded(false),
+    _txImplicitHeader(false),
+    _txAckRequired(false),
+    _txSf(0),
+    _txRepeatSfMask(0),
+    _txPowerDbm(0),
+    _txTimeSync(false),
+    _txWakeIntervalMs(0),
+    _ackWindowOpen(false),
+    _ackWindowStart(0),
+    _ackWindowMs(0),
+    _profilePending(false),
+    _neighborTable(0),
+    _networkClock(0),
+    _listenSf(0),
+    _nextListenSf(0),
+    _rendezvous(false),
+    _rxRegion(0),
+    _rxPacketCount(0),
+    _lplIntervalMs(0),
+    _lplHoldStart(0),
+    _lplHoldMs(0),
+    _lplSampleTime(0),
+    _lplWakePending(false),
+    _sleeping(false),
+    _sleepStart(0),
+    _shadowValid(false) {
+    RadioProfileTable profiles;
+    profiles.setDefaults();
+    _profile = profiles.getActive();
+    _listenSf = _profile.sf;
+    resetCounters();
+}
+
+void RadioDriver::resetCounters() {
+    _lastCadToTxUs = 0;
+    _maxCadToTxUs = 0;
+    _preloadHitCount = 0;
+    _preloadMissCount = 0;
+    _rxOverrunCount = 0;
+    _lastRxServiceUs = 0;
+    _maxRxServiceUs = 0;
+    _lastTxServiceUs = 0;
+    _maxTxServiceUs = 0;
+    _regWriteSkipCount = 0;
+    _ackWindowTimeoutCount = 0;
+    _lowSfTxCount = 0;
+    _lowSfSavedUs = 0;
+    _lowPowerTxCount = 0;
+    _rfEnergySavedUj = 0;
+    _countersStart = _clock.time();
+    _sleepMs = 0;
+    if (_sleeping) 
+        _sleepStart = _countersStart;
+    _lplSampleCount = 0;
+    _lplWakeCount = 0;
+    _lplFalseWakeCount = 0;
+    _longPreambleTxCount = 0;
+}
+
+uint16_t RadioDriver::getRadioOnPermille() const {
+    const uint32_t now = _clock.time();
+    const uint32_t elapsed = now - _countersStart;
+    if (elapsed == 0)
+        return 1000;
+    uint32_t sleepMs = _sleepMs;
+    if (_sleeping)
+        sleepMs += now - _sleepStart;
+    return 1000 - (uint16_t)(((uint64_t)sleepMs * 1000) / elapsed);
+}
+
+void RadioDriver::_recordTime(uint32_t us, uint32_t& last, uint32_t& max) {
+    last = us;
+    if (us > max) 
+        max = us;
+}
+
+// ----- Register Shadow ---------------------------------------------------
+
+/**
+ * The FIFO, the FIFO pointer, the IRQ flags and the status registers are 
+ * changed by the radio itself so they always go out to the radio.
+ */
+bool RadioDriver::_isCacheable(uint8_t reg) {
+    return !(reg == 0x00 || 
+        reg == 0x0d || 
+        reg == 0x10 || 
+        (reg >= 0x12 && reg <= 0x1c) || 
+        reg == 0x25 ||
+        (reg >= 0x28 && reg <= 0x2a) ||
+        reg == 0x2c ||
+        reg > SHADOW_REG_MAX);
+}
+
+/**
+ * Registers 0x01 through SHADOW_REG_MAX are read in a single burst 
+ * (register 0x00 is the FIFO, which must not be touched).
+ */
+void RadioDriver::syncShadow() {
+    _shadow[0] = 0;
+    _bus.readMulti(0x01, _shadow + 1, SHADOW_REG_MAX);
+    _shadowValid = true;
+}
+
+/**
+ * Used to record a register change that the radio made on its own
+ * (i.e. the automatic return to stand-by at the end of a TX or CAD).
+ */
+void RadioDriver::_shadowSet(uint8_t reg, uint8_t val) {
+    if (_isCacheable(reg)) {
+        _shadow[reg] = val;
+    }
+}
+
+uint8_t RadioDriver::_read(uint8_t reg) {
+    if (_shadowValid && _isCacheable(reg)) {
+        return _shadow[reg];
+    }
+    return _bus.read(reg);
+}
+
+void RadioDriver::_write(uint8_t reg, uint8_t val) {
+    if (_shadowValid && _isCacheable(reg)) {
+        if (_shadow[reg] == val) {
+            _regWriteSkipCount++;
+            return;
+        }
+        _shadow[reg] = val;
+    }
+    _bus.write(reg, val);
+}
+
+// ----- FIFO Management ---------------------------------------------------
+
+uint8_t RadioDriver::_fifoTxRegion() const {
+    return (_rxRegion + 1) % FIFO_REGION_COUNT;
+}
+
+/**
+ * Points the receiver at the next FIFO region.  Any frame that was 
+ * preloaded into that region is lost.
+ */
+void RadioDriver::_rotateRxRegion() {
+    _rxRegion = (_rxRegion + 1) % FIFO_REGION_COUNT;
+    _write(0x0f, fifoRegionBase(_rxRegion));
+    _txPreloaded = false;
+}
+
+void RadioDriver::_writeMessage(const uint8_t* data, uint8_t len) {
+    // Move the TX base and the pointer to the start of the region that
+    // the receiver isn't using
+    const uint8_t base = fifoRegionBase(_fifoTxRegion());
+    _write(0x0e, base);
+    _bus.write(0x0d, base);
+    // The message
+    _bus.writeMulti(0x00, data, len);
+    // Update the length register
+    _write(0x22, len);
+    // Keep track of how this frame needs to be sent
+    Header header;
+    if (len >= sizeof(Header)) {
+        memcpy(&header, data, sizeof(Header));
+        _txImplicitHeader = header.isAck() && len == ACK_FRAME_LEN;
+        _txAckRequired = header.isAckRequired();
+        _txTimeSync = header.getType() == TYPE_TIME_SYNC &&
+            len >= sizeof(Header) + sizeof(TimeSyncPayload);
+    } else {
+        _txImplicitHeader = false;
+        _txAckRequired = false;
+        _txTimeSync = false;
+    }
+    // Pick the spreading factor(s) that the receiver(s) are listening on.
+    // Everyone is on the profile spreading factor during the rendezvous
+    // window.
+    _txSf = _profile.sf;
+    _txRepeatSfMask = 0;
+    _txPowerDbm = _profile.powerDbm;
+    const bool rendezvous = _isRendezvousWindow();
+    if (_neighborTable && len >= sizeof(Header)) {
+        if (rendezvous) {
+            if (header.getDestAddr() != BROADCAST_ADDR) 
+                _txPowerDbm = _neighborTable->getTxPowerDbm(
+                    header.getDestAddr(), _profile.powerDbm);
+        } else if (header.getDestAddr() == BROADCAST_ADDR) {
+            _txRepeatSfMask = _neighborTable->getBroadcastSfMask(_profile.sf);
+            for (_txSf = NeighborTable::MIN_SF; _txSf < _profile.sf; _txSf++) 
+                if (_txRepeatSfMask & (1 << _txSf))
+                    break;
+            _txRepeatSfMask &= ~(1 << _txSf);
+        } else {
+            _txSf = _neighborTable->getTxSf(header.getDestAddr(), _profile.sf);
+            _txPowerDbm = _neighborTable->getTxPowerDbm(header.getDestAddr(), 
+                _profile.powerDbm);
+        }
+    }
+    // A neighbor that is sampling the channel needs a long preamble to 
+    // be woken up.  ACKs go back while the neighbor is still awake from 
+    // the frame being ACK'd.  Time sync beacons always use the normal 
+    // preamble because the receivers subtract the (normal) airtime to 
+    // find the start of the transmission.
+    _txWakeIntervalMs = 0;
+    if (_neighborTable && len >= sizeof(Header) && 
+        !_txImplicitHeader && !_txTimeSync) {
+        if (header.getDestAddr() == BROADCAST_ADDR) {
+            _txWakeIntervalMs = _neighborTable->getMaxWakeIntervalMs();
+        } else {
+            _txWakeIntervalMs = _neighborTable->getWakeIntervalMs(
+                header.getDestAddr());
+        }
+    }
+}
+
+/**
+ * Puts the network time into a time sync beacon that is in the TX 
+ * region of the FIFO.  This is done right before the transmission is
+ * started so that the receivers can work out exactly when the time
+ * was sampled.
+ */
+void RadioDriver::_stampTimeSync() {
+    const uint64_t networkUs = _networkClock->toNetworkUs(_clock.timeUs());
+    TimeSyncPayload payload;
+    payload.txSeconds = networkUs / 1000000ULL;
+    payload.txMicros = networkUs % 1000000ULL;
+    _bus.write(0x0d, fifoRegionBase(_fifoTxRegion()) + sizeof(Header));
+    // Only the time at the front of the payload is changed
+    _bus.writeMulti(0x00, (const uint8_t*)&payload, 
+        sizeof(payload.txSeconds) + sizeof(payload.txMicros));
+}
+
+/**
+ * Loads the frame at the front of the TX queue into the radio FIFO 
+ * without removing it from the queue.  
+ */
+void RadioDriver::_preloadTx() {
+    unsigned int txBufLen = MAX_FRAME_LEN;
+    uint8_t txBuf[MAX_FRAME_LEN];
+    _txBuffer.peek(0, txBuf, &txBufLen);
+    _writeMessage(txBuf, txBufLen);
+    _txPreloaded = true;
+}
+
+// ----- State Machine -----------------------------------------------------
+
+void RadioDriver::_startTx() {
+
+    const uint32_t serviceStartUs = _clock.timeUs();
+    _bus.beginBatch();
+
+    // At this point we have something pending to be sent.
+    // Go into stand-by so we know that nothing else is coming in
+    _setModeStandby();
+
+    // If the frame is already in the radio FIFO then all we need to do
+    // is take it off the TX queue.  Otherwise we have to move it now.
+    if (_txPreloaded) {
+        _txBuffer.popAndDiscard();
+        _preloadHitCount++;
+    } else {
+        unsigned int txBufLen = MAX_FRAME_LEN;
+        uint8_t txBuf[MAX_FRAME_LEN];
+        _txBuffer.pop(0, txBuf, &txBufLen);
+        _writeMessage(txBuf, txBufLen);
+        _preloadMissCount++;
+    }
+    _txPreloaded = false;
+
+    // ACKs go out without a header
+    _setImplicitHeader(_txImplicitHeader);
+    _setSf(_txSf);
+    _setTxPower(_txPowerDbm);
+    _setTxPreamble();
+    
+    // Go into transmit mode
+    _state = TX_STATE;
+    _startTxTime = _clock.time();
+    _enableInterruptTxDone();
+    if (_txTimeSync && _networkClock) {
+        _stampTimeSync();
+    }
+    _setModeTx();
+
+    _bus.endBatch();
+    _recordTime(_clock.timeUs() - serviceStartUs, _lastTxServiceUs, _maxTxServiceUs);
+}
+
+void RadioDriver::startRx() {
+    _ackWindowOpen = false;
+    _startRx(false);
+}
+
+void RadioDriver::startAckWindow() {
+    // The ACK comes back on the spreading factor that we listen on
+    _setSf(_getRxSf());
+    _ackWindowOpen = true;
+    _ackWindowStart = _clock.time();
+    _ackWindowMs = getAckWindowMs();
+    // In implicit header mode the length of the frame is known in advance
+    _write(0x22, ACK_FRAME_LEN);
+    _startRx(true);
+}
+
+uint32_t RadioDriver::getAckWindowMs() {
+    return _getAckTurnaroundMs() + 
+        (getAirtimeUs(ACK_FRAME_LEN, true) + 999) / 1000;
+}
+
+void RadioDriver::_startRx(bool implicitHeader) {
+    // Revert back to listening mode. 
+    _leaveSleep();
+    _state = RX_STATE;
+    _setImplicitHeader(implicitHeader);
+    _setSf(_getRxSf());
+    _setPreambleLen(PREAMBLE_LEN);
+    // The radio restarts its packet counter on entry into receive mode
+    _rxPacketCount = 0;
+    // Ask for interrupt when receiving
+    _enableInterruptRxDone();
+    // Go into RXCONTINUOUS so we can hear the response
+    _setModeRxContinuous();  
+}
+
+void RadioDriver::resumeRx() {
+    _state = RX_STATE;
+}
+
+void RadioDriver::sleep() {
+    _enterSleep();
+    _state = IDLE;
+}
+
+void RadioDriver::wake() {
+    _setModeStandby();
+    startRx();
+}
+
+/**
+ * Per the datasheet the sleep current is 1uA.  The register settings 
+ * are kept in SLEEP mode but the FIFO contents are not.
+ */
+void RadioDriver::_enterSleep() {
+    _setModeSleep();
+    _txPreloaded = false;
+    if (!_sleeping) {
+        _sleeping = true;
+        _sleepStart = _clock.time();
+    }
+}
+
+/**
+ * Keeps track of the time spent in SLEEP mode (for the radio duty 
+ * cycle).  Anything that takes the radio out of SLEEP mode must call 
+ * this.
+ */
+void RadioDriver::_leaveSleep() {
+    if (_sleeping) {
+        _sleepMs += _clock.time() - _sleepStart;
+        _sleeping = false;
+    }
+}
+
+/**
+ * The radio raises CadDone at the end of every CAD cycle, whether or
+ * not activity was detected, and returns to stand-by on its own.  The
+ * CadDetected flag tells us whether the channel was busy.  
+ */
+void RadioDriver::_startCad() {      
+
+    _state = CAD;
+    _startCadTime = _clock.time();
+    // CAD can only be started from stand-by
+    _setModeStandby();
+    _enableInterruptCadDone();
+    // Clear any stale flags so that the CadDone we see is from this cycle
+    _bus.write(0x12, 0xff);
+    _setModeCad();  
+
+    // Use the CAD time to get the frame into the radio so that we 
+    // can start transmitting as soon as the channel is found to be idle.
+    if (!_txPreloaded) {
+        _preloadTx();
+    }
+}
+
+/**
+ * Called when the radio reports the end of a transmission.
+ */
+void RadioDriver::_eventTxDone() {   
+    _txDoneUs = _edgeUs;
+    // Stay awake for the response
+    _lplHold(LPL_HOLD_MS);
+    // Keep track of the energy saved by the transmit power control
+    if (_txPowerDbm < _profile.powerDbm) {
+        const uint32_t txUs = getAirtimeUs(_read(0x22), _txImplicitHeader);
+        _lowPowerTxCount++;
+        _rfEnergySavedUj += (txUs / 100) * 
+            (tenthsMw(_profile.powerDbm) - tenthsMw(_txPowerDbm)) / 100;
+    }
+    // Keep track of the airtime saved by the adaptive data rate
+    if (_txSf < _profile.sf) {
+        const uint8_t len = _read(0x22);
+        const uint32_t txUs = getAirtimeUs(len, _txImplicitHeader);
+        _setSf(_profile.sf);
+        _lowSfTxCount++;
+        _lowSfSavedUs += getAirtimeUs(len, _txImplicitHeader) - txUs;
+    }
+    // A broadcast goes out once on each spreading factor that the 
+    // neighbors are listening on.
+    if (_txRepeatSfMask != 0) {
+        _repeatTx();
+    }
+    // If the frame needs an ACK then listen for it before doing 
+    // anything else.
+    else if (_txAckRequired) {
+        _txAckRequired = false;
+        startAckWindow();
+    }
+    // Check for pending transmissions.  If nothing is pending then 
+    // put the radio back into receive mode.
+    else if (_txBuffer.isEmpty()) {
+        startRx();
+    }
+    // If we have pending data then send it out immediately (the assumption
+    // is that the channel is still open), unless TDMA says that it has to
+    // wait.  In that case it goes through the normal channel check.
+    else if (_isTxChainAllowed()) {
+        _startTx();
+    }
+    else {
+        startRx();
+    }
+} 
+
+/**
+ * Sends the frame that is still in the TX region of the FIFO again on 
+ * the next spreading factor.  The channel was just ours, so no CAD is done.
+ */
+void RadioDriver::_repeatTx() {
+    for (_txSf = NeighborTable::MIN_SF; _txSf < 16; _txSf++) 
+        if (_txRepeatSfMask & (1 << _txSf))
+            break;
+    _txRepeatSfMask &= ~(1 << _txSf);
+    _setModeStandby();
+    _bus.write(0x0d, fifoRegionBase(_fifoTxRegion()));
+    _setSf(_txSf);
+    _setTxPreamble();
+    _state = TX_STATE;
+    _startTxTime = _clock.time();
+    _enableInterruptTxDone();
+    if (_txTimeSync && _networkClock) {
+        _stampTimeSync();
+    }
+    _setModeTx();
+}
+
+/**
+ * Called when a complete message is received.
+ */
+void RadioDriver::_eventRxDone() {
+
+    const uint32_t serviceStartUs = _clock.timeUs();
+    _bus.beginBatch();
+
+    // Registers 0x10 (RegFifoRxCurrentAddr) through 0x1a (RegPktRssiValue)
+    // are contiguous, so everything we need to know about the frame is 
+    // picked up in one burst.
+    uint8_t regs[11];
+    _bus.readMulti(0x10, regs, sizeof(regs));
+    const uint8_t start = regs[0x10 - 0x10];
+    const uint8_t len = regs[0x13 - 0x10];
+    const uint16_t packetCount = (regs[0x16 - 0x10] << 8) | regs[0x17 - 0x10];
+    const int8_t rawSnr = (int8_t)regs[0x19 - 0x10];
+    const uint8_t rawRssi = regs[0x1a - 0x10];
+    // RegFeiMsb/Mid/Lsb hold a 20-bit signed value
+    uint8_t fei[3];
+    _bus.readMulti(0x28, fei, sizeof(fei));
+    int32_t rawFei = ((int32_t)(fei[0] & 0x0f) << 16) | (fei[1] << 8) | fei[2];
+    if (rawFei & 0x80000)
+        rawFei -= 0x100000;
+
+    const uint8_t region = fifoRegionOf(start);
+
+    // Move the receiver to the other region so that anything arriving
+    // while this frame is being read out lands somewhere else.
+    if (region == _rxRegion) {
+        _rotateRxRegion();
+    }
+    // Otherwise the frame landed in the region used for transmitting, 
+    // on top of any preloaded frame.
+    else {
+        _txPreloaded = false;
+    }
+
+    // If more than one frame has arrived since the last time we were 
+    // here then the earlier ones have been overwritten.
+    const uint16_t newPackets = packetCount - _rxPacketCount;
+    const bool overrun = newPackets > 1;
+    if (overrun) {
+        _rxOverrunCount += newPackets - 1;
+    }
+    _rxPacketCount = packetCount;
+
+    // We do nothing for zero-length messages
+    if (len == 0) {
+        _bus.endBatch();
+        return;
+    }
+
+    // Reset the FIFO read pointer to the beginning of the packet we just 
+    // got and stream received data in from the FIFO. 
+    uint8_t rxBuf[256];
+    _bus.write(0x0d, start);
+    _bus.readMulti(0x00, rxBuf, len);
+
+    _bus.endBatch();
+    
+    // Convert the SNR and RSSI values from the radio
+    int8_t lastSnr = rawSnr / 4;
+    int16_t lastRssi = rawRssi;
+    if (lastSnr < 0)
+        lastRssi = lastRssi + lastSnr;
+    else
+        lastRssi = (int)lastRssi * 16 / 15;
+    // We are using the high frequency port
+    lastRssi -= 157;
+
+    // See page 114 (the crystal is 32MHz)
+    const float feiHz = (float)rawFei * (16777216.0 / 32000000.0) * 
+        ((float)loraBandwidthHz(_read(0x1d) >> 4) / 500000.0);
+
+    RxMetadata rxMeta;
+    rxMeta.rxTimeUs = _edgeUs;
+    rxMeta.rssi = lastRssi;
+    rxMeta.snr = lastSnr;
+    rxMeta.freqErrorHz = (feiHz < 0) ? feiHz - 0.5 : feiHz + 0.5;
+    // Taken from the shadow, so this is what the radio was actually 
+    // using (including any adaptive data rate change)
+    rxMeta.sf = _read(0x1e) >> 4;
+    rxMeta.bw = _read(0x1d) >> 4;
+    rxMeta.cr = (_read(0x1d) >> 1) & 0x07;
+    rxMeta.overrun = overrun;
+    rxMeta.airtimeUs = getAirtimeUs(len, _ackWindowOpen);
+
+    // Put the metadata (OOB) and the entire packet into the circular queue for 
+    // later processing.
+    _rxBuffer.push((const uint8_t*)&rxMeta, rxBuf, len);
+
+    // Stay awake for anything that follows (e.g. a response)
+    _lplWakePending = false;
+    _lplHold(LPL_HOLD_MS);
+
+    // The ACK has arrived, so go back to explicit header mode
+    if (_ackWindowOpen) {
+        startRx();
+    }
+
+    _recordTime(_clock.timeUs() - serviceStartUs, _lastRxServiceUs, _maxRxServiceUs);
+}
+
+/**
+ * Called when the radio completes a CAD cycle and it is determined 
+ * that these is channel activity. 
+ */
+void RadioDriver::_eventCadDoneDetection() {
+
+    logger.println("INF: CadDone Detection");
+
+    // Channel is busy so revert back to listening mode so that we're
+    // ready to receive the data.  The channel access policy decides 
+    // when we can try again.
+    _channelAccess.processChannelBusy(_cadTrafficClass);
+    startRx();
+}
+
+void RadioDriver::_eventCadDoneNoDetection() {
+    // Check for pending transmissions.  If nothing is pending then 
+    // put the radio back into receive mode.
+    if (_txBuffer.isEmpty()) {
+        startRx();
+    }
+    // If something is pending then transmit it (since we've been told
+    // that the channel is innactive), unless the channel access policy 
+    // tells us to defer.
+    else if (_channelAccess.processChannelIdle(_cadTrafficClass)) {     
+        _startTx();
+        _recordTime(_clock.timeUs() - _edgeUs, _lastCadToTxUs, _maxCadToTxUs);
+    } 
+    else {
+        startRx();
+    }
+}
+
+uint8_t RadioDriver::takeIrqFlags() {
+    // Read and reset the IRQ register at the same time:
+    uint8_t irqFlags = _bus.write(0x12, 0xff);    
+    // We saw a comment in another implementation that said that there are problems
+    // clearing the ISR sometimes.  Notice we do a logical OR so we don't loose anything.
+    irqFlags |= _bus.write(0x12, 0xff);    
+    return irqFlags;
+}
+
+void RadioDriver::processIrqFlags(uint8_t irqFlags, uint32_t edgeUs) {
+    _edgeUs = edgeUs;
+    // RX timeout - ignored
+    if (irqFlags & 0x80) {
+    } 
+    // RxDone without a CRC error
+    if ((irqFlags & 0x40) && !(irqFlags & 0x20)) {
+        _eventRxDone();
+    }
+    // The radio goes back to stand-by on its own at the end of a TX or CAD
+    if (irqFlags & (0x08 | 0x04)) {
+        _shadowSet(0x01, 0x01);
+    }
+    // TxDone
+    if (irqFlags & 0x08) {
+        _eventTxDone();
+    }
+    // CadDone
+    if ((irqFlags & 0x04) && (_state == CAD || _state == LPL_CAD)) {
+        _eventCadDone(irqFlags & 0x01);
+    }
+}
+
+void RadioDriver::_eventCadDone(bool detected) {
+    if (_state == LPL_CAD) {
+        _eventLplCadDone(detected);
+    } else if (detected) {
+        _eventCadDoneDetection();
+    } else {
+        _eventCadDoneNoDetection();
+    }
+}
+
+void RadioDriver::_tickTx() {
+    // Check for the case where a transmission times out
+    if (_clock.time() - _startTxTime > TX_TIMEOUT_MS) {
+        logger.println("ERR: TX time out");
+        startRx();
+    }
+}
+
+void RadioDriver::_tickRx() {
+    // Nothing is sent while waiting for an ACK
+    if (_ackWindowOpen) {
+        const uint32_t elapsed = _clock.time() - _ackWindowStart;
+        if (elapsed > _ackWindowMs) {
+            // Let an ACK that started late finish
+            if (elapsed <= 2 * _ackWindowMs && _isRxInProgress()) {
+                return;
+            }
+            _ackWindowTimeoutCount++;
+            startRx();
+        }
+        return;
+    }
+    // Check for pending transmissions.  If nothing is pending then 
+    // return without any state change.
+    if (_txBuffer.isEmpty()) {
+        // No state change needed here
+        return;
+    }
+    // Figure out what kind of traffic is waiting so that the right
+    // contention window (or TDMA exemption) is used
+    Header header;
+    unsigned int headerLen = sizeof(Header);
+    _txBuffer.peek(0, &header, &headerLen);
+    const TrafficClass tc = ChannelAccess::classify(header);
+    // Respect any backoff, deferral or TDMA slot (the rest of which 
+    // has to have room for the whole transmission)
+    const uint32_t extraUs = _channelAccess.isTdmaActive() ? _getTxExtraUs() : 0;
+    if (_channelAccess.isCadAllowed(tc, extraUs)) {
+        // At this point we know there is something pending.  We first 
+        // go into CAD mode to make sure the channel is innactive.
+        // A successful CAD check (with no detection) will trigger 
+        // the transmission.
+        _cadTrafficClass = tc;
+        _startCad();
+    }
+}
+
+void RadioDriver::_tickCad() {
+
+    const uint32_t elapsed = _clock.time() - _startCadTime;
+    // The CAD runs at the spreading factor of the transmission, so the 
+    // times scale with the symbol time
+    const uint32_t symbolUs = getSymbolUs();
+
+    // If the CAD cycle should be finished then look at the IRQ 
+    // register directly in case the interrupt was missed.
+    if (elapsed * 1000UL >= cadPollUs(symbolUs)) {
+        uint8_t irqFlags = _bus.read(0x12);
+        if (irqFlags & 0x04) {
+            _bus.write(0x12, 0xff);
+            _shadowSet(0x01, 0x01);
+            _edgeUs = _clock.timeUs();
+            _eventCadDone(irqFlags & 0x01);
+            return;
+        }
+    }
+
+    // Check for the case where a CAD check times out.  This should not 
+    // happen, but we don't want to strand the pending transmissions.
+    uint32_t timeoutMs = (CAD_TIMEOUT_SYMBOLS * symbolUs) / 1000;
+    if (timeoutMs < CAD_TIMEOUT_MS)
+        timeoutMs = CAD_TIMEOUT_MS;
+    if (elapsed > timeoutMs) {
+        logger.println("WRN: CAD time out");
+        _edgeUs = _clock.timeUs();
+        _eventCadDone(false);
+    }
+}
+
+void RadioDriver::tick() {
+    // Profile changes wait until nothing is going on
+    if (_profilePending && _state == RX_STATE && !_ackWindowOpen) {
+        _applyProfile();
+        startRx();
+    }
+    if (_state == RX_STATE && !_ackWindowOpen) {
+        _updateListenSf();
+    }
+    if (_state == RX_STATE && _isLplSleepDue()) {
+        if (_lplWakePending) {
+            _lplFalseWakeCount++;
+            _lplWakePending = false;
+        }
+        _enterSleep();
+        _state = LPL_SLEEP;
+        _lplSampleTime = _clock.time();
+    }
+    if (_state == RX_STATE) {
+        _tickRx();
+    } else if (_state == TX_STATE) {
+        _tickTx();
+    } else if (_state == CAD || _state == LPL_CAD) {
+        _tickCad();
+    } else if (_state == LPL_SLEEP) {
+        _tickLplSleep();
+    }
+}
+
+// ----- Low Power Listening -----------------------------------------------
+
+void RadioDriver::setLplInterval(uint16_t ms) {
+    _lplIntervalMs = ms;
+    _lplHold(LPL_HOLD_MS);
+    // Turning it off takes effect right away
+    if (ms == 0 && _state == LPL_SLEEP) {
+        startRx();
+    }
+}
+
+uint32_t RadioDriver::getLplSleepMs() const {
+    if (_state != LPL_SLEEP)
+        return 0;
+    const uint32_t elapsed = _clock.time() - _lplSampleTime;
+    return (elapsed >= _lplIntervalMs) ? 0 : _lplIntervalMs - elapsed;
+}
+
+void RadioDriver::_lplHold(uint32_t ms) {
+    _lplHoldStart = _clock.time();
+    _lplHoldMs = ms;
+}
+
+/**
+ * The receiver can go to sleep when nothing is going on and nothing has 
+ * happened for the hold time.
+ */
+bool RadioDriver::_isLplSleepDue() {
+    if (_lplIntervalMs == 0 || _ackWindowOpen || _profilePending ||
+        !_txBuffer.isEmpty()) 
+        return false;
+    if (_clock.time() - _lplHoldStart < _lplHoldMs)
+        return false;
+    return !_isRxInProgress();
+}
+
+void RadioDriver::_tickLplSleep() {
+    // Pending transmissions (and profile changes) are handled in the 
+    // normal receive state
+    if (!_txBuffer.isEmpty() || _profilePending) {
+        startRx();
+    } else if (_clock.time() - _lplSampleTime >= _lplIntervalMs) {
+        _startLplSample();
+    }
+}
+
+/**
+ * A CAD cycle finds a preamble in about two symbols, which is much less
+ * energy than listening.
+ */
+void RadioDriver::_startLplSample() {
+    _leaveSleep();
+    _lplSampleCount++;
+    _lplSampleTime = _clock.time();
+    _state = LPL_CAD;
+    _startCadTime = _clock.time();
+    // CAD can only be started from stand-by
+    _setModeStandby();
+    _enableInterruptCadDone();
+    _bus.write(0x12, 0xff);
+    _setModeCad();
+}
+
+void RadioDriver::_eventLplCadDone(bool detected) {
+    // Activity means that a neighbor may be sending us a long preamble.
+    // Listen for the rest of it (up to an interval) and the longest 
+    // possible frame.
+    if (detected) {
+        _lplWakeCount++;
+        _lplWakePending = true;
+        startRx();
+        _lplHold(_lplIntervalMs + getAirtimeUs(MAX_FRAME_LEN, false) / 1000 +
+            LPL_RX_MARGIN_MS);
+    } else if (_lplIntervalMs != 0 && _txBuffer.isEmpty() && !_profilePending) {
+        _enterSleep();
+        _state = LPL_SLEEP;
+    } else {
+        startRx();
+    }
+}
+
+// ----- Configuration -----------------------------------------------------
+
+// See page 103
+void RadioDriver::setFrequency(float freqMhz) {
+    const float CRYSTAL_MHZ = 32000000.0;
+    const float FREQ_STEP = (CRYSTAL_MHZ / 524288);
+    const uint32_t f = (freqMhz * 1000000.0) / FREQ_STEP;
+    _write(0x06, (f >> 16) & 0xff);
+    _write(0x07, (f >> 8) & 0xff);
+    _write(0x08, f & 0xff);
+}
+
+/**
+ * Sets the Over Current Protection register.
+ */
+void RadioDriver::_setOcp(uint8_t currentMa) {
+    uint8_t trim = 27;
+    if (currentMa <= 120) {
+        trim = (currentMa - 45) / 5;
+    } else if (currentMa <= 240) {
+        trim = (currentMa + 30) / 10;
+    }
+    _write(0x0b, 0x20 | (0x1F & trim));
+}
+
+/**
+ * The modem configuration can only be changed in stand-by, so the radio
+ * is only disturbed if the header mode actually changes.
+ */
+void RadioDriver::_setImplicitHeader(bool implicitHeader) {
+    const uint8_t current = _read(0x1d);
+    const uint8_t reg = (current & ~0x01) | (implicitHeader ? 0x01 : 0x00);
+    if (reg != current) {
+        _setModeStandby();
+        _write(0x1d, reg);
+    }
+}
+
+/**
+ * Like the header mode, the spreading factor can only be changed in 
+ * stand-by.  The low data rate optimization depends on it.
+ */
+void RadioDriver::_setSf(uint8_t sf) {
+    const uint8_t current = _read(0x1e);
+    const uint8_t reg = (current & 0x0f) | (sf << 4);
+    if (reg != current) {
+        _setModeStandby();
+        _write(0x1e, reg);
+        _setLowDatarate();
+    }
+}
+
+void RadioDriver::setNeighborTable(const NeighborTable* neighborTable) {
+    _neighborTable = neighborTable;
+}
+
+/**
+ * Moves the receiver to the spreading factor that the neighbors need.
+ * A move is announced in the probes and made at the end of the next 
+ * rendezvous window, which is when the neighbors make it too.  The 
+ * window has to line up with the neighbors, so the receiver stays on 
+ * the profile spreading factor until the network time is known.
+ */
+void RadioDriver::_updateListenSf() {
+    if (_neighborTable == 0 || _networkClock == 0 || 
+        !_networkClock->isSynced()) {
+        _listenSf = _profile.sf;
+        _nextListenSf = 0;
+        _rendezvous = false;
+    } else {
+        const bool rendezvous = 
+            NeighborTable::isRendezvous(_networkClock->getNetworkUs());
+        // Nothing is decided during the window so that every probe sent
+        // in it announces the same move
+        if (_rendezvous && !rendezvous) {
+            if (_nextListenSf != 0) 
+                _listenSf = _nextListenSf;
+            _nextListenSf = 0;
+        } else if (!rendezvous) {
+            const uint8_t sf = _neighborTable->getListenSf(_profile.sf, _listenSf);
+            _nextListenSf = (sf == _listenSf) ? 0 : sf;
+        }
+        _rendezvous = rendezvous;
+    }
+    // Don't pull the receiver off a frame that is coming in
+    if ((_read(0x1e) >> 4) != _getRxSf() && !_isRxInProgress()) {
+        startRx();
+    }
+}
+
+uint8_t RadioDriver::_getRxSf() const {
+    return _rendezvous ? _profile.sf : _listenSf;
+}
+
+bool RadioDriver::_isRendezvousWindow() const {
+    return _networkClock && _networkClock->isSynced() && 
+        NeighborTable::isRendezvous(_networkClock->getNetworkUs());
+}
+
+/**
+ * RegModemStat bit 0 is set while a frame is on its way in.
+ */
+bool RadioDriver::_isRxInProgress() {
+    return (_bus.read(0x18) & 0x01) != 0;
+}
+
+/**
+ * The time from the end of a frame until the receiver can start sending
+ * the ACK: the receive processing and a CAD (about two symbols, but 
+ * at least until the CAD is polled).
+ */
+uint32_t RadioDriver::_getAckTurnaroundMs() {
+    return ACK_TURNAROUND_MS + (cadPollUs(getSymbolUs()) + 999) / 1000;
+}
+
+void RadioDriver::_setPreambleLen(uint16_t symbols) {
+    _write(0x20, symbols >> 8);
+    _write(0x21, symbols & 0xff);
+}
+
+/**
+ * A receiver that is sampling the channel finds the frame during its 
+ * preamble, so the preamble has to span the whole sampling interval 
+ * (plus the CAD) and still leave enough for the receiver to lock on.  
+ * The number of symbols depends on the spreading factor, so this is 
+ * called after the spreading factor of the transmission has been set.
+ */
+void RadioDriver::_setTxPreamble() {
+    _setPreambleLen(_getLplPreambleLen(_txWakeIntervalMs, getSymbolUs()));
+    if (_txWakeIntervalMs != 0) {
+        _longPreambleTxCount++;
+    }
+}
+
+uint32_t RadioDriver::_getLplPreambleLen(uint16_t wakeIntervalMs, 
+    uint32_t symbolUs) {
+    if (wakeIntervalMs == 0) 
+        return PREAMBLE_LEN;
+    uint32_t symbols = ((uint32_t)wakeIntervalMs * 1000UL + cadPollUs(symbolUs)) / 
+        symbolUs + 2 * PREAMBLE_LEN;
+    if (symbols > MAX_PREAMBLE_LEN)
+        symbols = MAX_PREAMBLE_LEN;
+    return symbols;
+}
+
+/**
+ * The time that the frame at the front of the TX queue will occupy the 
+ * channel beyond a normal exchange (see ChannelAccess::setTdmaTiming), 
+ * which allows for one frame of the longest length on the profile 
+ * spreading factor with the normal preamble.  The spreading factor(s) 
+ * and the preamble are picked the same way as in _writeMessage().
+ */
+uint32_t RadioDriver::_getTxExtraUs() {
+    if (_neighborTable == 0) 
+        return 0;
+    unsigned int len = MAX_FRAME_LEN;
+    uint8_t buf[MAX_FRAME_LEN];
+    _txBuffer.peek(0, buf, &len);
+    if (len < sizeof(Header))
+        return 0;
+    Header header;
+    memcpy(&header, buf, sizeof(Header));
+    if (header.isAck())
+        return 0;
+    uint16_t sfMask;
+    uint16_t wakeIntervalMs;
+    if (header.getDestAddr() == BROADCAST_ADDR) {
+        sfMask = _neighborTable->getBroadcastSfMask(_profile.sf);
+        wakeIntervalMs = _neighborTable->getMaxWakeIntervalMs();
+    } else {
+        sfMask = 1 << _neighborTable->getTxSf(header.getDestAddr(), _profile.sf);
+        wakeIntervalMs = _neighborTable->getWakeIntervalMs(header.getDestAddr());
+    }
+    if (_isRendezvousWindow()) {
+        sfMask = 1 << _profile.sf;
+    }
+    if (header.getType() == TYPE_TIME_SYNC) {
+        wakeIntervalMs = 0;
+    }
+    const uint32_t bwHz = loraBandwidthHz(_profile.bw);
+    uint32_t totalUs = 0;
+    for (uint8_t sf = NeighborTable::MIN_SF; sf < 16; sf++) {
+        if (!(sfMask & (1 << sf)))
+            continue;
+        const uint32_t symbolUs = loraSymbolUs(sf, bwHz);
+        totalUs += loraAirtimeUs(sf, bwHz, _profile.cr, len, 
+            _getLplPreambleLen(wakeIntervalMs, symbolUs), true, false, 
+            symbolUs > 16000);
+    }
+    const uint32_t profileSymbolUs = loraSymbolUs(_profile.sf, bwHz);
+    const uint32_t normalUs = loraAirtimeUs(_profile.sf, bwHz, _profile.cr, 
+        MAX_FRAME_LEN, PREAMBLE_LEN, true, false, profileSymbolUs > 16000);
+    return (totalUs > normalUs) ? totalUs - normalUs : 0;
+}
+
+/**
+ * A frame that is waiting when a transmission ends is normally sent 
+ * right away.  In TDMA mode it also has to belong in the slot that is
+ * in progress and fit in the rest of it (e.g. not after an ACK that we 
+ * sent in someone else's slot).
+ */
+bool RadioDriver::_isTxChainAllowed() {
+    if (!_channelAccess.isTdmaActive())
+        return true;
+    Header header;
+    unsigned int headerLen = sizeof(Header);
+    _txBuffer.peek(0, &header, &headerLen);
+    return _channelAccess.isCadAllowed(ChannelAccess::classify(header), 
+        _getTxExtraUs());
+}
+
+uint32_t RadioDriver::getSymbolUs() {
+    return loraSymbolUs(_read(0x1e) >> 4, loraBandwidthHz(_read(0x1d) >> 4));
+}
+
+uint32_t RadioDriver::getAirtimeUs(uint8_t len, bool implicitHeader) {
+    const uint8_t bw = _read(0x1d) >> 4;
+    const uint8_t cr = (_read(0x1d) >> 1) & 0x07;
+    const uint8_t sf = _read(0x1e) >> 4;
+    const bool crcOn = (_read(0x1e) & 0x04) != 0;
+    const uint16_t preambleLen = (_read(0x20) << 8) | _read(0x21);
+    const bool ldro = (_read(0x26) & 0x08) != 0;
+    return loraAirtimeUs(sf, loraBandwidthHz(bw), cr, len, preambleLen, 
+        crcOn, implicitHeader, ldro);
+}
+
+void RadioDriver::_setLowDatarate() {
+
+    // called after changing bandwidth and/or spreading factor
+    //  Semtech modem design guide AN1200.13 says 
+    // "To avoid issues surrounding  drift  of  the  crystal  reference  oscillator  due  to  either  temperature  change  
+    // or  motion,the  low  data  rate optimization  bit  is  used. Specifically for 125  kHz  bandwidth  and  SF  =  11  and  12,  
+    // this  adds  a  small  overhead  to increase robustness to reference frequency variations over the timescale of the LoRa packet."
+ 
+    // calculate symbol time (see Semtech AN1200.22 section 4)
+    const uint32_t symbolUs = getSymbolUs();
+   
+    // the symbolTime for SF 11 BW 125 is 16.384ms. 
+    // and, according to this :- 
+    // https://www.thethingsnetwork.org/forum/t/a-point-to-note-lora-low-data-rate-optimisation-flag/12007
+    // the LDR bit should be set if the Symbol Time is > 16ms
+    // So the threshold used here is 16ms
+ 
+    // the LDR is bit 3 of register 0x26
+    uint8_t current = _read(0x26) & ~0x08; // mask off the LDR bit
+    if (symbolUs > 16000)
+      _write(0x26, current | 0x08);
+    else
+      _write(0x26, current);   
+}
+
+/**
+ * The RFM95W only has the PA_BOOST pin wired.  Above 17dBm the high 
+ * power setting of the PA DAC adds 3dB (see page 104).
+ */
+void RadioDriver::_setTxPower(uint8_t dbm) {
+    if (dbm > 20) 
+        dbm = 20;
+    else if (dbm < 2)
+        dbm = 2;
+    if (dbm > 17) {
+        // DAC enable (adds 3dB)
+        _write(0x4d, 0x87);
+        // PaSelect=1
+        _write(0x09, 0x80 | ((dbm - 3) - 2));
+    } else {
+        _write(0x4d, 0x84);
+        _write(0x09, 0x80 | (dbm - 2));
+    }
+}
+
+/**
+ * The modem configuration can only be changed in stand-by.  The header 
+ * mode is left alone.
+ */
+void RadioDriver::_applyProfile() {
+
+    _setModeStandby();
+
+    // 7-4: Bandwidth
+    // 3-1: Coding rate
+    // 0:   Header mode
+    _write(0x1d, (_profile.bw << 4) | (_profile.cr << 1) | (_read(0x1d) & 0x01));
+
+    // 7-4:   Spreading factor
+    // 3:     0 (RX continuous mode normal)
+    // 2:     1 (CRC mode on)
+    // 1-0:   RX timeout MSB
+    _write(0x1e, (_profile.sf << 4) | 0x04 | (_read(0x1e) & 0x03));
+    _listenSf = _profile.sf;
+    _nextListenSf = 0;
+
+    _setTxPower(_profile.powerDbm);
+
+    // This depends on the symbol time
+    _setLowDatarate();
+
+    // A TDMA slot needs room for a CAD, the longest frame and its ACK
+    _channelAccess.setTdmaTiming(
+        cadPollUs(getSymbolUs()) + getAirtimeUs(MAX_FRAME_LEN, false) + 
+        _getAckTurnaroundMs() * 1000 + getAirtimeUs(ACK_FRAME_LEN, true),
+        2 * getSymbolUs() + TDMA_SYNC_ERROR_US);
+
+    _profilePending = false;
+}
+
+void RadioDriver::setProfile(const RadioProfile& profile) {
+    _profile = profile;
+    _profilePending = true;
+}
+
+int RadioDriver::init(float freqMhz) {
+
+    // Check the radio version to make sure things are connected
+    uint8_t ver = _bus.read(0x42);
+    if (ver != 18) {
+        return -1;
+    }
+
+    // Switch into Sleep mode, LoRa mode
+    _write(0x01, 0x80);
+    // Wait for sleep mode 
+    delay(10); 
+
+    // Make sure we are actually in sleep mode
+    if (_bus.read(0x01) != 0x80) {
+        return -1; 
+    }
+
+    // Setup the FIFO pointers.  Anything that was in the FIFO is gone.
+    _rxRegion = 0;
+    _rxPacketCount = 0;
+    _txPreloaded = false;
+    // TX base:
+    _write(0x0e, fifoRegionBase(_fifoTxRegion()));
+    // RX base:
+    _write(0x0f, fifoRegionBase(_rxRegion));
+    // Anything larger than a region is rejected so that the receiver
+    // doesn't run into the other region
+    _write(0x23, MAX_FRAME_LEN);
+
+    setFrequency(freqMhz);
+
+    // Set LNA boost
+    _write(0x0c, _read(0x0c) | 0x03);
+
+    // AgcAutoOn=LNA gain set by AGC
+    _write(0x26, 0x04);
+
+    // Set OCP to 140 (as per the Sandeep Mistry library)
+    _setOcp(140);
+
+    // Go into stand-by
+    _setModeStandby();
+    _state = IDLE;
+
+    // Make sure none of the interrupts are masked (in particular 
+    // CadDone and CadDetected)
+    _write(0x11, 0x00);
+
+    // Explicit header mode (ACKs switch to implicit header mode as needed)
+    _write(0x1d, _read(0x1d) & ~0x01);
+
+    // Preamble Length=8 (default).  This is lengthened for frames that
+    // need to wake up a neighbor that is sampling the channel.
+    _setPreambleLen(PREAMBLE_LEN);
+
+    // Modem configuration and transmit power
+    _applyProfile();
+
+    return 0;
+}
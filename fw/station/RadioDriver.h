@@ -0,0 +1,488 @@
+/* 
+ * LoRa Birdhouse Mesh Network Project
+ * Wellesley Amateur Radio Society
+ * 
+ * Copyright (C) 2022 Bruce MacKinnon
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _RadioDriver_h
+#define _RadioDriver_h
+
+#include <stdint.h>
+
+#include "Clock.h"
+#include "CircularBuffer.h"
+#include "ChannelAccess.h"
+#include "RegisterBus.h"
+#include "RadioProfile.h"
+#include "NeighborTable.h"
+#include "NetworkClock.h"
+
+// The time we will wait for a TxDone interrupt before giving up.  This should
+// be an unusual case.
+#define TX_TIMEOUT_MS (30 * 1000)
+// A CAD cycle takes a little under two symbol periods (~8ms at SF9/125kHz,
+// ~62ms at SF12/125kHz).  If the CadDone interrupt hasn't been seen after
+// CAD_POLL_SYMBOLS (and at least CAD_POLL_MS) then the IRQ register is 
+// polled directly.
+#define CAD_POLL_SYMBOLS 2
+#define CAD_POLL_MS 6
+// The time we will wait for CadDone before giving up (CAD_TIMEOUT_SYMBOLS,
+// and at least CAD_TIMEOUT_MS).  This should be an unusual case.
+#define CAD_TIMEOUT_SYMBOLS 8
+#define CAD_TIMEOUT_MS 50
+
+// The 256-byte radio FIFO is split into two regions.  The receiver 
+// alternates between the regions (by rotating RegFifoRxBaseAddr) so 
+// that a frame that arrives while the previous one is still being 
+// read out doesn't overwrite it.  The transmitter uses whichever 
+// region the receiver is not filling.  Frames are never more than 
+// 128 bytes.
+#define FIFO_REGION_COUNT 2
+#define FIFO_REGION_SIZE 0x80
+#define MAX_FRAME_LEN FIFO_REGION_SIZE
+
+// The highest register address that is tracked in the shadow copy
+#define SHADOW_REG_MAX 0x70
+
+// ACKs always have the same length, so they are sent in implicit header
+// mode (no LoRa header).  Everything else is sent in explicit header mode.
+// After sending a frame that needs an ACK the receiver listens in implicit
+// header mode for long enough to hear the ACK and then goes back to 
+// explicit header mode.
+#define ACK_FRAME_LEN (sizeof(Header) + sizeof(AckPayload))
+// The time allowed for the other station to read the frame out and 
+// queue the ACK.  The CAD that the other station does before sending 
+// and the ACK airtime are added to this to get the length of the ACK 
+// window.  An ACK that is still coming in when the window closes is 
+// given up to another window to finish.
+#define ACK_TURNAROUND_MS 50
+
+// The TDMA guard time at each end of a slot is two symbols (for the 
+// radio's own timing) plus this allowance for the error in the 
+// network time.
+#define TDMA_SYNC_ERROR_US 5000
+
+// The normal preamble length (in symbols).  This is also the shortest
+// preamble that a receiver can lock on to.
+#define PREAMBLE_LEN 8
+#define MAX_PREAMBLE_LEN 0xffff
+// When low power listening is being used the receiver is put to sleep
+// after this long with nothing going on.  This gives the other station 
+// time to send back a response (or an ACK) to a frame.
+#define LPL_HOLD_MS 250
+// The extra time that the receiver stays on after a channel sample finds
+// activity, beyond the rest of the longest possible preamble and the 
+// longest frame.
+#define LPL_RX_MARGIN_MS 50
+
+/**
+ * @brief The SX1276 driver and the RX/CAD/TX state machine.  
+ * 
+ * Outbound frames are taken from the TX queue and received frames
+ * (along with their RxMetadata) are put onto the RX queue.  The radio
+ * is accessed through a RegisterBus so that the whole state machine 
+ * can be run against a fake radio.
+ * 
+ * The interrupt service routine only records the time of the edge 
+ * (see EdgeTimeQueue) and sets a flag.  Everything else happens on 
+ * the main loop: the IRQ flags are taken from the radio using 
+ * takeIrqFlags() and then dispatched, along with the edge time, using
+ * processIrqFlags().
+ * tick() must be called regularly to start channel checks and to 
+ * look for timeouts.
+ */
+class RadioDriver {
+public:
+
+    // The states of the state machine
+    enum State { IDLE, RX_STATE, TX_STATE, CAD, LPL_SLEEP, LPL_CAD };
+
+    RadioDriver(RegisterBus& bus, const Clock& clock, 
+        CircularBuffer& txBuffer, CircularBuffer& rxBuffer,
+        ChannelAccess& channelAccess);
+
+    /**
+     * @brief Loads the register shadow from the radio.  Must be 
+     * called after every hardware reset.
+     */
+    void syncShadow();
+
+    /**
+     * @brief All of the one-time initialization of the radio.  The radio
+     * is left in stand-by.
+     * 
+     * @return 0 on success, -1 if the radio isn't responding properly.
+     */
+    int init(float freqMhz);
+
+    /**
+     * @brief Sets the radio frequency from a decimal value that is 
+     * quoted in MHz.
+     */
+    void setFrequency(float freqMhz);
+
+    /**
+     * @brief Selects the modem settings and transmit power.  If the radio
+     * has been initialized then the change is made the next time the 
+     * radio is listening (i.e. not in the middle of a transmission, a 
+     * channel check or an ACK window), without a reset.
+     */
+    void setProfile(const RadioProfile& profile);
+
+    const RadioProfile& getProfile() const { return _profile; }
+
+    /**
+     * @brief Turns on the adaptive data rate and transmit power control.
+     * The receiver listens on the spreading factor that the neighbor 
+     * table says is needed to hear all of the neighbors, unicast frames
+     * are sent on the spreading factor that the destination is listening
+     * on (at the power that the neighbor table picks for it), and 
+     * broadcasts are sent at full power once on each spreading factor 
+     * in use by the neighbors.  Passing 0 turns this off.
+     */
+    void setNeighborTable(const NeighborTable* neighborTable);
+
+    /**
+     * @brief Time sync beacons are stamped with the network time just 
+     * before their transmission is started.  The adaptive data rate 
+     * also needs the network time to line up the rendezvous window with
+     * the neighbors.  Passing 0 turns this off.
+     */
+    void setNetworkClock(const NetworkClock* networkClock) { _networkClock = networkClock; }
+
+    /**
+     * @brief Turns on low power listening.  Whenever nothing is going on
+     * the radio is put to sleep and woken up once every interval to 
+     * sample the channel with a CAD.  The receiver is only turned on when
+     * the sample finds activity.  Neighbors learn the interval from our
+     * link probes and send us frames with a preamble that is longer than
+     * the interval.  Passing 0 turns this off.
+     */
+    void setLplInterval(uint16_t ms);
+
+    uint16_t getLplInterval() const { return _lplIntervalMs; }
+
+    /**
+     * @return The time (in milliseconds) until the next channel sample
+     *   is due, or zero if the receiver isn't sleeping between samples.
+     *   The processor can sleep for this long.
+     */
+    uint32_t getLplSleepMs() const;
+
+    /**
+     * @return The spreading factor that the receiver is using (outside
+     *   of the rendezvous window).
+     */
+    uint8_t getListenSf() const { return _listenSf; }
+
+    /**
+     * @return The spreading factor that the receiver will move to at 
+     *   the end of the next rendezvous window, or zero if no move is 
+     *   planned.  This is announced in the link probes.
+     */
+    uint8_t getNextListenSf() const { return _nextListenSf; }
+
+    /**
+     * @return The symbol time using the current modem configuration.
+     */
+    uint32_t getSymbolUs();
+
+    /**
+     * @brief Put the radio RXCONTINUOUS mode and enable the RxDone interrupt.
+     */
+    void startRx();
+
+    /**
+     * @brief Put the radio into RXCONTINUOUS mode in implicit header mode
+     * to wait for an ACK.  The radio goes back to normal receive mode 
+     * when the ACK arrives or the ACK window closes.  No transmissions 
+     * are started while the ACK window is open.
+     */
+    void startAckWindow();
+
+    bool isAckWindowOpen() const { return _ackWindowOpen; }
+
+    /**
+     * @brief The length of the ACK window on the current profile.  It
+     * stays open for up to twice this while an ACK is coming in.
+     */
+    uint32_t getAckWindowMs();
+
+    /**
+     * @return The airtime of a frame using the current modem 
+     *   configuration.
+     */
+    uint32_t getAirtimeUs(uint8_t len, bool implicitHeader);
+
+    /**
+     * @brief Used after a wake-up from deep sleep to pick up where we 
+     * left off.  The radio is assumed to still be listening.
+     */
+    void resumeRx();
+
+    /**
+     * @brief Puts the radio into SLEEP mode.
+     */
+    void sleep();
+
+    /**
+     * @brief Brings the radio back from sleep() and starts receiving.
+     * The register settings are kept in SLEEP mode but the FIFO 
+     * contents are not.
+     */
+    void wake();
+
+    /**
+     * @brief Reads and clears the radio's IRQ flags.
+     */
+    uint8_t takeIrqFlags();
+
+    /**
+     * @brief Handles the events reported in the IRQ flags.
+     * 
+     * @param edgeUs The time (on the microsecond clock) that the ISR 
+     *   saw the interrupt.  This is used to time stamp received frames 
+     *   and the end of transmissions, since the main loop may get 
+     *   around to the radio much later.
+     */
+    void processIrqFlags(uint8_t irqFlags, uint32_t edgeUs);
+
+    /**
+     * @brief Handles the events reported in the IRQ flags when the time
+     * of the interrupt isn't known.
+     */
+    void processIrqFlags(uint8_t irqFlags) { 
+        processIrqFlags(irqFlags, _clock.timeUs()); 
+    }
+
+    /**
+     * @brief Call periodically to look for timeouts or other pending 
+     * activity.
+     */
+    void tick();
+
+    State getState() const { return _state; }
+
+    uint32_t getCadToTxUs() const { return _lastCadToTxUs; }
+    uint32_t getMaxCadToTxUs() const { return _maxCadToTxUs; }
+    uint16_t getTxPreloadHits() const { return _preloadHitCount; }
+    uint16_t getTxPreloadMisses() const { return _preloadMissCount; }
+    uint16_t getRxOverruns() const { return _rxOverrunCount; }
+    uint32_t getRxServiceUs() const { return _lastRxServiceUs; }
+    uint32_t getMaxRxServiceUs() const { return _maxRxServiceUs; }
+    uint32_t getTxServiceUs() const { return _lastTxServiceUs; }
+    uint32_t getMaxTxServiceUs() const { return _maxTxServiceUs; }
+    uint32_t getRegWriteSkips() const { return _regWriteSkipCount; }
+    uint16_t getAckWindowTimeouts() const { return _ackWindowTimeoutCount; }
+    /**
+     * @return The time (on the microsecond clock) that the most recent
+     *   transmission ended.
+     */
+    uint32_t getTxDoneUs() const { return _txDoneUs; }
+    /**
+     * @return The number of transmissions made below the profile 
+     *   spreading factor, and the airtime (in microseconds) that this
+     *   saved.
+     */
+    uint16_t getLowSfTxCount() const { return _lowSfTxCount; }
+    uint32_t getLowSfSavedUs() const { return _lowSfSavedUs; }
+    /**
+     * @return The number of transmissions made below the profile 
+     *   power, and the RF energy (in microjoules) that this saved.
+     */
+    uint16_t getLowPowerTxCount() const { return _lowPowerTxCount; }
+    uint32_t getRfEnergySavedUj() const { return _rfEnergySavedUj; }
+    /**
+     * @return The fraction of the time (in tenths of a percent) since the 
+     *   counters were reset that the radio has been out of SLEEP mode.
+     */
+    uint16_t getRadioOnPermille() const;
+    uint32_t getLplSampleCount() const { return _lplSampleCount; }
+    uint16_t getLplWakeCount() const { return _lplWakeCount; }
+    uint16_t getLplFalseWakeCount() const { return _lplFalseWakeCount; }
+    uint16_t getLongPreambleTxCount() const { return _longPreambleTxCount; }
+
+    void resetCounters();
+
+private:
+
+    void _startTx();
+    void _startCad();
+    void _preloadTx();
+    void _writeMessage(const uint8_t* data, uint8_t len);
+    void _stampTimeSync();
+
+    void _eventTxDone();
+    void _eventRxDone();
+    void _eventCadDoneDetection();
+    void _eventCadDoneNoDetection();
+    void _tickRx();
+    void _tickTx();
+    void _tickCad();
+    void _eventCadDone(bool detected);
+    void _eventLplCadDone(bool detected);
+    void _tickLplSleep();
+    void _startLplSample();
+    void _lplHold(uint32_t ms);
+    bool _isLplSleepDue();
+
+    void _enterSleep();
+    void _leaveSleep();
+
+    uint8_t _fifoTxRegion() const;
+    void _rotateRxRegion();
+    void _setLowDatarate();
+    void _setTxPower(uint8_t dbm);
+    void _applyProfile();
+    void _setImplicitHeader(bool implicitHeader);
+    void _setSf(uint8_t sf);
+    void _updateListenSf();
+    uint8_t _getRxSf() const;
+    bool _isRendezvousWindow() const;
+    void _repeatTx();
+    void _startRx(bool implicitHeader);
+    void _setOcp(uint8_t currentMa);
+    uint32_t _getAckTurnaroundMs();
+    bool _isRxInProgress();
+    void _setPreambleLen(uint16_t symbols);
+    void _setTxPreamble();
+    static uint32_t _getLplPreambleLen(uint16_t wakeIntervalMs, uint32_t symbolUs);
+    uint32_t _getTxExtraUs();
+    bool _isTxChainAllowed();
+
+    static bool _isCacheable(uint8_t reg);
+    uint8_t _read(uint8_t reg);
+    void _write(uint8_t reg, uint8_t val);
+    void _shadowSet(uint8_t reg, uint8_t val);
+
+    // The LoRa mode bit can only change in SLEEP mode, so it is kept set
+    void _setModeSleep() { _write(0x01, 0x80); }
+    void _setModeStandby() { _write(0x01, 0x01); }
+    void _setModeTx() { _write(0x01, 0x03); }
+    void _setModeRxContinuous() { _write(0x01, 0x05); }
+    void _setModeCad() { _write(0x01, 0x07); }
+
+    // See table 17 - DIO0 is controlled by bits 7-6
+    void _enableInterruptTxDone() { _write(0x40, 0x40); }
+    void _enableInterruptRxDone() { _write(0x40, 0x00); }
+    // DIO0 is controlled by bits 7-6 (10=CadDone) and DIO1 is controlled 
+    // by bits 5-4 (10=CadDetected).  Only DIO0 is wired on this board, 
+    // so CadDetected is read from the IRQ register.
+    void _enableInterruptCadDone() { _write(0x40, 0xa0); }
+
+    static void _recordTime(uint32_t us, uint32_t& last, uint32_t& max);
+
+    RegisterBus& _bus;
+    const Clock& _clock;
+    CircularBuffer& _txBuffer;
+    CircularBuffer& _rxBuffer;
+    ChannelAccess& _channelAccess;
+
+    State _state;
+    // The time when we started the last transmission.  This is needed 
+    // to create a timeout on transmissions so we don't accidentally get 
+    // stuck in a transmission.
+    uint32_t _startTxTime;
+    // The time when we started the CAD (channel activity detect).
+    uint32_t _startCadTime;
+    // The time of the interrupt that is being handled
+    uint32_t _edgeUs;
+    // The time that the most recent transmission ended
+    uint32_t _txDoneUs;
+    // The traffic class of the packet that the CAD is being done for
+    TrafficClass _cadTrafficClass;
+    // Indicates that the frame at the front of the TX queue has already
+    // been loaded into the TX region of the radio FIFO.
+    bool _txPreloaded;
+    // Describe the frame that is in the TX region of the radio FIFO
+    bool _txImplicitHeader;
+    bool _txAckRequired;
+    // The spreading factor for the frame in the TX region, and any other
+    // spreading factors that a broadcast still needs to be sent on 
+    // (bit N is set for SF N)
+    uint8_t _txSf;
+    uint16_t _txRepeatSfMask;
+    uint8_t _txPowerDbm;
+    // Indicates that the frame in the TX region is a time sync beacon
+    bool _txTimeSync;
+    // The longest sampling interval of the receiver(s) of the frame in
+    // the TX region (0 if they are always listening)
+    uint16_t _txWakeIntervalMs;
+    // Indicates that the receiver is waiting for an ACK in implicit
+    // header mode
+    bool _ackWindowOpen;
+    uint32_t _ackWindowStart;
+    uint32_t _ackWindowMs;
+    // The modem settings, and whether they still need to be given to 
+    // the radio
+    RadioProfile _profile;
+    bool _profilePending;
+    // Adaptive data rate (0 if not in use)
+    const NeighborTable* _neighborTable;
+    // Used to stamp time sync beacons (0 if not in use)
+    const NetworkClock* _networkClock;
+    uint8_t _listenSf;
+    uint8_t _nextListenSf;
+    // Indicates that the rendezvous window was open at the last check
+    bool _rendezvous;
+    // The FIFO region that the receiver is currently filling
+    uint8_t _rxRegion;
+    // The value of RegRxPacketCnt the last time a frame was read out.  The
+    // radio clears this counter every time it enters receive mode.
+    uint16_t _rxPacketCount;
+    // Low power listening (interval is 0 if not in use).  The receiver 
+    // is kept on for the hold time after anything happens.
+    uint16_t _lplIntervalMs;
+    uint32_t _lplHoldStart;
+    uint32_t _lplHoldMs;
+    uint32_t _lplSampleTime;
+    // Indicates that a channel sample found activity and no frame has
+    // been received yet
+    bool _lplWakePending;
+    // Indicates that the radio is in SLEEP mode, and since when
+    bool _sleeping;
+    uint32_t _sleepStart;
+
+    // A copy of the radio's configuration registers.  Reads of these 
+    // registers come from RAM and writes that wouldn't change anything 
+    // are skipped. 
+    uint8_t _shadow[SHADOW_REG_MAX + 1];
+    bool _shadowValid;
+
+    uint32_t _lastCadToTxUs;
+    uint32_t _maxCadToTxUs;
+    uint16_t _preloadHitCount;
+    uint16_t _preloadMissCount;
+    uint16_t _rxOverrunCount;
+    uint32_t _lastRxServiceUs;
+    uint32_t _maxRxServiceUs;
+    uint32_t _lastTxServiceUs;
+    uint32_t _maxTxServiceUs;
+    uint32_t _regWriteSkipCount;
+    uint16_t _ackWindowTimeoutCount;
+    uint16_t _lowSfTxCount;
+    uint32_t _lowSfSavedUs;
+    uint16_t _lowPowerTxCount;
+    uint32_t _rfEnergySavedUj;
+    uint32_t _countersStart;
+    uint32_t _sleepMs;
+    uint32_t _lplSampleCount;
+    uint16_t _lplWakeCount;
+    uint16_t _lplFalseWakeCount;
+    uint16_t _longPreambleTxCount;
+};
+
+#endif
@@ -0,0 +1,109 @@
+/* 
+ * LoRa Birdhouse Mesh Network Project
+ * Wellesley Amateur Radio Society
+ * 
+ * Copyright (C) 2022 Bruce MacKinnon
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _RadioProfile_h
+#define _RadioProfile_h
+
+#include <stdint.h>
+#include <string.h>
+
+#define RADIO_PROFILE_COUNT 4
+#define RADIO_PROFILE_NAME_LEN 8
+
+/**
+ * @brief The modem settings that trade throughput for range.  The 
+ * codes are the ones used in RegModemConfig1/2 (see page 108).
+ */
+struct RadioProfile {
+    // Null-terminated unless all of the characters are used
+    char name[RADIO_PROFILE_NAME_LEN];
+    // Spreading factor (7-12)
+    uint8_t sf;
+    // Bandwidth code (0=7.8kHz, ..., 7=125kHz, 8=250kHz, 9=500kHz)
+    uint8_t bw;
+    // Coding rate code (1=4/5, 2=4/6, 3=4/7, 4=4/8)
+    uint8_t cr;
+    // Transmit power in dBm (2-20)
+    uint8_t powerDbm;
+
+    void set(const char* n, uint8_t s, uint8_t b, uint8_t c, uint8_t p) {
+        memset(name, 0, RADIO_PROFILE_NAME_LEN);
+        strncpy(name, n, RADIO_PROFILE_NAME_LEN);
+        sf = s;
+        bw = b;
+        cr = c;
+        powerDbm = p;
+    }
+
+    bool isNamed(const char* n) const {
+        return strncmp(name, n, RADIO_PROFILE_NAME_LEN) == 0;
+    }
+
+    bool isValid() const {
+        return name[0] != 0 &&
+            sf >= 7 && sf <= 12 &&
+            bw <= 9 &&
+            cr >= 1 && cr <= 4 &&
+            powerDbm >= 2 && powerDbm <= 20;
+    }
+};
+
+/**
+ * @brief The table of profiles that a station can switch between, and 
+ * which one is in use.
+ */
+struct RadioProfileTable {
+    uint8_t active;
+    RadioProfile profiles[RADIO_PROFILE_COUNT];
+
+    void setDefaults() {
+        active = 0;
+        // This is what the network has always used
+        profiles[0].set("default", 9, 7, 1, 20);
+        profiles[1].set("fast", 7, 7, 1, 20);
+        profiles[2].set("long", 11, 7, 4, 20);
+        profiles[3].set("max", 12, 7, 4, 20);
+    }
+
+    bool isValid() const {
+        if (active >= RADIO_PROFILE_COUNT)
+            return false;
+        for (unsigned int i = 0; i < RADIO_PROFILE_COUNT; i++) 
+            if (!profiles[i].isValid())
+                return false;
+        return true;
+    }
+
+    /**
+     * @return The index of the profile with the name given, or -1 if 
+     *   there isn't one.
+     */
+    int find(const char* name) const {
+        for (unsigned int i = 0; i < RADIO_PROFILE_COUNT; i++) 
+            if (profiles[i].isNamed(name))
+                return i;
+        return -1;
+    }
+
+    const RadioProfile& getActive() const {
+        return profiles[active];
+    }
+};
+
+#endif
@@ -0,0 +1,56 @@
+/* 
+ * LoRa Birdhouse Mesh Network Project
+ * Wellesley Amateur Radio Society
+ * 
+ * Copyright (C) 2022 Bruce MacKinnon
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _RegisterBus_h
+#define _RegisterBus_h
+
+#include <stdint.h>
+
+/**
+ * @brief An interface for accessing the registers of the radio.  This 
+ * is done through an abstract interface so that the radio driver can be
+ * exercised on a fake radio during unit testing.
+ */
+class RegisterBus {
+public:
+
+    virtual uint8_t read(uint8_t reg) = 0;
+
+    /**
+     * @brief Reads len consecutive registers (or len bytes from the
+     * FIFO) in a single transaction.
+     */
+    virtual void readMulti(uint8_t reg, uint8_t* buf, uint8_t len) = 0;
+
+    /**
+     * @return The value of the register before the write.
+     */
+    virtual uint8_t write(uint8_t reg, uint8_t val) = 0;
+
+    virtual void writeMulti(uint8_t reg, const uint8_t* buf, uint8_t len) = 0;
+
+    /**
+     * @brief Register accesses made between beginBatch() and endBatch() 
+     * can share a single bus transaction.  Batches can be nested.
+     */
+    virtual void beginBatch() {}
+    virtual void endBatch() {}
+};
+
+#endif
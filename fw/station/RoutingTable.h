@@ -21,16 +21,93 @@
 #define _RoutingTable_h
 
 #include "Utils.h"
+#include "packets.h"
 
 class RoutingTable {
 public:
 
     static nodeaddr_t NO_ROUTE;
+    static const unsigned int MAX_BACKUP_ROUTES = 2;
+    static const unsigned int TTL_MARGIN = 2;
 
     virtual nodeaddr_t nextHop(nodeaddr_t finalDestAddr) = 0;
 
     virtual void setRoute(nodeaddr_t target, nodeaddr_t nextHop) = 0;
 
+    /**
+     * @brief Sets one of the backup next hops for a target.  Backups 
+     * are used (in order) when the primary next hop is suspect.
+     * 
+     * @param index 0 to MAX_BACKUP_ROUTES - 1
+     */
+    virtual void setBackupRoute(nodeaddr_t /*target*/, unsigned int /*index*/, 
+        nodeaddr_t /*nextHop*/) { }
+
+    virtual nodeaddr_t getBackupRoute(nodeaddr_t /*target*/, unsigned int /*index*/) { 
+        return NO_ROUTE; 
+    }
+
+    /**
+     * @brief Marks a next hop as suspect (i.e. it has stopped 
+     * acknowledging our transmissions).  Routes will avoid the 
+     * suspect hop when a backup is available.
+     */
+    virtual void markSuspect(nodeaddr_t /*nextHop*/) { }
+
+    /**
+     * @brief Called when we have evidence that the hop is alive again.
+     */
+    virtual void clearSuspect(nodeaddr_t /*nextHop*/) { }
+
+    virtual bool isSuspect(nodeaddr_t /*nextHop*/) const { return false; }
+
+    /**
+     * @brief Temporarily takes a route out of service after a route 
+     * error.  nextHop() will return NO_ROUTE for the target until the 
+     * route is revalidated, unless the target can be reached over a 
+     * good direct link.  The stored route is not changed.
+     * 
+     * @param now The current time, used to expire the invalidation.
+     */
+    virtual void invalidateRoute(nodeaddr_t /*target*/, uint32_t /*now*/) { }
+
+    /**
+     * @brief Puts an invalidated route back into service.
+     */
+    virtual void revalidateRoute(nodeaddr_t /*target*/) { }
+
+    /**
+     * @brief Puts back any routes that have been invalidated for 
+     * longer than the hold-down time.
+     */
+    virtual void revalidateRoutes(uint32_t /*now*/, uint32_t /*holdDownMs*/) { }
+
+    virtual bool isRouteInvalidated(nodeaddr_t /*target*/) const { return false; }
+
+    /**
+     * @brief Records the number of hops that a message from the 
+     * target took to get here.  This is used as an estimate of the 
+     * length of the route back to the target.
+     */
+    virtual void setRouteLength(nodeaddr_t /*target*/, unsigned int /*hops*/) { }
+
+    /**
+     * @return The number of hops to the target, or 0 if not known.
+     */
+    virtual unsigned int getRouteLength(nodeaddr_t /*target*/) const { return 0; }
+
+    /**
+     * @brief Picks the hop limit for a message that is originating
+     * at this station.  A bit of slack is allowed on top of the known 
+     * route length in case the route changes along the way.
+     */
+    uint8_t getInitialTtl(nodeaddr_t target) const {
+        unsigned int hops = getRouteLength(target);
+        if (hops == 0 || hops + TTL_MARGIN > DEFAULT_TTL) 
+            return DEFAULT_TTL;
+        return hops + TTL_MARGIN;
+    }
+
     /**
      * @brief Removes all routes from the table.
      */
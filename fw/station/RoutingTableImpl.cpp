@@ -21,13 +21,27 @@
 #include "RoutingTableImpl.h"
 
 RoutingTableImpl::RoutingTableImpl(Preferences& pref) 
-:   _pref(pref) {
+:   _pref(pref),
+    _neighbors(0) {
+    for (unsigned int i = 0; i < _tableSize; i++) {
+        _table[i] = 0;
+        for (unsigned int b = 0; b < MAX_BACKUP_ROUTES; b++)
+            _backupTable[i][b] = 0;
+        _suspect[i] = false;
+        _routeLength[i] = 0;
+        _invalid[i] = false;
+        _invalidTime[i] = 0;
+    }
 }
 
 void RoutingTableImpl::begin() {
     _load();
 }
 
+void RoutingTableImpl::setNeighborTable(const NeighborTable* neighbors) {
+    _neighbors = neighbors;
+}
+
 nodeaddr_t RoutingTableImpl::nextHop(nodeaddr_t finalDestAddr) {
     if (finalDestAddr == 0) {
         return 0;
@@ -35,33 +49,138 @@ nodeaddr_t RoutingTableImpl::nextHop(nodeaddr_t finalDestAddr) {
         return finalDestAddr;
     } else if (finalDestAddr >= _tableSize) {
         return NO_ROUTE;
-    } else {
-        return _table[finalDestAddr];
     }
+
+    // A route that was taken out of service by a route error is not 
+    // used, but a good direct link can still be (see below).
+    nodeaddr_t hop = _invalid[finalDestAddr] ? NO_ROUTE : _table[finalDestAddr];
+
+    // If the primary next hop has gone quiet then use the first 
+    // healthy backup.  If there isn't one then we stick with 
+    // the primary.
+    if (isSuspect(hop)) {
+        for (unsigned int b = 0; b < MAX_BACKUP_ROUTES; b++) {
+            nodeaddr_t backup = _backupTable[finalDestAddr][b];
+            if (backup != NO_ROUTE && !isSuspect(backup)) {
+                hop = backup;
+                break;
+            }
+        }
+    }
+
+    // When link metrics are available we check to see whether the 
+    // destination can be reached directly for less than the cost 
+    // of the configured route.  Going through the configured next hop 
+    // costs at least one transmission beyond the first hop.  This is
+    // also done when there is no configured route.
+    if (_neighbors != 0 && 
+        hop != finalDestAddr &&
+        !isSuspect(finalDestAddr) &&
+        _neighbors->isEtxMeasured(finalDestAddr)) {
+        float directEtx = _neighbors->getEtx(finalDestAddr);
+        float routeEtx = NeighborTable::MAX_ETX;
+        if (hop != NO_ROUTE)
+            routeEtx = _neighbors->getEtx(hop) + 1.0;
+        if (directEtx < NeighborTable::MAX_ETX && directEtx < routeEtx)
+            return finalDestAddr;
+    }
+
+    return hop;
 }
 
 void RoutingTableImpl::setRoute(nodeaddr_t target, nodeaddr_t nextHop) {
     if (target > 0 && target < _tableSize) {
         _table[target] = nextHop;
+        _invalid[target] = false;
         _save();
     }
 }
 
+void RoutingTableImpl::setBackupRoute(nodeaddr_t target, unsigned int index, 
+    nodeaddr_t nextHop) {
+    if (target > 0 && target < _tableSize && index < MAX_BACKUP_ROUTES) {
+        _backupTable[target][index] = nextHop;
+        _save();
+    }
+}
+
+nodeaddr_t RoutingTableImpl::getBackupRoute(nodeaddr_t target, unsigned int index) {
+    if (target > 0 && target < _tableSize && index < MAX_BACKUP_ROUTES) {
+        return _backupTable[target][index];
+    } else {
+        return NO_ROUTE;
+    }
+}
+
 void RoutingTableImpl::clearRoutes() {
-    for (unsigned int i = 0; i < _tableSize; i++)
+    for (unsigned int i = 0; i < _tableSize; i++) {
         _table[i] = 0;
+        for (unsigned int b = 0; b < MAX_BACKUP_ROUTES; b++)
+            _backupTable[i][b] = 0;
+        _invalid[i] = false;
+    }
     _save();
 }
 
+void RoutingTableImpl::markSuspect(nodeaddr_t nextHop) {
+    if (nextHop < _tableSize) 
+        _suspect[nextHop] = true;
+}
+
+void RoutingTableImpl::clearSuspect(nodeaddr_t nextHop) {
+    if (nextHop < _tableSize) 
+        _suspect[nextHop] = false;
+}
+
+bool RoutingTableImpl::isSuspect(nodeaddr_t nextHop) const {
+    return nextHop < _tableSize && _suspect[nextHop];
+}
+
+void RoutingTableImpl::invalidateRoute(nodeaddr_t target, uint32_t now) {
+    if (target > 0 && target < _tableSize) {
+        _invalid[target] = true;
+        _invalidTime[target] = now;
+    }
+}
+
+void RoutingTableImpl::revalidateRoute(nodeaddr_t target) {
+    if (target < _tableSize) 
+        _invalid[target] = false;
+}
+
+void RoutingTableImpl::revalidateRoutes(uint32_t now, uint32_t holdDownMs) {
+    for (unsigned int i = 0; i < _tableSize; i++) 
+        if (_invalid[i] && (now - _invalidTime[i]) >= holdDownMs) 
+            _invalid[i] = false;
+}
+
+bool RoutingTableImpl::isRouteInvalidated(nodeaddr_t target) const {
+    return target < _tableSize && _invalid[target];
+}
+
+void RoutingTableImpl::setRouteLength(nodeaddr_t target, unsigned int hops) {
+    if (target < _tableSize) 
+        _routeLength[target] = (hops > 255) ? 255 : hops;
+}
+
+unsigned int RoutingTableImpl::getRouteLength(nodeaddr_t target) const {
+    if (target < _tableSize) 
+        return _routeLength[target];
+    return 0;
+}
+
 void RoutingTableImpl::factoryReset() {
     clearRoutes();
     _pref.remove("routing");
+    _pref.remove("backuprouting");
 }
 
 void RoutingTableImpl::_load() {
-    _pref.getBytes("routing", (void*)_table, _tableSize);
+    _pref.getBytes("routing", (void*)_table, sizeof(_table));
+    _pref.getBytes("backuprouting", (void*)_backupTable, sizeof(_backupTable));
 }
 
 void RoutingTableImpl::_save() {
-    _pref.putBytes("routing", (const void*)_table, _tableSize);
+    _pref.putBytes("routing", (const void*)_table, sizeof(_table));
+    _pref.putBytes("backuprouting", (const void*)_backupTable, sizeof(_backupTable));
 }
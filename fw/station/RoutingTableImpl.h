@@ -22,6 +22,7 @@
 
 #include <Preferences.h>
 #include "RoutingTable.h"
+#include "NeighborTable.h"
 
 class RoutingTableImpl : public RoutingTable {
 public:
@@ -32,11 +33,32 @@ public:
      * @brief Called once a startup
      */
     void begin();
+
+    /**
+     * @brief Makes link metrics (ETX) available to the route selection.
+     * 
+     * @param neighbors Can be 0 to disable the use of link metrics.
+     */
+    void setNeighborTable(const NeighborTable* neighbors);
     
     nodeaddr_t nextHop(nodeaddr_t finalDestAddr);
     void setRoute(nodeaddr_t target, nodeaddr_t nextHop);
+    void setBackupRoute(nodeaddr_t target, unsigned int index, nodeaddr_t nextHop);
+    nodeaddr_t getBackupRoute(nodeaddr_t target, unsigned int index);
     void clearRoutes();
 
+    void markSuspect(nodeaddr_t nextHop);
+    void clearSuspect(nodeaddr_t nextHop);
+    bool isSuspect(nodeaddr_t nextHop) const;
+
+    void invalidateRoute(nodeaddr_t target, uint32_t now);
+    void revalidateRoute(nodeaddr_t target);
+    void revalidateRoutes(uint32_t now, uint32_t holdDownMs);
+    bool isRouteInvalidated(nodeaddr_t target) const;
+
+    void setRouteLength(nodeaddr_t target, unsigned int hops);
+    unsigned int getRouteLength(nodeaddr_t target) const;
+
     void factoryReset();
 
 private:
@@ -49,8 +71,19 @@ private:
     void _save();
 
     Preferences& _pref;
+    const NeighborTable* _neighbors;
     static const unsigned int _tableSize = 64;
-    nodeaddr_t _table[64];
+    nodeaddr_t _table[_tableSize];
+    nodeaddr_t _backupTable[_tableSize][MAX_BACKUP_ROUTES];
+    // Suspect flags are kept in RAM only and are indexed by the 
+    // address of the next hop.
+    bool _suspect[_tableSize];
+    // Routes that have been taken out of service by route errors.  
+    // These are kept in RAM only.
+    bool _invalid[_tableSize];
+    uint32_t _invalidTime[_tableSize];
+    // Route lengths are learned from traffic and are kept in RAM only
+    uint8_t _routeLength[_tableSize];
 };
 
 #endif
@@ -0,0 +1,59 @@
+/* 
+ * LoRa Birdhouse Mesh Network Project
+ * Wellesley Amateur Radio Society
+ * 
+ * Copyright (C) 2022 Bruce MacKinnon
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _RxMetadata_h
+#define _RxMetadata_h
+
+#include <stdint.h>
+
+/**
+ * @brief Information about a received frame that is captured by the 
+ * radio and carried along with the frame (as OOB data) in the 
+ * receive queue.
+ */
+struct RxMetadata {
+
+    RxMetadata() : rxTimeUs(0), airtimeUs(0), rssi(0), snr(0), freqErrorHz(0), 
+        sf(0), bw(0), cr(0), overrun(false) { }
+
+    // Microsecond clock when the radio reported the end of the frame
+    // (captured in the ISR)
+    uint32_t rxTimeUs;
+    // The time on air of the frame, so rxTimeUs - airtimeUs is when the
+    // transmission started
+    uint32_t airtimeUs;
+    // Packet RSSI in dBm
+    int16_t rssi;
+    // Packet SNR in dB
+    int16_t snr;
+    // Frequency error (in Hz) of the transmitter, as estimated by the 
+    // receiver
+    int16_t freqErrorHz;
+    // The modem settings that the receiver was using (with the codes 
+    // used in RadioProfile).  Zero for frames that didn't come from the
+    // radio.
+    uint8_t sf;
+    uint8_t bw;
+    uint8_t cr;
+    // Set if one or more frames were lost just before this one because
+    // they weren't read out of the radio in time
+    bool overrun;
+};
+
+#endif
@@ -0,0 +1,57 @@
+/* 
+ * LoRa Birdhouse Mesh Network Project
+ * Wellesley Amateur Radio Society
+ * 
+ * Copyright (C) 2022 Bruce MacKinnon
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _SleepConfig_h
+#define _SleepConfig_h
+
+#include <stdint.h>
+
+/**
+ * @brief The parameters of the coordinated sleep schedule.  Every 
+ * periodMs of network time all of the stations wake up together for 
+ * at least listenMs.  This is stored as part of the station 
+ * configuration and should be the same for all of the stations in 
+ * an area.
+ */
+struct SleepConfig {
+    // Non-zero to sleep between the wake windows whenever the network 
+    // time is known
+    uint8_t enabled;
+    // The time from the start of one wake window to the next
+    uint16_t periodMs;
+    // The length of the common wake window
+    uint16_t listenMs;
+    // How long a station stays awake after hearing or sending traffic 
+    // (adaptive listening, zero to turn off)
+    uint16_t extendMs;
+
+    void setDefaults() {
+        enabled = 0;
+        periodMs = 30000;
+        listenMs = 2000;
+        extendMs = 2000;
+    }
+
+    bool isValid() const {
+        return enabled <= 1 && 
+            listenMs > 0 && listenMs < periodMs;
+    }
+};
+
+#endif
@@ -0,0 +1,116 @@
+/* 
+ * LoRa Birdhouse Mesh Network Project
+ * Wellesley Amateur Radio Society
+ * 
+ * Copyright (C) 2022 Bruce MacKinnon
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "SleepSchedule.h"
+
+SleepSchedule::SleepSchedule(const Clock& clock) 
+:   _clock(clock),
+    _networkClock(0),
+    _txMarginMs(0),
+    _lastActivityTime(clock.time()) {
+    SleepConfig config;
+    config.setDefaults();
+    configure(config);
+    resetCounters();
+}
+
+void SleepSchedule::configure(const SleepConfig& config) {
+    _config = config;
+    if (!_config.isValid()) 
+        _config.setDefaults();
+}
+
+bool SleepSchedule::isActive() const {
+    return _config.enabled && 
+        _networkClock != 0 && _networkClock->isSynced();
+}
+
+uint32_t SleepSchedule::_getPeriodOffsetMs() const {
+    return (_networkClock->getNetworkUs() / 1000ULL) % _config.periodMs;
+}
+
+bool SleepSchedule::isListenWindow() const {
+    return !isActive() || _getPeriodOffsetMs() < _config.listenMs;
+}
+
+bool SleepSchedule::isTxAllowed() const {
+    if (!isActive())
+        return true;
+    const uint32_t offsetMs = _getPeriodOffsetMs();
+    // If the window is too short for a whole exchange then any 
+    // time in the window will have to do
+    if (_txMarginMs >= _config.listenMs)
+        return offsetMs < _config.listenMs;
+    return offsetMs + _txMarginMs <= _config.listenMs;
+}
+
+bool SleepSchedule::isSleepAllowed() const {
+    return isActive() && 
+        _getPeriodOffsetMs() >= _config.listenMs &&
+        _clock.time() - _lastActivityTime >= _config.extendMs;
+}
+
+uint32_t SleepSchedule::getSleepMs() const {
+    if (!isSleepAllowed())
+        return 0;
+    const uint32_t toWindowMs = _config.periodMs - _getPeriodOffsetMs();
+    if (toWindowMs <= SLEEP_WAKE_LEAD_MS)
+        return 0;
+    return toWindowMs - SLEEP_WAKE_LEAD_MS;
+}
+
+void SleepSchedule::processActivity() {
+    _lastActivityTime = _clock.time();
+}
+
+void SleepSchedule::processSleep(uint32_t ms) {
+    _sleepCount++;
+    _sleepMs += ms;
+}
+
+void SleepSchedule::processHold(uint32_t ms) {
+    _holdCount++;
+    _holdTotalMs += ms;
+    if (ms > _maxHoldMs)
+        _maxHoldMs = ms;
+}
+
+float SleepSchedule::getAwakePct() const {
+    const uint32_t elapsedMs = _clock.time() - _startTime;
+    if (elapsedMs == 0)
+        return 100.0;
+    if (_sleepMs >= elapsedMs)
+        return 0.0;
+    return 100.0 * (float)(elapsedMs - _sleepMs) / (float)elapsedMs;
+}
+
+uint32_t SleepSchedule::getAvgHoldMs() const {
+    if (_holdCount == 0)
+        return 0;
+    return _holdTotalMs / _holdCount;
+}
+
+void SleepSchedule::resetCounters() {
+    _startTime = _clock.time();
+    _sleepMs = 0;
+    _sleepCount = 0;
+    _holdCount = 0;
+    _holdTotalMs = 0;
+    _maxHoldMs = 0;
+}
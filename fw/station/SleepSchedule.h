@@ -0,0 +1,155 @@
+/* 
+ * LoRa Birdhouse Mesh Network Project
+ * Wellesley Amateur Radio Society
+ * 
+ * Copyright (C) 2022 Bruce MacKinnon
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _SleepSchedule_h
+#define _SleepSchedule_h
+
+#include <stdint.h>
+
+#include "Clock.h"
+#include "NetworkClock.h"
+#include "SleepConfig.h"
+
+// Stations wake up this long before the wake window to allow for the 
+// radio start-up and any error in the network time
+#define SLEEP_WAKE_LEAD_MS 20
+
+/**
+ * @brief Decides when a station can sleep (S-MAC style coordinated 
+ * listen/sleep).
+ * 
+ * The network time is divided into periods of SleepConfig::periodMs 
+ * and every station is awake for the first SleepConfig::listenMs of 
+ * each period (the wake window).  Because the windows come from the 
+ * network time, neighbors that share the configuration wake up 
+ * together without any other negotiation.  Traffic (other than ACKs) 
+ * is only started inside the wake window, early enough that the 
+ * exchange finishes before the window closes, so everything else waits
+ * in the outbound queue.  A station that hears or sends traffic stays 
+ * awake for SleepConfig::extendMs afterwards (adaptive listening), so 
+ * the schedule stretches when the network is busy.
+ * 
+ * Stations that don't have the network time never sleep.
+ */
+class SleepSchedule {
+public:
+
+    SleepSchedule(const Clock& clock);
+
+    void configure(const SleepConfig& config);
+
+    const SleepConfig& getConfig() const { return _config; }
+
+    /**
+     * @brief Supplies the network time that the wake windows are 
+     * aligned to.  Nothing sleeps until this is set.
+     */
+    void setNetworkClock(const NetworkClock* networkClock) { _networkClock = networkClock; }
+
+    /**
+     * @brief Sets how much of the wake window has to be left for a new
+     * transmission to be started (the longest frame plus its ACK).
+     */
+    void setTxMarginMs(uint32_t ms) { _txMarginMs = ms; }
+
+    /**
+     * @return true if sleeping is enabled and the network time is known.
+     */
+    bool isActive() const;
+
+    /**
+     * @return true if the common wake window is in progress (always
+     *   true when the schedule isn't active).
+     */
+    bool isListenWindow() const;
+
+    /**
+     * @return true if a new transmission can be started now.
+     */
+    bool isTxAllowed() const;
+
+    /**
+     * @return true if the station can go to sleep now (outside of 
+     *   the wake window and not recently busy).
+     */
+    bool isSleepAllowed() const;
+
+    /**
+     * @return How long the station can sleep before it needs to be 
+     *   ready for the next wake window, or zero if sleeping isn't 
+     *   allowed.
+     */
+    uint32_t getSleepMs() const;
+
+    /**
+     * @brief Called whenever traffic is heard or sent.  This keeps the
+     * station awake for a while.
+     */
+    void processActivity();
+
+    /**
+     * @brief Called after the station wakes up.
+     * 
+     * @param ms How long the station was asleep.
+     */
+    void processSleep(uint32_t ms);
+
+    /**
+     * @brief Called when outbound traffic has been held back waiting
+     * for the wake window.
+     * 
+     * @param ms The extra time that the traffic waited.
+     */
+    void processHold(uint32_t ms);
+
+    /**
+     * @return The percentage of the time (since the counters were 
+     *   reset) that the station has been awake.
+     */
+    float getAwakePct() const;
+
+    uint16_t getSleepCount() const { return _sleepCount; }
+    uint16_t getHoldCount() const { return _holdCount; }
+    uint32_t getMaxHoldMs() const { return _maxHoldMs; }
+    uint32_t getAvgHoldMs() const;
+
+    void resetCounters();
+
+private:
+
+    /**
+     * @return How far into the current period the network time is.
+     */
+    uint32_t _getPeriodOffsetMs() const;
+
+    const Clock& _clock;
+    SleepConfig _config;
+    const NetworkClock* _networkClock;
+    uint32_t _txMarginMs;
+    uint32_t _lastActivityTime;
+    // Diagnostic counters
+    uint32_t _startTime;
+    uint32_t _sleepMs;
+    uint16_t _sleepCount;
+    uint16_t _holdCount;
+    uint32_t _holdTotalMs;
+    uint32_t _maxHoldMs;
+};
+
+#endif
@@ -0,0 +1,57 @@
+/* 
+ * LoRa Birdhouse Mesh Network Project
+ * Wellesley Amateur Radio Society
+ * 
+ * Copyright (C) 2022 Bruce MacKinnon
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _SpiRegisterBus_h
+#define _SpiRegisterBus_h
+
+#include "RegisterBus.h"
+#include "spi_utils.h"
+
+/**
+ * @brief Access to the radio registers via the ESP32 SPI interface.
+ */
+class SpiRegisterBus : public RegisterBus {
+public:
+
+    uint8_t read(uint8_t reg) {
+        return spi_read(reg);
+    }
+
+    void readMulti(uint8_t reg, uint8_t* buf, uint8_t len) {
+        spi_read_multi(reg, buf, len);
+    }
+
+    uint8_t write(uint8_t reg, uint8_t val) {
+        return spi_write(reg, val);
+    }
+
+    void writeMulti(uint8_t reg, const uint8_t* buf, uint8_t len) {
+        spi_write_multi(reg, (uint8_t*)buf, len);
+    }
+
+    void beginBatch() {
+        spi_batch_begin();
+    }
+
+    void endBatch() {
+        spi_batch_end();
+    }
+};
+
+#endif
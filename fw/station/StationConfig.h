@@ -21,6 +21,9 @@
 #define _StationConfig_h
 
 #include "Utils.h"
+#include "ChannelAccessConfig.h"
+#include "SleepConfig.h"
+#include "RadioProfile.h"
 
 // Size is approximately 24 bytes
 struct StationConfig {
@@ -32,6 +35,19 @@ struct StationConfig {
     uint16_t bootCount;
     uint16_t sleepCount;
     uint8_t logLevel;
+    // How often link probes are sent (0 means never)
+    uint16_t probeIntervalSeconds;
+    // CSMA/CA parameters (all zero means use the defaults)
+    ChannelAccessConfig channelAccess;
+    // Radio profiles (all zero means use the defaults)
+    RadioProfileTable radioProfiles;
+    // TDMA parameters (all zero means use the defaults)
+    TdmaConfig tdma;
+    // Sleep schedule parameters (all zero means use the defaults)
+    SleepConfig sleep;
+    // How often the channel is sampled when low power listening 
+    // (0 means always listening)
+    uint16_t lplIntervalMs;
 };
 
 #endif
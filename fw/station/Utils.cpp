@@ -1,5 +1,6 @@
 #include "Utils.h"
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
 
 nodeaddr_t parseAddr(const char* textAddr) {
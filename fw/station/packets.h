@@ -25,7 +25,10 @@
 #include "Utils.h"
 #include "Configuration.h"
 
-const uint8_t PACKET_VERSION = 2;
+const uint8_t PACKET_VERSION = 3;
+// The hop limit used when the length of the route to the 
+// destination is not known.
+const uint8_t DEFAULT_TTL = 8;
 static const nodeaddr_t BROADCAST_ADDR = 0xffff;
 
 // The top bit indicates whether an ACK is needed
@@ -46,7 +49,20 @@ enum MessageType {
     TYPE_GETROUTE_REQ  = 11,
     TYPE_GETROUTE_RESP = 12,
     TYPE_RESET         = 15,
+    // Periodic broadcast of the network time (not acknowledged)
+    TYPE_TIME_SYNC     = 16,
     TYPE_RESET_COUNTERS = 17,
+    // Neighbor link quality data
+    TYPE_GETLINKS_REQ  = 19,
+    TYPE_GETLINKS_RESP = 20,
+    // Periodic broadcast used for link estimation (not acknowledged)
+    TYPE_LINK_PROBE    = 21,
+    // Sent back to the originator when a message can't be delivered
+    TYPE_ROUTE_ERROR   = 22,
+    // Network-wide radio profile change (flooded to every station)
+    TYPE_SETPROFILE_REQ = 23,
+    // Sent back to the originator by each station that accepts the change
+    TYPE_SETPROFILE_RESP = 24,
     // Routine text traffic
     TYPE_TEXT          = 32,
     TYPE_ALERT         = 36
@@ -68,9 +84,17 @@ struct Header {
     // Used for multi-hop communication.  This is the node that 
     // originated the message.
     nodeaddr_t originalSourceAddr;
+    // The number of additional hops that this message is allowed to 
+    // take.  Decremented on each forward so that routing loops can't
+    // keep a message in the air forever.
+    uint8_t ttl;
+    // The number of times that this message has been forwarded.
+    uint8_t hopCount;
 
     Header() 
-    : version(PACKET_VERSION) 
+    : version(PACKET_VERSION),
+      ttl(DEFAULT_TTL),
+      hopCount(0)
     {
     }
 
@@ -95,6 +119,9 @@ struct Header {
         version = PACKET_VERSION;
         type = TYPE_ACK;
         id = rx_packet.id;
+        // ACKs are never forwarded
+        ttl = 1;
+        hopCount = 0;
         // Address stuff
         sourceAddr = config.getAddr();
         destAddr = rx_packet.sourceAddr;
@@ -125,6 +152,8 @@ struct Header {
         version = PACKET_VERSION;
         type = respType;
         id = respId;
+        ttl = DEFAULT_TTL;
+        hopCount = 0;
         // Address stuff
         sourceAddr = config.getAddr();
         destAddr = respDestAddr;
@@ -144,13 +173,13 @@ struct Header {
     }
 
     bool isAckRequired() const {
-        return !(type == TYPE_ACK || type == TYPE_STATION_ID) && 
-          (destAddr != BROADCAST_ADDR);
+        return !(type == TYPE_ACK || type == TYPE_STATION_ID || 
+          type == TYPE_LINK_PROBE) && (destAddr != BROADCAST_ADDR);
     }
 
     bool isResponseRequired() const {
         return (type == TYPE_PING_REQ || type == TYPE_GETSED_REQ ||
-          type == TYPE_GETROUTE_REQ);
+          type == TYPE_GETROUTE_REQ || type == TYPE_GETLINKS_REQ);
     }
 
     uint8_t getPacketVersion() const {
@@ -205,6 +234,22 @@ struct Header {
         finalDestAddr = addr;
     }
 
+    uint8_t getTtl() const {
+        return ttl;
+    }
+
+    void setTtl(uint8_t t) {
+        ttl = t;
+    }
+
+    uint8_t getHopCount() const {
+        return hopCount;
+    }
+
+    void setHopCount(uint8_t c) {
+        hopCount = c;
+    }
+
     void setSourceCall(const CallSign& call) {
         call.writeTo(sourceCall);
     }
@@ -260,22 +305,70 @@ struct SadRespPayload {
   uint16_t wrongNodeRxCount;
   // RSSI of the last hop (i.e. the link to the target node)
   int16_t lastHopRssi;
-  int16_t UNUSED0;
-  int16_t UNISED1;
-  int16_t UNUSED2;
+  // Number of times that packets were moved to a backup next hop
+  uint16_t failoverCount;
+  // Number of packets dropped because their hop limit ran out
+  uint16_t ttlDropCount;
+  // Number of route errors generated by this station
+  uint16_t routeErrorCount;
   int16_t UNISED3;
 };
 
+// Carried after the header of every ACK.  Tells the sender how well 
+// the acknowledged frame was received.
+struct AckPayload {
+  int8_t snr;
+  // RSSI of the acknowledged frame as -dBm (i.e. 100 means -100dBm)
+  uint8_t negRssi;
+  // Frequency error of the sender, as estimated by the receiver
+  int16_t freqErrorHz;
+};
+
 struct SetRouteReqPayload {
   uint32_t passcode;
   nodeaddr_t targetAddr;
   nodeaddr_t nextHopAddr;  
 };
 
+struct SetProfileReqPayload {
+  uint32_t passcode;
+  // Chosen by the originator so that each station only acts on the 
+  // change once, no matter how many copies of the flood it hears
+  uint16_t changeId;
+  // Seconds (after the request is heard) until the change is made.  
+  // Stations pass the request on as soon as they hear it.  This is only
+  // used when the network time can't be.
+  uint16_t delaySeconds;
+  // If nothing is heard for this long after the change then the 
+  // station goes back to the profile it was using before (zero 
+  // means never)
+  uint16_t fallbackSeconds;
+  uint16_t UNUSED0;
+  RadioProfile profile;
+  // The network time (in seconds) at which the change is made, or zero
+  // if the originator doesn't have the network time.  Unlike the delay,
+  // this doesn't grow with the time it takes to pass the request on.
+  uint32_t changeSeconds;
+};
+
+struct SetProfileRespPayload {
+  uint16_t changeId;
+  // Seconds until the change is made at the responding station
+  uint16_t delaySeconds;
+};
+
 struct GetRouteReqPayload {
   nodeaddr_t targetAddr;
 };
 
+struct RouteErrorPayload {
+  // The final destination that could not be reached
+  nodeaddr_t unreachableAddr;
+  // The station that failed to acknowledge, or the reporting 
+  // station itself if it had no route.
+  nodeaddr_t failedHopAddr;
+};
+
 struct GetRouteRespPayload {
   nodeaddr_t targetAddr;
   nodeaddr_t nextHopAddr;  
@@ -287,4 +380,60 @@ struct ResetReqPayload {
   uint32_t passcode;
 };
 
+struct LinkReport {
+  nodeaddr_t addr;
+  int16_t rssi;
+  int8_t snr;
+  // Delivery ratio in percent
+  uint8_t deliveryPct;
+  // Seconds since the neighbor was last heard (saturates)
+  uint16_t ageSeconds;
+};
+
+static const unsigned int MAX_LINK_REPORTS = 10;
+
+struct GetLinksRespPayload {
+  uint8_t count;
+  uint8_t UNUSED0;
+  LinkReport links[MAX_LINK_REPORTS];
+};
+
+struct ProbeEntry {
+  nodeaddr_t addr;
+  // The fraction of the neighbor's probes that were heard (0-255)
+  uint8_t rxRatio;
+  // The SNR (dB) of the frames that the neighbor sent to us, used
+  // for transmit power control (-128 if none were heard)
+  int8_t snr;
+};
+
+static const unsigned int MAX_PROBE_ENTRIES = 16;
+
+struct TimeSyncPayload {
+  // The network time at the start of the transmission (seconds since 
+  // the epoch and microseconds).  This is filled in by the radio 
+  // driver just before the transmission is started.
+  uint32_t txSeconds;
+  uint32_t txMicros;
+  // The station that the time came from
+  nodeaddr_t rootAddr;
+  // The number of hops between the sender and the root
+  uint8_t level;
+  uint8_t unused;
+};
+
+struct LinkProbePayload {
+  uint16_t seq;
+  uint16_t intervalSeconds;
+  uint8_t count;
+  // The spreading factor that the sender is listening on (0 if 
+  // not known) in the low nibble, and the one that it will move to at
+  // the end of the next rendezvous window (0 if none) in the high nibble
+  uint8_t listenSf;
+  // How often the sender samples the channel when its receiver is 
+  // asleep (0 if always listening)
+  uint16_t wakeIntervalMs;
+  ProbeEntry entries[MAX_PROBE_ENTRIES];
+};
+
 #endif
@@ -21,8 +21,29 @@
 #include "spi_utils.h"
 
 #define SS_PIN    5
+// The SX1276 supports an SPI clock of up to 10 MHz
+#define SPI_CLOCK_HZ 10000000
 
-static SPISettings spi_settings(1000000, MSBFIRST, SPI_MODE0);
+static SPISettings spi_settings(SPI_CLOCK_HZ, MSBFIRST, SPI_MODE0);
+
+// The nesting depth of spi_batch_begin()/spi_batch_end()
+static unsigned int batch_depth = 0;
+
+static void spi_begin() {
+  if (batch_depth == 0) {
+    SPI.beginTransaction(spi_settings);
+  }
+  // Slave Select
+  digitalWrite(SS_PIN, LOW);
+}
+
+static void spi_end() {
+  // Slave deselect
+  digitalWrite(SS_PIN, HIGH);
+  if (batch_depth == 0) {
+    SPI.endTransaction();
+  }
+}
 
 void spi_setup() {
   // SPI slave select configuration
@@ -32,34 +53,37 @@ void spi_setup() {
   SPI.begin();
 }
 
+void spi_batch_begin() {
+  if (batch_depth++ == 0) {
+    SPI.beginTransaction(spi_settings);
+  }
+}
+
+void spi_batch_end() {
+  if (--batch_depth == 0) {
+    SPI.endTransaction();
+  }
+}
+
 uint8_t spi_read(uint8_t reg) {
-  SPI.beginTransaction(spi_settings);
-  // Slave Select
-  digitalWrite(SS_PIN, LOW);
+  spi_begin();
   // Send the address with the write mask off
   SPI.transfer(reg & ~0x80); 
   // The written value is ignored, reg value is read
   uint8_t val = SPI.transfer(0); 
-  // Slave deselect
-  digitalWrite(SS_PIN, HIGH);
-  SPI.endTransaction();
+  spi_end();
   return val;
 }
 
 void spi_read_multi(uint8_t reg, uint8_t* buf, uint8_t len) {
-  SPI.beginTransaction(spi_settings);
-  // Slave Select
-  digitalWrite(SS_PIN, LOW);
+  spi_begin();
   // Send the address with the write mask off
   SPI.transfer(reg & ~0x80); 
-  while (len--) {
-    // The written value is ignored, reg value is read
-    *buf = SPI.transfer(0); 
-    buf++;
-  }
-  // Slave deselect
-  digitalWrite(SS_PIN, HIGH);
-  SPI.endTransaction();
+  // The written values are ignored, reg values are read.  The whole 
+  // block is moved in one bulk transfer.
+  memset(buf, 0, len);
+  SPI.transferBytes(buf, buf, len);
+  spi_end();
 }
 
 // Writes one byte to SPI.  Returns whatever comes back during the transfer.
@@ -70,32 +94,21 @@ void spi_read_multi(uint8_t reg, uint8_t* buf, uint8_t len) {
 // is the value of the written register before the write operation.
 //
 uint8_t spi_write(uint8_t reg, uint8_t val) {
-  SPI.beginTransaction(spi_settings);
-  // Slave Select
-  digitalWrite(SS_PIN, LOW);
+  spi_begin();
   // Send the address with the write mask on. 
   SPI.transfer(reg | 0x80);
   // Send the data, capturing the original value 
   uint8_t orig_val = SPI.transfer(val); 
-  // Slave deselect
-  digitalWrite(SS_PIN, HIGH);
-  SPI.endTransaction();
+  spi_end();
   return orig_val;
 }
 
 uint8_t spi_write_multi(uint8_t reg, uint8_t* buf, uint8_t len) {
-  SPI.beginTransaction(spi_settings);
-  // Slave Select
-  digitalWrite(SS_PIN, LOW);
+  spi_begin();
   // Send the address with the write mask on
   uint8_t stat = SPI.transfer(reg | 0x80); 
-  // Transfer each byte individually
-  while (len--) {
-    SPI.transfer(*buf);
-    buf++;
-  }
-  // Slave deselect
-  digitalWrite(SS_PIN, HIGH);
-  SPI.endTransaction();
+  // The whole block is moved in one bulk transfer
+  SPI.writeBytes(buf, len);
+  spi_end();
   return stat;
 }
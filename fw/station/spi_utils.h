@@ -24,8 +24,16 @@
 
 void spi_setup();
 uint8_t spi_read(uint8_t reg);
+// Reads len consecutive registers (or len bytes from the FIFO) in a 
+// single transaction.
 void spi_read_multi(uint8_t reg, uint8_t* buf, uint8_t len);
 uint8_t spi_write(uint8_t reg, uint8_t val);
 uint8_t spi_write_multi(uint8_t reg, uint8_t* buf, uint8_t len);
 
+// Register accesses made between spi_batch_begin() and spi_batch_end() 
+// share a single SPI bus transaction (the chip select is still toggled
+// for each access).  Batches can be nested.
+void spi_batch_begin();
+void spi_batch_end();
+
 #endif
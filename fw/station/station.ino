@@ -42,11 +42,19 @@ http://www.esp32learning.com/wp-content/uploads/2017/12/esp32minikit.jpg
 #include "spi_utils.h"
 #include "CircularBuffer.h"
 #include "ClockImpl.h"
+#include "NetworkClock.h"
 #include "ConfigurationImpl.h"
 #include "packets.h"
 #include "OutboundPacketManager.h"
 #include "Instrumentation.h"
 #include "RoutingTableImpl.h"
+#include "NeighborTable.h"
+#include "RxMetadata.h"
+#include "ChannelAccess.h"
+#include "SleepSchedule.h"
+#include "SpiRegisterBus.h"
+#include "RadioDriver.h"
+#include "EdgeTimeQueue.h"
 #include "MessageProcessor.h"
 #include "CommandProcessor.h"
 
@@ -70,12 +78,6 @@ http://www.esp32learning.com/wp-content/uploads/2017/12/esp32minikit.jpg
 // we are changing the CPU clock frequency)
 #define WDT_TIMEOUT 5
 
-// The time we will wait for a TxDone interrupt before giving up.  This should
-// be an unusual case.
-#define TX_TIMEOUT_MS 30 * 1000
-// The time we will wait for a CadDone interrupt before giving up. 
-#define CAD_TIMEOUT_MS 50
-
 #define S_TO_US_FACTOR 1000000UL
 
 // Deep sleep duration when low battery is detected
@@ -84,11 +86,12 @@ http://www.esp32learning.com/wp-content/uploads/2017/12/esp32minikit.jpg
 // How frequently to check the battery condition
 #define BATTERY_CHECK_INTERVAL_SECONDS 30
 
-// How frequently to check for idle potential
-#define IDLE_CHECK_INTERVAL_SECONDS 15
-
-// The definition of "idle" 
-#define IDLE_INTERVAL_SECONDS 60
+// Light sleeps are kept shorter than the watchdog timeout.  A longer 
+// sleep is done in pieces.
+#define MAX_LIGHT_SLEEP_MS 4000
+// The processor stays awake for this long after the console is used, 
+// even if the radio is asleep between low power listening samples
+#define CONSOLE_HOLD_MS (60UL * 1000UL)
 
 static const float STATION_FREQUENCY = 906.5;
 
@@ -103,9 +106,47 @@ Stream& logger = shell;
 
 // ===== Interface Classes ===========================================
 
+// Used for persistent storage
+static Preferences nvram;
+
+static ClockImpl mainClock;
+Clock& systemClock = mainClock;
+// The time shared by the whole network
+static NetworkClock networkClock(mainClock);
+NetworkClock& systemNetworkClock = networkClock;
+
+static ConfigurationImpl mainConfig(nvram);
+Configuration& systemConfig = mainConfig;
+
+static RoutingTableImpl routingTable(nvram);
+RoutingTable& systemRoutingTable = routingTable;
+
+static NeighborTable neighborTable(mainClock);
+NeighborTable& systemNeighborTable = neighborTable;
+
+static ChannelAccess channelAccess(mainClock);
+ChannelAccess& systemChannelAccess = channelAccess;
+
+static SleepSchedule sleepSchedule(mainClock);
+SleepSchedule& systemSleepSchedule = sleepSchedule;
+
+// We keep a pretty small TX buffer because the main area where we keep 
+// outbound packets is in the MessageProcessor.
+static CircularBufferImpl<256> txBuffer(0);
+// There is an OOB allocation here for the RSSI/SNR data on receive
+static CircularBufferImpl<2048> rxBuffer(sizeof(RxMetadata));
+
+static SpiRegisterBus radioBus;
+
+static RadioDriver radio(radioBus, mainClock, txBuffer, rxBuffer, channelAccess);
+
 class InstrumentationImpl : public Instrumentation {
 public:
 
+    InstrumentationImpl(RadioDriver& radio) 
+    :   _radio(radio) {        
+    }
+
     uint16_t getSoftwareVersion() const { return SW_VERSION; }
     uint16_t getDeviceClass() const { return 2; }
     uint16_t getDeviceRevision() const { return 1; }
@@ -144,52 +185,66 @@ public:
         sleep(ms);
     }
 
+    uint32_t getCadToTxUs() const { return _radio.getCadToTxUs(); }
+    uint32_t getMaxCadToTxUs() const { return _radio.getMaxCadToTxUs(); }
+    uint16_t getTxPreloadHits() const { return _radio.getTxPreloadHits(); }
+    uint16_t getTxPreloadMisses() const { return _radio.getTxPreloadMisses(); }
+    uint16_t getRxOverruns() const { return _radio.getRxOverruns(); }
+    uint32_t getRxServiceUs() const { return _radio.getRxServiceUs(); }
+    uint32_t getMaxRxServiceUs() const { return _radio.getMaxRxServiceUs(); }
+    uint32_t getTxServiceUs() const { return _radio.getTxServiceUs(); }
+    uint32_t getMaxTxServiceUs() const { return _radio.getMaxTxServiceUs(); }
+    uint32_t getRegWriteSkips() const { return _radio.getRegWriteSkips(); }
+    uint32_t getAckAirtimeUs() const { return _radio.getAirtimeUs(ACK_FRAME_LEN, true); }
+    uint32_t getExplicitAckAirtimeUs() const { return _radio.getAirtimeUs(ACK_FRAME_LEN, false); }
+    uint16_t getAckWindowTimeouts() const { return _radio.getAckWindowTimeouts(); }
+    uint32_t getAckWindowMs() const { return _radio.getAckWindowMs(); }
+    bool isTransmitting() const { return _radio.getState() == RadioDriver::TX_STATE; }
+    void setRadioProfile(const RadioProfile& profile) { _radio.setProfile(profile); }
+    uint32_t getSymbolUs() const { return _radio.getSymbolUs(); }
+    uint32_t getAirtimeUs(uint8_t len) const { return _radio.getAirtimeUs(len, false); }
+    uint8_t getListenSf() const { return _radio.getListenSf(); }
+    uint8_t getNextListenSf() const { return _radio.getNextListenSf(); }
+    uint16_t getLowSfTxCount() const { return _radio.getLowSfTxCount(); }
+    uint32_t getLowSfSavedUs() const { return _radio.getLowSfSavedUs(); }
+    uint16_t getLowPowerTxCount() const { return _radio.getLowPowerTxCount(); }
+    uint32_t getRfEnergySavedUj() const { return _radio.getRfEnergySavedUj(); }
+    void setLplInterval(uint16_t ms) { _radio.setLplInterval(ms); }
+    uint16_t getLplInterval() const { return _radio.getLplInterval(); }
+    uint16_t getRadioOnPermille() const { return _radio.getRadioOnPermille(); }
+    uint32_t getLplSampleCount() const { return _radio.getLplSampleCount(); }
+    uint16_t getLplWakeCount() const { return _radio.getLplWakeCount(); }
+    uint16_t getLplFalseWakeCount() const { return _radio.getLplFalseWakeCount(); }
+    uint16_t getLongPreambleTxCount() const { return _radio.getLongPreambleTxCount(); }
+
+    void resetCounters() {
+        _radio.resetCounters();
+    }
+
 private:
 
     static bool _backgroundRestart(void*) {
         ESP.restart();
         return false;
     }    
-};
 
-// Used for persistent storage
-static Preferences nvram;
-
-static ClockImpl mainClock;
-Clock& systemClock = mainClock;
-
-static ConfigurationImpl mainConfig(nvram);
-Configuration& systemConfig = mainConfig;
+    RadioDriver& _radio;
+};
 
-static InstrumentationImpl instrumentation;
+static InstrumentationImpl instrumentation(radio);
 Instrumentation& systemInstrumentation = instrumentation;
 
-static RoutingTableImpl routingTable(nvram);
-RoutingTable& systemRoutingTable = routingTable;
-
-// We keep a pretty small TX buffer because the main area where we keep 
-// outbound packets is in the MessageProcessor.
-static CircularBufferImpl<256> txBuffer(0);
-// There is a two-byte OOB allocation here for the RSSI data on receive
-static CircularBufferImpl<2048> rxBuffer(2);
-
+// The give-up and retry timeouts.  These are stretched on the slower radio 
+// profiles, where a frame and its ACK take longer on the air.
 static MessageProcessor messageProcessor(mainClock, 
-  rxBuffer, txBuffer, routingTable, instrumentation, mainConfig, 20 * 1000, 2 * 1000);
+  rxBuffer, txBuffer, routingTable, neighborTable, instrumentation, mainConfig, 
+  20 * 1000, 2 * 1000);
 MessageProcessor& systemMessageProcessor = messageProcessor;
 
-// The states of the state machine
-enum State { IDLE, RX_STATE, TX_STATE, CAD };
-
-// The overall state
-static volatile State state = State::IDLE;
 // This is volatile because it is set inside of the ISR context
 static volatile bool isrHit = false;
-// The time when we started the last transmission.  This is needed 
-// to create a timeout on transmissions so we don't accidentally get 
-// stuck in a transmission.
-static volatile uint32_t startTxTime = 0;
-// The time when we should give up on the CAD (channel activity detect).
-static volatile uint32_t endCadTime = 0;
+// The time of each DIO0 edge, recorded inside of the ISR context
+static EdgeTimeQueue edgeTimes;
 
 /**
  * @brief This is the actual ISR that is called by the Arduino run-time.
@@ -198,156 +253,12 @@ void IRAM_ATTR isr() {
     // NOTE: We've had so many problems with interrupt enable/disable on the ESP32
     // so now we're just going to set a flag and let everything happen in the loop()
     // context. This eliminates a lot of risk around concurrency, etc.
+    // The only other thing done here is to note the time, since the loop() 
+    // may not get to the radio for a while.
+    edgeTimes.push(micros());
     isrHit = true;
 }
 
-static void start_Tx() {
-
-    //logger.println("start_Tx");
-
-    // At this point we have something pending to be sent.
-    // Go into stand-by so we know that nothing else is coming in
-    set_mode_STDBY();
-
-    // Pop the data off the TX queue into the transmit buffer.  
-    unsigned int tx_buf_len = 256;
-    uint8_t tx_buf[tx_buf_len];
-    txBuffer.pop(0, tx_buf, &tx_buf_len);
-
-    // Move the data into the radio FIFO
-    write_message(tx_buf, tx_buf_len);
-    
-    // Go into transmit mode
-    state = State::TX_STATE;
-    startTxTime = mainClock.time();
-    enable_interrupt_TxDone();
-    set_mode_TX();
-}
-
-/**
- * @brief Put the radio RXCONTINUOUS mode and enable the RxDone interrupt.
- */
-static void start_Rx() {
-
-    //logger.println("start_Rx");
-
-    // Revert back to listening mode. 
-    state = State::RX_STATE;
-    // Ask for interrupt when receiving
-    enable_interrupt_RxDone();
-    // Go into RXCONTINUOUS so we can hear the response
-    set_mode_RXCONTINUOUS();  
-}
-
-/**
- * @brief Put the radio into CAD (channel activity detect) mode
- * and enable the CadDone interrupt.
- * 
- * NOTE: It appears that we don't get the CadDone interrupt under
- * normal (inactive) circumstances.  So a timeout is used to stop
- * the CAD process later.
- */
-static void start_Cad() {      
-
-    //logger.println("start_Cad");
-
-    state = State::CAD;
-    // We use a random number here to try to limit transmissions stepping on each other
-    endCadTime = mainClock.time() + (CAD_TIMEOUT_MS * random(1, 5));
-    enable_interrupt_CadDone();
-    set_mode_CAD();  
-}
-
-/**
- * @brief This is called when the radio reports the end of a 
- * transmission sequence.  The radio is put back into 
- * continuous receive mode.
- * 
- * This gets called from the main processing loop.
- */
-static void event_TxDone() {   
-
-    //logger.println("TxDone");
-
-    // Check for pending transmissions.  If nothing is pending then 
-    // put the radio back into receive mode.
-    if (txBuffer.isEmpty()) {
-        start_Rx();
-    }
-    // If we have pending data then send it out immediately (the assumption
-    // is that the channel is still open). 
-    else {
-        start_Tx();
-    }
-} 
-
-/**
- * @brief This is called when a complete message is received.
- * 
- * This gets called from the main processing loop.
- */
-static void event_RxDone() {
-
-    //logger.println("RxDone");
-
-    // How much data is available?
-    const uint8_t len = spi_read(0x13);
-    // Reset the FIFO read pointer to the beginning of the packet we just got
-    spi_write(0x0d, spi_read(0x10));
-
-    // We do nothing for zero-length messages
-    if (len == 0) {
-        return;
-    }
-
-    // Stream received data in from the FIFO. 
-    uint8_t rx_buf[256];
-    spi_read_multi(0x00, rx_buf, len);
-    
-    // Grab the RSSI value from the radio
-    int8_t lastSnr = (int8_t)spi_read(0x19) / 4;
-    int16_t lastRssi = spi_read(0x1a);
-    if (lastSnr < 0)
-        lastRssi = lastRssi + lastSnr;
-    else
-        lastRssi = (int)lastRssi * 16 / 15;
-    // We are using the high frequency port
-    lastRssi -= 157;
-
-    // Put the RSSI (OOB) and the entire packet into the circular queue for 
-    // later processing.
-    rxBuffer.push((const uint8_t*)&lastRssi, rx_buf, len);
-}
-
-/**
- * @brief This function is called when the radio completes a CAD cycle
- * and it is determined that these is channel activity. 
- */
-static void event_CadDone_Detection() {
-
-    logger.println("INF: CadDone Detection");
-
-    // Channel is busy so revert back to listening mode so that we're
-    // ready to receive the data. 
-    start_Rx();
-}
-
-static void event_CadDone_NoDetection() {
-
-    //logger.println("CadDone");
-
-    // Check for pending transmissions.  If nothing is pending then 
-    // put the radio back into receive mode.
-    if (txBuffer.isEmpty()) {
-        start_Rx();
-    }
-    // If something is pending then transmit it (since we've been told
-    // that the channel is innactive).
-    else {     
-        start_Tx();
-    }
-}
-
 /**
  * @brief This function gets called from inside of the main processing loop.  It looks
  * to see if any interrupt activity has been detected and, if so, figure 
@@ -368,144 +279,14 @@ static void check_for_interrupts() {
     noInterrupts();
 
     isrHit = false;
-
-    // Read and reset the IRQ register at the same time:
-    uint8_t irq_flags = spi_write(0x12, 0xff);    
-    
-    // We saw a comment in another implementation that said that there are problems
-    // clearing the ISR sometimes.  Notice we do a logical OR so we don't loose anything.
-    irq_flags |= spi_write(0x12, 0xff);    
+    const uint8_t irq_flags = radio.takeIrqFlags();
+    // After a wake-up from deep sleep there is no edge time
+    const uint32_t edgeUs = edgeTimes.popLatest(micros());
 
     interrupts();
     // *******************************************************************************
     
-    // RX timeout - ignored
-    if (irq_flags & 0x80) {
-    } 
-    // RxDone without a CRC error
-    if ((irq_flags & 0x40) && !(irq_flags & 0x20)) {
-        event_RxDone();
-    }
-    // TxDone
-    if (irq_flags & 0x08) {
-        event_TxDone();
-    }
-    // CadDone
-    if (irq_flags & 0x04) {
-        if (irq_flags & 0x01) {
-            event_CadDone_Detection();
-        } else {
-            event_CadDone_NoDetection();
-        }
-    }
-}
-
-static void event_tick_Tx() {
-    // Check for the case where a transmission times out
-    if (mainClock.time() - startTxTime > TX_TIMEOUT_MS) {
-        logger.println("ERR: TX time out");
-        start_Rx();
-    }
-}
-
-static void event_tick_Rx() {
-    // Check for pending transmissions.  If nothing is pending then 
-    // return without any state change.
-    if (txBuffer.isEmpty()) {
-        // No state change needed here
-        return;
-    }
-    else {
-        // At this point we know there is something pending.  We first 
-        // go into CAD mode to make sure the channel is innactive.
-        // A successful CAD check (with no detection) will trigger 
-        // the transmission.
-        start_Cad();
-    }
-}
-
-static void event_tick_Cad() {
-    // Check for the case where a CAD check times out
-    if (mainClock.time() > endCadTime) {
-        event_CadDone_NoDetection();
-    }
-}
-
-// Call periodically to look for timeouts or other pending activity.  This will happen
-// on the regular application thread.
-void event_tick() {
-    if (state == State::RX_STATE) {
-        event_tick_Rx();
-    } else if (state == State::TX_STATE) {
-        event_tick_Tx();
-    } else if (state == State::CAD) {
-        event_tick_Cad();
-    }
-}
-
-// --------------------------------------------------------------------------
-// Radio Utilty Functions
-// 
-// This reference will be very important to you:
-// https://www.hoperf.com/data/upload/portal/20190730/RFM95W-V2.0.pdf
-// 
-// The LoRa register map starts on page 103.
-
-static void set_mode_SLEEP() {
-    spi_write(0x01, 0x00);  
-}
-
-static void set_mode_STDBY() {
-    spi_write(0x01, 0x01);  
-}
-
-static void set_mode_TX() {
-    spi_write(0x01, 0x03);
-}
-
-static void set_mode_RXCONTINUOUS() {
-    spi_write(0x01, 0x05);
-}
-
-static void set_mode_CAD() {
-    spi_write(0x01, 0x07);
-}
-
-// See table 17 - DIO0 is controlled by bits 7-6
-static void enable_interrupt_TxDone() {
-    spi_write(0x40, 0x40);
-}
-
-// See table 17 - DIO0 is controlled by bits 7-6
-static void enable_interrupt_RxDone() {
-    spi_write(0x40, 0x00);
-}
-
-// See table 17 - DIO0 is controlled by bits 7-6
-static void enable_interrupt_CadDone() {
-    spi_write(0x40, 0x80);
-}
-
-/** Sets the radio frequency from a decimal value that is quoted
- *   in MHz.
- */
-// See page 103
-void set_frequency(float freq_mhz) {
-    const float CRYSTAL_MHZ = 32000000.0;
-    const float FREQ_STEP = (CRYSTAL_MHZ / 524288);
-    const uint32_t f = (freq_mhz * 1000000.0) / FREQ_STEP;
-    spi_write(0x06, (f >> 16) & 0xff);
-    spi_write(0x07, (f >> 8) & 0xff);
-    spi_write(0x08, f & 0xff);
-}
-
-void write_message(uint8_t* data, uint8_t len) {
-    // Move pointer to the start of the FIFO
-    spi_write(0x0d, 0);
-    // The message
-    spi_write_multi(0x00, data, len);
-    // Update the length register
-    spi_write(0x22, len);
+    radio.processIrqFlags(irq_flags, edgeUs);
 }
 
 int reset_radio() {
@@ -523,8 +304,11 @@ int reset_radio() {
     // Not sure if this is really needed:
     delay(250);
 
+    // Everything went back to the power-on defaults
+    radio.syncShadow();
+
     // Initialize the radio
-    if (init_radio() != 0) {
+    if (radio.init(STATION_FREQUENCY) != 0) {
         logger.println(F("ERR: Problem with radio initialization"));
         return -1;
     }
@@ -541,134 +325,11 @@ int reset_radio() {
     digitalWrite(LED_PIN, LOW);
 
     // Start listening for messages
-    start_Rx();
+    radio.startRx();
 
     return 0;  
 }
 
-/**
- * @brief Sets the Over Current Protection register.
- * 
- * @param current_ma 
- */
-static void set_ocp(uint8_t current_ma) {
-
-    uint8_t trim = 27;
-    if (current_ma <= 120) {
-        trim = (current_ma - 45) / 5;
-    } else if (current_ma <= 240) {
-        trim = (current_ma + 30) / 10;
-    }
-    spi_write(0x0b, 0x20 | (0x1F & trim));
-}
-
-static void setLowDatarate() {
-
-    // called after changing bandwidth and/or spreading factor
-    //  Semtech modem design guide AN1200.13 says 
-    // "To avoid issues surrounding  drift  of  the  crystal  reference  oscillator  due  to  either  temperature  change  
-    // or  motion,the  low  data  rate optimization  bit  is  used. Specifically for 125  kHz  bandwidth  and  SF  =  11  and  12,  
-    // this  adds  a  small  overhead  to increase robustness to reference frequency variations over the timescale of the LoRa packet."
- 
-    // read current value for BW and SF
-    uint8_t bw = spi_read(0x1d) >> 4;	// bw is in bits 7..4
-    uint8_t sf = spi_read(0x1e) >> 4;	// sf is in bits 7..4
-   
-    // calculate symbol time (see Semtech AN1200.22 section 4)
-    float bw_tab[] = { 7800, 10400, 15600, 20800, 31250, 41700, 62500, 
-      125000, 250000, 500000};
-    float bandwidth = bw_tab[bw];
-    float symbolTime = 1000.0 * pow(2, sf) / bandwidth;	// ms
-   
-    // the symbolTime for SF 11 BW 125 is 16.384ms. 
-    // and, according to this :- 
-    // https://www.thethingsnetwork.org/forum/t/a-point-to-note-lora-low-data-rate-optimisation-flag/12007
-    // the LDR bit should be set if the Symbol Time is > 16ms
-    // So the threshold used here is 16.0ms
- 
-    // the LDR is bit 3 of register 0x26
-    uint8_t current = spi_read(0x26) & ~0x08; // mask off the LDR bit
-    if (symbolTime > 16.0)
-      spi_write(0x26, current | 0x08);
-    else
-      spi_write(0x26, current);   
-}
-
-/** 
- *  All of the one-time initialization of the radio
- */
-int init_radio() {
-
-    // Check the radio version to make sure things are connected
-    uint8_t ver = spi_read(0x42);
-    if (ver != 18) {
-        return -1;
-    }
-
-    // Switch into Sleep mode, LoRa mode
-    spi_write(0x01, 0x80);
-    // Wait for sleep mode 
-    delay(10); 
-
-    // Make sure we are actually in sleep mode
-    if (spi_read(0x01) != 0x80) {
-        return -1; 
-    }
-
-    // Setup the FIFO pointers
-    // TX base:
-    spi_write(0x0e, 0);
-    // RX base:
-    spi_write(0x0f, 0);
-
-    set_frequency(STATION_FREQUENCY);
-
-    // Set LNA boost
-    spi_write(0x0c, spi_read(0x0c) | 0x03);
-
-    // AgcAutoOn=LNA gain set by AGC
-    spi_write(0x26, 0x04);
-
-    // DAC enable (adds 3dB)
-    spi_write(0x4d, 0x87);
-
-    // Turn on PA and set power to +20dB
-    // PaSelect=1
-    // OutputPower=17 (20 - 3dB from DAC)
-    spi_write(0x09, 0x80 | ((20 - 3) - 2));
-
-    // Set OCP to 140 (as per the Sandeep Mistry library)
-    set_ocp(140);
-
-    // Go into stand-by
-    set_mode_STDBY();
-
-    // Configure the radio
-    uint8_t reg = 0;
-
-    // 7-4: 0111  (125k BW)
-    // 3-1: 001   (4/5 coding rate)
-    // 0:   0     (Explicit header mode)
-    reg = 0b01110010;
-    spi_write(0x1d, reg);
-
-    // 7-4:   9 (512 chips/symbol, spreading factor 9)
-    // 3:     0 (RX continuous mode normal)
-    // 2:     1 (CRC mode on)
-    // 1-0:   0 (RX timeout MSB) 
-    reg = 0b10010100;
-    spi_write(0x1e, reg);
-
-    // Preable Length=8 (default)
-    // Preamble MSB and LSB
-    //spi_write(0x20, 8 >> 8);
-    //spi_write(0x21, 8 & 0xff);
-
-    setLowDatarate();
-
-    return 0;
-}
-
 static bool isDelim(char d, const char* delims) {
     const char* ptr = delims;
     while (*ptr != 0) {
@@ -757,7 +418,7 @@ static bool check_low_battery(void*) {
         systemConfig.setSleepCount(systemConfig.getSleepCount() + 1);
         // Put the radio into SLEEP mode to minimize power consumpion.  Per the 
         // datasheet the sleep current is 1uA.
-        set_mode_SLEEP();
+        radio.sleep();
         // Put the ESP32 into a deep sleep that will be awakened using the timer.
         // Wakeup will look like reboot.
         esp_sleep_enable_timer_wakeup(DEEP_SLEEP_SECONDS * S_TO_US_FACTOR);
@@ -768,29 +429,81 @@ static bool check_low_battery(void*) {
 }
 
 /**
- * @brief (Advanced feature) This is used in a time to see if we 
- * can put the processor to sleep between messages.  
- * 
- * @return true 
- * @return false 
+ * @brief Puts the radio and the ESP32 to sleep between the wake windows
+ * of the coordinated sleep schedule.  A light sleep is used so that 
+ * everything in memory (routes, neighbors, network time, queued 
+ * traffic) is still there after the wake-up.  The clocks keep running 
+ * while asleep.
  */
-static bool check_idle(void*) {
-  
-    if (state == State::RX_STATE &&
-        systemMessageProcessor.getPendingCount() == 0 &&
-        systemMessageProcessor.getSecondsSinceLastRx() > IDLE_INTERVAL_SECONDS) {
-        logger.println("INF: Sleeping due to inactivity");
-        // Put the ESP32 into a deep sleep that will be awakened using 
-        // an external interrupt.  Wakeup will look like reboot.
-        //
-        // There are a limited number of GPIOs that can be used 
-        // for this purpose.
-        //
-        esp_sleep_enable_ext0_wakeup(GPIO_NUM_4, 1);
-        esp_deep_sleep_start();        
+static void check_sleep() {
+
+    // The exchange time (a CAD, the longest frame and its ACK) follows 
+    // the radio profile
+    sleepSchedule.setTxMarginMs(channelAccess.getTdmaExchangeUs() / 1000);
+
+    uint32_t sleepMs = sleepSchedule.getSleepMs();
+    if (sleepMs == 0) {
+        return;
+    }
+    // Nothing can be in progress
+    if (isrHit || 
+        radio.getState() != RadioDriver::RX_STATE || 
+        radio.isAckWindowOpen() ||
+        !txBuffer.isEmpty() || 
+        !rxBuffer.isEmpty()) {
+        return;
+    }
+    if (sleepMs > MAX_LIGHT_SLEEP_MS) {
+        sleepMs = MAX_LIGHT_SLEEP_MS;
     }
 
-    return true;
+    // Let any logging finish
+    Serial.flush();
+    // Per the datasheet the radio's sleep current is 1uA
+    radio.sleep();
+    esp_sleep_enable_timer_wakeup(sleepMs * 1000UL);
+    // Typing on the console wakes us up (the first few characters are lost)
+    esp_sleep_enable_uart_wakeup(0);
+    const uint32_t start = mainClock.time();
+    esp_light_sleep_start();
+    sleepSchedule.processSleep(mainClock.time() - start);
+    radio.wake();
+    esp_task_wdt_reset();
+}
+
+// When the console was last used
+static uint32_t lastConsoleTime = 0;
+
+/**
+ * @brief Puts the ESP32 into a light sleep while the radio is asleep 
+ * between low power listening channel samples.  The radio stays in 
+ * SLEEP mode and the next sample is taken after the wake-up.
+ */
+static void check_lpl_sleep() {
+
+    uint32_t sleepMs = radio.getLplSleepMs();
+    if (sleepMs == 0) {
+        return;
+    }
+    // Nothing can be in progress and the operator gets a chance to 
+    // type the next command
+    if (isrHit || 
+        !txBuffer.isEmpty() || 
+        !rxBuffer.isEmpty() ||
+        mainClock.time() - lastConsoleTime < CONSOLE_HOLD_MS) {
+        return;
+    }
+    if (sleepMs > MAX_LIGHT_SLEEP_MS) {
+        sleepMs = MAX_LIGHT_SLEEP_MS;
+    }
+
+    // Let any logging finish
+    Serial.flush();
+    esp_sleep_enable_timer_wakeup(sleepMs * 1000UL);
+    // Typing on the console wakes us up (the first few characters are lost)
+    esp_sleep_enable_uart_wakeup(0);
+    esp_light_sleep_start();
+    esp_task_wdt_reset();
 }
 
 void setup() {
@@ -822,6 +535,27 @@ void setup() {
     nvram.begin("my-app", false);
     mainConfig.begin();
     routingTable.begin();
+    // Route selection takes the link metrics into account
+    routingTable.setNeighborTable(&neighborTable);
+    // Setup the CSMA/CA policy
+    channelAccess.configure(mainConfig.getChannelAccessConfig());
+    channelAccess.configureTdma(mainConfig.getTdmaConfig(), mainConfig.getAddr());
+    channelAccess.setNetworkClock(&networkClock);
+    messageProcessor.setChannelAccess(&channelAccess);
+    messageProcessor.setNetworkClock(&networkClock);
+    // Setup the coordinated sleep
+    sleepSchedule.configure(mainConfig.getSleepConfig());
+    sleepSchedule.setNetworkClock(&networkClock);
+    messageProcessor.setSleepSchedule(&sleepSchedule);
+    // Select the radio profile.  This is given to the radio when it is
+    // initialized.
+    radio.setProfile(mainConfig.getRadioProfiles().getActive());
+    // The spreading factor and transmit power of each link are chosen 
+    // using the link metrics
+    radio.setNeighborTable(&neighborTable);
+    radio.setNetworkClock(&networkClock);
+    // Sample the channel instead of listening all of the time
+    radio.setLplInterval(mainConfig.getLplInterval());
 
     // Radio interrupt pin
     pinMode(DIO0_PIN, INPUT);
@@ -841,20 +575,35 @@ void setup() {
     shell.addCommand(F("t <addr> <text>"), sendText);
     shell.addCommand(F("sendsetroute <addr> <target addr> <next hop addr> <passcode>"), sendSetRoute);
     shell.addCommand(F("sendgetroute <addr> <target addr>"), sendGetRoute);
+    shell.addCommand(F("sendgetlinks <addr>"), sendGetLinks);
     shell.addCommand(F("factoryreset"), factoryReset);
 
     shell.addCommand(F("setaddr <addr>"), setAddr);
     shell.addCommand(F("setcall <call_sign>"), setCall);
     shell.addCommand(F("setroute <target addr> <next hop addr> <passcode>"), setRoute);
+    shell.addCommand(F("setbackuproute <target addr> <backup hop addr> [<backup hop addr>]"), setBackupRoute);
     shell.addCommand(F("clearroutes"), clearRoutes);
     shell.addCommand(F("setblimit <limit_mv>"), setBatteryLimit);
     shell.addCommand(F("setpasscode <passcode>"), setPasscode);
     shell.addCommand(F("setlog <level>"), setLog);
     shell.addCommand(F("setmode <mode>"), setMode);
+    shell.addCommand(F("setprobe <seconds>"), setProbe);
+    shell.addCommand(F("setcsma <persist pct> <slot ms>"), setCsma);
+    shell.addCommand(F("setcw <class 0=ack,1=control,2=data> <cw min> <cw max>"), setCw);
+    shell.addCommand(F("settdma <0|1> <slot count> <slot ms> [<slot> ...]"), setTdma);
+    shell.addCommand(F("setsleep <0|1> <period ms> <listen ms> <extend ms>"), setSleep);
+    shell.addCommand(F("setlpl <sample interval ms>"), setLpl);
+    shell.addCommand(F("setprofile <name>"), setProfile);
+    shell.addCommand(F("defprofile <slot> <name> <sf 7-12> <bw 0-9, 7=125kHz> <cr 1-4> <power dBm>"), defProfile);
+    shell.addCommand(F("profiles"), profiles);
+    shell.addCommand(F("sendsetprofile <name> <delay seconds> <fallback seconds> <passcode>"), sendSetProfile);
+    shell.addCommand(F("settime <seconds since epoch>"), setTime);
+    shell.addCommand(F("time"), showTime);
 
     shell.addCommand(F("reset"), boot);
     shell.addCommand(F("resetradio"), bootRadio);
     shell.addCommand(F("info"), info);
+    shell.addCommand(F("links"), links);
     shell.addCommand(F("sleep <seconds>"), sleep);
     shell.addCommand(F("print <text>"), print);
     shell.addCommand(F("rem <text>"), rem);
@@ -891,7 +640,7 @@ void setup() {
           // Given that we just came up from an interrupt trigger, setup 
           // the state as if we were waiting for a message, and then 
           // set the flag that will cause the ISR code to run.
-          state = State::RX_STATE;
+          radio.resumeRx();
           isrHit = true;
         }
         // Any other reason for a reboot causes full radio reset/initialization
@@ -903,9 +652,6 @@ void setup() {
         
     // Enable the battery check timer
     timer.every(BATTERY_CHECK_INTERVAL_SECONDS * 1000, check_low_battery);
-    // Enable the idle check
-    // TODO: NOT WORKING YET - NOT SURE WHY
-    //timer.every(IDLE_CHECK_INTERVAL_SECONDS * 1000, check_idle);
    
     // Enable the watchdog timer
     esp_task_wdt_init(WDT_TIMEOUT, true); //enable panic so ESP32 restarts
@@ -919,17 +665,26 @@ void loop() {
   check_for_interrupts();
  
   // Check for shell activity
-  shell.executeIfInput();
+  if (shell.executeIfInput()) {
+    // Give the operator a chance to type the next command
+    sleepSchedule.processActivity();
+    lastConsoleTime = mainClock.time();
+  }
   
   // Service the timers
   timer.tick();
 
   // Check for radio activity
-  event_tick();
+  radio.tick();
 
   // Perform any message processing that is pending
   systemMessageProcessor.pump();
 
+  // Sleep between the wake windows if possible
+  check_sleep();
+  // Sleep between low power listening samples if possible
+  check_lpl_sleep();
+
   // Keep the watchdog alive
   esp_task_wdt_reset();
 }
@@ -0,0 +1,463 @@
+#include <string.h>
+
+#include "SX1276Emulator.h"
+#include "../station/Airtime.h"
+
+// Signed difference, so that comparisons survive the wrap of the 
+// microsecond clock
+static bool isDue(uint32_t now, uint32_t t) {
+    return (int32_t)(now - t) >= 0;
+}
+
+SX1276Emulator::SX1276Emulator(TestClock& clock) 
+:   _clock(clock),
+    _channel(0),
+    _dio0Cb(0),
+    _dio0Ctx(0),
+    _cadPending(false),
+    _cadEndUs(0),
+    _txPending(false),
+    _txEndUs(0),
+    _txStartUs(0),
+    _updating(false),
+    _transactions(0),
+    _ns(0),
+    _txCount(0),
+    _rxCount(0),
+    _crcErrorCount(0),
+    _headerErrorCount(0) {
+    memset(_regs, 0, sizeof(_regs));
+    memset(_fifo, 0, sizeof(_fifo));
+    // Power-on defaults: FSK stand-by
+    _regs[0x01] = 0x09;
+    _regs[0x0e] = 0x80;
+    _regs[0x0f] = 0x00;
+    _regs[0x1d] = 0x72;
+    _regs[0x1e] = 0x70;
+    _regs[0x21] = 0x08;
+    _regs[0x22] = 0x01;
+    _regs[0x23] = 0xff;
+    _regs[0x42] = 0x12;
+}
+
+// ----- RegisterBus -----------------------------------------------------------
+
+uint8_t SX1276Emulator::read(uint8_t reg) {
+    _account(1);
+    return _get(reg);
+}
+
+void SX1276Emulator::readMulti(uint8_t reg, uint8_t* buf, uint8_t len) {
+    _account(len);
+    for (unsigned int i = 0; i < len; i++) 
+        buf[i] = (reg == 0x00) ? _get(0x00) : _get(reg + i);
+}
+
+uint8_t SX1276Emulator::write(uint8_t reg, uint8_t val) {
+    _account(1);
+    const uint8_t orig = _regs[reg];
+    _set(reg, val);
+    return orig;
+}
+
+void SX1276Emulator::writeMulti(uint8_t reg, const uint8_t* buf, uint8_t len) {
+    _account(len);
+    for (unsigned int i = 0; i < len; i++) 
+        _set(reg == 0x00 ? 0x00 : reg + i, buf[i]);
+}
+
+void SX1276Emulator::_account(unsigned int len) {
+    _transactions++;
+    _ns += SPI_TRANSACTION_NS + (len + 1) * SPI_BYTE_NS;
+    _clock.advanceUs(_ns / 1000);
+    _ns = _ns % 1000;
+    update();
+}
+
+uint8_t SX1276Emulator::_get(uint8_t reg) {
+    if (reg == 0x00) 
+        return _fifo[_regs[0x0d]++];
+    // RegModemStat: signal detected, synchronized and header valid, or
+    // modem clear
+    if (reg == 0x18) 
+        return (_channel && isReceiving() && _channel->isLockedOn(this)) ? 
+            0x0b : 0x10;
+    return _regs[reg & 0x7f];
+}
+
+void SX1276Emulator::_set(uint8_t reg, uint8_t val) {
+    reg = reg & 0x7f;
+    if (reg == 0x00) {
+        _fifo[_regs[0x0d]++] = val;
+    } 
+    // IRQ flags are cleared by writing a 1
+    else if (reg == 0x12) {
+        _regs[0x12] &= ~val;
+    } 
+    else if (reg == 0x01) {
+        _setMode(val);
+    }
+    // Read-only status registers
+    else if (reg == 0x10 || (reg >= 0x13 && reg <= 0x1c) || reg == 0x42) {
+    }
+    else {
+        _regs[reg] = val;
+    }
+}
+
+void SX1276Emulator::_setMode(uint8_t val) {
+
+    // The LoRa bit only changes on the way into sleep mode
+    if ((val & 0x07) == 0x00) 
+        _regs[0x01] = val;
+    else 
+        _regs[0x01] = (_regs[0x01] & 0x80) | (val & 0x7f);
+
+    const uint8_t mode = val & 0x07;
+    const uint32_t now = _clock.timeUs();
+
+    // Anything other than CAD cancels a CAD in progress
+    if (mode != 0x07) {
+        _cadPending = false;
+    }
+
+    if (mode == 0x03) {
+        _txCount++;
+        _txStartUs = now;
+        const uint8_t len = _regs[0x22];
+        uint8_t frame[256];
+        for (unsigned int i = 0; i < len; i++) 
+            frame[i] = _fifo[(uint8_t)(_regs[0x0e] + i)];
+        if (_channel) {
+            const uint16_t preambleLen = getPreambleLen();
+            const uint32_t syncUs = (preambleLen > SYNC_SYMBOLS) ? 
+                (preambleLen - SYNC_SYMBOLS) * getSymbolUs() : 0;
+            _channel->startTransmission(this, frame, len, isImplicitHeader(),
+                getSf(), getAirtimeUs(len), syncUs);
+        } else {
+            _txPending = true;
+            _txEndUs = now + getAirtimeUs(len);
+        }
+    } 
+    else if (mode == 0x07) {
+        _cadPending = true;
+        _cadEndUs = now + getCadUs();
+    } 
+    else if (mode == 0x05) {
+        // The packet counter is cleared on entry into receive mode
+        _regs[0x16] = 0;
+        _regs[0x17] = 0;
+        if (_channel) {
+            _channel->startReception(this);
+        }
+    }
+}
+
+void SX1276Emulator::_raise(uint8_t flags) {
+    // Masked interrupts don't show up at all
+    flags &= ~_regs[0x11];
+    _regs[0x12] |= flags;
+    // See table 17 - DIO0 is controlled by bits 7-6
+    const uint8_t mapping = _regs[0x40] >> 6;
+    const bool dio0 = (mapping == 0 && (flags & 0x40)) ||
+        (mapping == 1 && (flags & 0x08)) ||
+        (mapping == 2 && (flags & 0x04));
+    if (dio0 && _dio0Cb) 
+        _dio0Cb(_dio0Ctx);
+}
+
+// ----- Test Interface ---------------------------------------------------------
+
+void SX1276Emulator::setDio0Callback(void (*cb)(void*), void* ctx) {
+    _dio0Cb = cb;
+    _dio0Ctx = ctx;
+}
+
+void SX1276Emulator::setFreqErrorHz(int32_t hz) {
+    const float raw = (float)hz * (32000000.0 / 16777216.0) * 
+        (500000.0 / (float)loraBandwidthHz(_regs[0x1d] >> 4));
+    const int32_t fei = ((int32_t)(raw < 0 ? raw - 0.5 : raw + 0.5)) & 0xfffff;
+    _regs[0x28] = fei >> 16;
+    _regs[0x29] = (fei >> 8) & 0xff;
+    _regs[0x2a] = fei & 0xff;
+}
+
+void SX1276Emulator::update() {
+    if (_channel) {
+        _channel->update();
+        return;
+    }
+    if (_updating)
+        return;
+    _updating = true;
+    const uint32_t now = _clock.timeUs();
+    if (_txPending && isDue(now, _txEndUs)) {
+        _txPending = false;
+        completeTx();
+    }
+    if (_cadPending && isDue(now, _cadEndUs)) {
+        completeCad(false);
+    }
+    _updating = false;
+}
+
+void SX1276Emulator::completeTx() {
+    if (getMode() == 0x03) {
+        _regs[0x01] = (_regs[0x01] & 0xf8) | 0x01;
+        _raise(0x08);
+    }
+}
+
+void SX1276Emulator::completeCad(bool detected) {
+    _cadPending = false;
+    if (getMode() == 0x07) {
+        _regs[0x01] = (_regs[0x01] & 0xf8) | 0x01;
+        _raise(0x04 | (detected ? 0x01 : 0x00));
+    }
+}
+
+void SX1276Emulator::inject(const uint8_t* frame, uint8_t len, int8_t snr, 
+    int16_t rssi, bool crcError) {
+
+    if (!isReceiving() || len > _regs[0x23])
+        return;
+
+    const uint8_t base = _regs[0x0f];
+    for (unsigned int i = 0; i < len; i++) 
+        _fifo[(uint8_t)(base + i)] = frame[i];
+    _regs[0x10] = base;
+    _regs[0x13] = len;
+    _regs[0x25] = base + len;
+
+    uint16_t count = (_regs[0x16] << 8) | _regs[0x17];
+    count++;
+    _regs[0x16] = count >> 8;
+    _regs[0x17] = count & 0xff;
+
+    // Inverse of the conversion on page 112 (high frequency port)
+    _regs[0x19] = (uint8_t)(snr * 4);
+    if (snr < 0) 
+        _regs[0x1a] = rssi + 157 - snr;
+    else 
+        _regs[0x1a] = ((rssi + 157) * 15) / 16;
+
+    if (crcError) 
+        _crcErrorCount++;
+    else 
+        _rxCount++;
+
+    _raise(0x40 | (crcError ? 0x20 : 0x00));
+}
+
+void SX1276Emulator::receive(const uint8_t* frame, uint8_t len, 
+    bool implicitHeader, int8_t snr, int16_t rssi, bool crcError) {
+    if (!isReceiving())
+        return;
+    if (isImplicitHeader()) {
+        // The receiver decides how long the frame is
+        const uint8_t rxLen = _regs[0x22];
+        uint8_t buf[256];
+        memset(buf, 0, sizeof(buf));
+        memcpy(buf, frame, len < rxLen ? len : rxLen);
+        inject(buf, rxLen, snr, rssi, 
+            crcError || !implicitHeader || len != rxLen);
+    } else if (implicitHeader) {
+        _headerErrorCount++;
+    } else {
+        inject(frame, len, snr, rssi, crcError);
+    }
+}
+
+uint32_t SX1276Emulator::getSymbolUs() const {
+    return loraSymbolUs(_regs[0x1e] >> 4, loraBandwidthHz(_regs[0x1d] >> 4));
+}
+
+/**
+ * Per AN1200.48 a CAD takes a little under two symbols (the receiver 
+ * listens for one symbol and then processes it).
+ */
+uint32_t SX1276Emulator::getCadUs() const {
+    return getSymbolUs() * 15 / 8;
+}
+
+uint32_t SX1276Emulator::getAirtimeUs(uint8_t len) const {
+    return loraAirtimeUs(
+        _regs[0x1e] >> 4, 
+        loraBandwidthHz(_regs[0x1d] >> 4),
+        (_regs[0x1d] >> 1) & 0x07,
+        len,
+        (_regs[0x20] << 8) | _regs[0x21],
+        (_regs[0x1e] & 0x04) != 0,
+        (_regs[0x1d] & 0x01) != 0,
+        (_regs[0x26] & 0x08) != 0);
+}
+
+// ----- VirtualChannel ---------------------------------------------------------
+
+VirtualChannel::VirtualChannel(TestClock& clock) 
+:   _clock(clock),
+    _radioCount(0),
+    _nextTx(0),
+    _snr(8),
+    _rssi(-80),
+    _updating(false),
+    _collisionCount(0) {
+    memset(_tx, 0, sizeof(_tx));
+}
+
+void VirtualChannel::attach(SX1276Emulator* radio) {
+    if (_radioCount < VC_MAX_RADIOS) {
+        _radios[_radioCount++] = radio;
+        radio->setChannel(this);
+    }
+}
+
+int VirtualChannel::_indexOf(const SX1276Emulator* radio) const {
+    for (unsigned int i = 0; i < _radioCount; i++)
+        if (_radios[i] == radio)
+            return i;
+    return -1;
+}
+
+void VirtualChannel::update() {
+
+    if (_updating)
+        return;
+    _updating = true;
+
+    const uint32_t now = _clock.timeUs();
+
+    // Process the events that are due in time order
+    while (true) {
+        Transmission* nextTx = 0;
+        SX1276Emulator* nextCad = 0;
+        uint32_t nextTime = 0;
+        for (unsigned int i = 0; i < VC_MAX_TRANSMISSIONS; i++) {
+            Transmission& t = _tx[i];
+            if (t.active && isDue(now, t.endUs) && 
+                (!nextTx || isDue(nextTime, t.endUs))) {
+                nextTx = &t;
+                nextTime = t.endUs;
+            }
+        }
+        for (unsigned int i = 0; i < _radioCount; i++) {
+            SX1276Emulator* r = _radios[i];
+            if (r->isCadPending() && isDue(now, r->getCadEndUs()) &&
+                ((!nextTx && !nextCad) || isDue(nextTime, r->getCadEndUs()))) {
+                nextCad = r;
+                nextTime = r->getCadEndUs();
+            }
+        }
+        if (nextCad) {
+            nextCad->completeCad(isBusy(nextCad, nextTime, nextCad->getSymbolUs()));
+        } else if (nextTx) {
+            _endTransmission(*nextTx);
+        } else {
+            break;
+        }
+    }
+
+    _updating = false;
+}
+
+void VirtualChannel::startTransmission(SX1276Emulator* from, const uint8_t* data, 
+    uint8_t len, bool implicitHeader, uint8_t sf, uint32_t airtimeUs,
+    uint32_t syncUs) {
+
+    // Get everything up to date first
+    update();
+
+    Transmission& t = _tx[_nextTx];
+    _nextTx = (_nextTx + 1) % VC_MAX_TRANSMISSIONS;
+
+    t.from = from;
+    memcpy(t.data, data, len);
+    t.len = len;
+    t.implicitHeader = implicitHeader;
+    t.sf = sf;
+    t.startUs = _clock.timeUs();
+    t.endUs = t.startUs + airtimeUs;
+    t.syncEndUs = t.startUs + syncUs;
+    t.active = true;
+
+    for (unsigned int i = 0; i < _radioCount; i++) {
+        t.locked[i] = false;
+        t.corrupted[i] = false;
+        SX1276Emulator* r = _radios[i];
+        if (r == from) 
+            continue;
+        // Is anything else on the air from this receiver's point of view?
+        bool otherOnAir = false;
+        for (unsigned int j = 0; j < VC_MAX_TRANSMISSIONS; j++) {
+            Transmission& u = _tx[j];
+            if (&u == &t || !u.active || u.from == r || u.sf != sf)
+                continue;
+            otherOnAir = true;
+            // Whatever the receiver was locked on to is lost
+            if (u.locked[i] && !u.corrupted[i]) {
+                u.corrupted[i] = true;
+                _collisionCount++;
+            }
+        }
+        if (!otherOnAir && r->isReceiving() && r->getSf() == sf) {
+            t.locked[i] = true;
+        }
+    }
+}
+
+bool VirtualChannel::isLockedOn(const SX1276Emulator* receiver) const {
+    const int i = _indexOf(receiver);
+    if (i < 0)
+        return false;
+    for (unsigned int j = 0; j < VC_MAX_TRANSMISSIONS; j++) {
+        const Transmission& t = _tx[j];
+        if (t.active && t.locked[i] && t.sf == receiver->getSf())
+            return true;
+    }
+    return false;
+}
+
+void VirtualChannel::startReception(SX1276Emulator* radio) {
+    const int i = _indexOf(radio);
+    if (i < 0)
+        return;
+    const uint32_t now = _clock.timeUs();
+    Transmission* found = 0;
+    for (unsigned int j = 0; j < VC_MAX_TRANSMISSIONS; j++) {
+        Transmission& t = _tx[j];
+        if (!t.active || t.from == radio || t.sf != radio->getSf())
+            continue;
+        // Already locked on, or more than one thing on the air
+        if (t.locked[i] || found)
+            return;
+        found = &t;
+    }
+    if (found && !isDue(now, found->syncEndUs)) {
+        found->locked[i] = true;
+        found->corrupted[i] = false;
+    }
+}
+
+void VirtualChannel::_endTransmission(Transmission& t) {
+    t.active = false;
+    t.from->completeTx();
+    for (unsigned int i = 0; i < _radioCount; i++) {
+        if (t.locked[i] && _radios[i]->getSf() == t.sf) {
+            _radios[i]->receive(t.data, t.len, t.implicitHeader, _snr, _rssi, 
+                t.corrupted[i]);
+        }
+    }
+}
+
+bool VirtualChannel::isBusy(const SX1276Emulator* observer, uint32_t timeUs, 
+    uint32_t detectUs) const {
+    for (unsigned int i = 0; i < VC_MAX_TRANSMISSIONS; i++) {
+        const Transmission& t = _tx[i];
+        if (t.from == 0 || t.from == observer || t.sf != observer->getSf()) 
+            continue;
+        // On the air long enough to be detected and not finished
+        if (isDue(timeUs, t.startUs + detectUs) && !isDue(timeUs, t.endUs))
+            return true;
+    }
+    return false;
+}
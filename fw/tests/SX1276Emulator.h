@@ -0,0 +1,243 @@
+#ifndef _SX1276Emulator_h
+#define _SX1276Emulator_h
+
+#include <stdint.h>
+
+#include "../station/RegisterBus.h"
+#include "TestClockImpl.h"
+
+class VirtualChannel;
+
+// The number of preamble symbols that a receiver needs to synchronize
+#define SYNC_SYMBOLS 5
+
+// Cost of an SPI transaction at 10 MHz: 0.8us per byte plus the 
+// chip select and driver overhead.
+#define SPI_BYTE_NS 800
+#define SPI_TRANSACTION_NS 2000
+
+/**
+ * @brief A register-level model of the SX1276 in LoRa mode, used for
+ * running the radio driver on the host.
+ * 
+ * The following is modelled:
+ * 
+ * - The register file and the FIFO, including the FIFO pointer 
+ *   auto-increment and RegFifoRxCurrentAddr/RegRxNbBytes.
+ * - The mode register.  TX, CAD and RX complete at the times implied by 
+ *   the modem configuration (airtime and symbol time).  The radio goes
+ *   back to stand-by on its own after a TX or CAD.
+ * - The write-to-clear IRQ flags and the DIO0 mapping (a callback is 
+ *   fired when the mapped event happens).
+ * - Each received packet is written at RegFifoRxBaseAddr and counted 
+ *   in RegRxPacketCnt, which is cleared on entry into receive mode.
+ * - Explicit and implicit header mode.  A receiver in explicit header
+ *   mode can't find the header of an implicit mode frame, so it 
+ *   hears nothing.  A receiver in implicit header mode takes 
+ *   RegPayloadLength bytes from whatever it hears, so anything that 
+ *   isn't an implicit mode frame of that length fails the CRC.
+ * - RegModemStat shows a signal while the receiver is locked on to a
+ *   transmission.
+ * - The spreading factor.  A receiver (or a CAD) only sees transmissions 
+ *   that use the same spreading factor, and transmissions on different
+ *   spreading factors don't collide.
+ * 
+ * Every bus transaction advances the shared clock by the time it 
+ * would take on a 10 MHz SPI bus.  Radios that are attached to the same
+ * VirtualChannel hear each other.
+ */
+class SX1276Emulator : public RegisterBus {
+public:
+
+    SX1276Emulator(TestClock& clock);
+
+    // ----- RegisterBus ---------------------------------------------------
+
+    uint8_t read(uint8_t reg);
+    void readMulti(uint8_t reg, uint8_t* buf, uint8_t len);
+    uint8_t write(uint8_t reg, uint8_t val);
+    void writeMulti(uint8_t reg, const uint8_t* buf, uint8_t len);
+
+    // ----- Test Interface ------------------------------------------------
+
+    void setDio0Callback(void (*cb)(void*), void* ctx);
+
+    /**
+     * @brief Sets the frequency error that is reported for received 
+     * packets (RegFeiMsb/Mid/Lsb) using the current bandwidth.
+     */
+    void setFreqErrorHz(int32_t hz);
+
+    /**
+     * @brief Brings the radio up to the current time.  Events that are 
+     * due (end of TX, end of CAD, received packets) are processed.
+     */
+    void update();
+
+    /**
+     * @brief Puts a packet directly into the receiver, as if it had 
+     * just finished arriving.  Ignored unless the radio is in receive
+     * mode.
+     */
+    void inject(const uint8_t* frame, uint8_t len, int8_t snr, int16_t rssi,
+        bool crcError = false);
+
+    /**
+     * @brief Like inject(), but for a frame that was sent using the header
+     * mode given.  The header mode of the receiver decides what comes 
+     * out.
+     */
+    void receive(const uint8_t* frame, uint8_t len, bool implicitHeader, 
+        int8_t snr, int16_t rssi, bool crcError = false);
+
+    /**
+     * @return The time on air of a frame using the current modem 
+     *   configuration.
+     */
+    uint32_t getAirtimeUs(uint8_t len) const;
+    uint32_t getSymbolUs() const;
+    uint32_t getCadUs() const;
+    uint16_t getPreambleLen() const { return (_regs[0x20] << 8) | _regs[0x21]; }
+
+    uint8_t getMode() const { return _regs[0x01] & 0x07; }
+    bool isImplicitHeader() const { return (_regs[0x1d] & 0x01) != 0; }
+    uint8_t getSf() const { return _regs[0x1e] >> 4; }
+    uint8_t getReg(uint8_t reg) const { return _regs[reg]; }
+    const uint8_t* getTxFrame() const { return _fifo + _regs[0x0e]; }
+    uint8_t getTxLen() const { return _regs[0x22]; }
+    unsigned int getTransactions() const { return _transactions; }
+    unsigned int getTxCount() const { return _txCount; }
+    uint32_t getTxStartUs() const { return _txStartUs; }
+    unsigned int getRxCount() const { return _rxCount; }
+    unsigned int getCrcErrorCount() const { return _crcErrorCount; }
+    unsigned int getHeaderErrorCount() const { return _headerErrorCount; }
+
+    // ----- Used by the VirtualChannel ------------------------------------
+
+    void setChannel(VirtualChannel* channel) { _channel = channel; }
+    // LoRa frames are only heard in LoRa mode
+    bool isReceiving() const { return (_regs[0x01] & 0x80) && getMode() == 0x05; }
+    bool isCadPending() const { return _cadPending; }
+    uint32_t getCadEndUs() const { return _cadEndUs; }
+    void completeTx();
+    void completeCad(bool detected);
+
+private:
+
+    void _account(unsigned int len);
+    uint8_t _get(uint8_t reg);
+    void _set(uint8_t reg, uint8_t val);
+    void _setMode(uint8_t val);
+    void _raise(uint8_t flags);
+
+    TestClock& _clock;
+    VirtualChannel* _channel;
+    uint8_t _regs[128];
+    uint8_t _fifo[256];
+    void (*_dio0Cb)(void*);
+    void* _dio0Ctx;
+    bool _cadPending;
+    uint32_t _cadEndUs;
+    // Used when the radio isn't attached to a channel
+    bool _txPending;
+    uint32_t _txEndUs;
+    // When the most recent transmission started
+    uint32_t _txStartUs;
+    bool _updating;
+    unsigned int _transactions;
+    uint32_t _ns;
+    unsigned int _txCount;
+    unsigned int _rxCount;
+    unsigned int _crcErrorCount;
+    unsigned int _headerErrorCount;
+};
+
+#define VC_MAX_RADIOS 8
+#define VC_MAX_TRANSMISSIONS 16
+
+/**
+ * @brief A shared radio channel.  All attached radios hear each other 
+ * with the same signal quality.  
+ * 
+ * A receiver locks on to a transmission if it is listening when the 
+ * transmission starts (or starts listening while enough of the 
+ * preamble is left to synchronize) and nothing else is on the air.  Transmissions 
+ * that overlap at a receiver are both lost (the packet is reported 
+ * with a CRC error).  A CAD reports activity if a transmission from 
+ * another radio has been on the air for at least one symbol when the 
+ * CAD finishes.
+ */
+class VirtualChannel {
+public:
+
+    VirtualChannel(TestClock& clock);
+
+    void attach(SX1276Emulator* radio);
+
+    void setLinkQuality(int8_t snr, int16_t rssi) { _snr = snr; _rssi = rssi; }
+
+    /**
+     * @brief Processes everything that has happened on the channel 
+     * up to the current time.
+     */
+    void update();
+
+    void startTransmission(SX1276Emulator* from, const uint8_t* data, 
+        uint8_t len, bool implicitHeader, uint8_t sf, uint32_t airtimeUs,
+        uint32_t syncUs);
+
+    /**
+     * @brief Called when a radio goes into receive mode.  The radio 
+     * locks on to a transmission that is still in its preamble.
+     */
+    void startReception(SX1276Emulator* radio);
+
+    /**
+     * @return true if a transmission from a radio other than the 
+     * observer is detectable at the time given.
+     */
+    bool isBusy(const SX1276Emulator* observer, uint32_t timeUs, 
+        uint32_t detectUs) const;
+
+    /**
+     * @return true if the receiver is locked on to a transmission that
+     * is still on the air.
+     */
+    bool isLockedOn(const SX1276Emulator* receiver) const;
+
+    unsigned int getCollisionCount() const { return _collisionCount; }
+
+private:
+
+    struct Transmission {
+        SX1276Emulator* from;
+        uint8_t data[256];
+        uint8_t len;
+        bool implicitHeader;
+        uint8_t sf;
+        uint32_t startUs;
+        uint32_t endUs;
+        // The latest time that a receiver can lock on to the preamble
+        uint32_t syncEndUs;
+        bool active;
+        // Indicates which receivers locked on to this transmission and 
+        // which of them lost it to a collision
+        bool locked[VC_MAX_RADIOS];
+        bool corrupted[VC_MAX_RADIOS];
+    };
+
+    int _indexOf(const SX1276Emulator* radio) const;
+    void _endTransmission(Transmission& t);
+
+    TestClock& _clock;
+    SX1276Emulator* _radios[VC_MAX_RADIOS];
+    unsigned int _radioCount;
+    Transmission _tx[VC_MAX_TRANSMISSIONS];
+    unsigned int _nextTx;
+    int8_t _snr;
+    int16_t _rssi;
+    bool _updating;
+    unsigned int _collisionCount;
+};
+
+#endif
@@ -8,23 +8,37 @@ public:
 
     TestClock() {
         _time = 10 * 1000;
+        _us = 0;
     }
 
     uint32_t time() const {
         return _time;
     };
 
+    uint32_t timeUs() const {
+        return _time * 1000 + _us;
+    }
+
     void setTime(uint32_t t) {
         _time = t;
+        _us = 0;
     }
 
     void advanceSeconds(uint32_t seconds) {
         _time += (seconds * 1000);
     }
 
+    void advanceUs(uint32_t us) {
+        _us += us;
+        _time += _us / 1000;
+        _us = _us % 1000;
+    }
+
 private:
 
     uint32_t _time;
+    // Microseconds past _time
+    uint32_t _us;
 };
 
 #endif
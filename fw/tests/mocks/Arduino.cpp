@@ -2,6 +2,8 @@
 #include "EEPROM.h"
 #include "Preferences.h"
 
+#include <stdlib.h>
+
 static uint8_t DUMMY[256];
 
 uint8_t EEPROMClass::read(unsigned int addr) {
@@ -18,6 +20,19 @@ uint32_t millis() {
     return 1000;
 }
 
+uint32_t micros() {
+    return 1000 * 1000;
+}
+
+void delay(uint32_t) {
+}
+
+long random(long min, long max) {
+    if (max <= min) 
+        return min;
+    return min + (rand() % (max - min));
+}
+
 // ----- Pref
 
 void Preferences::begin(const char*) {
@@ -24,6 +24,10 @@ public:
 
 // Returns unsigned long on Arduino
 uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+
+long random(long min, long max);
 
 #endif
 
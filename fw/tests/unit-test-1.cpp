@@ -6,7 +6,9 @@
 #include "../station/Instrumentation.h"
 #include "../station/RoutingTable.h"
 #include "../station/RoutingTableImpl.h"
+#include "../station/NeighborTable.h"
 #include "../station/MessageProcessor.h"
+#include "../station/SleepSchedule.h"
 #include "../station/Configuration.h"
 #include "TestClockImpl.h"
 
@@ -34,6 +36,10 @@ static const uint8_t SW_VERSION = 1;
 // Dummy Instrumentation
 class TestInstrumentation : public Instrumentation {
 public:
+
+    TestInstrumentation() : listenSf(9), nextListenSf(0), lplIntervalMs(0), 
+        airtimeUs(0), ackWindowMs(0), transmitting(false) { memset(&profile, 0, sizeof(profile)); }
+
     uint16_t getSoftwareVersion() const { return 1; }
     uint16_t getDeviceClass() const { return 2; }
     uint16_t getDeviceRevision() const { return 1; }
@@ -44,6 +50,21 @@ public:
     void restart() { cout << "RESTART" << endl; }
     void restartRadio() { cout << "RESTART" << endl; }
     void sleep(uint32_t ms) { cout << "SLEEP " << ms << endl; }
+    void setRadioProfile(const RadioProfile& p) { profile = p; }
+    uint8_t getListenSf() const { return listenSf; }
+    uint8_t getNextListenSf() const { return nextListenSf; }
+    uint16_t getLplInterval() const { return lplIntervalMs; }
+    uint32_t getAirtimeUs(uint8_t) const { return airtimeUs; }
+    uint32_t getAckWindowMs() const { return ackWindowMs; }
+    bool isTransmitting() const { return transmitting; }
+
+    RadioProfile profile;
+    uint8_t listenSf;
+    uint8_t nextListenSf;
+    uint16_t lplIntervalMs;
+    uint32_t airtimeUs;
+    uint32_t ackWindowMs;
+    bool transmitting;
 };
 
 // Dummy configuration
@@ -52,7 +73,9 @@ public:
 
     TestConfiguration(nodeaddr_t myAddr, const char* myCall) 
     : _myAddr(myAddr), 
-      _myCall(myCall) {
+      _myCall(myCall),
+      _probeInterval(0) {
+        _radioProfiles.setDefaults();
     }
 
     nodeaddr_t getAddr() const {
@@ -83,12 +106,30 @@ public:
         return 1;
     }
 
+    uint16_t getProbeInterval() const {
+        return _probeInterval;
+    }
+
+    void setProbeInterval(uint16_t s) {
+        _probeInterval = s;
+    }
+
+    RadioProfileTable getRadioProfiles() const {
+        return _radioProfiles;
+    }
+
+    void setRadioProfiles(const RadioProfileTable& t) {
+        _radioProfiles = t;
+    }
+
    void factoryReset() { }
 
 private:
 
     nodeaddr_t _myAddr;
     const CallSign _myCall;
+    uint16_t _probeInterval;
+    RadioProfileTable _radioProfiles;
 };
 
 void movePacket(CircularBuffer& from, CircularBuffer& to) {
@@ -96,8 +137,32 @@ void movePacket(CircularBuffer& from, CircularBuffer& to) {
     uint8_t packet[256];
     bool got = from.popIfNotEmpty(0, packet, &packetLen);
     if (got) {
-        int16_t rssi = 100;
-        to.push(&rssi, packet, packetLen);
+        RxMetadata rxMeta;
+        rxMeta.rssi = -100;
+        rxMeta.snr = 5;
+        to.push(&rxMeta, packet, packetLen);
+    }
+}
+
+/**
+ * @brief Like movePacket(), but the metadata says that the frame came
+ * from the radio using the profile and ended at endUs.
+ */
+void moveRadioPacket(CircularBuffer& from, CircularBuffer& to, 
+    const RadioProfile& profile, uint32_t endUs, uint32_t airtimeUs) {
+    unsigned int packetLen = 256;
+    uint8_t packet[256];
+    bool got = from.popIfNotEmpty(0, packet, &packetLen);
+    if (got) {
+        RxMetadata rxMeta;
+        rxMeta.rssi = -100;
+        rxMeta.snr = 5;
+        rxMeta.rxTimeUs = endUs;
+        rxMeta.airtimeUs = airtimeUs;
+        rxMeta.sf = profile.sf;
+        rxMeta.bw = profile.bw;
+        rxMeta.cr = profile.cr;
+        to.push(&rxMeta, packet, packetLen);
     }
 }
 
@@ -112,10 +177,11 @@ void test_MessageProcessor() {
     RoutingTableImpl routingTable1(nvram1);
     routingTable1.setRoute(3, 3);
     routingTable1.setRoute(7, 3);
+    NeighborTable neighborTable1(clock);
     CircularBufferImpl<4096> txBuffer1(0);
-    CircularBufferImpl<4096> rxBuffer1(2);
+    CircularBufferImpl<4096> rxBuffer1(sizeof(RxMetadata));
     MessageProcessor mp1(clock, rxBuffer1, txBuffer1,
-        routingTable1, instrumentation1, config1,
+        routingTable1, neighborTable1, instrumentation1, config1,
         10 * 1000, 2 * 1000);
 
     // Node #3 (intermediate)
@@ -125,10 +191,11 @@ void test_MessageProcessor() {
     RoutingTableImpl routingTable3(nvram3);
     routingTable3.setRoute(1, 1);
     routingTable3.setRoute(7, 7);
+    NeighborTable neighborTable3(clock);
     CircularBufferImpl<4096> txBuffer3(0);
-    CircularBufferImpl<4096> rxBuffer3(2);
+    CircularBufferImpl<4096> rxBuffer3(sizeof(RxMetadata));
     MessageProcessor mp3(clock, rxBuffer3, txBuffer3,
-        routingTable3, instrumentation3, config3,
+        routingTable3, neighborTable3, instrumentation3, config3,
         10 * 1000, 2 * 1000);
 
     // Node #7 (desktop)
@@ -139,10 +206,11 @@ void test_MessageProcessor() {
     RoutingTableImpl routingTable7(nvram7);
     routingTable7.setRoute(1, 3);
     routingTable7.setRoute(3, 3);
+    NeighborTable neighborTable7(clock);
     CircularBufferImpl<4096> txBuffer7(0);
-    CircularBufferImpl<4096> rxBuffer7(2);
+    CircularBufferImpl<4096> rxBuffer7(sizeof(RxMetadata));
     MessageProcessor mp7(clock, rxBuffer7, txBuffer7,
-        routingTable7, instrumentation7, config7,
+        routingTable7, neighborTable7, instrumentation7, config7,
         10 * 1000, 2 * 1000);
 
     clock.setTime(60 * 1000);
@@ -177,6 +245,11 @@ void test_MessageProcessor() {
     mp1.pump();
     assert(!txBuffer1.isEmpty());
 
+    // Node 1 should now know about node 3
+    assert(neighborTable1.get(3) != 0);
+    assert(neighborTable1.get(3)->rssi == -100);
+    assert(neighborTable1.get(3)->rxCount == 1);
+
     // Transfer the TX.1->RX.3
     // The first is the ACK, the second is the PING_RESP
     movePacket(txBuffer1, rxBuffer3);
@@ -232,7 +305,8 @@ void test_OutboundPacket() {
     TestInstrumentation instrumentation;
     RoutingTableImpl routingTable1(nvram1);
     CircularBufferImpl<4096> txBuffer(0);
-    OutboundPacketManager opm(clock, txBuffer, 10 * 1000, 2 * 1000);
+    NeighborTable neighborTable(clock);
+    OutboundPacketManager opm(clock, txBuffer, routingTable1, neighborTable, 10 * 1000, 2 * 1000);
     assert(opm.getFreeCount() == 8);
 
     clock.setTime(10 * 1000);
@@ -287,6 +361,11 @@ void test_OutboundPacket() {
     // Validate that the slot is freed now
     assert(opm.getFreeCount() == 8);
 
+    // The ACK should have been credited to the neighbor
+    assert(neighborTable.get(3) != 0);
+    assert(neighborTable.get(3)->ackCount == 1);
+    assert(neighborTable.get(3)->deliveryRatio == 1.0);
+
     // ==============================================================
     // Validate Re-Transmit And Timeout
 
@@ -349,6 +428,11 @@ void test_OutboundPacket() {
     // Validate that we still are holding a slot (not ACKed yet)
     assert(opm.getFreeCount() == 8);
 
+    // Two attempts were made and neither was ACKed
+    assert(neighborTable.get(3)->txCount == 3);
+    assert(neighborTable.get(3)->ackCount == 1);
+    assert(neighborTable.get(3)->deliveryRatio < 1.0);
+
     // ========================================================
     // Queue Two Messages That Don't Need ACK
 
@@ -397,6 +481,1323 @@ void test_OutboundPacket() {
     txBuffer.popAndDiscard();
     txBuffer.popAndDiscard();
     assert(txBuffer.isEmpty());
+
+    // ========================================================
+    // Slow Radio Profile: the retry has to wait for the frame to go out
+    // and for the ACK to come back.
+
+    NeighborTable neighborTable2(clock);
+    OutboundPacketManager opm2(clock, txBuffer, routingTable1, neighborTable2, 10 * 1000, 2 * 1000);
+    // A 3 second frame and a 400ms ACK window: 3800ms retry, 19s give-up
+    instrumentation.airtimeUs = 3000 * 1000;
+    instrumentation.ackWindowMs = 400;
+    opm2.setInstrumentation(&instrumentation);
+
+    clock.setTime(100 * 1000);
+    assert(opm2.scheduleTransmitIfPossible(packet1, packet1Len));
+    opm2.pump();
+    assert(!txBuffer.isEmpty());
+
+    // Nothing is counted while the frame waits in the TX queue
+    clock.setTime(103 * 1000);
+    opm2.pump();
+    txBuffer.popAndDiscard();
+    assert(txBuffer.isEmpty());
+
+    // ... or while it is on the air
+    instrumentation.transmitting = true;
+    clock.setTime(105 * 1000);
+    opm2.pump();
+    instrumentation.transmitting = false;
+    assert(neighborTable2.get(3) == 0 || neighborTable2.get(3)->txCount == 0);
+
+    // No retry before the ACK could have come back
+    clock.setTime(108 * 1000 + 700);
+    opm2.pump();
+    assert(txBuffer.isEmpty());
+    assert(neighborTable2.get(3) == 0 || neighborTable2.get(3)->txCount == 0);
+
+    clock.setTime(109 * 1000);
+    opm2.pump();
+    assert(!txBuffer.isEmpty());
+    txBuffer.popAndDiscard();
+    assert(neighborTable2.get(3)->txCount == 1);
+
+    // The give-up timeout is stretched the same way
+    clock.setTime(118 * 1000 + 500);
+    opm2.pump();
+    assert(opm2.getFreeCount() == 7);
+    txBuffer.popAndDiscard();
+    assert(txBuffer.isEmpty());
+
+    clock.setTime(119 * 1000 + 500);
+    opm2.pump();
+    assert(opm2.getFreeCount() == 8);
+    assert(txBuffer.isEmpty());
+
+    instrumentation.airtimeUs = 0;
+    instrumentation.ackWindowMs = 0;
+}
+
+void test_NeighborTable() {
+
+    TestClock clock;
+    NeighborTable table(clock);
+
+    clock.setTime(10 * 1000);
+
+    // First sample seeds the average
+    table.processRx(5, -80, 8);
+    assert(table.get(5) != 0);
+    assert(table.get(5)->rssi == -80);
+    assert(table.get(5)->snr == 8);
+    assert(table.get(5)->rxCount == 1);
+
+    // Subsequent samples are smoothed
+    table.processRx(5, -120, 8);
+    assert(table.get(5)->rssi < -80);
+    assert(table.get(5)->rssi > -120);
+
+    // Delivery ratio
+    table.processAck(5);
+    assert(table.get(5)->deliveryRatio == 1.0);
+    table.processTxFailure(5);
+    assert(table.get(5)->deliveryRatio < 1.0);
+    assert(table.get(5)->txCount == 2);
+    assert(table.get(5)->ackCount == 1);
+
+    // Broadcast is never tracked
+    table.processRx(0xffff, -80, 8);
+    assert(table.get(0xffff) == 0);
+
+    // Fill the table up.  The oldest entry (5) should be evicted
+    // to make space.
+    for (unsigned int i = 0; i < NeighborTable::SIZE; i++) {
+        clock.advanceSeconds(1);
+        table.processRx(100 + i, -90, 0);
+    }
+    assert(table.get(5) == 0);
+    assert(table.get(100) != 0);
+    assert(table.get(100 + NeighborTable::SIZE - 1) != 0);
+    assert(table.getSecondsSinceHeard(*table.get(100)) == NeighborTable::SIZE - 1);
+
+    // Adaptive data rate.  Nothing changes until probes are heard.
+    table.clear();
+    assert(table.getListenSf(9) == 9);
+    table.processRx(5, -80, 8);
+    table.processRx(6, -110, -5);
+    assert(table.getRequiredSf(*table.get(5), 9) == 9);
+    assert(table.getListenSf(9) == 9);
+    table.processProbe(5, 1, 0);
+    table.processProbe(6, 1, 0);
+    // SF7 needs an SNR of at least -1.5dB, SF9 needs -6.5dB
+    assert(table.getRequiredSf(*table.get(5), 9) == 7);
+    assert(table.getRequiredSf(*table.get(6), 9) == 9);
+    assert(table.getRequiredSf(*table.get(6), 12) == 9);
+    // The weakest neighbor decides
+    assert(table.getListenSf(9) == 9);
+    assert(table.getListenSf(12) == 9);
+    // Missed probes push the link back up to the profile
+    table.processProbe(5, 3, 0);
+    assert(table.getRequiredSf(*table.get(5), 9) == 9);
+    // Transmissions use what the neighbor listens on
+    assert(table.getTxSf(5, 9) == 9);
+    table.processListenSf(5, 7);
+    assert(table.getTxSf(5, 9) == 7);
+    assert(table.getTxSf(99, 9) == 9);
+    assert(table.getBroadcastSfMask(9) == ((1 << 7) | (1 << 9)));
+    // An announced move is made when the neighbor said it would be
+    table.processListenSf(5, 7, 8, 1000);
+    assert(table.getTxSf(5, 9) == 7);
+    clock.advanceSeconds(1);
+    assert(table.getTxSf(5, 9) == 8);
+    table.processListenSf(5, 7);
+    assert(table.getTxSf(5, 9) == 7);
+    // Hysteresis.  Neighbor 7 is just good enough for SF7, but moving 
+    // down from SF9 takes another 3dB so the receiver only goes to SF8.
+    {
+        NeighborTable table2(clock);
+        table2.processRx(7, -100, -1);
+        table2.processProbe(7, 1, 0);
+        assert(table2.getListenSf(9) == 7);
+        assert(table2.getListenSf(9, 9) == 8);
+        assert(table2.getListenSf(9, 8) == 8);
+        assert(table2.getListenSf(9, 7) == 7);
+    }
+    // The rendezvous window is at the start of every interval of 
+    // network time
+    assert(NeighborTable::isRendezvous(0));
+    assert(!NeighborTable::isRendezvous(SF_RENDEZVOUS_WINDOW_MS * 1000ULL));
+    assert(NeighborTable::isRendezvous(SF_RENDEZVOUS_INTERVAL_MS * 1000ULL));
+    assert(NeighborTable::getRendezvousEndMs(1000) == SF_RENDEZVOUS_WINDOW_MS - 1);
+    assert(NeighborTable::getRendezvousEndMs(SF_RENDEZVOUS_WINDOW_MS * 1000ULL) == 
+        SF_RENDEZVOUS_INTERVAL_MS);
+
+    // Low power listening.  A broadcast has to wake up the neighbor 
+    // that samples least often.
+    assert(table.getWakeIntervalMs(5) == 0);
+    assert(table.getMaxWakeIntervalMs() == 0);
+    table.processWakeInterval(5, 500);
+    table.processWakeInterval(6, 2000);
+    assert(table.getWakeIntervalMs(5) == 500);
+    assert(table.getWakeIntervalMs(99) == 0);
+    assert(table.getMaxWakeIntervalMs() == 2000);
+    table.processWakeInterval(6, 0);
+    assert(table.getMaxWakeIntervalMs() == 500);
+
+    // Transmit power control.  Neighbor 5 listens on SF7, so the target
+    // is -7.5 + 8 = 0.5dB.
+    assert(table.getReportSnr(*table.get(5)) == NeighborTable::NO_SNR);
+    table.processUnicastRx(5, 6);
+    assert(table.getReportSnr(*table.get(5)) == 6);
+    assert(table.getTxPowerDbm(5, 20) == 20);
+    assert(table.getTxPowerDbm(99, 20) == 20);
+    // A strong report brings the power down one step at a time
+    table.processLinkReport(5, 10);
+    assert(table.getTxPowerDbm(5, 20) == 18);
+    table.processLinkReport(5, 10);
+    assert(table.getTxPowerDbm(5, 20) == 16);
+    // Inside the margin nothing changes
+    table.processLinkReport(5, 1);
+    assert(table.getTxPowerDbm(5, 20) == 16);
+    // Below the target the power goes back up by the shortfall
+    table.processLinkReport(5, -1);
+    assert(table.getTxPowerDbm(5, 20) == 18);
+    table.processLinkReport(5, NeighborTable::NO_SNR);
+    assert(table.getTxPowerDbm(5, 20) == 18);
+    // Losses bring the power back up
+    table.processTxFailure(5);
+    assert(table.getTxPowerDbm(5, 20) == 20);
+    // Never below 2dBm
+    for (unsigned int i = 0; i < 20; i++)
+        table.processLinkReport(5, 30);
+    assert(table.getTxPowerDbm(5, 20) == 2);
+    assert(table.getTxPowerDbm(5, 10) == 2);
+}
+
+void test_Probe() {
+
+    TestClock clock;
+    clock.setTime(60 * 1000);
+
+    // Node #1
+    Preferences nvram1;
+    TestConfiguration config1(1, "KC1FSZ");
+    config1.setProbeInterval(10);
+    TestInstrumentation instrumentation1;
+    RoutingTableImpl routingTable1(nvram1);
+    routingTable1.setRoute(7, 3);
+    NeighborTable neighborTable1(clock);
+    CircularBufferImpl<4096> txBuffer1(0);
+    CircularBufferImpl<4096> rxBuffer1(sizeof(RxMetadata));
+    MessageProcessor mp1(clock, rxBuffer1, txBuffer1,
+        routingTable1, neighborTable1, instrumentation1, config1,
+        10 * 1000, 2 * 1000);
+
+    // Node #7
+    Preferences nvram7;
+    TestConfiguration config7(7, "WA3ITR");
+    config7.setProbeInterval(10);
+    TestInstrumentation instrumentation7;
+    RoutingTableImpl routingTable7(nvram7);
+    NeighborTable neighborTable7(clock);
+    CircularBufferImpl<4096> txBuffer7(0);
+    CircularBufferImpl<4096> rxBuffer7(sizeof(RxMetadata));
+    MessageProcessor mp7(clock, rxBuffer7, txBuffer7,
+        routingTable7, neighborTable7, instrumentation7, config7,
+        10 * 1000, 2 * 1000);
+
+    // The static route is used before there are any metrics
+    assert(routingTable1.nextHop(7) == 3);
+    routingTable1.setNeighborTable(&neighborTable1);
+    assert(routingTable1.nextHop(7) == 3);
+
+    // Node 1 sends its first probe right away.  It samples the channel 
+    // instead of listening all of the time.
+    instrumentation1.lplIntervalMs = 1000;
+    instrumentation1.nextListenSf = 7;
+    mp1.pump();
+    instrumentation1.nextListenSf = 0;
+    assert(!txBuffer1.isEmpty());
+    movePacket(txBuffer1, rxBuffer7);
+    assert(txBuffer1.isEmpty());
+
+    // Node 7 hears the probe and sends its own probe (which includes 
+    // the report on node 1)
+    mp7.pump();
+    assert(neighborTable7.get(1) != 0);
+    assert(neighborTable7.getReverseRatio(*neighborTable7.get(1)) == 1.0);
+    // The probe says what node 1 is listening on
+    assert(neighborTable7.get(1)->listenSf == 9);
+    // Node 7 doesn't have the network time, so it can't tell when the 
+    // announced move will be made
+    assert(neighborTable7.get(1)->nextListenSf == 0);
+    // ... and how often it samples the channel
+    assert(neighborTable7.getWakeIntervalMs(1) == 1000);
+    // Node 1 didn't mention node 7 so the forward direction looks dead
+    assert(neighborTable7.getEtx(1) == NeighborTable::MAX_ETX);
+    movePacket(txBuffer7, rxBuffer1);
+    assert(txBuffer7.isEmpty());
+
+    // Probes are not acknowledged or forwarded
+    mp1.pump();
+    assert(txBuffer1.isEmpty());
+    assert(neighborTable1.isEtxMeasured(7));
+    assert(neighborTable1.getWakeIntervalMs(7) == 0);
+    assert(neighborTable1.getEtx(7) == 1.0);
+
+    // Node 7 is now a better choice than the configured route
+    assert(routingTable1.nextHop(7) == 7);
+    // ... and is still used when a route error has taken the configured
+    // route out of service
+    routingTable1.invalidateRoute(7, clock.time());
+    assert(routingTable1.nextHop(7) == 7);
+    routingTable1.revalidateRoute(7);
+
+    // Let time pass without any probes from node 7.  The reverse 
+    // delivery ratio falls off.
+    clock.advanceSeconds(80);
+    assert(neighborTable1.getEtx(7) > 1.0);
+    clock.advanceSeconds(100);
+    assert(neighborTable1.getEtx(7) == NeighborTable::MAX_ETX);
+    assert(routingTable1.nextHop(7) == 3);
+
+    // Frames that are longer than the payload structures are rejected
+    // without overrunning them
+    const uint8_t types[] = { TYPE_LINK_PROBE, TYPE_GETLINKS_RESP };
+    for (unsigned int i = 0; i < 2; i++) {
+        Packet packet;
+        packet.header.setType(types[i]);
+        packet.header.setId(20 + i);
+        packet.header.setSourceAddr(7);
+        packet.header.setDestAddr(types[i] == TYPE_LINK_PROBE ? BROADCAST_ADDR : 1);
+        packet.header.setOriginalSourceAddr(7);
+        packet.header.setFinalDestAddr(types[i] == TYPE_LINK_PROBE ? BROADCAST_ADDR : 1);
+        packet.header.setSourceCall("WA3ITR");
+        packet.header.setOriginalSourceCall("WA3ITR");
+        memset(packet.payload, 0xff, MAX_PAYLOAD_SIZE);
+        RxMetadata rxMeta;
+        rxMeta.rssi = -100;
+        rxMeta.snr = 5;
+        rxBuffer1.push(&rxMeta, &packet, sizeof(Header) + MAX_PAYLOAD_SIZE);
+    }
+    const uint16_t badCount = mp1.getBadRxPacketCounter();
+    mp1.pump();
+    mp1.pump();
+    assert(mp1.getBadRxPacketCounter() == badCount + 1);
+}
+
+void test_Failover() {
+
+    TestClock clock;
+    clock.setTime(60 * 1000);
+
+    // Node #1 reaches node 7 through node 3 with node 5 as the backup
+    Preferences nvram1;
+    TestConfiguration config1(1, "KC1FSZ");
+    TestInstrumentation instrumentation1;
+    RoutingTableImpl routingTable1(nvram1);
+    routingTable1.setRoute(7, 3);
+    routingTable1.setBackupRoute(7, 0, 5);
+    assert(routingTable1.getBackupRoute(7, 0) == 5);
+    assert(routingTable1.getBackupRoute(7, 1) == RoutingTable::NO_ROUTE);
+    NeighborTable neighborTable1(clock);
+    CircularBufferImpl<4096> txBuffer1(0);
+    CircularBufferImpl<4096> rxBuffer1(sizeof(RxMetadata));
+    MessageProcessor mp1(clock, rxBuffer1, txBuffer1,
+        routingTable1, neighborTable1, instrumentation1, config1,
+        10 * 1000, 2 * 1000);
+
+    // Node #5 (backup)
+    Preferences nvram5;
+    TestConfiguration config5(5, "W1TKZ");
+    TestInstrumentation instrumentation5;
+    RoutingTableImpl routingTable5(nvram5);
+    routingTable5.setRoute(1, 1);
+    routingTable5.setRoute(7, 7);
+    NeighborTable neighborTable5(clock);
+    CircularBufferImpl<4096> txBuffer5(0);
+    CircularBufferImpl<4096> rxBuffer5(sizeof(RxMetadata));
+    MessageProcessor mp5(clock, rxBuffer5, txBuffer5,
+        routingTable5, neighborTable5, instrumentation5, config5,
+        10 * 1000, 2 * 1000);
+
+    // Send a ping from node 1 to node 7
+    {
+        Packet packet;
+        packet.header.setType(TYPE_PING_REQ);
+        packet.header.setId(1);
+        packet.header.setSourceAddr(1);
+        packet.header.setDestAddr(routingTable1.nextHop(7));
+        packet.header.setOriginalSourceAddr(1);
+        packet.header.setFinalDestAddr(7);
+        packet.header.setSourceCall("KC1FSZ");
+        packet.header.setOriginalSourceCall("KC1FSZ");
+        packet.header.setFinalDestCall("WA3ITR");
+        assert(mp1.transmitIfPossible(packet, sizeof(Header)));
+    }
+
+    uint32_t startTime = clock.time();
+    uint32_t failoverTime = 0;
+
+    // Node 3 is dead so everything that goes to it is lost. Step 
+    // the clock until the packet shows up addressed to the backup.
+    for (unsigned int i = 0; i < 10 && failoverTime == 0; i++) {
+        mp1.pump();
+        Packet packet;
+        unsigned int packetLen = sizeof(packet);
+        if (txBuffer1.popIfNotEmpty(0, &packet, &packetLen)) {
+            if (packet.header.getDestAddr() == 5) {
+                failoverTime = clock.time() - startTime;
+                RxMetadata rxMeta;
+                rxMeta.rssi = -100;
+                rxMeta.snr = 5;
+                rxBuffer5.push(&rxMeta, &packet, packetLen);
+            } else {
+                assert(packet.header.getDestAddr() == 3);
+            }
+        }
+        if (failoverTime == 0) {
+            clock.advanceSeconds(1);
+        }
+    }
+
+    cout << "Failover time (ms): " << failoverTime << endl;
+    assert(failoverTime > 0);
+    // Well ahead of the 10 second give-up
+    assert(failoverTime <= 2 * 1000 * FAILOVER_FAILURE_COUNT);
+    assert(mp1.getFailoverCounter() == 1);
+    assert(routingTable1.isSuspect(3));
+    assert(routingTable1.nextHop(7) == 5);
+    assert(neighborTable1.get(3)->consecutiveFailures >= FAILOVER_FAILURE_COUNT);
+
+    // The backup ACKs and forwards
+    mp5.pump();
+    movePacket(txBuffer5, rxBuffer1);
+    mp1.pump();
+    // Nothing else is pending on node 1
+    clock.advanceSeconds(3);
+    mp1.pump();
+    assert(txBuffer1.isEmpty());
+
+    // Once the primary is heard from again it is used
+    {
+        Packet packet;
+        packet.header.setType(TYPE_PING_RESP);
+        packet.header.setId(9);
+        packet.header.setSourceAddr(3);
+        packet.header.setDestAddr(1);
+        packet.header.setOriginalSourceAddr(3);
+        packet.header.setFinalDestAddr(1);
+        packet.header.setSourceCall("W1TKZ");
+        packet.header.setOriginalSourceCall("W1TKZ");
+        packet.header.setFinalDestCall("KC1FSZ");
+        RxMetadata rxMeta;
+        rxMeta.rssi = -100;
+        rxMeta.snr = 5;
+        rxBuffer1.push(&rxMeta, &packet, sizeof(Header));
+    }
+    mp1.pump();
+    assert(!routingTable1.isSuspect(3));
+    assert(routingTable1.nextHop(7) == 3);
+
+    // A failover doesn't move the give-up time.  Neither hop answers 
+    // this time.
+    {
+        Packet packet;
+        packet.header.setType(TYPE_PING_REQ);
+        packet.header.setId(2);
+        packet.header.setSourceAddr(1);
+        packet.header.setDestAddr(routingTable1.nextHop(7));
+        packet.header.setOriginalSourceAddr(1);
+        packet.header.setFinalDestAddr(7);
+        packet.header.setSourceCall("KC1FSZ");
+        packet.header.setOriginalSourceCall("KC1FSZ");
+        packet.header.setFinalDestCall("WA3ITR");
+        assert(mp1.transmitIfPossible(packet, sizeof(Header)));
+    }
+    startTime = clock.time();
+    while (clock.time() - startTime < 10 * 1000) {
+        mp1.pump();
+        Packet packet;
+        unsigned int packetLen = sizeof(packet);
+        txBuffer1.popIfNotEmpty(0, &packet, &packetLen);
+        clock.advanceSeconds(1);
+    }
+    assert(mp1.getFailoverCounter() > 1);
+    clock.advanceSeconds(1);
+    mp1.pump();
+    assert(mp1.getPendingCount() == 0);
+}
+
+void test_Ttl() {
+
+    TestClock clock;
+    clock.setTime(60 * 1000);
+
+    // Nodes 1 and 3 are mis-configured so that each thinks the 
+    // other is the way to node 7.
+    Preferences nvram1;
+    TestConfiguration config1(1, "KC1FSZ");
+    TestInstrumentation instrumentation1;
+    RoutingTableImpl routingTable1(nvram1);
+    routingTable1.setRoute(7, 3);
+    NeighborTable neighborTable1(clock);
+    CircularBufferImpl<4096> txBuffer1(0);
+    CircularBufferImpl<4096> rxBuffer1(sizeof(RxMetadata));
+    MessageProcessor mp1(clock, rxBuffer1, txBuffer1,
+        routingTable1, neighborTable1, instrumentation1, config1,
+        10 * 1000, 2 * 1000);
+
+    Preferences nvram3;
+    TestConfiguration config3(3, "W1TKZ");
+    TestInstrumentation instrumentation3;
+    RoutingTableImpl routingTable3(nvram3);
+    routingTable3.setRoute(7, 1);
+    NeighborTable neighborTable3(clock);
+    CircularBufferImpl<4096> txBuffer3(0);
+    CircularBufferImpl<4096> rxBuffer3(sizeof(RxMetadata));
+    MessageProcessor mp3(clock, rxBuffer3, txBuffer3,
+        routingTable3, neighborTable3, instrumentation3, config3,
+        10 * 1000, 2 * 1000);
+
+    // Nothing is known about the route so the default is used
+    assert(routingTable1.getInitialTtl(7) == DEFAULT_TTL);
+
+    {
+        Packet packet;
+        packet.header.setType(TYPE_TEXT);
+        packet.header.setId(mp1.getUniqueId());
+        packet.header.setSourceAddr(1);
+        packet.header.setDestAddr(3);
+        packet.header.setOriginalSourceAddr(1);
+        packet.header.setFinalDestAddr(7);
+        packet.header.setTtl(routingTable1.getInitialTtl(7));
+        packet.header.setSourceCall("KC1FSZ");
+        packet.header.setOriginalSourceCall("KC1FSZ");
+        packet.header.setFinalDestCall("WA3ITR");
+        assert(mp1.transmitIfPossible(packet, sizeof(Header)));
+    }
+
+    // Shuttle traffic back and forth.  Without a hop limit this 
+    // would go on forever.
+    unsigned int txCount = 0;
+    for (unsigned int i = 0; i < 50; i++) {
+        mp1.pump();
+        mp3.pump();
+        while (!txBuffer1.isEmpty()) {
+            movePacket(txBuffer1, rxBuffer3);
+            txCount++;
+        }
+        while (!txBuffer3.isEmpty()) {
+            movePacket(txBuffer3, rxBuffer1);
+            txCount++;
+        }
+    }
+
+    // Each hop is a data packet plus an ACK
+    assert(txCount == 2 * DEFAULT_TTL);
+    assert(mp1.getTtlDropCounter() + mp3.getTtlDropCounter() == 1);
+    // Everything has been delivered or dropped
+    clock.advanceSeconds(3);
+    mp1.pump();
+    mp3.pump();
+    assert(txBuffer1.isEmpty());
+    assert(txBuffer3.isEmpty());
+
+    // Node 1 heard its own packet come back around, which 
+    // doesn't count as a route.  Node 3 learned that node 1 is 
+    // one hop away.
+    assert(routingTable1.getRouteLength(1) == 0);
+    assert(routingTable3.getRouteLength(1) == 1);
+    assert(routingTable3.getInitialTtl(1) == 1 + RoutingTable::TTL_MARGIN);
+}
+
+void test_RouteError() {
+
+    TestClock clock;
+    clock.setTime(60 * 1000);
+
+    // Node #1 reaches node 7 through node 3.  Node 7 is dead.
+    Preferences nvram1;
+    TestConfiguration config1(1, "KC1FSZ");
+    TestInstrumentation instrumentation1;
+    RoutingTableImpl routingTable1(nvram1);
+    routingTable1.setRoute(3, 3);
+    routingTable1.setRoute(7, 3);
+    routingTable1.setRoute(9, 3);
+    NeighborTable neighborTable1(clock);
+    CircularBufferImpl<4096> txBuffer1(0);
+    CircularBufferImpl<4096> rxBuffer1(sizeof(RxMetadata));
+    MessageProcessor mp1(clock, rxBuffer1, txBuffer1,
+        routingTable1, neighborTable1, instrumentation1, config1,
+        10 * 1000, 2 * 1000);
+
+    // Node #3 has no route to node 9
+    Preferences nvram3;
+    TestConfiguration config3(3, "W1TKZ");
+    TestInstrumentation instrumentation3;
+    RoutingTableImpl routingTable3(nvram3);
+    routingTable3.setRoute(1, 1);
+    routingTable3.setRoute(7, 7);
+    NeighborTable neighborTable3(clock);
+    CircularBufferImpl<4096> txBuffer3(0);
+    CircularBufferImpl<4096> rxBuffer3(sizeof(RxMetadata));
+    MessageProcessor mp3(clock, rxBuffer3, txBuffer3,
+        routingTable3, neighborTable3, instrumentation3, config3,
+        10 * 1000, 2 * 1000);
+
+    for (nodeaddr_t target = 7; target <= 9; target += 2) {
+        Packet packet;
+        packet.header.setType(TYPE_TEXT);
+        packet.header.setId(mp1.getUniqueId());
+        packet.header.setSourceAddr(1);
+        packet.header.setDestAddr(routingTable1.nextHop(target));
+        packet.header.setOriginalSourceAddr(1);
+        packet.header.setFinalDestAddr(target);
+        packet.header.setSourceCall("KC1FSZ");
+        packet.header.setOriginalSourceCall("KC1FSZ");
+        packet.header.setFinalDestCall("WA3ITR");
+        assert(mp1.transmitIfPossible(packet, sizeof(Header)));
+    }
+
+    // Run the network.  Anything that node 3 sends to node 7 is lost.
+    for (unsigned int i = 0; i < 30; i++) {
+        mp1.pump();
+        mp3.pump();
+        while (!txBuffer1.isEmpty()) 
+            movePacket(txBuffer1, rxBuffer3);
+        Packet packet;
+        unsigned int packetLen = sizeof(packet);
+        while (txBuffer3.popIfNotEmpty(0, &packet, &packetLen)) {
+            if (packet.header.getDestAddr() == 1) {
+                RxMetadata rxMeta;
+                rxMeta.rssi = -100;
+                rxMeta.snr = 5;
+                rxBuffer1.push(&rxMeta, &packet, packetLen);
+            }
+            packetLen = sizeof(packet);
+        }
+        clock.advanceSeconds(1);
+    }
+
+    // Node 3 reported both failures
+    assert(mp3.getRouteErrorCounter() == 2);
+    assert(mp1.getRouteErrorCounter() == 0);
+
+    // Both stations have stopped using the broken routes
+    assert(routingTable3.isRouteInvalidated(7));
+    assert(routingTable3.nextHop(7) == RoutingTable::NO_ROUTE);
+    assert(routingTable1.isRouteInvalidated(7));
+    assert(routingTable1.nextHop(7) == RoutingTable::NO_ROUTE);
+    assert(routingTable1.isRouteInvalidated(9));
+    // Unaffected routes are still in use
+    assert(routingTable1.nextHop(3) == 3);
+
+    // The routes come back after the hold-down
+    clock.advanceSeconds(ROUTE_HOLD_DOWN_MS / 1000);
+    mp1.pump();
+    mp3.pump();
+    assert(!routingTable1.isRouteInvalidated(7));
+    assert(routingTable1.nextHop(7) == 3);
+    assert(routingTable3.nextHop(7) == 7);
+}
+
+void test_ProfileChange() {
+
+    TestClock clock;
+    clock.setTime(60 * 1000);
+
+    // A chain of stations 1 <-> 3 <-> 7
+    Preferences nvram1;
+    TestConfiguration config1(1, "KC1FSZ");
+    TestInstrumentation instrumentation1;
+    RoutingTableImpl routingTable1(nvram1);
+    routingTable1.setRoute(3, 3);
+    routingTable1.setRoute(7, 3);
+    NeighborTable neighborTable1(clock);
+    CircularBufferImpl<4096> txBuffer1(0);
+    CircularBufferImpl<4096> rxBuffer1(sizeof(RxMetadata));
+    MessageProcessor mp1(clock, rxBuffer1, txBuffer1,
+        routingTable1, neighborTable1, instrumentation1, config1,
+        10 * 1000, 2 * 1000);
+
+    Preferences nvram3;
+    TestConfiguration config3(3, "W1TKZ");
+    TestInstrumentation instrumentation3;
+    RoutingTableImpl routingTable3(nvram3);
+    routingTable3.setRoute(1, 1);
+    routingTable3.setRoute(7, 7);
+    NeighborTable neighborTable3(clock);
+    CircularBufferImpl<4096> txBuffer3(0);
+    CircularBufferImpl<4096> rxBuffer3(sizeof(RxMetadata));
+    MessageProcessor mp3(clock, rxBuffer3, txBuffer3,
+        routingTable3, neighborTable3, instrumentation3, config3,
+        10 * 1000, 2 * 1000);
+
+    Preferences nvram7;
+    TestConfiguration config7(7, "WA3ITR");
+    TestInstrumentation instrumentation7;
+    RoutingTableImpl routingTable7(nvram7);
+    routingTable7.setRoute(1, 3);
+    routingTable7.setRoute(3, 3);
+    NeighborTable neighborTable7(clock);
+    CircularBufferImpl<4096> txBuffer7(0);
+    CircularBufferImpl<4096> rxBuffer7(sizeof(RxMetadata));
+    MessageProcessor mp7(clock, rxBuffer7, txBuffer7,
+        routingTable7, neighborTable7, instrumentation7, config7,
+        10 * 1000, 2 * 1000);
+
+    RadioProfileTable profiles;
+    profiles.setDefaults();
+    const RadioProfile& fast = profiles.profiles[profiles.find("fast")];
+
+    // Node 1 asks everyone to move in 10 seconds
+    assert(mp1.sendProfileChange(fast, 10, 30, 0));
+
+    // Station 3 is heard by both 1 and 7
+    unsigned int rxCount7 = 0;
+    for (unsigned int i = 0; i < 10; i++) {
+        mp1.pump();
+        mp3.pump();
+        mp7.pump();
+        movePacket(txBuffer1, rxBuffer3);
+        while (!txBuffer3.isEmpty()) {
+            unsigned int packetLen = 256;
+            uint8_t packet[256];
+            txBuffer3.popIfNotEmpty(0, packet, &packetLen);
+            RxMetadata rxMeta;
+            rxMeta.rssi = -100;
+            rxMeta.snr = 5;
+            rxBuffer1.push(&rxMeta, packet, packetLen);
+            rxBuffer7.push(&rxMeta, packet, packetLen);
+            rxCount7++;
+        }
+        movePacket(txBuffer7, rxBuffer3);
+    }
+
+    // Nobody has changed yet
+    assert(instrumentation1.profile.sf == 0);
+    assert(instrumentation3.profile.sf == 0);
+    assert(instrumentation7.profile.sf == 0);
+    assert(rxCount7 > 0);
+
+    // After the delay everyone changes at (about) the same time
+    clock.advanceSeconds(11);
+    mp1.pump();
+    mp3.pump();
+    mp7.pump();
+    assert(instrumentation1.profile.isNamed("fast"));
+    assert(instrumentation3.profile.isNamed("fast"));
+    assert(instrumentation7.profile.isNamed("fast"));
+    // Nothing is saved until traffic is heard on the new profile
+    assert(config3.getRadioProfiles().getActive().isNamed("default"));
+
+    // Station 3 hears station 1 and keeps the new profile.  A frame 
+    // that was already on the air when the profile changed doesn't 
+    // count, even though it is processed afterwards.
+    for (unsigned int i = 0; i < 2; i++) {
+        Packet packet;
+        packet.header.setType(TYPE_PING_REQ);
+        packet.header.setId(mp1.getUniqueId());
+        packet.header.setSourceAddr(1);
+        packet.header.setDestAddr(3);
+        packet.header.setOriginalSourceAddr(1);
+        packet.header.setFinalDestAddr(3);
+        assert(mp1.transmitIfPossible(packet, sizeof(Header)));
+        mp1.pump();
+        moveRadioPacket(txBuffer1, rxBuffer3, fast, clock.timeUs(), 50000);
+        mp3.pump();
+        if (i == 0) {
+            assert(config3.getRadioProfiles().getActive().isNamed("default"));
+            clock.advanceSeconds(1);
+        }
+    }
+    assert(config3.getRadioProfiles().getActive().isNamed("fast"));
+    assert(mp3.getProfileFallbackCounter() == 0);
+
+    // Station 7 hears nothing and goes back
+    clock.advanceSeconds(31);
+    mp7.pump();
+    assert(instrumentation7.profile.isNamed("default"));
+    assert(config7.getRadioProfiles().getActive().isNamed("default"));
+    assert(mp7.getProfileFallbackCounter() == 1);
+}
+
+/**
+ * @brief With the network time the change is made at the same moment 
+ * everywhere, even when the request is held up on the way.
+ */
+void test_ProfileChangeNetworkTime() {
+
+    TestClock clock;
+    clock.setTime(60 * 1000);
+
+    // A chain of stations 1 <-> 3 <-> 7 that all have the network time
+    Preferences nvram1;
+    TestConfiguration config1(1, "KC1FSZ");
+    TestInstrumentation instrumentation1;
+    RoutingTableImpl routingTable1(nvram1);
+    routingTable1.setRoute(3, 3);
+    routingTable1.setRoute(7, 3);
+    NeighborTable neighborTable1(clock);
+    CircularBufferImpl<4096> txBuffer1(0);
+    CircularBufferImpl<4096> rxBuffer1(sizeof(RxMetadata));
+    MessageProcessor mp1(clock, rxBuffer1, txBuffer1,
+        routingTable1, neighborTable1, instrumentation1, config1,
+        10 * 1000, 2 * 1000);
+    NetworkClock networkClock1(clock);
+    networkClock1.setTime(1000000000ULL, 1);
+    mp1.setNetworkClock(&networkClock1);
+
+    Preferences nvram3;
+    TestConfiguration config3(3, "W1TKZ");
+    TestInstrumentation instrumentation3;
+    RoutingTableImpl routingTable3(nvram3);
+    routingTable3.setRoute(1, 1);
+    routingTable3.setRoute(7, 7);
+    NeighborTable neighborTable3(clock);
+    CircularBufferImpl<4096> txBuffer3(0);
+    CircularBufferImpl<4096> rxBuffer3(sizeof(RxMetadata));
+    MessageProcessor mp3(clock, rxBuffer3, txBuffer3,
+        routingTable3, neighborTable3, instrumentation3, config3,
+        10 * 1000, 2 * 1000);
+    NetworkClock networkClock3(clock);
+    networkClock3.setTime(1000000000ULL, 3);
+    mp3.setNetworkClock(&networkClock3);
+
+    Preferences nvram7;
+    TestConfiguration config7(7, "WA3ITR");
+    TestInstrumentation instrumentation7;
+    RoutingTableImpl routingTable7(nvram7);
+    routingTable7.setRoute(1, 3);
+    routingTable7.setRoute(3, 3);
+    NeighborTable neighborTable7(clock);
+    CircularBufferImpl<4096> txBuffer7(0);
+    CircularBufferImpl<4096> rxBuffer7(sizeof(RxMetadata));
+    MessageProcessor mp7(clock, rxBuffer7, txBuffer7,
+        routingTable7, neighborTable7, instrumentation7, config7,
+        10 * 1000, 2 * 1000);
+    NetworkClock networkClock7(clock);
+    networkClock7.setTime(1000000000ULL, 7);
+    mp7.setNetworkClock(&networkClock7);
+
+    RadioProfileTable profiles;
+    profiles.setDefaults();
+    const RadioProfile& fast = profiles.profiles[profiles.find("fast")];
+
+    // Node 1 asks everyone to move in 10 seconds
+    assert(mp1.sendProfileChange(fast, 10, 0, 0));
+    mp1.pump();
+    while (!txBuffer1.isEmpty())
+        movePacket(txBuffer1, rxBuffer3);
+    mp3.pump();
+
+    // Station 3's copy takes 4 seconds to get to station 7
+    clock.advanceSeconds(4);
+    while (!txBuffer3.isEmpty())
+        movePacket(txBuffer3, rxBuffer7);
+    mp7.pump();
+
+    // Station 7 changes along with station 1, not 10 seconds after it
+    // heard the request
+    clock.advanceSeconds(6);
+    mp1.pump();
+    mp3.pump();
+    mp7.pump();
+    assert(instrumentation1.profile.isNamed("fast"));
+    assert(instrumentation3.profile.isNamed("fast"));
+    assert(instrumentation7.profile.isNamed("fast"));
+}
+
+void test_AckFeedback() {
+
+    TestClock clock;
+    clock.setTime(60 * 1000);
+
+    Preferences nvram1;
+    TestConfiguration config1(1, "KC1FSZ");
+    TestInstrumentation instrumentation1;
+    RoutingTableImpl routingTable1(nvram1);
+    routingTable1.setRoute(3, 3);
+    NeighborTable neighborTable1(clock);
+    CircularBufferImpl<4096> txBuffer1(0);
+    CircularBufferImpl<4096> rxBuffer1(sizeof(RxMetadata));
+    MessageProcessor mp1(clock, rxBuffer1, txBuffer1,
+        routingTable1, neighborTable1, instrumentation1, config1,
+        10 * 1000, 2 * 1000);
+
+    Preferences nvram3;
+    TestConfiguration config3(3, "W1TKZ");
+    TestInstrumentation instrumentation3;
+    RoutingTableImpl routingTable3(nvram3);
+    NeighborTable neighborTable3(clock);
+    CircularBufferImpl<4096> txBuffer3(0);
+    CircularBufferImpl<4096> rxBuffer3(sizeof(RxMetadata));
+    MessageProcessor mp3(clock, rxBuffer3, txBuffer3,
+        routingTable3, neighborTable3, instrumentation3, config3,
+        10 * 1000, 2 * 1000);
+
+    {
+        Packet packet;
+        packet.header.setType(TYPE_TEXT);
+        packet.header.setId(mp1.getUniqueId());
+        packet.header.setSourceAddr(1);
+        packet.header.setDestAddr(3);
+        packet.header.setOriginalSourceAddr(1);
+        packet.header.setFinalDestAddr(3);
+        assert(mp1.transmitIfPossible(packet, sizeof(Header)));
+    }
+    mp1.pump();
+
+    // Node 3 hears the frame with a frequency error
+    {
+        unsigned int packetLen = 256;
+        uint8_t packet[256];
+        assert(txBuffer1.popIfNotEmpty(0, packet, &packetLen));
+        RxMetadata rxMeta;
+        rxMeta.rssi = -100;
+        rxMeta.snr = 5;
+        rxMeta.freqErrorHz = -1200;
+        rxBuffer3.push(&rxMeta, packet, packetLen);
+    }
+    mp3.pump();
+
+    // The ACK carries the receive quality
+    {
+        unsigned int packetLen = 256;
+        Packet ack;
+        assert(txBuffer3.popIfNotEmpty(0, &ack, &packetLen));
+        assert(ack.header.isAck());
+        assert(packetLen == sizeof(Header) + sizeof(AckPayload));
+        AckPayload payload;
+        memcpy(&payload, ack.payload, sizeof(payload));
+        assert(payload.snr == 5);
+        assert(payload.negRssi == 100);
+        assert(payload.freqErrorHz == -1200);
+        RxMetadata rxMeta;
+        rxBuffer1.push(&rxMeta, &ack, packetLen);
+    }
+    mp1.pump();
+
+    // Node 1 now knows how it is heard by node 3
+    const NeighborEntry* entry = neighborTable1.get(3);
+    assert(entry != 0);
+    assert(entry->ackCount == 1);
+    assert(entry->fwdValid);
+    assert(entry->fwdRssi == -100);
+    assert(entry->fwdSnr == 5);
+    assert(entry->fwdFreqErrorHz == -1200);
+    // 4.5dB above the target, so the transmit power comes down
+    assert(neighborTable1.getTxPowerDbm(3, 20) == 18);
+}
+
+void test_NetworkClock() {
+
+    const uint64_t startUs = 1700000000ULL * 1000000ULL;
+
+    TestClock rootLocal;
+    NetworkClock root(rootLocal);
+    assert(!root.hasTime());
+    assert(!root.isSynced());
+    root.setTime(startUs, 1);
+    assert(root.isRoot());
+    assert(root.getNetworkUs() == startUs);
+    assert(root.getNetworkSeconds() == 1700000000UL);
+
+    // The child's crystal runs 50ppm fast
+    TestClock childLocal;
+    childLocal.advanceUs(12345);
+    NetworkClock child(childLocal);
+
+    for (unsigned int i = 0; i < 6; i++) {
+        rootLocal.advanceUs(60000000);
+        childLocal.advanceUs(60003000);
+        assert(child.processBeacon(1, 1, 0, childLocal.timeUs(), root.getNetworkUs()));
+        assert(child.getNetworkUs() == root.getNetworkUs());
+        // The first beacon sets the time, the second measures the drift
+        // and after that the drift is corrected
+        if (i == 1) {
+            assert(child.getLastOffsetUs() == -3000);
+        } else if (i > 1) {
+            assert(child.getLastOffsetUs() >= -2 && child.getLastOffsetUs() <= 2);
+        }
+    }
+    assert(child.isSynced());
+    assert(child.getLevel() == 1);
+    assert(child.getParent() == 1);
+    assert(child.getRoot() == 1);
+    assert(child.getSkewPpb() > -50100 && child.getSkewPpb() < -49900);
+    assert(child.getBeaconCount() == 6);
+
+    // Between beacons the time runs at the corrected rate
+    rootLocal.advanceUs(30000000);
+    childLocal.advanceUs(30001500);
+    int64_t errorUs = child.getNetworkUs() - root.getNetworkUs();
+    assert(errorUs >= -2 && errorUs <= 2);
+
+    // The root doesn't take its time from anyone, and a station that is 
+    // no closer to the root than the parent is ignored
+    assert(!root.processBeacon(3, 1, 1, rootLocal.timeUs(), startUs));
+    assert(!child.processBeacon(5, 1, 1, childLocal.timeUs(), startUs));
+    assert(!child.processBeacon(5, 1, TIME_SYNC_MAX_LEVEL, childLocal.timeUs(), startUs));
+    assert(child.getParent() == 1);
+
+    // The time keeps running over a long gap
+    for (unsigned int i = 0; i < 40; i++) {
+        rootLocal.advanceUs(60000000);
+        childLocal.advanceUs(60003000);
+        root.tick();
+        child.tick();
+    }
+    assert(child.hasTime());
+    errorUs = child.getNetworkUs() - root.getNetworkUs();
+    assert(errorUs >= -100 && errorUs <= 100);
+    // But the parent was lost, so any station will do
+    assert(!child.isSynced());
+    assert(child.processBeacon(5, 1, 3, childLocal.timeUs(), root.getNetworkUs()));
+    assert(child.getLevel() == 4);
+    assert(child.getParent() == 5);
+}
+
+void test_TimeSync() {
+
+    TestClock clock;
+    clock.setTime(60 * 1000);
+
+    Preferences nvram1;
+    TestConfiguration config1(1, "KC1FSZ");
+    TestInstrumentation instrumentation1;
+    RoutingTableImpl routingTable1(nvram1);
+    NeighborTable neighborTable1(clock);
+    CircularBufferImpl<4096> txBuffer1(0);
+    CircularBufferImpl<4096> rxBuffer1(sizeof(RxMetadata));
+    MessageProcessor mp1(clock, rxBuffer1, txBuffer1,
+        routingTable1, neighborTable1, instrumentation1, config1,
+        10 * 1000, 2 * 1000);
+    NetworkClock networkClock1(clock);
+    mp1.setNetworkClock(&networkClock1);
+
+    Preferences nvram3;
+    TestConfiguration config3(3, "W1TKZ");
+    TestInstrumentation instrumentation3;
+    RoutingTableImpl routingTable3(nvram3);
+    NeighborTable neighborTable3(clock);
+    CircularBufferImpl<4096> txBuffer3(0);
+    CircularBufferImpl<4096> rxBuffer3(sizeof(RxMetadata));
+    MessageProcessor mp3(clock, rxBuffer3, txBuffer3,
+        routingTable3, neighborTable3, instrumentation3, config3,
+        10 * 1000, 2 * 1000);
+    NetworkClock networkClock3(clock);
+    mp3.setNetworkClock(&networkClock3);
+
+    // Nobody has the time, so nothing is sent
+    mp1.pump();
+    mp3.pump();
+    assert(txBuffer1.isEmpty());
+    assert(txBuffer3.isEmpty());
+
+    // Node 1 becomes the root and sends a beacon at the next interval
+    networkClock1.setTime(1700000000ULL * 1000000ULL, 1);
+    clock.advanceSeconds(TIME_SYNC_INTERVAL_MS * 5 / 4000);
+    const uint32_t txStartUs = clock.timeUs();
+    mp1.pump();
+    {
+        unsigned int packetLen = 256;
+        Packet packet;
+        assert(txBuffer1.popIfNotEmpty(0, &packet, &packetLen));
+        assert(packet.header.getType() == TYPE_TIME_SYNC);
+        assert(packet.header.getDestAddr() == BROADCAST_ADDR);
+        assert(!packet.header.isAckRequired());
+        assert(packetLen == sizeof(Header) + sizeof(TimeSyncPayload));
+        TimeSyncPayload payload;
+        memcpy(&payload, packet.payload, sizeof(payload));
+        assert(payload.level == 0);
+        assert(payload.rootAddr == 1);
+        // The frame is on the air for 300ms and the receiver time 
+        // stamps the end of it
+        clock.advanceUs(300000);
+        RxMetadata rxMeta;
+        rxMeta.rxTimeUs = clock.timeUs();
+        rxMeta.airtimeUs = 300000;
+        clock.advanceUs(20000);
+        rxBuffer3.push(&rxMeta, &packet, packetLen);
+    }
+    mp3.pump();
+    assert(networkClock3.isSynced());
+    assert(networkClock3.getLevel() == 1);
+    assert(networkClock3.getParent() == 1);
+    assert(networkClock3.getRoot() == 1);
+    assert(networkClock3.getNetworkUs() == networkClock1.getNetworkUs());
+    assert(networkClock3.toNetworkUs(txStartUs) == networkClock1.toNetworkUs(txStartUs));
+
+    // Node 3 passes the time on 
+    clock.advanceSeconds(TIME_SYNC_INTERVAL_MS * 5 / 4000);
+    mp3.pump();
+    {
+        unsigned int packetLen = 256;
+        Packet packet;
+        assert(txBuffer3.popIfNotEmpty(0, &packet, &packetLen));
+        assert(packet.header.getType() == TYPE_TIME_SYNC);
+        TimeSyncPayload payload;
+        memcpy(&payload, packet.payload, sizeof(payload));
+        assert(payload.level == 1);
+        assert(payload.rootAddr == 1);
+    }
+}
+
+void test_SleepSchedule() {
+
+    TestClock clock;
+    clock.setTime(60 * 1000);
+    NetworkClock networkClock(clock);
+    SleepSchedule ss(clock);
+    ss.setNetworkClock(&networkClock);
+    ss.setTxMarginMs(1100);
+
+    SleepConfig config;
+    config.setDefaults();
+    config.enabled = 1;
+    config.periodMs = 30000;
+    config.listenMs = 2000;
+    config.extendMs = 2000;
+    ss.configure(config);
+
+    // Nobody sleeps without the network time
+    clock.advanceSeconds(10);
+    assert(!ss.isActive());
+    assert(ss.isListenWindow());
+    assert(ss.isTxAllowed());
+    assert(ss.getSleepMs() == 0);
+
+    // The wake window starts now
+    networkClock.setTime(0, 1);
+    assert(ss.isActive());
+    assert(ss.isListenWindow());
+    assert(ss.isTxAllowed());
+    assert(!ss.isSleepAllowed());
+    // The exchange has to fit in the rest of the window
+    clock.setTime(clock.time() + 900);
+    assert(ss.isTxAllowed());
+    clock.setTime(clock.time() + 100);
+    assert(!ss.isTxAllowed());
+    assert(ss.isListenWindow());
+    // Traffic at the end of the window keeps us awake for a while
+    clock.setTime(clock.time() + 900);
+    ss.processActivity();
+    clock.setTime(clock.time() + 1000);
+    assert(!ss.isListenWindow());
+    assert(!ss.isSleepAllowed());
+    clock.setTime(clock.time() + 1000);
+    assert(ss.isSleepAllowed());
+    // Wake up a little before the next window
+    assert(ss.getSleepMs() == 30000 - 3900 - SLEEP_WAKE_LEAD_MS);
+    clock.setTime(clock.time() + ss.getSleepMs());
+    assert(!ss.isListenWindow());
+    assert(ss.getSleepMs() == 0);
+    clock.setTime(clock.time() + SLEEP_WAKE_LEAD_MS);
+    assert(ss.isListenWindow());
+    assert(ss.isTxAllowed());
+
+    // Measurements
+    ss.resetCounters();
+    ss.processHold(1000);
+    ss.processHold(3000);
+    assert(ss.getHoldCount() == 2);
+    assert(ss.getAvgHoldMs() == 2000);
+    assert(ss.getMaxHoldMs() == 3000);
+    clock.setTime(clock.time() + 10000);
+    ss.processSleep(9000);
+    assert(ss.getSleepCount() == 1);
+    assert(ss.getAwakePct() > 9.9 && ss.getAwakePct() < 10.1);
+}
+
+/**
+ * Two stations on a sleep schedule.  Station 3 pings station 1 every 
+ * few minutes at random times.  The pings wait for the wake window, 
+ * and the stations sleep the rest of the time.
+ */
+void test_SleepTraffic() {
+
+    TestClock clock;
+    clock.setTime(60 * 1000);
+    srand(1);
+
+    SleepConfig sleepConfig;
+    sleepConfig.setDefaults();
+    sleepConfig.enabled = 1;
+
+    Preferences nvram1;
+    TestConfiguration config1(1, "KC1FSZ");
+    TestInstrumentation instrumentation1;
+    RoutingTableImpl routingTable1(nvram1);
+    routingTable1.setRoute(3, 3);
+    NeighborTable neighborTable1(clock);
+    CircularBufferImpl<4096> txBuffer1(0);
+    CircularBufferImpl<4096> rxBuffer1(sizeof(RxMetadata));
+    MessageProcessor mp1(clock, rxBuffer1, txBuffer1,
+        routingTable1, neighborTable1, instrumentation1, config1,
+        10 * 1000, 2 * 1000);
+    NetworkClock networkClock1(clock);
+    networkClock1.setTime(0, 1);
+    mp1.setNetworkClock(&networkClock1);
+    SleepSchedule ss1(clock);
+    ss1.configure(sleepConfig);
+    ss1.setNetworkClock(&networkClock1);
+    ss1.setTxMarginMs(1100);
+    mp1.setSleepSchedule(&ss1);
+
+    Preferences nvram3;
+    TestConfiguration config3(3, "W1TKZ");
+    TestInstrumentation instrumentation3;
+    RoutingTableImpl routingTable3(nvram3);
+    routingTable3.setRoute(1, 1);
+    NeighborTable neighborTable3(clock);
+    CircularBufferImpl<4096> txBuffer3(0);
+    CircularBufferImpl<4096> rxBuffer3(sizeof(RxMetadata));
+    MessageProcessor mp3(clock, rxBuffer3, txBuffer3,
+        routingTable3, neighborTable3, instrumentation3, config3,
+        10 * 1000, 2 * 1000);
+    NetworkClock networkClock3(clock);
+    networkClock3.setTime(0, 3);
+    mp3.setNetworkClock(&networkClock3);
+    SleepSchedule ss3(clock);
+    ss3.configure(sleepConfig);
+    ss3.setNetworkClock(&networkClock3);
+    ss3.setTxMarginMs(1100);
+    mp3.setSleepSchedule(&ss3);
+
+    MessageProcessor* mps[2] = { &mp1, &mp3 };
+    SleepSchedule* sss[2] = { &ss1, &ss3 };
+    CircularBuffer* txBuffers[2] = { &txBuffer1, &txBuffer3 };
+    CircularBuffer* rxBuffers[2] = { &rxBuffer1, &rxBuffer3 };
+    uint32_t wakeTime[2] = { 0, 0 };
+
+    const uint32_t startTime = clock.time();
+    const uint32_t endTime = startTime + 60UL * 60UL * 1000UL;
+    uint32_t nextPingTime = startTime + random(0, 300000);
+    uint32_t pingTime = 0;
+    unsigned int pingCount = 0;
+    unsigned int respCount = 0;
+    uint32_t maxLatencyMs = 0;
+
+    while (clock.time() < endTime) {
+
+        const uint32_t now = clock.time();
+        if (now >= nextPingTime) {
+            Packet packet;
+            packet.header.setType(TYPE_PING_REQ);
+            packet.header.setId(mp3.getUniqueId());
+            packet.header.setSourceAddr(3);
+            packet.header.setDestAddr(1);
+            packet.header.setOriginalSourceAddr(3);
+            packet.header.setFinalDestAddr(1);
+            packet.header.setSourceCall("W1TKZ");
+            packet.header.setOriginalSourceCall("W1TKZ");
+            packet.header.setFinalDestCall("KC1FSZ");
+            assert(mp3.transmitIfPossible(packet, sizeof(Header)));
+            pingCount++;
+            pingTime = now;
+            nextPingTime = now + random(120000, 300000);
+        }
+
+        for (unsigned int i = 0; i < 2; i++) {
+            if (now < wakeTime[i])
+                continue;
+            mps[i]->pump();
+            // Frames only arrive if the other station is awake
+            while (!txBuffers[i]->isEmpty()) {
+                const unsigned int o = 1 - i;
+                unsigned int packetLen = 256;
+                Packet packet;
+                txBuffers[i]->popIfNotEmpty(0, &packet, &packetLen);
+                if (now < wakeTime[o])
+                    continue;
+                if (packet.header.getType() == TYPE_PING_RESP) {
+                    respCount++;
+                    if (now - pingTime > maxLatencyMs)
+                        maxLatencyMs = now - pingTime;
+                }
+                RxMetadata rxMeta;
+                rxMeta.rxTimeUs = clock.timeUs();
+                rxBuffers[o]->push(&rxMeta, &packet, packetLen);
+            }
+            const uint32_t sleepMs = sss[i]->getSleepMs();
+            if (sleepMs > 0) {
+                sss[i]->processSleep(sleepMs);
+                wakeTime[i] = now + sleepMs;
+            }
+        }
+
+        clock.setTime(now + 10);
+    }
+
+    // Every ping got through, within one period of the schedule 
+    assert(pingCount > 10);
+    assert(respCount == pingCount);
+    assert(maxLatencyMs < sleepConfig.periodMs);
+    assert(ss3.getHoldCount() > 0);
+    assert(ss3.getMaxHoldMs() < sleepConfig.periodMs);
+    // An order of magnitude less time awake
+    assert(ss1.getAwakePct() < 10.0);
+    assert(ss3.getAwakePct() < 10.0);
+    cout << "SLEEP: { \"pings\": " << pingCount 
+         << ", \"maxLatencyMs\": " << maxLatencyMs
+         << ", \"holdAvgMs\": " << ss3.getAvgHoldMs()
+         << ", \"holdMaxMs\": " << ss3.getMaxHoldMs()
+         << ", \"awakePct\": [" << ss1.getAwakePct() << ", " 
+         << ss3.getAwakePct() << "] }" << endl;
+
+    // Outside of the window a frame that arrives is still ACKed right 
+    // away, but the response waits for the window
+    while (txBuffer1.isEmpty() == false || ss1.isListenWindow())
+        clock.setTime(clock.time() + 100);
+    {
+        Packet packet;
+        packet.header.setType(TYPE_PING_REQ);
+        packet.header.setId(mp3.getUniqueId());
+        packet.header.setSourceAddr(3);
+        packet.header.setDestAddr(1);
+        packet.header.setOriginalSourceAddr(3);
+        packet.header.setFinalDestAddr(1);
+        packet.header.setSourceCall("W1TKZ");
+        packet.header.setOriginalSourceCall("W1TKZ");
+        packet.header.setFinalDestCall("KC1FSZ");
+        RxMetadata rxMeta;
+        rxMeta.rxTimeUs = clock.timeUs();
+        rxBuffer1.push(&rxMeta, &packet, sizeof(Header));
+    }
+    mp1.pump();
+    {
+        unsigned int packetLen = 256;
+        Packet packet;
+        assert(txBuffer1.popIfNotEmpty(0, &packet, &packetLen));
+        assert(packet.header.isAck());
+        assert(txBuffer1.isEmpty());
+    }
+    // The response isn't given up on, no matter how long the wait
+    const uint16_t holdCount = ss1.getHoldCount();
+    while (true) {
+        clock.setTime(clock.time() + 100);
+        if (ss1.isTxAllowed())
+            break;
+        mp1.pump();
+        assert(txBuffer1.isEmpty());
+    }
+    mp1.pump();
+    {
+        // Other held traffic (i.e. time sync) may be going out too
+        bool found = false;
+        unsigned int packetLen = 256;
+        Packet packet;
+        while (txBuffer1.popIfNotEmpty(0, &packet, &packetLen)) {
+            if (packet.header.getType() == TYPE_PING_RESP)
+                found = true;
+            packetLen = 256;
+        }
+        assert(found);
+    }
+    assert(ss1.getHoldCount() == holdCount + 1);
 }
 
 void test_buffer() {
@@ -572,10 +1973,11 @@ void test_Loopback() {
     RoutingTableImpl routingTable1(nvram1);
     routingTable1.setRoute(3, 3);
     routingTable1.setRoute(7, 3);
+    NeighborTable neighborTable1(clock);
     CircularBufferImpl<4096> txBuffer1(0);
-    CircularBufferImpl<4096> rxBuffer1(2);
+    CircularBufferImpl<4096> rxBuffer1(sizeof(RxMetadata));
     MessageProcessor mp1(clock, rxBuffer1, txBuffer1,
-        routingTable1, instrumentation1, config1,
+        routingTable1, neighborTable1, instrumentation1, config1,
         10 * 1000, 2 * 1000);
 
     // Message to myself
@@ -618,7 +2020,19 @@ void test_Loopback() {
 int main(int argc, const char** argv) {
     test_buffer();
     test_header();
+    test_NeighborTable();
+    test_Probe();
     test_OutboundPacket();
+    test_Failover();
+    test_Ttl();
+    test_RouteError();
+    test_ProfileChange();
+    test_ProfileChangeNetworkTime();
+    test_AckFeedback();
+    test_NetworkClock();
+    test_TimeSync();
+    test_SleepSchedule();
+    test_SleepTraffic();
     test_MessageProcessor();
     test_Loopback();
 }
@@ -6,6 +6,8 @@
 #include "../station/Instrumentation.h"
 #include "../station/RoutingTable.h"
 #include "../station/RoutingTableImpl.h"
+#include "../station/NeighborTable.h"
+#include "../station/ChannelAccess.h"
 #include "../station/MessageProcessor.h"
 #include "../station/CommandProcessor.h"
 #include "../station/Configuration.h"
@@ -102,8 +104,10 @@ void movePacket(CircularBuffer& from, CircularBuffer& to) {
     uint8_t packet[256];
     bool got = from.popIfNotEmpty(0, packet, &packetLen);
     if (got) {
-        int16_t rssi = 100;
-        to.push(&rssi, packet, packetLen);
+        RxMetadata rxMeta;
+        rxMeta.rssi = -100;
+        rxMeta.snr = 5;
+        to.push(&rxMeta, packet, packetLen);
     }
 }
 
@@ -122,10 +126,18 @@ static TestInstrumentation testInstrumentation;
 Instrumentation& systemInstrumentation = testInstrumentation;
 static RoutingTableImpl testRoutingTable(nvram1);
 RoutingTable& systemRoutingTable = testRoutingTable;
+static NeighborTable testNeighborTable(testClock);
+NeighborTable& systemNeighborTable = testNeighborTable;
+static ChannelAccess testChannelAccess(testClock);
+ChannelAccess& systemChannelAccess = testChannelAccess;
+static NetworkClock testNetworkClock(testClock);
+NetworkClock& systemNetworkClock = testNetworkClock;
+static SleepSchedule testSleepSchedule(testClock);
+SleepSchedule& systemSleepSchedule = testSleepSchedule;
 CircularBufferImpl<4096> txBuffer(0);
-CircularBufferImpl<4096> rxBuffer(2);
+CircularBufferImpl<4096> rxBuffer(sizeof(RxMetadata));
 MessageProcessor testMessageProcessor(testClock, rxBuffer, txBuffer,
-    testRoutingTable, testInstrumentation, testConfig,
+    testRoutingTable, testNeighborTable, testInstrumentation, testConfig,
     10 * 1000, 2 * 1000);
 MessageProcessor& systemMessageProcessor = testMessageProcessor;
 
@@ -215,6 +227,27 @@ void test_CommandProcessor() {
         assert(payload.nextHopAddr == 4);
     }
 
+    // GET LINKS REMOTE
+    {
+        const char* a0 = "sendgetlinks";
+        const char* a1 = "7";
+        const char *a_args[2] = { a0, a1 };
+
+        sendGetLinks(2, (char**)a_args);
+
+        systemMessageProcessor.pump();
+
+        // Make sure we see the outbound message
+        assert(!txBuffer.isEmpty());
+
+        Packet packet;
+        unsigned int packetLen = sizeof(packet);
+        txBuffer.pop(0, (void*)&packet, &packetLen);
+        assert(packet.header.getType() == TYPE_GETLINKS_REQ);
+        assert(packet.header.destAddr == 3);
+        assert(packet.header.finalDestAddr == 7);
+    }
+
     // SEND TEXT
     {
         const char* a0 = "text";
@@ -3,6 +3,7 @@
 
 #include <EEPROM.h>
 #include <iostream>
+#include <assert.h>
 
 using namespace std;
 
@@ -59,9 +60,115 @@ void test_3() {
     assert(config.getBatteryLimit() == 3800);
 }
 
+void test_4() {
+
+    Preferences nvram;
+    ConfigurationImpl config(nvram);
+    config.factoryReset();
+
+    // Nothing configured yet, so the defaults are used
+    ChannelAccessConfig c = config.getChannelAccessConfig();
+    assert(c.isValid());
+    assert(c.persistencePct == 50);
+
+    c.persistencePct = 25;
+    c.cwMax[TRAFFIC_DATA] = 32;
+    config.setChannelAccessConfig(c);
+    ChannelAccessConfig c2 = config.getChannelAccessConfig();
+    assert(c2.persistencePct == 25);
+    assert(c2.cwMax[TRAFFIC_DATA] == 32);
+}
+
+void test_5() {
+
+    Preferences nvram;
+    ConfigurationImpl config(nvram);
+    config.factoryReset();
+
+    // Nothing configured yet, so the defaults are used
+    RadioProfileTable t = config.getRadioProfiles();
+    assert(t.isValid());
+    assert(t.active == 0);
+    assert(t.getActive().isNamed("default"));
+    assert(t.getActive().sf == 9);
+    assert(t.find("long") == 2);
+    assert(t.find("nothing") == -1);
+
+    t.profiles[1].set("test", 8, 8, 2, 14);
+    t.active = 1;
+    config.setRadioProfiles(t);
+    RadioProfileTable t2 = config.getRadioProfiles();
+    assert(t2.active == 1);
+    assert(t2.getActive().isNamed("test"));
+    assert(t2.getActive().bw == 8);
+    assert(t2.getActive().powerDbm == 14);
+
+    // Out of range settings are rejected
+    t2.profiles[1].set("test", 13, 7, 1, 20);
+    assert(!t2.isValid());
+    t2.profiles[1].set("", 9, 7, 1, 20);
+    assert(!t2.isValid());
+}
+
+void test_6() {
+
+    Preferences nvram;
+    ConfigurationImpl config(nvram);
+    config.factoryReset();
+
+    // Nothing configured yet, so the defaults are used
+    TdmaConfig c = config.getTdmaConfig();
+    assert(c.isValid());
+    assert(c.enabled == 0);
+    assert(c.slotCount == 8);
+
+    c.enabled = 1;
+    c.slotCount = 4;
+    c.slotMs = 2000;
+    c.slotMask = 0x05;
+    config.setTdmaConfig(c);
+    TdmaConfig c2 = config.getTdmaConfig();
+    assert(c2.enabled == 1);
+    assert(c2.slotCount == 4);
+    assert(c2.slotMs == 2000);
+    assert(c2.slotMask == 0x05);
+
+    c2.slotCount = TDMA_MAX_SLOTS + 1;
+    assert(!c2.isValid());
+}
+
+void test_7() {
+
+    Preferences nvram;
+    ConfigurationImpl config(nvram);
+    config.factoryReset();
+
+    // Nothing configured yet, so the defaults are used
+    SleepConfig c = config.getSleepConfig();
+    assert(c.isValid());
+    assert(c.enabled == 0);
+
+    c.enabled = 1;
+    c.periodMs = 20000;
+    c.listenMs = 1500;
+    config.setSleepConfig(c);
+    SleepConfig c2 = config.getSleepConfig();
+    assert(c2.enabled == 1);
+    assert(c2.periodMs == 20000);
+    assert(c2.listenMs == 1500);
+
+    // The window has to be shorter than the period
+    c2.listenMs = 20000;
+    assert(!c2.isValid());
+}
+
 int main(int argc, const char** argv) {
     test_1();
     test_2();
     test_3();
+    test_4();
+    test_5();
+    test_6();
+    test_7();
     return 0;
 }
@@ -0,0 +1,432 @@
+#include <Arduino.h>
+
+#include "../station/packets.h"
+#include "../station/ChannelAccess.h"
+#include "../station/NetworkClock.h"
+#include "TestClockImpl.h"
+
+#include <iostream>
+#include <assert.h>
+#include <stdlib.h>
+
+using namespace std;
+
+// ----- Host-side contention benchmark ------------------------------------
+//
+// A number of stations share one channel and each has a backlog of data 
+// packets to send.  Time advances in 1ms steps.  Each station runs the same
+// sequence as the firmware: wait for the channel access policy to allow a 
+// CAD, run the CAD (which detects any transmission in progress), then either
+// transmit, defer or back off.  Two transmissions that overlap are both lost,
+// which looks like a missed ACK to the sender.  A transmission that has 
+// just started can't be detected yet, which is where collisions come from.
+//
+// In the hidden terminal case the stations are split into two groups 
+// that can't hear each other (so CAD only sees the own group) but that
+// are both heard by the receiver, where any overlap is a collision.  
+// In the TDMA case all stations share the network time and own one slot 
+// each.
+//
+// Run with no arguments to check the default policy.  Run with arguments 
+// to try out other parameters:
+//
+//   ./unit-test-4 <stations> <persist pct> <slot ms> <data cw min> <data cw max>
+
+// Roughly a 64 byte frame at SF9/125kHz
+#define AIRTIME_MS 200
+// Roughly one symbol plus processing at SF9/125kHz
+#define CAD_MS 5
+// A transmission can't be detected by CAD until the radio has turned 
+// around and at least one preamble symbol has been sent
+#define DETECT_MS 6
+#define PACKETS_PER_STATION 40
+#define MAX_STATIONS 32
+// The guard time used for the TDMA slots
+#define GUARD_MS 5
+
+enum SimState { SIM_IDLE, SIM_CAD, SIM_TX };
+
+struct SimStation {
+    SimStation() : ca(0), state(SIM_IDLE), startTime(0), endTime(0), 
+        backlog(0), collided(false) { }
+    ChannelAccess* ca;
+    SimState state;
+    uint32_t startTime;
+    uint32_t endTime;
+    unsigned int backlog;
+    bool collided;
+};
+
+struct SimResult {
+    unsigned int delivered;
+    unsigned int collisions;
+    unsigned int busy;
+    unsigned int defers;
+    uint32_t elapsedMs;
+};
+
+static SimResult simulate(unsigned int stationCount, 
+    const ChannelAccessConfig& config, const TdmaConfig* tdma, bool hidden) {
+
+    TestClock clock;
+    clock.setTime(0);
+    srand(1);
+
+    // Everyone is on the same clock, so one root is enough
+    NetworkClock networkClock(clock);
+    networkClock.setTime(0, 1);
+
+    ChannelAccess* cas[MAX_STATIONS];
+    SimStation stations[MAX_STATIONS];
+    for (unsigned int i = 0; i < stationCount; i++) {
+        cas[i] = new ChannelAccess(clock);
+        cas[i]->configure(config);
+        if (tdma) {
+            cas[i]->configureTdma(*tdma, i + 1);
+            cas[i]->setNetworkClock(&networkClock);
+            cas[i]->setTdmaTiming((CAD_MS + AIRTIME_MS) * 1000, GUARD_MS * 1000);
+        }
+        stations[i].ca = cas[i];
+        stations[i].backlog = PACKETS_PER_STATION;
+        // Stations don't all start at the same moment
+        stations[i].endTime = random(0, AIRTIME_MS);
+    }
+
+    SimResult result;
+    result.delivered = 0;
+    result.collisions = 0;
+
+    // Stop when everything has been delivered (or it's hopeless)
+    const uint32_t limitMs = 60UL * 60UL * 1000UL;
+    while (clock.time() < limitMs) {
+
+        const uint32_t now = clock.time();
+        unsigned int remaining = 0;
+        networkClock.tick();
+
+        for (unsigned int i = 0; i < stationCount; i++) {
+            SimStation& st = stations[i];
+            remaining += st.backlog;
+
+            if (st.state == SIM_IDLE) {
+                if (st.backlog > 0 && now >= st.endTime && 
+                    st.ca->isCadAllowed(TRAFFIC_DATA)) {
+                    st.state = SIM_CAD;
+                    st.endTime = now + CAD_MS;
+                }
+            }
+            else if (st.state == SIM_CAD && now >= st.endTime) {
+                bool busy = false;
+                for (unsigned int j = 0; j < stationCount; j++) 
+                    if (j != i && stations[j].state == SIM_TX &&
+                        now - stations[j].startTime >= DETECT_MS &&
+                        (!hidden || (i % 2) == (j % 2)))
+                        busy = true;
+                if (busy) {
+                    st.ca->processChannelBusy(TRAFFIC_DATA);
+                    st.state = SIM_IDLE;
+                } else if (st.ca->processChannelIdle(TRAFFIC_DATA)) {
+                    st.state = SIM_TX;
+                    st.startTime = now;
+                    st.endTime = now + AIRTIME_MS;
+                    st.collided = false;
+                    // Anyone else on the air is now garbled, and so are we
+                    for (unsigned int j = 0; j < stationCount; j++) {
+                        if (j != i && stations[j].state == SIM_TX) {
+                            stations[j].collided = true;
+                            st.collided = true;
+                        }
+                    }
+                } else {
+                    st.state = SIM_IDLE;
+                }
+            }
+            else if (st.state == SIM_TX && now >= st.endTime) {
+                st.state = SIM_IDLE;
+                if (st.collided) {
+                    result.collisions++;
+                    st.ca->processAckMissed(TRAFFIC_DATA);
+                } else {
+                    result.delivered++;
+                    st.backlog--;
+                    st.ca->processTxSuccess(TRAFFIC_DATA);
+                }
+            }
+        }
+
+        if (remaining == 0) 
+            break;
+
+        clock.setTime(now + 1);
+    }
+
+    result.busy = 0;
+    result.defers = 0;
+    for (unsigned int i = 0; i < stationCount; i++) {
+        result.busy += cas[i]->getBusyCounter();
+        result.defers += cas[i]->getDeferCounter();
+        delete cas[i];
+    }
+    result.elapsedMs = clock.time();
+    return result;
+}
+
+static SimResult run(const char* name, unsigned int stationCount, 
+    const ChannelAccessConfig& config, const TdmaConfig* tdma = 0, 
+    bool hidden = false) {
+    SimResult r = simulate(stationCount, config, tdma, hidden);
+    float attempts = r.delivered + r.collisions;
+    cout << "BENCH: { \"policy\": \"" << name << "\""
+         << ", \"stations\": " << stationCount
+         << ", \"hidden\": " << hidden
+         << ", \"tdmaSlotMs\": " << (tdma ? (int)tdma->slotMs : 0)
+         << ", \"persistPct\": " << (int)config.persistencePct
+         << ", \"slotMs\": " << (int)config.slotMs
+         << ", \"cwMin\": " << (int)config.cwMin[TRAFFIC_DATA]
+         << ", \"cwMax\": " << (int)config.cwMax[TRAFFIC_DATA]
+         << ", \"delivered\": " << r.delivered
+         << ", \"collisions\": " << r.collisions
+         << ", \"collisionPct\": " << (100.0 * r.collisions / attempts)
+         << ", \"busy\": " << r.busy
+         << ", \"defers\": " << r.defers
+         << ", \"utilizationPct\": " 
+         << (100.0 * r.delivered * AIRTIME_MS / r.elapsedMs)
+         << " }" << endl;
+    return r;
+}
+
+void test_ChannelAccess() {
+
+    TestClock clock;
+    clock.setTime(1000);
+    ChannelAccess ca(clock);
+    const ChannelAccessConfig& config = ca.getConfig();
+    assert(config.isValid());
+
+    // Traffic classes
+    Header h;
+    h.setType(TYPE_ACK);
+    assert(ChannelAccess::classify(h) == TRAFFIC_ACK);
+    h.setType(TYPE_LINK_PROBE);
+    assert(ChannelAccess::classify(h) == TRAFFIC_CONTROL);
+    h.setType(TYPE_TEXT);
+    assert(ChannelAccess::classify(h) == TRAFFIC_DATA);
+
+    // Nothing is holding us back at the start
+    assert(ca.isCadAllowed(TRAFFIC_DATA));
+    assert(ca.getContentionWindow(TRAFFIC_DATA) == config.cwMin[TRAFFIC_DATA]);
+
+    // A busy channel doubles the window and imposes a backoff
+    ca.processChannelBusy(TRAFFIC_DATA);
+    assert(ca.getContentionWindow(TRAFFIC_DATA) == 2 * config.cwMin[TRAFFIC_DATA]);
+    assert(!ca.isCadAllowed(TRAFFIC_DATA));
+    // An ACK isn't held back by the data backoff
+    assert(ca.isCadAllowed(TRAFFIC_ACK));
+    assert(ca.isCadAllowed(TRAFFIC_CONTROL));
+    clock.setTime(clock.time() + 
+        ca.getContentionWindow(TRAFFIC_DATA) * config.slotMs);
+    assert(ca.isCadAllowed(TRAFFIC_DATA));
+    // The other classes are not affected
+    assert(ca.getContentionWindow(TRAFFIC_ACK) == config.cwMin[TRAFFIC_ACK]);
+
+    // A backoff that runs across the wrap of the clock
+    {
+        TestClock wrapClock;
+        wrapClock.setTime(0xffffffff - config.slotMs);
+        ChannelAccess wrapCa(wrapClock);
+        wrapCa.processChannelBusy(TRAFFIC_DATA);
+        assert(!wrapCa.isCadAllowed(TRAFFIC_DATA));
+        wrapClock.setTime(wrapClock.time() + 
+            wrapCa.getContentionWindow(TRAFFIC_DATA) * config.slotMs);
+        assert(wrapClock.time() < config.cwMax[TRAFFIC_DATA] * config.slotMs);
+        assert(wrapCa.isCadAllowed(TRAFFIC_DATA));
+    }
+
+    // The window is capped
+    for (unsigned int i = 0; i < 16; i++) 
+        ca.processAckMissed(TRAFFIC_DATA);
+    assert(ca.getContentionWindow(TRAFFIC_DATA) == config.cwMax[TRAFFIC_DATA]);
+    assert(ca.getAckMissedCounter() == 16);
+
+    // Success resets the window
+    ca.processTxSuccess(TRAFFIC_DATA);
+    assert(ca.getContentionWindow(TRAFFIC_DATA) == config.cwMin[TRAFFIC_DATA]);
+
+    // ACKs always go out on an idle channel
+    clock.setTime(clock.time() + 60 * 1000);
+    for (unsigned int i = 0; i < 20; i++) 
+        assert(ca.processChannelIdle(TRAFFIC_ACK));
+    assert(ca.getDeferCounter() == 0);
+
+    // Data sometimes defers for a slot
+    unsigned int sent = 0;
+    for (unsigned int i = 0; i < 1000; i++) {
+        clock.setTime(clock.time() + config.slotMs);
+        if (ca.processChannelIdle(TRAFFIC_DATA))
+            sent++;
+    }
+    assert(sent > 300 && sent < 700);
+    assert(ca.getDeferCounter() == 1000 - sent);
+
+    // Bad configurations are replaced with the defaults
+    ChannelAccessConfig bad;
+    bad.setDefaults();
+    bad.cwMax[TRAFFIC_DATA] = 0;
+    assert(!bad.isValid());
+    ca.configure(bad);
+    assert(ca.getConfig().isValid());
+}
+
+void test_Tdma() {
+
+    TestClock clock;
+    clock.setTime(0);
+    NetworkClock networkClock(clock);
+    ChannelAccess ca(clock);
+    ca.setNetworkClock(&networkClock);
+    assert(!ca.getTdmaConfig().enabled);
+
+    // Four 100ms slots, station 6 owns slot 2 (200ms-300ms)
+    TdmaConfig tdma;
+    tdma.setDefaults();
+    tdma.enabled = 1;
+    tdma.slotCount = 4;
+    tdma.slotMs = 100;
+    ca.configureTdma(tdma, 6);
+    ca.setTdmaTiming(50 * 1000, 10 * 1000);
+    assert(!ca.isOwnSlot(1));
+    assert(ca.isOwnSlot(2));
+
+    // Without the network time it's plain CSMA
+    assert(!ca.isTdmaActive());
+    assert(ca.isCadAllowed(TRAFFIC_DATA));
+
+    networkClock.setTime(0, 1);
+    assert(ca.isTdmaActive());
+    // Someone else's slot
+    clock.setTime(150);
+    assert(!ca.isCadAllowed(TRAFFIC_DATA));
+    assert(!ca.isCadAllowed(TRAFFIC_CONTROL));
+    // ACKs are never held back
+    assert(ca.isCadAllowed(TRAFFIC_ACK));
+    // Inside the leading guard time
+    clock.setTime(205);
+    assert(!ca.isCadAllowed(TRAFFIC_DATA));
+    // The frame and ACK fit between the guard times
+    clock.setTime(210);
+    assert(ca.isCadAllowed(TRAFFIC_DATA));
+    clock.setTime(240);
+    assert(ca.isCadAllowed(TRAFFIC_DATA));
+    // A longer transmission (e.g. a broadcast on several spreading 
+    // factors) needs more of the slot
+    assert(!ca.isCadAllowed(TRAFFIC_DATA, 10 * 1000));
+    clock.setTime(230);
+    assert(ca.isCadAllowed(TRAFFIC_DATA, 10 * 1000));
+    // One that doesn't fit in any slot starts early in the slot
+    assert(ca.isCadAllowed(TRAFFIC_DATA, 200 * 1000));
+    clock.setTime(241);
+    assert(!ca.isCadAllowed(TRAFFIC_DATA, 200 * 1000));
+    clock.setTime(240);
+    // Too close to the end of the slot
+    clock.setTime(241);
+    assert(!ca.isCadAllowed(TRAFFIC_DATA));
+    // The same slot in the next frame
+    clock.setTime(620);
+    assert(ca.isCadAllowed(TRAFFIC_DATA));
+
+    // No persistence deferral or backoff in our own slot
+    for (unsigned int i = 0; i < 20; i++) 
+        assert(ca.processChannelIdle(TRAFFIC_DATA));
+    assert(ca.getTdmaTxCounter() == 20);
+    assert(ca.getDeferCounter() == 0);
+    ca.processAckMissed(TRAFFIC_DATA);
+    assert(ca.getContentionWindow(TRAFFIC_DATA) == ca.getConfig().cwMin[TRAFFIC_DATA]);
+    assert(ca.isCadAllowed(TRAFFIC_DATA));
+
+    // Configured slots override the address
+    tdma.slotMask = (1 << 0) | (1 << 3);
+    ca.configureTdma(tdma, 6);
+    assert(ca.isOwnSlot(0));
+    assert(!ca.isOwnSlot(2));
+    assert(ca.isOwnSlot(3));
+
+    // Slots that are too short for the radio profile fall back to CSMA
+    ca.setTdmaTiming(90 * 1000, 10 * 1000);
+    assert(!ca.isTdmaActive());
+}
+
+void test_contention() {
+
+    // The old behavior: no memory of contention, retry on the next tick
+    ChannelAccessConfig legacy;
+    legacy.setDefaults();
+    legacy.persistencePct = 100;
+    legacy.slotMs = 1;
+    legacy.cwMin[TRAFFIC_DATA] = 1;
+    legacy.cwMax[TRAFFIC_DATA] = 1;
+
+    ChannelAccessConfig defaults;
+    defaults.setDefaults();
+
+    SimResult r0 = run("legacy", 8, legacy);
+    SimResult r1 = run("default", 8, defaults);
+
+    // Without any memory of contention the stations that collide 
+    // retry in lock-step
+    assert(r1.delivered == 8 * PACKETS_PER_STATION);
+    assert(r1.delivered > r0.delivered);
+    // The CSMA/CA policy should cut the collisions substantially
+    float c0 = (float)r0.collisions / (r0.delivered + r0.collisions);
+    float c1 = (float)r1.collisions / (r1.delivered + r1.collisions);
+    assert(c1 * 2 < c0);
+}
+
+void test_tdma_contention() {
+
+    ChannelAccessConfig defaults;
+    defaults.setDefaults();
+
+    TdmaConfig tdma;
+    tdma.setDefaults();
+    tdma.enabled = 1;
+    tdma.slotCount = 8;
+    tdma.slotMs = CAD_MS + AIRTIME_MS + 2 * GUARD_MS;
+
+    SimResult r0 = run("default", 8, defaults, 0, true);
+    SimResult r1 = run("tdma", 8, defaults, &tdma, true);
+    SimResult r2 = run("tdma", 8, defaults, &tdma, false);
+
+    // Hidden terminals defeat the channel check, but not the slots
+    assert(r0.collisions > 0);
+    assert(r1.collisions == 0);
+    assert(r1.delivered == 8 * PACKETS_PER_STATION);
+    assert(r1.elapsedMs < r0.elapsedMs);
+    // With everything in range TDMA doesn't depend on the CAD at all
+    assert(r2.collisions == 0);
+    assert(r2.elapsedMs == r1.elapsedMs);
+}
+
+int main(int argc, const char** argv) {
+
+    if (argc == 6) {
+        ChannelAccessConfig config;
+        config.setDefaults();
+        config.persistencePct = atoi(argv[2]);
+        config.slotMs = atoi(argv[3]);
+        config.cwMin[TRAFFIC_DATA] = atoi(argv[4]);
+        config.cwMax[TRAFFIC_DATA] = atoi(argv[5]);
+        unsigned int stations = atoi(argv[1]);
+        if (!config.isValid() || stations == 0 || stations > MAX_STATIONS) {
+            cout << "ERR: Bad parameters" << endl;
+            return -1;
+        }
+        run("custom", stations, config);
+        return 0;
+    }
+
+    test_ChannelAccess();
+    test_Tdma();
+    test_contention();
+    test_tdma_contention();
+    return 0;
+}
@@ -0,0 +1,1156 @@
+#include <Arduino.h>
+
+#include "../station/packets.h"
+#include "../station/CircularBuffer.h"
+#include "../station/ChannelAccess.h"
+#include "../station/RadioDriver.h"
+#include "../station/RxMetadata.h"
+#include "../station/Airtime.h"
+#include "../station/NeighborTable.h"
+#include "../station/EdgeTimeQueue.h"
+#include "../station/NetworkClock.h"
+#include "TestClockImpl.h"
+#include "SX1276Emulator.h"
+
+#include <iostream>
+#include <assert.h>
+#include <string.h>
+
+using namespace std;
+
+// Dummy stream for unit test
+class TestStream : public Stream {
+public:
+
+    void print(const char* m) { cout << m; }
+    void print(uint16_t m) { cout << m; }
+    void print(uint32_t m) { cout << m; }
+    void println() { cout << endl; }
+    void println(const char* m) { cout << m << endl; }
+};
+
+static TestStream testStream;
+Stream& logger = testStream;
+
+/**
+ * @brief Everything a station needs to run the radio: an emulated 
+ * radio, the queues, the channel access policy and the driver.  
+ * loop() does what the main loop in station.ino does.
+ */
+struct TestStation {
+
+    TestStation(TestClock& clock) 
+    :   radio(clock),
+        txBuffer(0),
+        rxBuffer(sizeof(RxMetadata)),
+        ca(clock),
+        driver(radio, clock, txBuffer, rxBuffer, ca),
+        isrHit(false),
+        _clock(clock) {
+        radio.setDio0Callback(_isr, this);
+        // Always transmit when the channel is idle so the tests are 
+        // predictable
+        ChannelAccessConfig config;
+        config.setDefaults();
+        config.persistencePct = 100;
+        ca.configure(config);
+    }
+
+    void begin() {
+        driver.syncShadow();
+        assert(driver.init(906.5) == 0);
+        driver.startRx();
+    }
+
+    void loop() {
+        radio.update();
+        if (isrHit) {
+            isrHit = false;
+            const uint8_t irqFlags = driver.takeIrqFlags();
+            driver.processIrqFlags(irqFlags, 
+                edgeTimes.popLatest(_clock.timeUs()));
+        }
+        driver.tick();
+    }
+
+    static void _isr(void* ctx) {
+        TestStation* s = (TestStation*)ctx;
+        s->edgeTimes.push(s->_clock.timeUs());
+        s->isrHit = true;
+    }
+
+    SX1276Emulator radio;
+    CircularBufferImpl<256> txBuffer;
+    CircularBufferImpl<1024> rxBuffer;
+    ChannelAccess ca;
+    RadioDriver driver;
+    bool isrHit;
+    EdgeTimeQueue edgeTimes;
+    TestClock& _clock;
+};
+
+/**
+ * @brief Runs the main loop of all of the stations in 100us steps.
+ */
+static void run(TestClock& clock, TestStation** stations, unsigned int count, 
+    uint32_t ms) {
+    const uint32_t end = clock.timeUs() + ms * 1000;
+    while ((int32_t)(clock.timeUs() - end) < 0) {
+        for (unsigned int i = 0; i < count; i++) 
+            stations[i]->loop();
+        clock.advanceUs(100);
+    }
+}
+
+static unsigned int makeFrame(uint8_t* buf, uint8_t type, unsigned int len,
+    nodeaddr_t destAddr = BROADCAST_ADDR) {
+    memset(buf, 0, len);
+    // The constructor doesn't set every field, so start from the 
+    // zeroed buffer
+    Header header;
+    memcpy(&header, buf, sizeof(header));
+    header.setType(type);
+    header.setDestAddr(destAddr);
+    memcpy(buf, &header, sizeof(header));
+    for (unsigned int i = sizeof(header); i < len; i++)
+        buf[i] = i;
+    return len;
+}
+
+static void test_airtime() {
+    assert(loraBandwidthHz(7) == 125000);
+    assert(loraSymbolUs(9, 125000) == 4096);
+    // SF9/125kHz, 4/5, 64 bytes, CRC, explicit header
+    assert(loraAirtimeUs(9, 125000, 1, 64, 8, true, false, false) == 390144);
+    // SF12/125kHz, 4/5, 10 bytes, CRC, explicit header, LDRO 
+    assert(loraAirtimeUs(12, 125000, 1, 10, 8, true, false, true) == 991232);
+    // Implicit header saves symbols
+    assert(loraAirtimeUs(9, 125000, 1, 14, 8, true, true, false) <
+        loraAirtimeUs(9, 125000, 1, 14, 8, true, false, false));
+}
+
+static void test_init() {
+
+    TestClock clock;
+    TestStation s(clock);
+    SX1276Emulator& bus = s.radio;
+    RadioDriver& radio = s.driver;
+
+    radio.syncShadow();
+    assert(radio.init(906.5) == 0);
+    assert(bus.getMode() == 0x01);
+    assert((bus.getReg(0x01) & 0x80) == 0x80);
+    // FIFO split
+    assert(bus.getReg(0x0f) == 0x00);
+    assert(bus.getReg(0x0e) == 0x80);
+    assert(bus.getReg(0x23) == MAX_FRAME_LEN);
+    // SF9/125kHz
+    assert(bus.getReg(0x1d) == 0b01110010);
+    assert(bus.getReg(0x1e) == 0b10010100);
+    assert(bus.getSymbolUs() == 4096);
+    // Frequency
+    assert(bus.getReg(0x06) == 0xe2);
+    // No low data rate optimization at SF9
+    assert((bus.getReg(0x26) & 0x08) == 0);
+
+    radio.startRx();
+    assert(radio.getState() == RadioDriver::RX_STATE);
+    assert(bus.getMode() == 0x05);
+    assert(bus.getReg(0x40) == 0x00);
+
+    // Nothing changes so nothing should go out on the bus
+    unsigned int t = bus.getTransactions();
+    radio.startRx();
+    assert(bus.getTransactions() == t);
+    assert(radio.getRegWriteSkips() >= 2);
+
+}
+
+static void test_tx() {
+
+    TestClock clock;
+    TestStation s(clock);
+    TestStation* stations[] = { &s };
+    s.begin();
+
+    // Nothing pending, nothing happens
+    run(clock, stations, 1, 10);
+    assert(s.driver.getState() == RadioDriver::RX_STATE);
+
+    uint8_t frame[64];
+    unsigned int frameLen = makeFrame(frame, TYPE_TEXT, 64);
+    s.txBuffer.push(0, frame, frameLen);
+
+    // The CAD is started and the frame is loaded in the mean time
+    s.loop();
+    assert(s.driver.getState() == RadioDriver::CAD);
+    assert(s.radio.getMode() == 0x07);
+    assert(s.radio.getReg(0x40) == 0xa0);
+    assert(s.radio.getReg(0x0e) == 0x80);
+    assert(s.radio.getTxLen() == frameLen);
+    assert(memcmp(s.radio.getTxFrame(), frame, frameLen) == 0);
+    assert(!s.txBuffer.isEmpty());
+
+    // The CAD takes a little under two symbols and finds the channel clear
+    run(clock, stations, 1, 8);
+    assert(s.driver.getState() == RadioDriver::TX_STATE);
+    assert(s.radio.getMode() == 0x03);
+    assert(s.radio.getReg(0x40) == 0x40);
+    assert(s.txBuffer.isEmpty());
+    assert(s.driver.getTxPreloadHits() == 1);
+    assert(s.driver.getTxPreloadMisses() == 0);
+    assert(s.radio.getTxCount() == 1);
+
+    // The transmission takes ~390ms, after which we are back to listening
+    run(clock, stations, 1, 380);
+    assert(s.driver.getState() == RadioDriver::TX_STATE);
+    run(clock, stations, 1, 20);
+    assert(s.driver.getState() == RadioDriver::RX_STATE);
+    assert(s.radio.getMode() == 0x05);
+
+    // A missed CadDone interrupt is picked up by polling
+    s.txBuffer.push(0, frame, frameLen);
+    s.loop();
+    assert(s.driver.getState() == RadioDriver::CAD);
+    clock.advanceUs(5000);
+    s.radio.update();
+    s.isrHit = false;
+    s.edgeTimes.popLatest(0);
+    clock.setTime(clock.time() + 
+        (CAD_POLL_SYMBOLS * s.radio.getSymbolUs()) / 1000);
+    s.driver.tick();
+    assert(s.driver.getState() == RadioDriver::TX_STATE);
+    assert(s.txBuffer.isEmpty());
+}
+
+static void test_rx() {
+
+    TestClock clock;
+    TestStation s(clock);
+    s.begin();
+
+    uint8_t frame[64];
+    unsigned int frameLen = makeFrame(frame, TYPE_TEXT, 48);
+
+    s.radio.inject(frame, frameLen, 8, -80);
+    s.loop();
+    // The receiver has moved to the other region
+    assert(s.radio.getReg(0x0f) == 0x80);
+
+    RxMetadata meta;
+    uint8_t buf[256];
+    unsigned int bufLen = sizeof(buf);
+    assert(s.rxBuffer.popIfNotEmpty(&meta, buf, &bufLen));
+    assert(bufLen == frameLen);
+    assert(memcmp(buf, frame, frameLen) == 0);
+    assert(meta.snr == 8);
+    assert(meta.rssi >= -81 && meta.rssi <= -79);
+    assert(meta.freqErrorHz == 0);
+    assert(clock.timeUs() - meta.rxTimeUs < 1000);
+    // The default profile
+    assert(meta.sf == 9);
+    assert(meta.bw == 7);
+    assert(meta.cr == 1);
+    assert(!meta.overrun);
+    assert(s.driver.getRxOverruns() == 0);
+
+    // The next frame lands in the other region and the receiver moves 
+    // back
+    s.radio.setFreqErrorHz(-2500);
+    s.radio.inject(frame, frameLen, 8, -80);
+    s.loop();
+    assert(s.radio.getReg(0x0f) == 0x00);
+    bufLen = sizeof(buf);
+    assert(s.rxBuffer.popIfNotEmpty(&meta, buf, &bufLen));
+    assert(memcmp(buf, frame, frameLen) == 0);
+    assert(meta.freqErrorHz == -2500);
+
+    // Two frames arrive before the loop gets around to servicing 
+    // the radio
+    s.radio.inject(frame, frameLen, 8, -80);
+    s.radio.inject(frame, frameLen, 8, -80);
+    s.loop();
+    assert(s.driver.getRxOverruns() == 1);
+    bufLen = sizeof(buf);
+    assert(s.rxBuffer.popIfNotEmpty(&meta, buf, &bufLen));
+    assert(meta.overrun);
+
+    // A CRC error is ignored
+    s.radio.inject(frame, frameLen, 8, -80, true);
+    s.loop();
+    assert(s.rxBuffer.isEmpty());
+}
+
+/**
+ * @brief A frame that lands in the region used for transmitting 
+ * overwrites the preloaded frame, so it has to be loaded again.
+ */
+static void test_rx_over_preload() {
+
+    TestClock clock;
+    TestStation s(clock);
+    TestStation* stations[] = { &s };
+    s.begin();
+
+    uint8_t frame[64];
+    unsigned int frameLen = makeFrame(frame, TYPE_TEXT, 64);
+    uint8_t rxFrame[64];
+    unsigned int rxFrameLen = makeFrame(rxFrame, TYPE_TEXT, 48);
+    memset(rxFrame + sizeof(Header), 'x', rxFrameLen - sizeof(Header));
+
+    // The frame is preloaded during the CAD, which finds the channel 
+    // busy, so the frame stays in the FIFO while we back off
+    s.txBuffer.push(0, frame, frameLen);
+    s.loop();
+    assert(s.driver.getState() == RadioDriver::CAD);
+    assert(s.radio.getReg(0x0e) == 0x80);
+    s.radio.completeCad(true);
+    s.loop();
+    assert(s.driver.getState() == RadioDriver::RX_STATE);
+    assert(!s.txBuffer.isEmpty());
+
+    // The emulator writes every frame at RegFifoRxBaseAddr, so the base
+    // is moved to put this frame where the radio would write one that 
+    // followed on from the end of the receive region
+    s.radio.write(0x0f, 0x80);
+    s.radio.inject(rxFrame, rxFrameLen, 8, -80);
+    s.radio.write(0x0f, 0x00);
+    s.loop();
+    assert(!s.rxBuffer.isEmpty());
+    s.rxBuffer.popAndDiscard();
+
+    // What goes out is the queued frame, not what was received
+    while (s.driver.getState() != RadioDriver::TX_STATE)
+        run(clock, stations, 1, 1);
+    assert(s.txBuffer.isEmpty());
+    assert(s.radio.getTxLen() == frameLen);
+    assert(memcmp(s.radio.getTxFrame(), frame, frameLen) == 0);
+}
+
+static void test_sleep() {
+
+    TestClock clock;
+    TestStation s(clock);
+    s.begin();
+
+    uint8_t frame[64];
+    unsigned int frameLen = makeFrame(frame, TYPE_TEXT, 48);
+
+    // The radio stays in LoRa mode while asleep
+    s.driver.sleep();
+    assert(s.radio.getMode() == 0x00);
+    assert(s.radio.getReg(0x01) & 0x80);
+    assert(s.driver.getState() == RadioDriver::IDLE);
+
+    // Nothing is heard while asleep
+    s.radio.inject(frame, frameLen, 8, -80);
+    s.loop();
+    assert(s.rxBuffer.isEmpty());
+
+    s.driver.wake();
+    assert(s.radio.getMode() == 0x05);
+    assert(s.radio.getReg(0x01) & 0x80);
+    assert(s.driver.getState() == RadioDriver::RX_STATE);
+    s.radio.inject(frame, frameLen, 8, -80);
+    s.loop();
+    RxMetadata meta;
+    uint8_t buf[256];
+    unsigned int bufLen = sizeof(buf);
+    assert(s.rxBuffer.popIfNotEmpty(&meta, buf, &bufLen));
+    assert(bufLen == frameLen);
+    assert(memcmp(buf, frame, frameLen) == 0);
+}
+
+static void test_edge_time() {
+
+    EdgeTimeQueue q;
+    uint32_t t;
+    assert(!q.pop(&t));
+    assert(q.popLatest(99) == 99);
+    // The newest times are dropped when the queue is full
+    for (uint32_t i = 1; i <= EDGE_TIME_QUEUE_SIZE + 2; i++) 
+        q.push(i);
+    assert(q.getDroppedCount() == 2);
+    assert(q.pop(&t) && t == 1);
+    assert(q.popLatest(0) == EDGE_TIME_QUEUE_SIZE);
+    assert(!q.pop(&t));
+
+    TestClock clock;
+    TestStation s(clock);
+    TestStation* stations[] = { &s };
+    s.begin();
+
+    uint8_t frame[64];
+    unsigned int frameLen = makeFrame(frame, TYPE_TEXT, 48);
+
+    // The frame is time stamped when the interrupt happened, not when 
+    // the main loop got around to it
+    s.radio.inject(frame, frameLen, 8, -80);
+    s.radio.update();
+    const uint32_t rxEdgeUs = clock.timeUs();
+    clock.advanceUs(25000);
+    s.loop();
+    RxMetadata meta;
+    uint8_t buf[256];
+    unsigned int bufLen = sizeof(buf);
+    assert(s.rxBuffer.popIfNotEmpty(&meta, buf, &bufLen));
+    assert(meta.rxTimeUs == rxEdgeUs);
+
+    // The same for the end of a transmission
+    s.txBuffer.push(0, frame, frameLen);
+    run(clock, stations, 1, 10);
+    assert(s.driver.getState() == RadioDriver::TX_STATE);
+    clock.advanceUs(400000);
+    s.radio.update();
+    const uint32_t txEdgeUs = clock.timeUs();
+    clock.advanceUs(25000);
+    s.loop();
+    assert(s.driver.getState() == RadioDriver::RX_STATE);
+    assert(s.driver.getTxDoneUs() == txEdgeUs);
+}
+
+/**
+ * @brief A time sync beacon is stamped at the start of the transmission
+ * and the receiver can work that moment out from the receive time 
+ * stamp and the airtime.
+ */
+static void test_time_sync() {
+
+    TestClock clock;
+    VirtualChannel channel(clock);
+    TestStation a(clock), b(clock);
+    channel.attach(&a.radio);
+    channel.attach(&b.radio);
+    TestStation* stations[] = { &a, &b };
+    a.begin();
+    b.begin();
+
+    NetworkClock networkClock(clock);
+    networkClock.setTime(1700000000ULL * 1000000ULL, 1);
+    a.driver.setNetworkClock(&networkClock);
+
+    uint8_t frame[64];
+    unsigned int frameLen = makeFrame(frame, TYPE_TIME_SYNC, 
+        sizeof(Header) + sizeof(TimeSyncPayload));
+    a.txBuffer.push(0, frame, frameLen);
+
+    run(clock, stations, 2, 10);
+    assert(a.driver.getState() == RadioDriver::TX_STATE);
+    const uint32_t txStartUs = a.radio.getTxStartUs();
+
+    // The time was put into the FIFO and nothing else was changed
+    TimeSyncPayload sent;
+    memcpy(&sent, a.radio.getTxFrame() + sizeof(Header), sizeof(sent));
+    const uint64_t stampUs = (uint64_t)sent.txSeconds * 1000000ULL + 
+        sent.txMicros;
+    // Only the SPI transaction that starts the transmission comes 
+    // in between
+    const int64_t stampErrorUs = networkClock.toNetworkUs(txStartUs) - stampUs;
+    assert(stampErrorUs >= 0 && stampErrorUs < 20);
+    assert(memcmp(a.radio.getTxFrame(), frame, sizeof(Header)) == 0);
+    assert(memcmp(a.radio.getTxFrame() + sizeof(Header) + 8, 
+        frame + sizeof(Header) + 8, frameLen - sizeof(Header) - 8) == 0);
+
+    // The receiver can tell when the transmission started to within 
+    // one step of the main loop
+    run(clock, stations, 2, 500);
+    RxMetadata meta;
+    uint8_t buf[256];
+    unsigned int bufLen = sizeof(buf);
+    assert(b.rxBuffer.popIfNotEmpty(&meta, buf, &bufLen));
+    assert(meta.airtimeUs == a.driver.getAirtimeUs(frameLen, false));
+    const int32_t errorUs = (meta.rxTimeUs - meta.airtimeUs) - txStartUs;
+    assert(errorUs >= -100 && errorUs <= 100);
+}
+
+static void test_profile() {
+
+    TestClock clock;
+    TestStation s(clock);
+    TestStation* stations[] = { &s };
+    s.begin();
+    // 20dBm uses the high power DAC setting
+    assert(s.radio.getReg(0x4d) == 0x87);
+    assert(s.radio.getReg(0x09) == (0x80 | 15));
+
+    RadioProfileTable t;
+    t.setDefaults();
+
+    // The change is made right away when the radio is only listening, 
+    // without going through init()
+    s.driver.setProfile(t.profiles[t.find("max")]);
+    unsigned int x0 = s.radio.getTransactions();
+    s.loop();
+    assert(s.radio.getTransactions() - x0 < 10);
+    assert(s.radio.getReg(0x1d) == 0b01111000);
+    assert(s.radio.getReg(0x1e) == 0b11000100);
+    // SF12/125kHz needs the low data rate optimization
+    assert(s.radio.getReg(0x26) & 0x08);
+    assert(s.driver.getSymbolUs() == 32768);
+    assert(s.radio.getSymbolUs() == 32768);
+    assert(s.driver.getState() == RadioDriver::RX_STATE);
+    assert(s.radio.getMode() == 0x05);
+
+    // The CAD takes ~61ms on this profile.  The driver waits it out
+    // rather than giving up and transmitting without a channel check.
+    {
+        uint8_t frame[64];
+        unsigned int frameLen = makeFrame(frame, TYPE_TEXT, 64);
+        s.txBuffer.push(0, frame, frameLen);
+        const uint32_t cadStartUs = clock.timeUs();
+        s.loop();
+        assert(s.driver.getState() == RadioDriver::CAD);
+        run(clock, stations, 1, s.radio.getCadUs() / 1000 - 1);
+        assert(s.driver.getState() == RadioDriver::CAD);
+        run(clock, stations, 1, 2);
+        assert(s.driver.getState() == RadioDriver::TX_STATE);
+        assert(s.radio.getTxStartUs() - cadStartUs >= s.radio.getCadUs());
+        run(clock, stations, 1, s.radio.getAirtimeUs(frameLen) / 1000 + 10);
+        assert(s.driver.getState() == RadioDriver::RX_STATE);
+    }
+
+    // Lower power uses the normal DAC setting
+    RadioProfile p;
+    p.set("low", 7, 8, 1, 10);
+    s.driver.setProfile(p);
+    s.loop();
+    assert(s.radio.getReg(0x4d) == 0x84);
+    assert(s.radio.getReg(0x09) == (0x80 | 8));
+    assert((s.radio.getReg(0x26) & 0x08) == 0);
+    assert(s.driver.getSymbolUs() == 512);
+
+    // A change that is requested during a transmission waits until the 
+    // transmission is finished
+    uint8_t frame[64];
+    unsigned int frameLen = makeFrame(frame, TYPE_TEXT, 64);
+    s.txBuffer.push(0, frame, frameLen);
+    s.loop();
+    run(clock, stations, 1, 2);
+    assert(s.driver.getState() == RadioDriver::TX_STATE);
+    s.driver.setProfile(t.getActive());
+    s.loop();
+    assert(s.radio.getReg(0x1e) >> 4 == 7);
+    run(clock, stations, 1, 200);
+    assert(s.driver.getState() == RadioDriver::RX_STATE);
+    assert(s.radio.getReg(0x1e) >> 4 == 9);
+    assert(s.radio.getReg(0x1d) == 0b01110010);
+}
+
+/**
+ * @brief Several stations sharing a virtual channel.
+ */
+static void test_channel() {
+
+    TestClock clock;
+    VirtualChannel channel(clock);
+    TestStation a(clock), b(clock), c(clock);
+    channel.attach(&a.radio);
+    channel.attach(&b.radio);
+    channel.attach(&c.radio);
+    TestStation* stations[] = { &a, &b, &c };
+    for (unsigned int i = 0; i < 3; i++)
+        stations[i]->begin();
+
+    uint8_t frame[MAX_FRAME_LEN];
+    unsigned int frameLen = makeFrame(frame, TYPE_TEXT, 64);
+    uint8_t longFrame[MAX_FRAME_LEN];
+    unsigned int longFrameLen = makeFrame(longFrame, TYPE_TEXT, MAX_FRAME_LEN);
+
+    // A simple transmission is heard by everyone else
+    a.txBuffer.push(0, frame, frameLen);
+    run(clock, stations, 3, 500);
+    assert(a.radio.getTxCount() == 1);
+    assert(b.radio.getRxCount() == 1);
+    assert(c.radio.getRxCount() == 1);
+    assert(a.radio.getRxCount() == 0);
+    uint8_t buf[256];
+    unsigned int bufLen = sizeof(buf);
+    RxMetadata meta;
+    assert(b.rxBuffer.popIfNotEmpty(&meta, buf, &bufLen));
+    assert(bufLen == frameLen);
+    assert(memcmp(buf, frame, frameLen) == 0);
+    c.rxBuffer.popAndDiscard();
+
+    // B starts a long transmission.  A has something to send while B 
+    // is on the air, so the CAD finds the channel busy and A backs off.
+    b.txBuffer.push(0, longFrame, longFrameLen);
+    run(clock, stations, 3, 50);
+    assert(b.driver.getState() == RadioDriver::TX_STATE);
+    a.txBuffer.push(0, frame, frameLen);
+    run(clock, stations, 3, 20);
+    assert(a.ca.getBusyCounter() >= 1);
+    assert(a.radio.getTxCount() == 1);
+    // Eventually both get through without a collision
+    run(clock, stations, 3, 3000);
+    assert(a.radio.getTxCount() == 2);
+    assert(a.txBuffer.isEmpty());
+    assert(c.radio.getRxCount() == 3);
+    assert(c.radio.getCrcErrorCount() == 0);
+    assert(channel.getCollisionCount() == 0);
+    while (!c.rxBuffer.isEmpty())
+        c.rxBuffer.popAndDiscard();
+
+    // A and B check the channel at the same moment, both find it clear
+    // and their transmissions collide at C
+    a.txBuffer.push(0, frame, frameLen);
+    b.txBuffer.push(0, frame, frameLen);
+    run(clock, stations, 3, 1000);
+    assert(a.radio.getTxCount() == 3);
+    assert(channel.getCollisionCount() > 0);
+    assert(c.radio.getCrcErrorCount() == 1);
+    assert(c.rxBuffer.isEmpty());
+}
+
+/**
+ * @brief ACKs are sent in implicit header mode and the sender of the 
+ * frame listens for them in implicit header mode.
+ */
+static void test_ack() {
+
+    TestClock clock;
+    VirtualChannel channel(clock);
+    TestStation a(clock), b(clock), c(clock);
+    channel.attach(&a.radio);
+    channel.attach(&b.radio);
+    channel.attach(&c.radio);
+    TestStation* stations[] = { &a, &b, &c };
+    for (unsigned int i = 0; i < 3; i++)
+        stations[i]->begin();
+
+    // A sends B a frame that needs an ACK
+    uint8_t frame[MAX_FRAME_LEN];
+    unsigned int frameLen = makeFrame(frame, TYPE_TEXT, 64, 2);
+    a.txBuffer.push(0, frame, frameLen);
+    while (!a.driver.isAckWindowOpen())
+        run(clock, stations, 3, 1);
+    assert(a.radio.getTxCount() == 1);
+    assert(b.radio.getRxCount() == 1);
+
+    // A is now waiting for the ACK in implicit header mode
+    assert(a.driver.isAckWindowOpen());
+    assert(a.radio.isImplicitHeader());
+    assert(a.radio.getReg(0x22) == ACK_FRAME_LEN);
+    assert(a.radio.getMode() == 0x05);
+
+    // Nothing else goes out while the ACK window is open
+    uint8_t other[MAX_FRAME_LEN];
+    unsigned int otherLen = makeFrame(other, TYPE_TEXT, 32);
+    a.txBuffer.push(0, other, otherLen);
+
+    // B sends the ACK 
+    uint8_t buf[256];
+    unsigned int bufLen = sizeof(buf);
+    RxMetadata meta;
+    assert(b.rxBuffer.popIfNotEmpty(&meta, buf, &bufLen));
+    uint8_t ack[ACK_FRAME_LEN];
+    makeFrame(ack, TYPE_ACK, ACK_FRAME_LEN, 1);
+    b.txBuffer.push(0, ack, ACK_FRAME_LEN);
+    run(clock, stations, 3, 10);
+    assert(b.driver.getState() == RadioDriver::TX_STATE);
+    assert(b.radio.isImplicitHeader());
+    assert(a.radio.getTxCount() == 1);
+    run(clock, stations, 3, 300);
+
+    // A got the ACK and went back to explicit header mode.  C, which 
+    // is listening in explicit header mode, didn't hear the ACK at all.
+    assert(!a.driver.isAckWindowOpen());
+    bufLen = sizeof(buf);
+    assert(a.rxBuffer.popIfNotEmpty(&meta, buf, &bufLen));
+    assert(bufLen == ACK_FRAME_LEN);
+    assert(memcmp(buf, ack, ACK_FRAME_LEN) == 0);
+    assert(c.radio.getHeaderErrorCount() == 1);
+    assert(!b.radio.isImplicitHeader());
+    // The next frame goes out as normal
+    run(clock, stations, 3, 500);
+    assert(a.radio.getTxCount() == 2);
+    assert(!a.radio.isImplicitHeader());
+    assert(a.txBuffer.isEmpty());
+
+    // An ACK that never comes.  The window closes after the turnaround
+    // time plus the ACK airtime.
+    a.txBuffer.push(0, frame, frameLen);
+    run(clock, stations, 3, 500);
+    assert(a.driver.isAckWindowOpen());
+    run(clock, stations, 3, ACK_TURNAROUND_MS + 300);
+    assert(!a.driver.isAckWindowOpen());
+    assert(!a.radio.isImplicitHeader());
+    assert(a.driver.getAckWindowTimeouts() == 1);
+
+    // An ACK that starts late (after the turnaround allowance) and is 
+    // still coming in when the window closes is allowed to finish
+    bufLen = sizeof(buf);
+    while (b.rxBuffer.popIfNotEmpty(&meta, buf, &bufLen))
+        bufLen = sizeof(buf);
+    a.txBuffer.push(0, frame, frameLen);
+    while (!a.driver.isAckWindowOpen())
+        run(clock, stations, 3, 1);
+    run(clock, stations, 3, ACK_TURNAROUND_MS + 20);
+    assert(a.driver.isAckWindowOpen());
+    b.txBuffer.push(0, ack, ACK_FRAME_LEN);
+    run(clock, stations, 3, 500);
+    assert(!a.driver.isAckWindowOpen());
+    assert(a.driver.getAckWindowTimeouts() == 1);
+    bufLen = sizeof(buf);
+    assert(a.rxBuffer.popIfNotEmpty(&meta, buf, &bufLen));
+    assert(bufLen == ACK_FRAME_LEN);
+    assert(memcmp(buf, ack, ACK_FRAME_LEN) == 0);
+
+    // Airtime of an ACK with and without the header
+    const uint32_t explicitUs = a.driver.getAirtimeUs(ACK_FRAME_LEN, false);
+    const uint32_t implicitUs = a.driver.getAirtimeUs(ACK_FRAME_LEN, true);
+    assert(explicitUs == a.radio.getAirtimeUs(ACK_FRAME_LEN) || 
+        implicitUs == a.radio.getAirtimeUs(ACK_FRAME_LEN));
+    assert(implicitUs <= explicitUs);
+    cout << "ACK: { \"len\": " << ACK_FRAME_LEN 
+        << ", \"explicitUs\": " << explicitUs 
+        << ", \"implicitUs\": " << implicitUs << " }" << endl;
+}
+
+/**
+ * @brief Measures the latency of the main state transitions with 
+ * the SPI bus running at 10 MHz.
+ */
+/**
+ * @brief Adaptive data rate.  A and B are close together and can use 
+ * SF7.  C doesn't use the adaptive data rate and stays on SF9.
+ */
+static void test_adr() {
+
+    TestClock clock;
+    clock.setTime(1000);
+    VirtualChannel channel(clock);
+    channel.setLinkQuality(8, -80);
+    TestStation a(clock), b(clock), c(clock);
+    channel.attach(&a.radio);
+    channel.attach(&b.radio);
+    channel.attach(&c.radio);
+    TestStation* stations[] = { &a, &b, &c };
+    for (unsigned int i = 0; i < 3; i++)
+        stations[i]->begin();
+
+    // The network time starts just after a rendezvous window
+    NetworkClock networkClock(clock);
+    networkClock.setTime(SF_RENDEZVOUS_WINDOW_MS * 1000ULL, 1);
+    const uint32_t startMs = clock.time();
+    const uint32_t windowMs = startMs + SF_RENDEZVOUS_INTERVAL_MS - 
+        SF_RENDEZVOUS_WINDOW_MS;
+    const uint32_t switchMs = startMs + SF_RENDEZVOUS_INTERVAL_MS;
+    const uint32_t switchDelayMs = 
+        NeighborTable::getRendezvousEndMs(networkClock.getNetworkUs());
+    assert(switchDelayMs == SF_RENDEZVOUS_INTERVAL_MS);
+
+    // What A and B have learned from each other's probes, including 
+    // the moves to SF7 that they have announced
+    NeighborTable tableA(clock), tableB(clock);
+    tableA.processRx(2, -80, 8);
+    tableA.processProbe(2, 1, 0);
+    tableA.processListenSf(2, 9, 7, switchDelayMs);
+    tableA.processRx(3, -80, 8);
+    tableA.processProbe(3, 1, 0);
+    tableA.processListenSf(3, 9);
+    tableB.processRx(1, -80, 8);
+    tableB.processProbe(1, 1, 0);
+    tableB.processListenSf(1, 9, 7, switchDelayMs);
+    assert(tableA.getListenSf(9) == 7);
+    assert(tableA.getTxSf(2, 9) == 9);
+
+    // Nothing moves without the network time
+    a.driver.setNeighborTable(&tableA);
+    b.driver.setNeighborTable(&tableB);
+    run(clock, stations, 3, 1);
+    assert(a.driver.getListenSf() == 9);
+    assert(a.driver.getNextListenSf() == 0);
+
+    // The move is planned (and announced) but not made until the end of
+    // the next rendezvous window
+    a.driver.setNetworkClock(&networkClock);
+    b.driver.setNetworkClock(&networkClock);
+    run(clock, stations, 3, 1);
+    assert(a.driver.getListenSf() == 9);
+    assert(a.driver.getNextListenSf() == 7);
+    assert(b.driver.getNextListenSf() == 7);
+    assert(a.radio.getSf() == 9);
+    clock.setTime(windowMs);
+    networkClock.tick();
+    run(clock, stations, 3, 1);
+    assert(a.driver.getNextListenSf() == 7);
+    assert(a.radio.getSf() == 9);
+    clock.setTime(switchMs);
+    networkClock.tick();
+    run(clock, stations, 3, 1);
+    assert(a.driver.getListenSf() == 7);
+    assert(a.driver.getNextListenSf() == 0);
+    assert(a.radio.getSf() == 7);
+    assert(b.radio.getSf() == 7);
+    assert(c.radio.getSf() == 9);
+    // The neighbors moved at the same time
+    assert(tableA.getTxSf(2, 9) == 7);
+    assert(tableA.getTxSf(3, 9) == 9);
+    assert(tableA.getBroadcastSfMask(9) == ((1 << 7) | (1 << 9)));
+
+    // A unicast to B goes out on SF7, so C doesn't hear it
+    uint8_t frame[64];
+    unsigned int frameLen = makeFrame(frame, TYPE_TEXT, 64, 2);
+    a.txBuffer.push(0, frame, frameLen);
+    run(clock, stations, 3, 500);
+    assert(a.radio.getTxCount() == 1);
+    assert(b.radio.getRxCount() == 1);
+    assert(c.radio.getRxCount() == 0);
+    assert(a.driver.getLowSfTxCount() == 1);
+    assert(a.driver.getLowSfSavedUs() == 
+        loraAirtimeUs(9, 125000, 1, 64, 8, true, false, false) - 
+        loraAirtimeUs(7, 125000, 1, 64, 8, true, false, false));
+    // A listens on SF7 again
+    assert(a.radio.getSf() == 7);
+    assert(a.driver.getState() == RadioDriver::RX_STATE);
+
+    // A broadcast goes out on both spreading factors
+    frameLen = makeFrame(frame, TYPE_TEXT, 64);
+    a.txBuffer.push(0, frame, frameLen);
+    run(clock, stations, 3, 1000);
+    assert(a.radio.getTxCount() == 3);
+    assert(b.radio.getRxCount() == 2);
+    assert(c.radio.getRxCount() == 1);
+    assert(a.radio.getSf() == 7);
+
+    // A receiver that is taking in a frame when the next rendezvous 
+    // window opens stays where it is until the frame is finished
+    const uint32_t window2Ms = windowMs + SF_RENDEZVOUS_INTERVAL_MS;
+    clock.setTime(window2Ms - 30);
+    networkClock.tick();
+    frameLen = makeFrame(frame, TYPE_TEXT, 64, 1);
+    b.txBuffer.push(0, frame, frameLen);
+    run(clock, stations, 3, 60);
+    assert(a.radio.isReceiving());
+    assert(a.radio.getSf() == 7);
+    run(clock, stations, 3, 250);
+    assert(a.radio.getRxCount() == 1);
+    assert(a.radio.getSf() == 9);
+    assert(b.radio.getSf() == 9);
+
+    // Everyone is on the profile spreading factor during the window, so
+    // a broadcast only goes out once
+    frameLen = makeFrame(frame, TYPE_TEXT, 64);
+    a.txBuffer.push(0, frame, frameLen);
+    run(clock, stations, 3, 1000);
+    assert(a.radio.getTxCount() == 4);
+    assert(b.radio.getRxCount() == 3);
+    assert(c.radio.getRxCount() == 2);
+    assert(a.radio.getSf() == 9);
+
+    // A station that stops hearing the neighbor's probes plans to go 
+    // back up, which happens at the end of the window
+    tableB.processProbe(1, 10, 0);
+    run(clock, stations, 3, 2);
+    assert(b.driver.getNextListenSf() == 0);
+    clock.setTime(window2Ms + SF_RENDEZVOUS_WINDOW_MS - 1000);
+    networkClock.tick();
+    run(clock, stations, 3, 1);
+    assert(b.driver.getNextListenSf() == 0);
+    clock.setTime(window2Ms + SF_RENDEZVOUS_WINDOW_MS);
+    networkClock.tick();
+    run(clock, stations, 3, 2);
+    assert(b.driver.getNextListenSf() == 9);
+    assert(b.radio.getSf() == 7);
+    clock.setTime(window2Ms + SF_RENDEZVOUS_INTERVAL_MS + SF_RENDEZVOUS_WINDOW_MS);
+    networkClock.tick();
+    run(clock, stations, 3, 1);
+    assert(b.driver.getListenSf() == 9);
+    assert(b.radio.getSf() == 9);
+
+    // Turning the adaptive data rate off
+    a.driver.setNeighborTable(0);
+    a.loop();
+    assert(a.driver.getListenSf() == 9);
+    assert(a.radio.getSf() == 9);
+}
+
+/**
+ * @brief Transmit power control.  A has learned that it can reach B with
+ * less power.
+ */
+static void test_tpc() {
+
+    TestClock clock;
+    VirtualChannel channel(clock);
+    TestStation a(clock), b(clock);
+    channel.attach(&a.radio);
+    channel.attach(&b.radio);
+    TestStation* stations[] = { &a, &b };
+    for (unsigned int i = 0; i < 2; i++)
+        stations[i]->begin();
+
+    NeighborTable tableA(clock);
+    tableA.processRx(2, -80, 8);
+    for (unsigned int i = 0; i < 3; i++)
+        tableA.processLinkReport(2, 20);
+    assert(tableA.getTxPowerDbm(2, 20) == 14);
+    a.driver.setNeighborTable(&tableA);
+
+    // A unicast goes out at the reduced power
+    uint8_t frame[64];
+    unsigned int frameLen = makeFrame(frame, TYPE_TEXT, 64, 2);
+    a.txBuffer.push(0, frame, frameLen);
+    run(clock, stations, 2, 500);
+    assert(b.radio.getRxCount() == 1);
+    assert(a.radio.getReg(0x4d) == 0x84);
+    assert(a.radio.getReg(0x09) == (0x80 | 12));
+    assert(a.driver.getLowPowerTxCount() == 1);
+    // 100mW - 25.1mW for the whole frame
+    const uint32_t txUs = loraAirtimeUs(9, 125000, 1, 64, 8, true, false, false);
+    assert(a.driver.getRfEnergySavedUj() == (txUs / 100) * (1000 - 251) / 100);
+
+    // Broadcasts go out at full power
+    frameLen = makeFrame(frame, TYPE_TEXT, 64);
+    a.txBuffer.push(0, frame, frameLen);
+    run(clock, stations, 2, 1500);
+    assert(b.radio.getRxCount() == 2);
+    assert(a.radio.getReg(0x4d) == 0x87);
+    assert(a.radio.getReg(0x09) == (0x80 | 15));
+    assert(a.driver.getLowPowerTxCount() == 1);
+}
+
+/**
+ * @brief Low power listening.  B samples the channel once a second, C
+ * is an always-listening backbone station.  A knows this from their 
+ * probes.
+ */
+static void test_lpl() {
+
+    TestClock clock;
+    // Stay clear of the rendezvous window
+    clock.setTime(SF_RENDEZVOUS_WINDOW_MS + 1000);
+    VirtualChannel channel(clock);
+    TestStation a(clock), b(clock), c(clock);
+    channel.attach(&a.radio);
+    channel.attach(&b.radio);
+    channel.attach(&c.radio);
+    TestStation* stations[] = { &a, &b, &c };
+    for (unsigned int i = 0; i < 3; i++)
+        stations[i]->begin();
+    assert(a.radio.getPreambleLen() == PREAMBLE_LEN);
+
+    NeighborTable tableA(clock);
+    tableA.processRx(2, -80, 8);
+    tableA.processWakeInterval(2, 1000);
+    tableA.processRx(3, -80, 8);
+    a.driver.setNeighborTable(&tableA);
+
+    // B goes to sleep once the hold time is over
+    b.driver.setLplInterval(1000);
+    b.driver.resetCounters();
+    run(clock, stations, 3, LPL_HOLD_MS + 10);
+    assert(b.driver.getState() == RadioDriver::LPL_SLEEP);
+    assert(b.radio.getMode() == 0x00);
+    assert(b.radio.getReg(0x01) & 0x80);
+    assert(b.driver.getLplSleepMs() > 900);
+    // ... and samples the channel once a second
+    run(clock, stations, 3, 5000);
+    assert(b.driver.getLplSampleCount() == 5);
+    assert(b.driver.getLplWakeCount() == 0);
+    assert(b.driver.getState() == RadioDriver::LPL_SLEEP);
+
+    // A unicast to C uses the normal preamble, so B doesn't wake up
+    uint8_t frame[64];
+    unsigned int frameLen = makeFrame(frame, TYPE_TEXT, 64, 3);
+    a.txBuffer.push(0, frame, frameLen);
+    run(clock, stations, 3, 500);
+    assert(a.radio.getTxCount() == 1);
+    assert(c.radio.getRxCount() == 1);
+    assert(b.radio.getRxCount() == 0);
+    assert(a.driver.getLongPreambleTxCount() == 0);
+
+    // A unicast to B needs a preamble that spans B's sampling interval
+    frameLen = makeFrame(frame, TYPE_TEXT, 64, 2);
+    a.txBuffer.push(0, frame, frameLen);
+    while (a.driver.getState() != RadioDriver::TX_STATE) 
+        run(clock, stations, 3, 1);
+    const uint16_t preambleLen = (1000 * 1000UL + 
+        CAD_POLL_SYMBOLS * loraSymbolUs(9, 125000)) / loraSymbolUs(9, 125000) + 
+        2 * PREAMBLE_LEN;
+    assert(a.radio.getPreambleLen() == preambleLen);
+    assert(a.driver.getLongPreambleTxCount() == 1);
+    run(clock, stations, 3, 2000);
+    // B woke up on its next sample and got the frame
+    assert(b.radio.getRxCount() == 1);
+    assert(b.driver.getLplWakeCount() == 1);
+    RxMetadata meta;
+    uint8_t buf[256];
+    unsigned int bufLen = sizeof(buf);
+    assert(b.rxBuffer.popIfNotEmpty(&meta, buf, &bufLen));
+    assert(bufLen == frameLen);
+    assert(memcmp(buf, frame, frameLen) == 0);
+    // A listens with the normal preamble again
+    assert(a.radio.getPreambleLen() == PREAMBLE_LEN);
+    // ... and B goes back to sleep
+    assert(b.driver.getState() == RadioDriver::LPL_SLEEP);
+
+    // Time sync beacons always use the normal preamble
+    frameLen = makeFrame(frame, TYPE_TIME_SYNC, 
+        sizeof(Header) + sizeof(TimeSyncPayload));
+    a.txBuffer.push(0, frame, frameLen);
+    run(clock, stations, 3, 500);
+    assert(a.driver.getLongPreambleTxCount() == 1);
+
+    // The radio is off most of the time
+    run(clock, stations, 3, 10000);
+    cout << "LPL radio on: " << b.driver.getRadioOnPermille() << 
+        " permille, samples: " << b.driver.getLplSampleCount() << 
+        ", wakes: " << b.driver.getLplWakeCount() << 
+        ", false wakes: " << b.driver.getLplFalseWakeCount() << endl;
+    assert(b.driver.getRadioOnPermille() < 150);
+    assert(c.driver.getRadioOnPermille() == 1000);
+
+    // Turning it off
+    b.driver.setLplInterval(0);
+    assert(b.driver.getState() == RadioDriver::RX_STATE);
+    assert(b.radio.getMode() == 0x05);
+    run(clock, stations, 3, 2000);
+    assert(b.driver.getState() == RadioDriver::RX_STATE);
+}
+
+/**
+ * @brief TDMA.  A owns slot 0 and B owns slot 1.  B ACKs a frame from 
+ * A in A's slot, and the frame that B has waiting behind the ACK isn't
+ * sent until B's own slot.
+ */
+static void test_tdma_chain() {
+
+    TestClock clock;
+    VirtualChannel channel(clock);
+    TestStation a(clock), b(clock);
+    channel.attach(&a.radio);
+    channel.attach(&b.radio);
+    TestStation* stations[] = { &a, &b };
+    a.begin();
+    b.begin();
+
+    // The network time starts at the beginning of A's slot
+    NetworkClock networkClock(clock);
+    networkClock.setTime(0, 1);
+    const uint32_t startMs = clock.time();
+    TdmaConfig tdma;
+    tdma.setDefaults();
+    tdma.enabled = 1;
+    tdma.slotCount = 2;
+    tdma.slotMs = 2000;
+    tdma.slotMask = 1 << 0;
+    a.ca.setNetworkClock(&networkClock);
+    a.ca.configureTdma(tdma, 1);
+    tdma.slotMask = 1 << 1;
+    b.ca.setNetworkClock(&networkClock);
+    b.ca.configureTdma(tdma, 2);
+    assert(a.ca.isTdmaActive());
+    assert(b.ca.isTdmaActive());
+
+    // A sends B a frame that needs an ACK in its own slot
+    uint8_t frame[64];
+    unsigned int frameLen = makeFrame(frame, TYPE_TEXT, 64, 2);
+    a.txBuffer.push(0, frame, frameLen);
+    while (b.rxBuffer.isEmpty())
+        run(clock, stations, 2, 1);
+    assert(a.driver.isAckWindowOpen());
+
+    // B has its own frame waiting behind the ACK
+    uint8_t ack[ACK_FRAME_LEN];
+    makeFrame(ack, TYPE_ACK, ACK_FRAME_LEN, 1);
+    b.txBuffer.push(0, ack, ACK_FRAME_LEN);
+    unsigned int otherLen = makeFrame(frame, TYPE_TEXT, 64, 1);
+    b.txBuffer.push(0, frame, otherLen);
+    run(clock, stations, 2, 500);
+    // The ACK went out but the frame waits
+    assert(!a.driver.isAckWindowOpen());
+    assert(a.driver.getAckWindowTimeouts() == 0);
+    assert(b.radio.getTxCount() == 1);
+    assert(!b.txBuffer.isEmpty());
+    assert(b.driver.getState() == RadioDriver::RX_STATE);
+    const uint32_t slot1Ms = startMs + tdma.slotMs;
+    run(clock, stations, 2, slot1Ms - clock.time() - 1);
+    assert(b.radio.getTxCount() == 1);
+
+    // In B's own slot
+    run(clock, stations, 2, 500);
+    assert(b.radio.getTxCount() == 2);
+    assert(b.txBuffer.isEmpty());
+    assert(b.radio.getTxStartUs() >= slot1Ms * 1000);
+}
+
+static void bench_transitions() {
+
+    TestClock clock;
+    TestStation s(clock);
+    s.begin();
+    SX1276Emulator& bus = s.radio;
+    RadioDriver& radio = s.driver;
+
+    uint8_t frame[MAX_FRAME_LEN];
+    unsigned int frameLen = makeFrame(frame, TYPE_TEXT, 64);
+
+    // RX -> CAD (including the preload)
+    s.txBuffer.push(0, frame, frameLen);
+    uint32_t t0 = clock.timeUs();
+    unsigned int x0 = bus.getTransactions();
+    radio.tick();
+    const uint32_t rxToCadUs = clock.timeUs() - t0;
+    const unsigned int rxToCadX = bus.getTransactions() - x0;
+
+    // CAD -> TX
+    clock.advanceUs(bus.getCadUs());
+    bus.update();
+    t0 = clock.timeUs();
+    x0 = bus.getTransactions();
+    radio.processIrqFlags(radio.takeIrqFlags());
+    const uint32_t cadToTxUs = clock.timeUs() - t0;
+    const unsigned int cadToTxX = bus.getTransactions() - x0;
+    assert(radio.getState() == RadioDriver::TX_STATE);
+
+    // TX -> RX
+    clock.advanceUs(bus.getAirtimeUs(frameLen));
+    bus.update();
+    t0 = clock.timeUs();
+    x0 = bus.getTransactions();
+    radio.processIrqFlags(radio.takeIrqFlags());
+    const uint32_t txToRxUs = clock.timeUs() - t0;
+    const unsigned int txToRxX = bus.getTransactions() - x0;
+    assert(radio.getState() == RadioDriver::RX_STATE);
+
+    // RX service
+    bus.inject(frame, frameLen, 8, -80);
+    t0 = clock.timeUs();
+    x0 = bus.getTransactions();
+    radio.processIrqFlags(radio.takeIrqFlags());
+    const uint32_t rxServiceUs = clock.timeUs() - t0;
+    const unsigned int rxServiceX = bus.getTransactions() - x0;
+
+    cout << "BENCH: { \"frameLen\": " << frameLen 
+        << ", \"rxToCadUs\": " << rxToCadUs << ", \"rxToCadSpi\": " << rxToCadX
+        << ", \"cadToTxUs\": " << cadToTxUs << ", \"cadToTxSpi\": " << cadToTxX
+        << ", \"txToRxUs\": " << txToRxUs << ", \"txToRxSpi\": " << txToRxX
+        << ", \"rxServiceUs\": " << rxServiceUs << ", \"rxServiceSpi\": " << rxServiceX
+        << " }" << endl;
+
+    // With the frame preloaded the CAD->TX transition doesn't move 
+    // the frame
+    assert(cadToTxUs < rxToCadUs);
+    assert(radio.getCadToTxUs() > 0);
+}
+
+int main() {
+    test_airtime();
+    test_init();
+    test_tx();
+    test_rx();
+    test_rx_over_preload();
+    test_sleep();
+    test_edge_time();
+    test_time_sync();
+    test_profile();
+    test_channel();
+    test_ack();
+    test_adr();
+    test_tpc();
+    test_lpl();
+    test_tdma_chain();
+    bench_transitions();
+    return 0;
+}